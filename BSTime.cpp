@@ -14,45 +14,119 @@
 
 
 
-double SystemTime::sm_CpuTickDelta = 0.0;
+#include <cmath>
+#ifndef _WIN32
+#include <cpuid.h>
+#endif
 
-// Query the performance counter frequency
-void SystemTime::Initialize(void)
+#ifdef _WIN32
+QpcClock::QpcClock()
 {
     LARGE_INTEGER frequency;
-    RAID_ASSERT(TRUE == QueryPerformanceFrequency(&frequency), "Unable to query performance counter frequency");
-    sm_CpuTickDelta = 1.0 / static_cast<double>(frequency.QuadPart);
+    QueryPerformanceFrequency(&frequency);
+    SetFrequency(static_cast<double>(frequency.QuadPart));
 }
+#endif
 
-// Query the current value of the performance counter
-int64_t SystemTime::GetCurrentTick(void)
+const IClock& GetPlatformClock()
 {
-    LARGE_INTEGER currentTick;
-    RAID_ASSERT(TRUE == QueryPerformanceCounter(&currentTick), "Unable to query performance counter value");
-    return static_cast<int64_t>(currentTick.QuadPart);
+    static const PlatformClock clock;
+    return clock;
 }
 
-void SystemTime::BusyLoopSleep(float SleepTime)
+#if BS_TIME_TSC
+bool TscClock::IsInvariant()
 {
-    int64_t finalTick = (int64_t)((double)SleepTime / sm_CpuTickDelta) + GetCurrentTick();
-    while (GetCurrentTick() < finalTick);
+    unsigned int regs[4] = {};
+#ifdef _MSC_VER
+    __cpuid((int*)regs, 0x80000000);
+    if (regs[0] < 0x80000007)
+        return false;
+    __cpuid((int*)regs, 0x80000007);
+#else
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007)
+        return false;
+    __get_cpuid(0x80000007, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+    return (regs[3] & (1u << 8)) != 0;
 }
-_int64 GameTimer::m_BaseTime = 0;
-__int64 GameTimer::m_PausedTime = 0;
-__int64 GameTimer::m_StopTime = 0;
-__int64 GameTimer::m_PrevTime = 0;
-__int64 GameTimer::m_CurrTime = 0;
 
-double GameTimer::m_SecondsPerCount = 0.0;
-double GameTimer::m_DeltaTime = 0.016f;
+// Reference tick and the TSC at the same moment: the TSC read closest around the reference read
+// of a few tries, so a preemption in between does not skew the calibration.
+static void SamplePair(const IClock& Reference, int64_t& RefTick, int64_t& Tsc)
+{
+    int64_t best = INT64_MAX;
+    for (int i = 0; i < 8; i++)
+    {
+        const int64_t before = TscClock::Read();
+        const int64_t ref = Reference.GetTicks();
+        const int64_t after = TscClock::Read();
+        if (after - before < best)
+        {
+            best = after - before;
+            RefTick = ref;
+            Tsc = before + (after - before) / 2;
+        }
+    }
+}
 
-bool GameTimer::m_IsStopped = false;
+void TscClock::Calibrate(const IClock& Reference, double Seconds)
+{
+    int64_t ref_start = 0, tsc_start = 0, ref_end = 0, tsc_end = 0;
+    SamplePair(Reference, ref_start, tsc_start);
+    const int64_t wait = (std::max)(Reference.SecondsToTicks(Seconds), (int64_t)1);
+    while (Reference.GetTicks() - ref_start < wait);
+    SamplePair(Reference, ref_end, tsc_end);
+    SetFrequency((double)(tsc_end - tsc_start) / Reference.TicksToSeconds(ref_end - ref_start));
+}
+#endif
+
+ClockBenchmarkResult BenchmarkClock(const IClock& Clock, const IClock& Reference, unsigned Iterations, double Seconds)
+{
+    ClockBenchmarkResult r;
+    Iterations = (std::max)(Iterations, 2u);
+
+    int64_t step = INT64_MAX;
+    int64_t previous = Clock.GetTicks();
+    const int64_t ref_start = Reference.GetTicks();
+    for (unsigned i = 0; i < Iterations; i++)
+    {
+        const int64_t now = Clock.GetTicks();
+        if (now != previous)
+            step = (std::min)(step, now - previous);
+        previous = now;
+    }
+    r.ReadNanosecs = Reference.TicksToSeconds(Reference.GetTicks() - ref_start) * 1e9 / Iterations;
+    r.ResolutionNanosecs = step == INT64_MAX ? 0.0 : Clock.TicksToSeconds(step) * 1e9;
+
+    const int64_t clock_start = Clock.GetTicks();
+    const int64_t interval_start = Reference.GetTicks();
+    const int64_t wait = (std::max)(Reference.SecondsToTicks(Seconds), (int64_t)1);
+    while (Reference.GetTicks() - interval_start < wait);
+    const int64_t clock_end = Clock.GetTicks();
+    const int64_t interval_end = Reference.GetTicks();
+    const double reference_seconds = Reference.TicksToSeconds(interval_end - interval_start);
+    r.ErrorPPM = (Clock.TicksToSeconds(clock_end - clock_start) - reference_seconds) / reference_seconds * 1e6;
+    return r;
+}
 
-int GameTimer::m_Ticks = 0;;
+double SystemTime::sm_CpuTickDelta = GetPlatformClock().TicksToSeconds(1);
 
-GameTimer::GameTimer()
+// Query the performance counter frequency
+void SystemTime::Initialize(void)
 {
+    sm_CpuTickDelta = GetPlatformClock().TicksToSeconds(1);
+}
 
+void SystemTime::BusyLoopSleep(float SleepTime)
+{
+    int64_t finalTick = (int64_t)((double)SleepTime / sm_CpuTickDelta) + GetCurrentTick();
+    while (GetCurrentTick() < finalTick);
+}
+
+GameTimer::GameTimer(const IClock& Clock) : m_Clock(&Clock)
+{
+	Reset();
 }
 
 GameTimer::~GameTimer()
@@ -63,61 +137,51 @@ void GameTimer::Tick()
 {
 	if (m_IsStopped)
 	{
-		m_DeltaTime = 0.0f;
+		m_DeltaTime.store(0.0, std::memory_order_relaxed);
 		return;
 	}
-	++m_Ticks;
+	m_Ticks.store(m_Ticks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 
-	__int64 currTime;
-	QueryPerformanceCounter((LARGE_INTEGER*)&currTime);
-	m_DeltaTime = (currTime - m_PrevTime) * m_SecondsPerCount;
+	int64_t currTime = m_Clock->GetTicks();
+	double delta = m_Clock->TicksToSeconds(currTime - m_PrevTime);
 	m_CurrTime = currTime;
 	m_PrevTime = m_CurrTime;
 
-	if (m_DeltaTime < 0.0f)
+	if (delta < 0.0)
 	{
-		m_DeltaTime = 0.0f;
+		delta = 0.0;
 	}
+	m_DeltaTime.store(delta, std::memory_order_relaxed);
 }
 
-float GameTimer::GameTime()
+float GameTimer::GameTime() const
 {
 	if (m_IsStopped)
 	{
-		return (float)(((m_StopTime - m_PausedTime) - m_BaseTime) * m_SecondsPerCount);
+		return (float)m_Clock->TicksToSeconds((m_StopTime - m_PausedTime) - m_BaseTime);
 	}
-	return (float)(((m_CurrTime - m_PausedTime) - m_BaseTime) * m_SecondsPerCount);
-}
-
-float GameTimer::DeltaTime()
-{
-	return (float)m_DeltaTime;
+	return (float)m_Clock->TicksToSeconds((m_CurrTime - m_PausedTime) - m_BaseTime);
 }
 
 void GameTimer::Reset()
 {
-	__int64 countsPerSec;
-	QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSec);
-	m_SecondsPerCount = 1.0 / (double)(countsPerSec);
-
-	__int64 currTime;
-	QueryPerformanceCounter((LARGE_INTEGER*)&currTime);
+	int64_t currTime = m_Clock->GetTicks();
 	m_BaseTime = currTime;
 	m_PrevTime = currTime;
+	m_CurrTime = currTime;
+	m_PausedTime = 0;
 	m_StopTime = 0;
 	m_IsStopped = false;
 }
 
 void GameTimer::Start()
 {
-	__int64 startTime;
-	QueryPerformanceCounter((LARGE_INTEGER*)&startTime);
+	int64_t startTime = m_Clock->GetTicks();
 
 	if (m_IsStopped)
 	{
 		m_PausedTime += (startTime - m_StopTime);
 		m_PrevTime = startTime;
-
 		m_StopTime = 0;
 		m_IsStopped = false;
 	}
@@ -127,9 +191,7 @@ void GameTimer::Stop()
 {
 	if (!m_IsStopped)
 	{
-		__int64 currTime;
-		QueryPerformanceCounter((LARGE_INTEGER*)&currTime);
-		m_StopTime = currTime;
+		m_StopTime = m_Clock->GetTicks();
 		m_IsStopped = true;
 	}
-}
\ No newline at end of file
+}
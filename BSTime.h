@@ -1,5 +1,21 @@
 #pragma once
+#ifdef _WIN32
 #include "VRCore.h"
+#else
+#include <cstdint>
+#include <time.h>
+#endif
+#include <atomic>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BS_TIME_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#define BS_TIME_TSC 0
+#endif
 //
 // Copyright (c) Microsoft. All rights reserved.
 // This code is licensed under the MIT License (MIT).
@@ -17,6 +33,112 @@
 
 #pragma once
 
+// A monotonic tick counter. Clocks are immutable once constructed (TscClock: once calibrated), so
+// one instance can be read from any number of threads.
+class IClock
+{
+public:
+    virtual ~IClock() = default;
+
+    virtual int64_t GetTicks() const = 0;
+    virtual const char* GetName() const = 0;
+
+    double GetTicksPerSecond() const { return m_TicksPerSecond; }
+    double TicksToSeconds(int64_t TickCount) const { return TickCount * m_SecondsPerTick; }
+    double TicksToMillisecs(int64_t TickCount) const { return TickCount * m_SecondsPerTick * 1000.0; }
+    int64_t SecondsToTicks(double Seconds) const { return (int64_t)(Seconds * m_TicksPerSecond); }
+
+protected:
+    void SetFrequency(double TicksPerSecond)
+    {
+        m_TicksPerSecond = TicksPerSecond;
+        m_SecondsPerTick = 1.0 / TicksPerSecond;
+    }
+
+private:
+    double m_TicksPerSecond = 1.0;
+    double m_SecondsPerTick = 1.0;
+};
+
+#ifdef _WIN32
+// QueryPerformanceCounter. The clock of SystemTime, D3D12 clock calibration and PIX on Windows.
+class QpcClock : public IClock
+{
+public:
+    QpcClock();
+
+    static int64_t Read()
+    {
+        LARGE_INTEGER tick;
+        QueryPerformanceCounter(&tick);
+        return static_cast<int64_t>(tick.QuadPart);
+    }
+
+    int64_t GetTicks() const override { return Read(); }
+    const char* GetName() const override { return "QPC"; }
+};
+#else
+// clock_gettime(CLOCK_MONOTONIC_RAW) in nanoseconds, not slewed by NTP.
+class MonotonicClock : public IClock
+{
+public:
+    MonotonicClock() { SetFrequency(1e9); }
+
+    static int64_t Read()
+    {
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+        return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+    }
+
+    int64_t GetTicks() const override { return Read(); }
+    const char* GetName() const override { return "MONOTONIC_RAW"; }
+};
+#endif
+
+#ifdef _WIN32
+typedef QpcClock PlatformClock;
+#else
+typedef MonotonicClock PlatformClock;
+#endif
+
+// The process-wide PlatformClock, safe to use before SystemTime::Initialize.
+const IClock& GetPlatformClock();
+
+#if BS_TIME_TSC
+// rdtsc, a few cycles per read. Its frequency is measured against a reference clock by
+// Calibrate(), only trustworthy if the TSC is invariant (constant rate across P/C-states and the
+// same on every core), see IsInvariant().
+class TscClock : public IClock
+{
+public:
+    // Calibrates against Reference for Seconds, busy waiting.
+    explicit TscClock(const IClock& Reference = GetPlatformClock(), double Seconds = 0.05) { Calibrate(Reference, Seconds); }
+
+    void Calibrate(const IClock& Reference, double Seconds);
+
+    static int64_t Read() { return (int64_t)__rdtsc(); }
+    // CPUID 0x80000007 EDX bit 8.
+    static bool IsInvariant();
+
+    int64_t GetTicks() const override { return Read(); }
+    const char* GetName() const override { return "TSC"; }
+};
+#endif
+
+struct ClockBenchmarkResult
+{
+    // Cost of one GetTicks() through the interface.
+    double ReadNanosecs = 0.0;
+    // Smallest non-zero step seen between two reads, in nanoseconds.
+    double ResolutionNanosecs = 0.0;
+    // Drift against Reference over the measured interval, parts per million.
+    double ErrorPPM = 0.0;
+};
+
+// Times Clock's reads, then measures Clock and Reference over the same Seconds long interval.
+ClockBenchmarkResult BenchmarkClock(const IClock& Clock, const IClock& Reference, unsigned Iterations = 1000000, double Seconds = 1.0);
+
 class SystemTime
 {
 public:
@@ -24,9 +146,10 @@ public:
     // Query the performance counter frequency
     static void Initialize(void);
 
-    // Query the current value of the performance counter
-    static int64_t GetCurrentTick(void);
+    // Query the current value of the performance counter (PlatformClock)
+    static int64_t GetCurrentTick(void) { return PlatformClock::Read(); }
 
+    // Spins a core for the whole wait, FramePacer (VRFramePacer.h) sleeps most of it.
     static void BusyLoopSleep(float SleepTime);
 
     static inline double TicksToSeconds(int64_t TickCount)
@@ -93,33 +216,36 @@ private:
     int64_t m_ElapsedTicks;
 };
 
+// Game/frame clock on any IClock. Each subsystem owns its own, Tick/Start/Stop/Reset on the
+// owning thread, DeltaTime() and Ticks() may be read from any thread.
 class GameTimer
 {
 public:
-    GameTimer();
+    explicit GameTimer(const IClock& Clock = GetPlatformClock());
     ~GameTimer();
 
-    static float GameTime();
-    static float DeltaTime();
+    float GameTime() const;
+    float DeltaTime() const { return (float)m_DeltaTime.load(std::memory_order_relaxed); }
 
-    static void Reset();
-    static void Start();
-    static void Stop();
-    static void Tick();
-    static bool IsPaused() { return m_IsStopped; }
-    static int Ticks() { return m_Ticks; }
+    void Reset();
+    void Start();
+    void Stop();
+    void Tick();
+    bool IsPaused() const { return m_IsStopped; }
+    int Ticks() const { return m_Ticks.load(std::memory_order_relaxed); }
+    const IClock& GetClock() const { return *m_Clock; }
 
 private:
-    static double m_SecondsPerCount;
-    static double m_DeltaTime;
+    const IClock* m_Clock;
+    std::atomic<double> m_DeltaTime{ 0.0 };
 
-    static __int64 m_BaseTime;
-    static __int64 m_PausedTime;
-    static __int64 m_StopTime;
-    static __int64 m_PrevTime;
-    static __int64 m_CurrTime;
+    int64_t m_BaseTime = 0;
+    int64_t m_PausedTime = 0;
+    int64_t m_StopTime = 0;
+    int64_t m_PrevTime = 0;
+    int64_t m_CurrTime = 0;
 
-    static bool m_IsStopped;
+    bool m_IsStopped = false;
 
-    static int m_Ticks;
-};
\ No newline at end of file
+    std::atomic<int> m_Ticks{ 0 };
+};
@@ -24,6 +24,7 @@
 
 #include <combaseapi.h>
 #include <mutex>
+#include <thread>
 #include <algorithm>
 #include <utility>
 #include <cstdlib>
@@ -107,6 +108,21 @@ especially to test compatibility with D3D12_RESOURCE_HEAP_TIER_1 on modern GPUs.
    #define D3D12MA_DEFAULT_BLOCK_SIZE (64ull * 1024 * 1024)
 #endif
 
+#ifndef D3D12MA_THREAD_CACHE_MIN_SIZE
+   /// Smallest size class kept in per-thread caches of pools with POOL_FLAG_THREAD_CACHE. Power of two.
+   #define D3D12MA_THREAD_CACHE_MIN_SIZE (4096ull)
+#endif
+
+#ifndef D3D12MA_THREAD_CACHE_MAX_SIZE
+   /// Largest size class kept in per-thread caches. Power of two.
+   #define D3D12MA_THREAD_CACHE_MAX_SIZE (256ull * 1024)
+#endif
+
+#ifndef D3D12MA_THREAD_CACHE_BYTES
+   /// Upper limit of memory one thread keeps cached in one pool, all size classes together.
+   #define D3D12MA_THREAD_CACHE_BYTES (1024ull * 1024)
+#endif
+
 #endif // _D3D12MA_CONFIGURATION
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -356,6 +372,9 @@ For 0 returns true.
 template <typename T>
 static bool IsPow2(T x) { return (x & (x - 1)) == 0; }
 
+// Floor of log2(x), for compile-time constants.
+static constexpr UINT Log2Constexpr(UINT64 x) { return x > 1 ? 1 + Log2Constexpr(x >> 1) : 0; }
+
 // Aligns given value up to nearest multiply of align value. For example: AlignUp(11, 8) = 16.
 // Use types like UINT, uint64_t as T.
 template <typename T>
@@ -5798,206 +5817,840 @@ bool BlockMetadata_TLSF::CheckBlock(
 #endif // _D3D12MA_BLOCK_METADATA_TLSF_FUNCTIONS
 #endif // _D3D12MA_BLOCK_METADATA_TLSF
 
-#ifndef _D3D12MA_MEMORY_BLOCK
+#ifndef _D3D12MA_BLOCK_METADATA_BUDDY
 /*
-Represents a single block of device memory (heap).
-Base class for inheritance.
-Thread-safety: This class must be externally synchronized.
+Binary buddy allocator. The block is treated as a tree of power-of-2 nodes: level 0 is
+the whole usable size, every split node has two children of half its size. Free nodes
+are kept in one list per level, and m_FreeLevels has bit N set when the list of level N
+is not empty, so finding the smallest free node that fits is a single bit scan.
+Allocation splits that node down to the target level, free merges a node with its
+buddy for as long as the buddy is free too, both O(log n) in the number of levels.
+
+Sizes are rounded up to a power of 2, the rest of the node is internal fragmentation.
+It is counted as free (GetSumFreeSize) but cannot be allocated, and is reported as an
+unused range. When the block size is not a power of 2, the tail after the largest
+power of 2 that fits is never used, it is reported the same way.
+
+Nodes are split and merged under the caller's feet, so AllocHandle is offset + 1 like
+in BlockMetadata_Linear, and the node is found again by walking down from the root.
 */
-class MemoryBlock
+class BlockMetadata_Buddy : public BlockMetadata
 {
 public:
-    // Creates the ID3D12Heap.
-    MemoryBlock(
-        AllocatorPimpl* allocator,
-        const D3D12_HEAP_PROPERTIES& heapProps,
-        D3D12_HEAP_FLAGS heapFlags,
-        UINT64 size,
-        UINT id);
-    virtual ~MemoryBlock();
+    BlockMetadata_Buddy(const ALLOCATION_CALLBACKS* allocationCallbacks, bool isVirtual);
+    virtual ~BlockMetadata_Buddy();
 
-    const D3D12_HEAP_PROPERTIES& GetHeapProperties() const { return m_HeapProps; }
-    D3D12_HEAP_FLAGS GetHeapFlags() const { return m_HeapFlags; }
-    UINT64 GetSize() const { return m_Size; }
-    UINT GetId() const { return m_Id; }
-    ID3D12Heap* GetHeap() const { return m_Heap; }
+    size_t GetAllocationCount() const override { return m_AllocationCount; }
+    size_t GetFreeRegionsCount() const override { return m_FreeCount + (GetUnusableSize() > 0 ? 1 : 0); }
+    UINT64 GetSumFreeSize() const override { return m_SumFreeSize + GetUnusableSize(); }
+    bool IsEmpty() const override { return m_Root->type == Node::TYPE_FREE; }
+    UINT64 GetAllocationOffset(AllocHandle allocHandle) const override { return (UINT64)allocHandle - 1; }
 
-protected:
-    AllocatorPimpl* const m_Allocator;
-    const D3D12_HEAP_PROPERTIES m_HeapProps;
-    const D3D12_HEAP_FLAGS m_HeapFlags;
-    const UINT64 m_Size;
-    const UINT m_Id;
+    void Init(UINT64 size) override;
+    bool Validate() const override;
+    void GetAllocationInfo(AllocHandle allocHandle, VIRTUAL_ALLOCATION_INFO& outInfo) const override;
 
-    HRESULT Init(ID3D12ProtectedResourceSession* pProtectedSession, bool denyMsaaTextures);
+    bool CreateAllocationRequest(
+        UINT64 allocSize,
+        UINT64 allocAlignment,
+        bool upperAddress,
+        UINT32 strategy,
+        AllocationRequest* pAllocationRequest) override;
 
-private:
-    ID3D12Heap* m_Heap = NULL;
+    void Alloc(
+        const AllocationRequest& request,
+        UINT64 allocSize,
+        void* privateData) override;
 
-    D3D12MA_CLASS_NO_COPY(MemoryBlock)
-};
-#endif // _D3D12MA_MEMORY_BLOCK
+    void Free(AllocHandle allocHandle) override;
+    void Clear() override;
 
-#ifndef _D3D12MA_NORMAL_BLOCK
-/*
-Represents a single block of device memory (heap) with all the data about its
-regions (aka suballocations, Allocation), assigned and free.
-Thread-safety: This class must be externally synchronized.
-*/
-class NormalBlock : public MemoryBlock
-{
-public:
-    BlockMetadata* m_pMetadata;
+    AllocHandle GetAllocationListBegin() const override;
+    AllocHandle GetNextAllocation(AllocHandle prevAlloc) const override;
+    UINT64 GetNextFreeRegionSize(AllocHandle alloc) const override;
+    void* GetAllocationPrivateData(AllocHandle allocHandle) const override;
+    void SetAllocationPrivateData(AllocHandle allocHandle, void* privateData) override;
 
-    NormalBlock(
-        AllocatorPimpl* allocator,
-        BlockVector* blockVector,
-        const D3D12_HEAP_PROPERTIES& heapProps,
-        D3D12_HEAP_FLAGS heapFlags,
-        UINT64 size,
-        UINT id);
-    virtual ~NormalBlock();
+    void AddStatistics(Statistics& inoutStats) const override;
+    void AddDetailedStatistics(DetailedStatistics& inoutStats) const override;
+    void WriteAllocationInfoToJson(JsonWriter& json) const override;
 
-    BlockVector* GetBlockVector() const { return m_BlockVector; }
+private:
+    // m_FreeLevels is 64 bits, 48 levels is already 2^47 times the smallest node.
+    static const UINT MAX_LEVELS = 48;
+    // Smallest node of a real heap. Virtual blocks go down to 1 byte (or MAX_LEVELS).
+    static const UINT64 MIN_NODE_SIZE = 4096;
+    static const UINT INITIAL_NODE_ALLOC_COUNT = 32;
 
-    // 'algorithm' should be one of the *_ALGORITHM_* flags in enums POOL_FLAGS or VIRTUAL_BLOCK_FLAGS
-    HRESULT Init(UINT32 algorithm, ID3D12ProtectedResourceSession* pProtectedSession, bool denyMsaaTextures);
+    struct Node
+    {
+        enum TYPE : UINT8
+        {
+            TYPE_FREE,
+            TYPE_ALLOCATION,
+            TYPE_SPLIT,
+        };
 
-    // Validates all data structures inside this object. If not valid, returns false.
-    bool Validate() const;
+        UINT64 offset;
+        TYPE type;
+        UINT8 level;
+        Node* parent;
+        Node* buddy;
 
-private:
-    BlockVector* m_BlockVector;
+        union
+        {
+            struct
+            {
+                Node* prev;
+                Node* next;
+            } free;
+            struct
+            {
+                void* privateData;
+                // Requested size, the rest of the node is internal fragmentation.
+                UINT64 size;
+            } allocation;
+            struct
+            {
+                // Right child is leftChild->buddy.
+                Node* leftChild;
+            } split;
+        };
+    };
 
-    D3D12MA_CLASS_NO_COPY(NormalBlock)
+    struct ValidationContext
+    {
+        size_t calculatedAllocationCount = 0;
+        size_t calculatedFreeCount = 0;
+        UINT64 calculatedSumFreeSize = 0;
+    };
+
+    // Largest power of 2 <= block size.
+    UINT64 m_UsableSize = 0;
+    UINT m_LevelCount = 0;
+    PoolAllocator<Node> m_NodeAllocator;
+    Node* m_Root = NULL;
+    Node* m_FreeList[MAX_LEVELS] = {};
+    // Bit N set = m_FreeList[N] is not empty.
+    UINT64 m_FreeLevels = 0;
+    size_t m_AllocationCount = 0;
+    size_t m_FreeCount = 0;
+    // Free nodes plus internal fragmentation of allocated ones, without the unusable tail.
+    UINT64 m_SumFreeSize = 0;
+
+    UINT64 GetUnusableSize() const { return GetSize() - m_UsableSize; }
+    UINT64 LevelToNodeSize(UINT level) const { return m_UsableSize >> level; }
+    // Deepest level whose nodes still fit allocSize.
+    UINT AllocSizeToLevel(UINT64 allocSize) const;
+
+    // Leaf (free or allocation) containing the offset.
+    Node* FindNode(UINT64 offset) const;
+    Node* FindAllocationNode(AllocHandle allocHandle) const;
+    void AddToFreeListFront(UINT level, Node* node);
+    void RemoveFromFreeList(UINT level, Node* node);
+    void DeleteNodeChildren(Node* node);
+    // Next leaf (free or allocation) in offset order, NULL after the last one.
+    static Node* GetNextLeaf(Node* node);
+
+    bool ValidateNode(ValidationContext& ctx, const Node* parent, const Node* curr, UINT level, UINT64 levelNodeSize) const;
+    void AddNodeToDetailedStatistics(DetailedStatistics& inoutStats, const Node* node, UINT64 levelNodeSize) const;
+    void PrintDetailedMapNode(JsonWriter& json, const Node* node, UINT64 levelNodeSize) const;
+
+    D3D12MA_CLASS_NO_COPY(BlockMetadata_Buddy)
 };
-#endif // _D3D12MA_NORMAL_BLOCK
 
-#ifndef _D3D12MA_COMMITTED_ALLOCATION_LIST_ITEM_TRAITS
-struct CommittedAllocationListItemTraits
+#ifndef _D3D12MA_BLOCK_METADATA_BUDDY_FUNCTIONS
+BlockMetadata_Buddy::BlockMetadata_Buddy(const ALLOCATION_CALLBACKS* allocationCallbacks, bool isVirtual)
+    : BlockMetadata(allocationCallbacks, isVirtual),
+    m_NodeAllocator(*allocationCallbacks, INITIAL_NODE_ALLOC_COUNT)
 {
-    using ItemType = Allocation;
+    D3D12MA_ASSERT(allocationCallbacks);
+}
 
-    static ItemType* GetPrev(const ItemType* item)
-    {
-        D3D12MA_ASSERT(item->m_PackedData.GetType() == Allocation::TYPE_COMMITTED || item->m_PackedData.GetType() == Allocation::TYPE_HEAP);
-        return item->m_Committed.prev;
-    }
-    static ItemType* GetNext(const ItemType* item)
+BlockMetadata_Buddy::~BlockMetadata_Buddy()
+{
+    if (m_Root)
     {
-        D3D12MA_ASSERT(item->m_PackedData.GetType() == Allocation::TYPE_COMMITTED || item->m_PackedData.GetType() == Allocation::TYPE_HEAP);
-        return item->m_Committed.next;
+        DeleteNodeChildren(m_Root);
+        m_NodeAllocator.Free(m_Root);
     }
-    static ItemType*& AccessPrev(ItemType* item)
+}
+
+void BlockMetadata_Buddy::Init(UINT64 size)
+{
+    BlockMetadata::Init(size);
+    D3D12MA_ASSERT(size > 0);
+
+    m_UsableSize = 1ull << BitScanMSB(size);
+    m_SumFreeSize = m_UsableSize;
+
+    const UINT64 minNodeSize = IsVirtual() ? 1 : MIN_NODE_SIZE;
+    m_LevelCount = 1;
+    while (m_LevelCount < MAX_LEVELS && LevelToNodeSize(m_LevelCount) >= minNodeSize)
+        ++m_LevelCount;
+
+    m_Root = m_NodeAllocator.Alloc();
+    m_Root->offset = 0;
+    m_Root->type = Node::TYPE_FREE;
+    m_Root->level = 0;
+    m_Root->parent = NULL;
+    m_Root->buddy = NULL;
+    AddToFreeListFront(0, m_Root);
+}
+
+bool BlockMetadata_Buddy::Validate() const
+{
+    ValidationContext ctx;
+    D3D12MA_VALIDATE(m_Root != NULL);
+    D3D12MA_VALIDATE(ValidateNode(ctx, NULL, m_Root, 0, m_UsableSize));
+    D3D12MA_VALIDATE(ctx.calculatedAllocationCount == m_AllocationCount);
+    D3D12MA_VALIDATE(ctx.calculatedFreeCount == m_FreeCount);
+    D3D12MA_VALIDATE(ctx.calculatedSumFreeSize == m_SumFreeSize);
+
+    size_t freeListCount = 0;
+    for (UINT level = 0; level < MAX_LEVELS; ++level)
     {
-        D3D12MA_ASSERT(item->m_PackedData.GetType() == Allocation::TYPE_COMMITTED || item->m_PackedData.GetType() == Allocation::TYPE_HEAP);
-        return item->m_Committed.prev;
+        D3D12MA_VALIDATE(((m_FreeLevels >> level) & 1) == (m_FreeList[level] != NULL ? 1u : 0u));
+        const Node* prev = NULL;
+        for (const Node* node = m_FreeList[level]; node != NULL; node = node->free.next)
+        {
+            D3D12MA_VALIDATE(level < m_LevelCount);
+            D3D12MA_VALIDATE(node->type == Node::TYPE_FREE);
+            D3D12MA_VALIDATE(node->level == level);
+            D3D12MA_VALIDATE(node->free.prev == prev);
+            prev = node;
+            ++freeListCount;
+        }
     }
-    static ItemType*& AccessNext(ItemType* item)
+    D3D12MA_VALIDATE(freeListCount == m_FreeCount);
+    return true;
+}
+
+void BlockMetadata_Buddy::GetAllocationInfo(AllocHandle allocHandle, VIRTUAL_ALLOCATION_INFO& outInfo) const
+{
+    const Node* node = FindAllocationNode(allocHandle);
+    outInfo.Offset = node->offset;
+    outInfo.Size = node->allocation.size;
+    outInfo.pPrivateData = node->allocation.privateData;
+}
+
+bool BlockMetadata_Buddy::CreateAllocationRequest(
+    UINT64 allocSize,
+    UINT64 allocAlignment,
+    bool upperAddress,
+    UINT32 strategy,
+    AllocationRequest* pAllocationRequest)
+{
+    D3D12MA_ASSERT(allocSize > 0 && "Cannot allocate empty block!");
+    D3D12MA_ASSERT(!upperAddress && "ALLOCATION_FLAG_UPPER_ADDRESS can be used only with linear algorithm.");
+    D3D12MA_ASSERT(pAllocationRequest != NULL);
+    D3D12MA_HEAVY_ASSERT(Validate());
+
+    allocSize += GetDebugMargin();
+    if (allocSize > m_UsableSize)
+        return false;
+
+    // Every node of levels 0..targetLevel is big enough. Deepest one wastes the least,
+    // nodes are aligned to their own size so the first one usually fits the alignment too.
+    const UINT targetLevel = AllocSizeToLevel(allocSize);
+    UINT64 levels = m_FreeLevels & ((2ull << targetLevel) - 1);
+    while (levels != 0)
     {
-        D3D12MA_ASSERT(item->m_PackedData.GetType() == Allocation::TYPE_COMMITTED || item->m_PackedData.GetType() == Allocation::TYPE_HEAP);
-        return item->m_Committed.next;
+        const UINT level = BitScanMSB(levels);
+        for (Node* node = m_FreeList[level]; node != NULL; node = node->free.next)
+        {
+            if (allocAlignment <= 1 || node->offset % allocAlignment == 0)
+            {
+                pAllocationRequest->allocHandle = (AllocHandle)(node->offset + 1);
+                pAllocationRequest->size = allocSize - GetDebugMargin();
+                pAllocationRequest->algorithmData = (UINT64)node;
+                pAllocationRequest->sumFreeSize = LevelToNodeSize(level);
+                pAllocationRequest->sumItemSize = 0;
+                pAllocationRequest->zeroInitialized = FALSE;
+                return true;
+            }
+        }
+        levels &= ~(1ull << level);
     }
-};
-#endif // _D3D12MA_COMMITTED_ALLOCATION_LIST_ITEM_TRAITS
+    return false;
+}
 
-#ifndef _D3D12MA_COMMITTED_ALLOCATION_LIST
-/*
-Stores linked list of Allocation objects that are of TYPE_COMMITTED or TYPE_HEAP.
-Thread-safe, synchronized internally.
-*/
-class CommittedAllocationList
+void BlockMetadata_Buddy::Alloc(
+    const AllocationRequest& request,
+    UINT64 allocSize,
+    void* privateData)
 {
-public:
-    CommittedAllocationList() = default;
-    void Init(bool useMutex, D3D12_HEAP_TYPE heapType, PoolPimpl* pool);
-    ~CommittedAllocationList();
+    const UINT targetLevel = AllocSizeToLevel(allocSize + GetDebugMargin());
+    Node* currNode = (Node*)request.algorithmData;
+    UINT currLevel = currNode->level;
+    D3D12MA_ASSERT(currNode->type == Node::TYPE_FREE && currLevel <= targetLevel);
+    RemoveFromFreeList(currLevel, currNode);
 
-    D3D12_HEAP_TYPE GetHeapType() const { return m_HeapType; }
-    PoolPimpl* GetPool() const { return m_Pool; }
-    UINT GetMemorySegmentGroup(AllocatorPimpl* allocator) const;
-    
-    void AddStatistics(Statistics& inoutStats);
-    void AddDetailedStatistics(DetailedStatistics& inoutStats);
-    // Writes JSON array with the list of allocations.
-    void BuildStatsString(JsonWriter& json);
+    // Split down to the target level, right halves go to the free lists.
+    while (currLevel < targetLevel)
+    {
+        const UINT childLevel = currLevel + 1;
+        const UINT64 childSize = LevelToNodeSize(childLevel);
 
-    void Register(Allocation* alloc);
-    void Unregister(Allocation* alloc);
+        Node* leftChild = m_NodeAllocator.Alloc();
+        Node* rightChild = m_NodeAllocator.Alloc();
 
-private:
-    using CommittedAllocationLinkedList = IntrusiveLinkedList<CommittedAllocationListItemTraits>;
+        leftChild->offset = currNode->offset;
+        leftChild->type = Node::TYPE_FREE;
+        leftChild->level = (UINT8)childLevel;
+        leftChild->parent = currNode;
+        leftChild->buddy = rightChild;
 
-    bool m_UseMutex = true;
-    D3D12_HEAP_TYPE m_HeapType = D3D12_HEAP_TYPE_CUSTOM;
-    PoolPimpl* m_Pool = NULL;
+        rightChild->offset = currNode->offset + childSize;
+        rightChild->type = Node::TYPE_FREE;
+        rightChild->level = (UINT8)childLevel;
+        rightChild->parent = currNode;
+        rightChild->buddy = leftChild;
 
-    D3D12MA_RW_MUTEX m_Mutex;
-    CommittedAllocationLinkedList m_AllocationList;
-};
-#endif // _D3D12MA_COMMITTED_ALLOCATION_LIST
+        currNode->type = Node::TYPE_SPLIT;
+        currNode->split.leftChild = leftChild;
+        AddToFreeListFront(childLevel, rightChild);
 
-#ifndef _D3D12M_COMMITTED_ALLOCATION_PARAMETERS
-struct CommittedAllocationParameters
-{
-    CommittedAllocationList* m_List = NULL;
-    D3D12_HEAP_PROPERTIES m_HeapProperties = {};
-    D3D12_HEAP_FLAGS m_HeapFlags = D3D12_HEAP_FLAG_NONE;
-    ID3D12ProtectedResourceSession* m_ProtectedSession = NULL;
-    bool m_CanAlias = false;
+        currNode = leftChild;
+        currLevel = childLevel;
+    }
 
-    bool IsValid() const { return m_List != NULL; }
-};
-#endif // _D3D12M_COMMITTED_ALLOCATION_PARAMETERS
+    D3D12MA_ASSERT(allocSize + GetDebugMargin() <= LevelToNodeSize(currLevel));
+    currNode->type = Node::TYPE_ALLOCATION;
+    currNode->allocation.privateData = privateData;
+    currNode->allocation.size = allocSize;
 
-#ifndef _D3D12MA_BLOCK_VECTOR
-/*
-Sequence of NormalBlock. Represents memory blocks allocated for a specific
-heap type and possibly resource type (if only Tier 1 is supported).
+    ++m_AllocationCount;
+    m_SumFreeSize -= allocSize;
+}
 
-Synchronized internally with a mutex.
-*/
-class BlockVector
+void BlockMetadata_Buddy::Free(AllocHandle allocHandle)
 {
-    friend class DefragmentationContextPimpl;
-    D3D12MA_CLASS_NO_COPY(BlockVector)
-public:
-    BlockVector(
-        AllocatorPimpl* hAllocator,
-        const D3D12_HEAP_PROPERTIES& heapProps,
-        D3D12_HEAP_FLAGS heapFlags,
-        UINT64 preferredBlockSize,
-        size_t minBlockCount,
-        size_t maxBlockCount,
-        bool explicitBlockSize,
-        UINT64 minAllocationAlignment,
-        UINT32 algorithm,
-        bool denyMsaaTextures,
-        ID3D12ProtectedResourceSession* pProtectedSession);
-    ~BlockVector();
+    Node* node = FindAllocationNode(allocHandle);
 
-    const D3D12_HEAP_PROPERTIES& GetHeapProperties() const { return m_HeapProps; }
-    D3D12_HEAP_FLAGS GetHeapFlags() const { return m_HeapFlags; }
-    UINT64 GetPreferredBlockSize() const { return m_PreferredBlockSize; }
-    UINT32 GetAlgorithm() const { return m_Algorithm; }
-    bool DeniesMsaaTextures() const { return m_DenyMsaaTextures; }
-    // To be used only while the m_Mutex is locked. Used during defragmentation.
-    size_t GetBlockCount() const { return m_Blocks.size(); }
-    // To be used only while the m_Mutex is locked. Used during defragmentation.
-    NormalBlock* GetBlock(size_t index) const { return m_Blocks[index]; }
-    D3D12MA_RW_MUTEX& GetMutex() { return m_Mutex; }
+    --m_AllocationCount;
+    m_SumFreeSize += node->allocation.size;
+    node->type = Node::TYPE_FREE;
 
-    HRESULT CreateMinBlocks();
-    bool IsEmpty();
+    // Join with the buddy while it is free, the parent takes the place of both.
+    UINT level = node->level;
+    while (level > 0 && node->buddy->type == Node::TYPE_FREE)
+    {
+        RemoveFromFreeList(level, node->buddy);
+        Node* const parent = node->parent;
 
-    HRESULT Allocate(
-        UINT64 size,
-        UINT64 alignment,
-        const ALLOCATION_DESC& allocDesc,
-        size_t allocationCount,
-        Allocation** pAllocations);
+        m_NodeAllocator.Free(node->buddy);
+        m_NodeAllocator.Free(node);
+        parent->type = Node::TYPE_FREE;
 
-    void Free(Allocation* hAllocation);
+        node = parent;
+        --level;
+    }
+    AddToFreeListFront(level, node);
+}
+
+void BlockMetadata_Buddy::Clear()
+{
+    DeleteNodeChildren(m_Root);
+    for (UINT level = 0; level < MAX_LEVELS; ++level)
+        m_FreeList[level] = NULL;
+    m_FreeLevels = 0;
+    m_FreeCount = 0;
+    m_AllocationCount = 0;
+    m_SumFreeSize = m_UsableSize;
+
+    m_Root->type = Node::TYPE_FREE;
+    AddToFreeListFront(0, m_Root);
+}
+
+AllocHandle BlockMetadata_Buddy::GetAllocationListBegin() const
+{
+    if (m_AllocationCount == 0)
+        return (AllocHandle)0;
+
+    Node* node = m_Root;
+    while (node->type == Node::TYPE_SPLIT)
+        node = node->split.leftChild;
+    while (node->type != Node::TYPE_ALLOCATION)
+        node = GetNextLeaf(node);
+    return (AllocHandle)(node->offset + 1);
+}
+
+AllocHandle BlockMetadata_Buddy::GetNextAllocation(AllocHandle prevAlloc) const
+{
+    Node* node = FindAllocationNode(prevAlloc);
+    do
+    {
+        node = GetNextLeaf(node);
+    } while (node != NULL && node->type != Node::TYPE_ALLOCATION);
+    return node != NULL ? (AllocHandle)(node->offset + 1) : (AllocHandle)0;
+}
+
+UINT64 BlockMetadata_Buddy::GetNextFreeRegionSize(AllocHandle alloc) const
+{
+    Node* node = FindAllocationNode(alloc);
+
+    UINT64 size = LevelToNodeSize(node->level) - node->allocation.size;
+    const Node* next = GetNextLeaf(node);
+    if (next != NULL && next->type == Node::TYPE_FREE)
+        size += LevelToNodeSize(next->level);
+    return size;
+}
+
+void* BlockMetadata_Buddy::GetAllocationPrivateData(AllocHandle allocHandle) const
+{
+    return FindAllocationNode(allocHandle)->allocation.privateData;
+}
+
+void BlockMetadata_Buddy::SetAllocationPrivateData(AllocHandle allocHandle, void* privateData)
+{
+    FindAllocationNode(allocHandle)->allocation.privateData = privateData;
+}
+
+void BlockMetadata_Buddy::AddStatistics(Statistics& inoutStats) const
+{
+    inoutStats.BlockCount++;
+    inoutStats.AllocationCount += (UINT)m_AllocationCount;
+    inoutStats.BlockBytes += GetSize();
+    inoutStats.AllocationBytes += GetSize() - GetSumFreeSize();
+}
+
+void BlockMetadata_Buddy::AddDetailedStatistics(DetailedStatistics& inoutStats) const
+{
+    inoutStats.Stats.BlockCount++;
+    inoutStats.Stats.BlockBytes += GetSize();
+
+    AddNodeToDetailedStatistics(inoutStats, m_Root, m_UsableSize);
+
+    const UINT64 unusableSize = GetUnusableSize();
+    if (unusableSize > 0)
+        AddDetailedStatisticsUnusedRange(inoutStats, unusableSize);
+}
+
+void BlockMetadata_Buddy::WriteAllocationInfoToJson(JsonWriter& json) const
+{
+    DetailedStatistics stats;
+    ClearDetailedStatistics(stats);
+    AddDetailedStatistics(stats);
+
+    PrintDetailedMap_Begin(json, stats.Stats.BlockBytes - stats.Stats.AllocationBytes,
+        stats.Stats.AllocationCount, stats.UnusedRangeCount);
+
+    PrintDetailedMapNode(json, m_Root, m_UsableSize);
+
+    const UINT64 unusableSize = GetUnusableSize();
+    if (unusableSize > 0)
+        PrintDetailedMap_UnusedRange(json, m_UsableSize, unusableSize);
+
+    PrintDetailedMap_End(json);
+}
+
+UINT BlockMetadata_Buddy::AllocSizeToLevel(UINT64 allocSize) const
+{
+    D3D12MA_ASSERT(allocSize > 0 && allocSize <= m_UsableSize);
+    // Log2 of the smallest power of 2 >= allocSize.
+    const UINT sizeLog2 = allocSize > 1 ? BitScanMSB(allocSize - 1) + 1u : 0u;
+    const UINT level = BitScanMSB(m_UsableSize) - sizeLog2;
+    return D3D12MA_MIN(level, m_LevelCount - 1);
+}
+
+BlockMetadata_Buddy::Node* BlockMetadata_Buddy::FindNode(UINT64 offset) const
+{
+    D3D12MA_ASSERT(offset < m_UsableSize);
+
+    Node* node = m_Root;
+    while (node->type == Node::TYPE_SPLIT)
+    {
+        Node* const rightChild = node->split.leftChild->buddy;
+        node = offset < rightChild->offset ? node->split.leftChild : rightChild;
+    }
+    return node;
+}
+
+BlockMetadata_Buddy::Node* BlockMetadata_Buddy::FindAllocationNode(AllocHandle allocHandle) const
+{
+    const UINT64 offset = (UINT64)allocHandle - 1;
+    Node* node = FindNode(offset);
+    D3D12MA_ASSERT(node->type == Node::TYPE_ALLOCATION && node->offset == offset);
+    return node;
+}
+
+void BlockMetadata_Buddy::AddToFreeListFront(UINT level, Node* node)
+{
+    D3D12MA_ASSERT(node->type == Node::TYPE_FREE);
+
+    node->free.prev = NULL;
+    node->free.next = m_FreeList[level];
+    if (m_FreeList[level] != NULL)
+        m_FreeList[level]->free.prev = node;
+    m_FreeList[level] = node;
+
+    m_FreeLevels |= 1ull << level;
+    ++m_FreeCount;
+}
+
+void BlockMetadata_Buddy::RemoveFromFreeList(UINT level, Node* node)
+{
+    D3D12MA_ASSERT(node->type == Node::TYPE_FREE);
+
+    if (node->free.prev != NULL)
+        node->free.prev->free.next = node->free.next;
+    else
+    {
+        D3D12MA_ASSERT(m_FreeList[level] == node);
+        m_FreeList[level] = node->free.next;
+        if (m_FreeList[level] == NULL)
+            m_FreeLevels &= ~(1ull << level);
+    }
+    if (node->free.next != NULL)
+        node->free.next->free.prev = node->free.prev;
+
+    --m_FreeCount;
+}
+
+void BlockMetadata_Buddy::DeleteNodeChildren(Node* node)
+{
+    if (node->type == Node::TYPE_SPLIT)
+    {
+        Node* leftChild = node->split.leftChild;
+        Node* rightChild = leftChild->buddy;
+        DeleteNodeChildren(leftChild);
+        DeleteNodeChildren(rightChild);
+        m_NodeAllocator.Free(leftChild);
+        m_NodeAllocator.Free(rightChild);
+    }
+}
+
+BlockMetadata_Buddy::Node* BlockMetadata_Buddy::GetNextLeaf(Node* node)
+{
+    // Up while we are a right child, then over to the right sibling and down its left edge.
+    while (node->parent != NULL && node->parent->split.leftChild != node)
+        node = node->parent;
+    if (node->parent == NULL)
+        return NULL;
+
+    node = node->buddy;
+    while (node->type == Node::TYPE_SPLIT)
+        node = node->split.leftChild;
+    return node;
+}
+
+bool BlockMetadata_Buddy::ValidateNode(ValidationContext& ctx, const Node* parent, const Node* curr, UINT level, UINT64 levelNodeSize) const
+{
+    D3D12MA_VALIDATE(level < m_LevelCount);
+    D3D12MA_VALIDATE(curr->parent == parent);
+    D3D12MA_VALIDATE(curr->level == level);
+    D3D12MA_VALIDATE((parent == NULL) == (curr->buddy == NULL));
+    D3D12MA_VALIDATE(curr->buddy == NULL || curr->buddy->buddy == curr);
+    D3D12MA_VALIDATE(curr->offset % levelNodeSize == 0);
+
+    switch (curr->type)
+    {
+    case Node::TYPE_FREE:
+        ctx.calculatedSumFreeSize += levelNodeSize;
+        ++ctx.calculatedFreeCount;
+        break;
+    case Node::TYPE_ALLOCATION:
+        D3D12MA_VALIDATE(curr->allocation.size > 0);
+        D3D12MA_VALIDATE(curr->allocation.size + GetDebugMargin() <= levelNodeSize);
+        ctx.calculatedSumFreeSize += levelNodeSize - curr->allocation.size;
+        ++ctx.calculatedAllocationCount;
+        break;
+    case Node::TYPE_SPLIT:
+    {
+        const UINT childLevel = level + 1;
+        const UINT64 childSize = levelNodeSize / 2;
+        const Node* leftChild = curr->split.leftChild;
+        D3D12MA_VALIDATE(leftChild != NULL);
+        D3D12MA_VALIDATE(leftChild->offset == curr->offset);
+        D3D12MA_VALIDATE(ValidateNode(ctx, curr, leftChild, childLevel, childSize));
+        const Node* rightChild = leftChild->buddy;
+        D3D12MA_VALIDATE(rightChild->offset == curr->offset + childSize);
+        D3D12MA_VALIDATE(ValidateNode(ctx, curr, rightChild, childLevel, childSize));
+        // Two free buddies must have been merged back into the parent.
+        D3D12MA_VALIDATE(leftChild->type != Node::TYPE_FREE || rightChild->type != Node::TYPE_FREE);
+        break;
+    }
+    default:
+        return false;
+    }
+    return true;
+}
+
+void BlockMetadata_Buddy::AddNodeToDetailedStatistics(DetailedStatistics& inoutStats, const Node* node, UINT64 levelNodeSize) const
+{
+    switch (node->type)
+    {
+    case Node::TYPE_FREE:
+        AddDetailedStatisticsUnusedRange(inoutStats, levelNodeSize);
+        break;
+    case Node::TYPE_ALLOCATION:
+        AddDetailedStatisticsAllocation(inoutStats, node->allocation.size);
+        if (node->allocation.size < levelNodeSize)
+            AddDetailedStatisticsUnusedRange(inoutStats, levelNodeSize - node->allocation.size);
+        break;
+    case Node::TYPE_SPLIT:
+    {
+        const Node* leftChild = node->split.leftChild;
+        AddNodeToDetailedStatistics(inoutStats, leftChild, levelNodeSize / 2);
+        AddNodeToDetailedStatistics(inoutStats, leftChild->buddy, levelNodeSize / 2);
+        break;
+    }
+    default:
+        D3D12MA_ASSERT(0);
+    }
+}
+
+void BlockMetadata_Buddy::PrintDetailedMapNode(JsonWriter& json, const Node* node, UINT64 levelNodeSize) const
+{
+    switch (node->type)
+    {
+    case Node::TYPE_FREE:
+        PrintDetailedMap_UnusedRange(json, node->offset, levelNodeSize);
+        break;
+    case Node::TYPE_ALLOCATION:
+        PrintDetailedMap_Allocation(json, node->offset, node->allocation.size, node->allocation.privateData);
+        if (node->allocation.size < levelNodeSize)
+        {
+            PrintDetailedMap_UnusedRange(json, node->offset + node->allocation.size,
+                levelNodeSize - node->allocation.size);
+        }
+        break;
+    case Node::TYPE_SPLIT:
+    {
+        const Node* leftChild = node->split.leftChild;
+        PrintDetailedMapNode(json, leftChild, levelNodeSize / 2);
+        PrintDetailedMapNode(json, leftChild->buddy, levelNodeSize / 2);
+        break;
+    }
+    default:
+        D3D12MA_ASSERT(0);
+    }
+}
+#endif // _D3D12MA_BLOCK_METADATA_BUDDY_FUNCTIONS
+#endif // _D3D12MA_BLOCK_METADATA_BUDDY
+
+#ifndef _D3D12MA_MEMORY_BLOCK
+/*
+Represents a single block of device memory (heap).
+Base class for inheritance.
+Thread-safety: This class must be externally synchronized.
+*/
+class MemoryBlock
+{
+public:
+    // Creates the ID3D12Heap.
+    MemoryBlock(
+        AllocatorPimpl* allocator,
+        const D3D12_HEAP_PROPERTIES& heapProps,
+        D3D12_HEAP_FLAGS heapFlags,
+        UINT64 size,
+        UINT id);
+    virtual ~MemoryBlock();
+
+    const D3D12_HEAP_PROPERTIES& GetHeapProperties() const { return m_HeapProps; }
+    D3D12_HEAP_FLAGS GetHeapFlags() const { return m_HeapFlags; }
+    UINT64 GetSize() const { return m_Size; }
+    UINT GetId() const { return m_Id; }
+    ID3D12Heap* GetHeap() const { return m_Heap; }
+
+protected:
+    AllocatorPimpl* const m_Allocator;
+    const D3D12_HEAP_PROPERTIES m_HeapProps;
+    const D3D12_HEAP_FLAGS m_HeapFlags;
+    const UINT64 m_Size;
+    const UINT m_Id;
+
+    HRESULT Init(ID3D12ProtectedResourceSession* pProtectedSession, bool denyMsaaTextures);
+
+private:
+    ID3D12Heap* m_Heap = NULL;
+
+    D3D12MA_CLASS_NO_COPY(MemoryBlock)
+};
+#endif // _D3D12MA_MEMORY_BLOCK
+
+#ifndef _D3D12MA_NORMAL_BLOCK
+/*
+Represents a single block of device memory (heap) with all the data about its
+regions (aka suballocations, Allocation), assigned and free.
+Thread-safety: This class must be externally synchronized.
+*/
+class NormalBlock : public MemoryBlock
+{
+public:
+    BlockMetadata* m_pMetadata;
+
+    NormalBlock(
+        AllocatorPimpl* allocator,
+        BlockVector* blockVector,
+        const D3D12_HEAP_PROPERTIES& heapProps,
+        D3D12_HEAP_FLAGS heapFlags,
+        UINT64 size,
+        UINT id);
+    virtual ~NormalBlock();
+
+    BlockVector* GetBlockVector() const { return m_BlockVector; }
+
+    // 'algorithm' should be one of the *_ALGORITHM_* flags in enums POOL_FLAGS or VIRTUAL_BLOCK_FLAGS
+    HRESULT Init(UINT32 algorithm, ID3D12ProtectedResourceSession* pProtectedSession, bool denyMsaaTextures);
+
+    // Validates all data structures inside this object. If not valid, returns false.
+    bool Validate() const;
+
+private:
+    BlockVector* m_BlockVector;
+
+    D3D12MA_CLASS_NO_COPY(NormalBlock)
+};
+#endif // _D3D12MA_NORMAL_BLOCK
+
+#ifndef _D3D12MA_COMMITTED_ALLOCATION_LIST_ITEM_TRAITS
+struct CommittedAllocationListItemTraits
+{
+    using ItemType = Allocation;
+
+    static ItemType* GetPrev(const ItemType* item)
+    {
+        D3D12MA_ASSERT(item->m_PackedData.GetType() == Allocation::TYPE_COMMITTED || item->m_PackedData.GetType() == Allocation::TYPE_HEAP);
+        return item->m_Committed.prev;
+    }
+    static ItemType* GetNext(const ItemType* item)
+    {
+        D3D12MA_ASSERT(item->m_PackedData.GetType() == Allocation::TYPE_COMMITTED || item->m_PackedData.GetType() == Allocation::TYPE_HEAP);
+        return item->m_Committed.next;
+    }
+    static ItemType*& AccessPrev(ItemType* item)
+    {
+        D3D12MA_ASSERT(item->m_PackedData.GetType() == Allocation::TYPE_COMMITTED || item->m_PackedData.GetType() == Allocation::TYPE_HEAP);
+        return item->m_Committed.prev;
+    }
+    static ItemType*& AccessNext(ItemType* item)
+    {
+        D3D12MA_ASSERT(item->m_PackedData.GetType() == Allocation::TYPE_COMMITTED || item->m_PackedData.GetType() == Allocation::TYPE_HEAP);
+        return item->m_Committed.next;
+    }
+};
+#endif // _D3D12MA_COMMITTED_ALLOCATION_LIST_ITEM_TRAITS
+
+#ifndef _D3D12MA_COMMITTED_ALLOCATION_LIST
+/*
+Stores linked list of Allocation objects that are of TYPE_COMMITTED or TYPE_HEAP.
+Thread-safe, synchronized internally.
+*/
+class CommittedAllocationList
+{
+public:
+    CommittedAllocationList() = default;
+    void Init(bool useMutex, D3D12_HEAP_TYPE heapType, PoolPimpl* pool);
+    ~CommittedAllocationList();
+
+    D3D12_HEAP_TYPE GetHeapType() const { return m_HeapType; }
+    PoolPimpl* GetPool() const { return m_Pool; }
+    UINT GetMemorySegmentGroup(AllocatorPimpl* allocator) const;
+    
+    void AddStatistics(Statistics& inoutStats);
+    void AddDetailedStatistics(DetailedStatistics& inoutStats);
+    // Writes JSON array with the list of allocations.
+    void BuildStatsString(JsonWriter& json);
+
+    void Register(Allocation* alloc);
+    void Unregister(Allocation* alloc);
+
+private:
+    using CommittedAllocationLinkedList = IntrusiveLinkedList<CommittedAllocationListItemTraits>;
+
+    bool m_UseMutex = true;
+    D3D12_HEAP_TYPE m_HeapType = D3D12_HEAP_TYPE_CUSTOM;
+    PoolPimpl* m_Pool = NULL;
+
+    D3D12MA_RW_MUTEX m_Mutex;
+    CommittedAllocationLinkedList m_AllocationList;
+};
+#endif // _D3D12MA_COMMITTED_ALLOCATION_LIST
+
+#ifndef _D3D12M_COMMITTED_ALLOCATION_PARAMETERS
+struct CommittedAllocationParameters
+{
+    CommittedAllocationList* m_List = NULL;
+    D3D12_HEAP_PROPERTIES m_HeapProperties = {};
+    D3D12_HEAP_FLAGS m_HeapFlags = D3D12_HEAP_FLAG_NONE;
+    ID3D12ProtectedResourceSession* m_ProtectedSession = NULL;
+    bool m_CanAlias = false;
+
+    bool IsValid() const { return m_List != NULL; }
+};
+#endif // _D3D12M_COMMITTED_ALLOCATION_PARAMETERS
+
+#ifndef _D3D12MA_BLOCK_VECTOR
+/*
+Sequence of NormalBlock. Represents memory blocks allocated for a specific
+heap type and possibly resource type (if only Tier 1 is supported).
+
+Synchronized internally with a mutex.
+*/
+class BlockVector
+{
+    friend class DefragmentationContextPimpl;
+    D3D12MA_CLASS_NO_COPY(BlockVector)
+public:
+    BlockVector(
+        AllocatorPimpl* hAllocator,
+        const D3D12_HEAP_PROPERTIES& heapProps,
+        D3D12_HEAP_FLAGS heapFlags,
+        UINT64 preferredBlockSize,
+        size_t minBlockCount,
+        size_t maxBlockCount,
+        bool explicitBlockSize,
+        UINT64 minAllocationAlignment,
+        UINT32 algorithm,
+        bool denyMsaaTextures,
+        ID3D12ProtectedResourceSession* pProtectedSession,
+        bool threadCache = false);
+    ~BlockVector();
+
+    const D3D12_HEAP_PROPERTIES& GetHeapProperties() const { return m_HeapProps; }
+    D3D12_HEAP_FLAGS GetHeapFlags() const { return m_HeapFlags; }
+    UINT64 GetPreferredBlockSize() const { return m_PreferredBlockSize; }
+    UINT32 GetAlgorithm() const { return m_Algorithm; }
+    bool DeniesMsaaTextures() const { return m_DenyMsaaTextures; }
+    // To be used only while the m_Mutex is locked. Used during defragmentation.
+    size_t GetBlockCount() const { return m_Blocks.size(); }
+    // To be used only while the m_Mutex is locked. Used during defragmentation.
+    NormalBlock* GetBlock(size_t index) const { return m_Blocks[index]; }
+    D3D12MA_RW_MUTEX& GetMutex() { return m_Mutex; }
+
+    HRESULT CreateMinBlocks();
+    bool IsEmpty();
+
+    HRESULT Allocate(
+        UINT64 size,
+        UINT64 alignment,
+        const ALLOCATION_DESC& allocDesc,
+        size_t allocationCount,
+        Allocation** pAllocations);
+    // Allocates pAllocInfos[pIndices[i]] to pAllocations[pIndices[i]] in the order of pIndices,
+    // under one lock, bypassing thread caches. All or nothing, budget updated once.
+    HRESULT AllocateBatch(
+        const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfos,
+        const UINT* pIndices,
+        size_t allocationCount,
+        const ALLOCATION_DESC& allocDesc,
+        Allocation** pAllocations);
+
+    void Free(Allocation* hAllocation);
+    // Frees allocations that all belong to this block vector under one lock.
+    // threadCached: they come from thread caches, see FlushThreadCaches.
+    void FreeBatch(Allocation* const* pAllocations, size_t allocationCount, bool threadCached = false);
+
+    bool IsThreadCacheEnabled() const { return m_ThreadCacheEnabled; }
+    // Keeps hAllocation in the calling thread's cache instead of freeing it. Returns false if
+    // it is not eligible, the caller frees it then. Budget must already be updated by the caller.
+    bool FreeToThreadCache(Allocation* hAllocation);
+    // Returns every cached allocation to the blocks. Must not be called with m_Mutex locked.
+    void FlushThreadCaches();
+    // While blocked (defragmentation in progress), caches are flushed and not used.
+    void SetThreadCacheBlocked(bool blocked);
 
     HRESULT CreateResource(
         UINT64 size,
@@ -6050,9 +6703,82 @@ private:
     UINT m_NextBlockId;
     bool m_IncrementalSort = true;
 
+    // Per-thread caches of free suballocations, see POOL_FLAG_THREAD_CACHE. Every cache is owned
+    // by one thread and locked only by it, except when flushed. Cached allocations stay allocated
+    // in the block metadata, but are not counted in the budget or the statistics.
+    static constexpr UINT THREAD_CACHE_MAX_ENTRIES = 32;
+    static constexpr UINT THREAD_CACHE_MIN_SHIFT = Log2Constexpr(D3D12MA_THREAD_CACHE_MIN_SIZE);
+    static constexpr UINT THREAD_CACHE_CLASS_COUNT = Log2Constexpr(D3D12MA_THREAD_CACHE_MAX_SIZE) - THREAD_CACHE_MIN_SHIFT + 1;
+    struct ThreadCache
+    {
+        struct SizeClass
+        {
+            UINT count = 0;
+            Allocation* entries[THREAD_CACHE_MAX_ENTRIES];
+        };
+        D3D12MA_MUTEX mutex;
+        std::thread::id thread;
+        UINT64 bytes = 0;
+        SizeClass classes[THREAD_CACHE_CLASS_COUNT];
+    };
+    const bool m_ThreadCacheEnabled;
+    const UINT64 m_ThreadCacheId;
+    D3D12MA_ATOMIC_UINT32 m_ThreadCacheBlocked = 0;
+    D3D12MA_MUTEX m_ThreadCacheMutex;
+    Vector<ThreadCache*> m_ThreadCaches;
+    // Entries in all caches. Changed under m_Mutex together with the block metadata when caches
+    // are refilled or flushed, so statistics taken under it are exact. Handing an entry out or
+    // taking one back changes only these.
+    D3D12MA_ATOMIC_UINT32 m_ThreadCachedCount = 0;
+    D3D12MA_ATOMIC_UINT64 m_ThreadCachedBytes = 0;
+
     // Disable incremental sorting when freeing allocations
     void SetIncrementalSort(bool val) { m_IncrementalSort = val; }
 
+    static UINT GetThreadCacheClass(UINT64 size)
+    {
+        return size <= D3D12MA_THREAD_CACHE_MIN_SIZE ? 0 : BitScanMSB(size - 1) + 1 - THREAD_CACHE_MIN_SHIFT;
+    }
+    static UINT64 GetThreadCacheClassSize(UINT sizeClass) { return D3D12MA_THREAD_CACHE_MIN_SIZE << sizeClass; }
+    static UINT GetThreadCacheCapacity(UINT sizeClass)
+    {
+        // Half of the cache for one class, so a thread can keep a few classes.
+        const UINT64 capacity = (D3D12MA_THREAD_CACHE_BYTES / 2) >> (THREAD_CACHE_MIN_SHIFT + sizeClass);
+        return (UINT)D3D12MA_MAX(D3D12MA_MIN(capacity, (UINT64)THREAD_CACHE_MAX_ENTRIES), (UINT64)2);
+    }
+    ThreadCache* GetThreadCache();
+    // Returns false if the request can't be served from the cache, Allocate goes the usual way then.
+    bool AllocateFromThreadCache(
+        UINT64 size,
+        UINT64 alignment,
+        const ALLOCATION_DESC& allocDesc,
+        Allocation** pAllocation);
+    // Called with cache.mutex locked, takes m_Mutex.
+    HRESULT RefillThreadCache(ThreadCache& cache, UINT sizeClassIndex);
+    // Frees cached entries already taken out of their cache.
+    void ReleaseThreadCacheEntries(Allocation* const* pAllocations, size_t allocationCount);
+    HRESULT AllocatePages(
+        UINT64 size,
+        UINT64 alignment,
+        const ALLOCATION_DESC& allocDesc,
+        size_t allocationCount,
+        Allocation** pAllocations);
+    HRESULT AllocateBatchPages(
+        const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfos,
+        const UINT* pIndices,
+        size_t allocationCount,
+        const ALLOCATION_DESC& allocDesc,
+        Allocation** pAllocations);
+    // Body of FreeBatch, to be called with m_Mutex locked. Empty blocks to destroy
+    // after unlocking are appended to blocksToDelete.
+    void FreeBatchLocked(
+        Allocation* const* pAllocations,
+        size_t allocationCount,
+        bool threadCached,
+        bool budgetExceeded,
+        Vector<NormalBlock*>& blocksToDelete);
+    bool IsBudgetExceeded() const;
+
     UINT64 CalcSumBlockSize() const;
     UINT64 CalcMaxBlockSize() const;
 
@@ -6068,7 +6794,8 @@ private:
         UINT64 size,
         UINT64 alignment,
         const ALLOCATION_DESC& allocDesc,
-        Allocation** pAllocation);
+        Allocation** pAllocation,
+        bool addToBudget = true);
 
     HRESULT AllocateFromBlock(
         NormalBlock* pBlock,
@@ -6077,7 +6804,8 @@ private:
         ALLOCATION_FLAGS allocFlags,
         void* pPrivateData,
         UINT32 strategy,
-        Allocation** pAllocation);
+        Allocation** pAllocation,
+        bool addToBudget = true);
 
     HRESULT CommitAllocationRequest(
         AllocationRequest& allocRequest,
@@ -6085,7 +6813,8 @@ private:
         UINT64 size,
         UINT64 alignment,
         void* pPrivateData,
-        Allocation** pAllocation);
+        Allocation** pAllocation,
+        bool addToBudget = true);
 
     HRESULT CreateBlock(
         UINT64 blockSize,
@@ -6108,8 +6837,8 @@ public:
     HRESULT UpdateBudget(IDXGIAdapter3* adapter3, bool useMutex);
 #endif
 
-    void AddAllocation(UINT group, UINT64 allocationBytes);
-    void RemoveAllocation(UINT group, UINT64 allocationBytes);
+    void AddAllocation(UINT group, UINT64 allocationBytes, UINT allocationCount = 1);
+    void RemoveAllocation(UINT group, UINT64 allocationBytes, UINT allocationCount = 1);
 
     void AddBlock(UINT group, UINT64 blockBytes);
     void RemoveBlock(UINT group, UINT64 blockBytes);
@@ -6199,19 +6928,19 @@ HRESULT CurrentBudgetData::UpdateBudget(IDXGIAdapter3* adapter3, bool useMutex)
 }
 #endif // #if D3D12MA_DXGI_1_4
 
-void CurrentBudgetData::AddAllocation(UINT group, UINT64 allocationBytes)
+void CurrentBudgetData::AddAllocation(UINT group, UINT64 allocationBytes, UINT allocationCount)
 {
-    ++m_AllocationCount[group];
+    m_AllocationCount[group] += allocationCount;
     m_AllocationBytes[group] += allocationBytes;
     ++m_OperationsSinceBudgetFetch;
 }
 
-void CurrentBudgetData::RemoveAllocation(UINT group, UINT64 allocationBytes)
+void CurrentBudgetData::RemoveAllocation(UINT group, UINT64 allocationBytes, UINT allocationCount)
 {
     D3D12MA_ASSERT(m_AllocationBytes[group] >= allocationBytes);
-    D3D12MA_ASSERT(m_AllocationCount[group] > 0);
+    D3D12MA_ASSERT(m_AllocationCount[group] >= allocationCount);
     m_AllocationBytes[group] -= allocationBytes;
-    --m_AllocationCount[group];
+    m_AllocationCount[group] -= allocationCount;
     ++m_OperationsSinceBudgetFetch;
 }
 
@@ -6246,6 +6975,7 @@ public:
 
     void GetStats(DEFRAGMENTATION_STATS& outStats) { outStats = m_GlobalStats; }
     const ALLOCATION_CALLBACKS& GetAllocs() const { return m_Moves.GetAllocs(); }
+    void SetPassLimits(UINT64 maxBytesPerPass, UINT32 maxAllocationsPerPass);
 
     HRESULT DefragmentPassBegin(DEFRAGMENTATION_PASS_MOVE_INFO& moveInfo);
     HRESULT DefragmentPassEnd(DEFRAGMENTATION_PASS_MOVE_INFO& moveInfo);
@@ -6273,8 +7003,8 @@ private:
         DEFRAGMENTATION_MOVE move = {};
     };
 
-    const UINT64 m_MaxPassBytes;
-    const UINT32 m_MaxPassAllocations;
+    UINT64 m_MaxPassBytes;
+    UINT32 m_MaxPassAllocations;
 
     Vector<DEFRAGMENTATION_MOVE> m_Moves;
 
@@ -6435,16 +7165,27 @@ public:
         const ALLOCATION_DESC* pAllocDesc,
         const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfo,
         Allocation** ppAllocation);
+    // Placed allocations go to their block vector in one batch, largest first, the rest
+    // through AllocateMemory. All or nothing.
+    HRESULT AllocateMemoryBatch(
+        const ALLOCATION_DESC* pAllocDesc,
+        UINT allocationCount,
+        const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfos,
+        Allocation** ppAllocations);
 
     // Unregisters allocation from the collection of dedicated allocations.
     // Allocation object must be deleted externally afterwards.
     void FreeCommittedMemory(Allocation* allocation);
     // Unregisters allocation from the collection of placed allocations.
     // Allocation object must be deleted externally afterwards.
-    void FreePlacedMemory(Allocation* allocation);
+    // Returns true if the allocation was kept by a thread cache, its object must not be freed then.
+    bool FreePlacedMemory(Allocation* allocation);
     // Unregisters allocation from the collection of dedicated allocations and destroys associated heap.
     // Allocation object must be deleted externally afterwards.
     void FreeHeapMemory(Allocation* allocation);
+    // Drops one reference of each allocation and frees the ones that reach zero,
+    // placed allocations grouped by block vector.
+    void FreeBatch(UINT allocationCount, Allocation* const* pAllocations);
 
     void SetCurrentFrameIndex(UINT frameIndex);
     // For more deailed stats use outCutomHeaps to access statistics divided into L0 and L1 group
@@ -6649,7 +7390,8 @@ HRESULT AllocatorPimpl::Init(const ALLOCATOR_DESC& desc)
             D3D12MA_DEBUG_ALIGNMENT, // minAllocationAlignment
             0, // Default algorithm,
             m_MsaaAlwaysCommitted,
-            NULL); // pProtectedSession
+            NULL, // pProtectedSession
+            (desc.Flags & ALLOCATOR_FLAG_DEFAULT_POOLS_THREAD_CACHE) != 0);
         // No need to call m_pBlockVectors[i]->CreateMinBlocks here, becase minBlockCount is 0.
     }
 
@@ -6910,6 +7652,70 @@ HRESULT AllocatorPimpl::AllocateMemory(
     return hr;
 }
 
+HRESULT AllocatorPimpl::AllocateMemoryBatch(
+    const ALLOCATION_DESC* pAllocDesc,
+    UINT allocationCount,
+    const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfos,
+    Allocation** ppAllocations)
+{
+    ZeroMemory(ppAllocations, sizeof(Allocation*) * allocationCount);
+
+    // Same decision as AllocateMemory for every element: the ones that would be placed first
+    // go to the batch, the rest (committed preferred or required) one by one.
+    BlockVector* batchVector = NULL;
+    Vector<UINT> placedIndices(GetAllocs());
+    Vector<UINT> otherIndices(GetAllocs());
+    for (UINT i = 0; i < allocationCount; ++i)
+    {
+        BlockVector* blockVector = NULL;
+        CommittedAllocationParameters committedAllocationParams = {};
+        bool preferCommitted = false;
+        const HRESULT hr = CalcAllocationParams<D3D12_RESOURCE_DESC>(*pAllocDesc, pAllocInfos[i].SizeInBytes,
+            NULL, // pResDesc
+            blockVector, committedAllocationParams, preferCommitted);
+        if (FAILED(hr))
+            return hr;
+
+        if (blockVector != NULL && !(committedAllocationParams.IsValid() && preferCommitted))
+        {
+            D3D12MA_ASSERT(batchVector == NULL || batchVector == blockVector);
+            batchVector = blockVector;
+            placedIndices.push_back(i);
+        }
+        else
+            otherIndices.push_back(i);
+    }
+
+    if (!placedIndices.empty())
+    {
+        // Largest first packs better, small ones fill the gaps left by the big ones.
+        D3D12MA_SORT(placedIndices.begin(), placedIndices.end(),
+            [pAllocInfos](UINT i1, UINT i2)
+            {
+                return pAllocInfos[i1].SizeInBytes > pAllocInfos[i2].SizeInBytes;
+            });
+        if (FAILED(batchVector->AllocateBatch(pAllocInfos, placedIndices.data(), placedIndices.size(),
+            *pAllocDesc, ppAllocations)))
+        {
+            // Out of room in the block vector, AllocateMemory may still fall back to committed.
+            for (UINT index : placedIndices)
+                otherIndices.push_back(index);
+        }
+    }
+
+    for (UINT index : otherIndices)
+    {
+        const HRESULT hr = AllocateMemory(pAllocDesc, pAllocInfos + index, ppAllocations + index);
+        if (FAILED(hr))
+        {
+            FreeBatch(allocationCount, ppAllocations);
+            ZeroMemory(ppAllocations, sizeof(Allocation*) * allocationCount);
+            return hr;
+        }
+    }
+    return S_OK;
+}
+
 HRESULT AllocatorPimpl::CreateAliasingResource(
     Allocation* pAllocation,
     UINT64 AllocationLocalOffset,
@@ -6961,7 +7767,7 @@ void AllocatorPimpl::FreeCommittedMemory(Allocation* allocation)
     m_Budget.RemoveBlock(memSegmentGroup, allocSize);
 }
 
-void AllocatorPimpl::FreePlacedMemory(Allocation* allocation)
+bool AllocatorPimpl::FreePlacedMemory(Allocation* allocation)
 {
     D3D12MA_ASSERT(allocation && allocation->m_PackedData.GetType() == Allocation::TYPE_PLACED);
 
@@ -6970,7 +7776,10 @@ void AllocatorPimpl::FreePlacedMemory(Allocation* allocation)
     BlockVector* const blockVector = block->GetBlockVector();
     D3D12MA_ASSERT(blockVector);
     m_Budget.RemoveAllocation(HeapPropertiesToMemorySegmentGroup(block->GetHeapProperties()), allocation->GetSize());
+    if (blockVector->FreeToThreadCache(allocation))
+        return true;
     blockVector->Free(allocation);
+    return false;
 }
 
 void AllocatorPimpl::FreeHeapMemory(Allocation* allocation)
@@ -6987,6 +7796,62 @@ void AllocatorPimpl::FreeHeapMemory(Allocation* allocation)
     m_Budget.RemoveBlock(memSegmentGroup, allocSize);
 }
 
+void AllocatorPimpl::FreeBatch(UINT allocationCount, Allocation* const* pAllocations)
+{
+    Vector<Allocation*> placed(GetAllocs());
+    UINT freedCount[DXGI_MEMORY_SEGMENT_GROUP_COUNT] = {};
+    UINT64 freedBytes[DXGI_MEMORY_SEGMENT_GROUP_COUNT] = {};
+    for (UINT i = 0; i < allocationCount; ++i)
+    {
+        Allocation* const alloc = pAllocations[i];
+        if (alloc == NULL || alloc->ReleaseReference() != 0)
+            continue;
+
+        if (alloc->m_PackedData.GetType() != Allocation::TYPE_PLACED)
+        {
+            // Committed and heap allocations own their memory, nothing to batch.
+            alloc->ReleaseThis();
+            continue;
+        }
+        SAFE_RELEASE(alloc->m_Resource);
+        NormalBlock* const block = alloc->m_Placed.block;
+        D3D12MA_ASSERT(block && block->GetBlockVector());
+        const UINT memSegmentGroup = HeapPropertiesToMemorySegmentGroup(block->GetHeapProperties());
+        ++freedCount[memSegmentGroup];
+        freedBytes[memSegmentGroup] += alloc->GetSize();
+        placed.push_back(alloc);
+    }
+    if (placed.empty())
+        return;
+
+    for (UINT group = 0; group < DXGI_MEMORY_SEGMENT_GROUP_COUNT; ++group)
+    {
+        if (freedCount[group] > 0)
+            m_Budget.RemoveAllocation(group, freedBytes[group], freedCount[group]);
+    }
+
+    D3D12MA_SORT(placed.begin(), placed.end(),
+        [](const Allocation* a1, const Allocation* a2)
+        {
+            return a1->m_Placed.block->GetBlockVector() < a2->m_Placed.block->GetBlockVector();
+        });
+    for (size_t first = 0; first < placed.size();)
+    {
+        BlockVector* const blockVector = placed[first]->m_Placed.block->GetBlockVector();
+        size_t last = first + 1;
+        while (last < placed.size() && placed[last]->m_Placed.block->GetBlockVector() == blockVector)
+            ++last;
+        blockVector->FreeBatch(placed.data() + first, last - first);
+        first = last;
+    }
+
+    for (Allocation* alloc : placed)
+    {
+        alloc->FreeName();
+        GetAllocationObjectAllocator().Free(alloc);
+    }
+}
+
 void AllocatorPimpl::SetCurrentFrameIndex(UINT frameIndex)
 {
     m_CurrentFrameIndex.store(frameIndex);
@@ -8006,56 +8871,328 @@ bool AllocatorPimpl::NewAllocationWithinBudget(D3D12_HEAP_TYPE heapType, UINT64
     return budget.UsageBytes + size <= budget.BudgetBytes;
 }
 
-void AllocatorPimpl::WriteBudgetToJson(JsonWriter& json, const Budget& budget)
+void AllocatorPimpl::WriteBudgetToJson(JsonWriter& json, const Budget& budget)
+{
+    json.BeginObject();
+    {
+        json.WriteString(L"BudgetBytes");
+        json.WriteNumber(budget.BudgetBytes);
+        json.WriteString(L"UsageBytes");
+        json.WriteNumber(budget.UsageBytes);
+    }
+    json.EndObject();
+}
+#endif // _D3D12MA_ALLOCATOR_PIMPL
+#endif // _D3D12MA_ALLOCATOR_PIMPL
+
+#ifndef _D3D12MA_VIRTUAL_BLOCK_PIMPL
+class VirtualBlockPimpl
+{
+public:
+    const ALLOCATION_CALLBACKS m_AllocationCallbacks;
+    const UINT64 m_Size;
+    const UINT32 m_Algorithm;
+    BlockMetadata* m_Metadata;
+
+    VirtualBlockPimpl(const ALLOCATION_CALLBACKS& allocationCallbacks, const VIRTUAL_BLOCK_DESC& desc);
+    ~VirtualBlockPimpl();
+};
+
+#ifndef _D3D12MA_VIRTUAL_BLOCK_PIMPL_FUNCTIONS
+VirtualBlockPimpl::VirtualBlockPimpl(const ALLOCATION_CALLBACKS& allocationCallbacks, const VIRTUAL_BLOCK_DESC& desc)
+    : m_AllocationCallbacks(allocationCallbacks), m_Size(desc.Size),
+    m_Algorithm(desc.Flags & VIRTUAL_BLOCK_FLAG_ALGORITHM_MASK)
+{
+    switch (m_Algorithm)
+    {
+    case VIRTUAL_BLOCK_FLAG_ALGORITHM_LINEAR:
+        m_Metadata = D3D12MA_NEW(allocationCallbacks, BlockMetadata_Linear)(&m_AllocationCallbacks, true);
+        break;
+    case VIRTUAL_BLOCK_FLAG_ALGORITHM_BUDDY:
+        m_Metadata = D3D12MA_NEW(allocationCallbacks, BlockMetadata_Buddy)(&m_AllocationCallbacks, true);
+        break;
+    default:
+        D3D12MA_ASSERT(0);
+    case 0:
+        m_Metadata = D3D12MA_NEW(allocationCallbacks, BlockMetadata_TLSF)(&m_AllocationCallbacks, true);
+        break;
+    }
+    m_Metadata->Init(m_Size);
+}
+
+VirtualBlockPimpl::~VirtualBlockPimpl()
+{
+    D3D12MA_DELETE(m_AllocationCallbacks, m_Metadata);
+}
+#endif // _D3D12MA_VIRTUAL_BLOCK_PIMPL_FUNCTIONS
+#endif // _D3D12MA_VIRTUAL_BLOCK_PIMPL
+
+#ifndef _D3D12MA_VIRTUAL_DEFRAGMENTATION_CONTEXT_PIMPL
+/*
+Defragmentation of a single virtual block. Every move goes to a lower offset in the same
+metadata, reserved by a temporary allocation while the source stays allocated, so the two
+ranges never overlap. The algorithms are the in-block parts of the pool ones.
+*/
+class VirtualDefragmentationContextPimpl
+{
+    D3D12MA_CLASS_NO_COPY(VirtualDefragmentationContextPimpl)
+public:
+    VirtualDefragmentationContextPimpl(
+        const ALLOCATION_CALLBACKS& allocs,
+        const VIRTUAL_DEFRAGMENTATION_DESC& desc,
+        BlockMetadata* metadata);
+
+    void GetStats(DEFRAGMENTATION_STATS& outStats) { outStats = m_GlobalStats; }
+    const ALLOCATION_CALLBACKS& GetAllocs() const { return m_Moves.GetAllocs(); }
+    void SetPassLimits(UINT64 maxBytesPerPass, UINT32 maxAllocationsPerPass);
+
+    HRESULT DefragmentPassBegin(VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO& moveInfo);
+    HRESULT DefragmentPassEnd(VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO& moveInfo);
+
+private:
+    // Max number of allocations to ignore due to size constraints before ending single pass
+    static const UINT8 MAX_ALLOCS_TO_IGNORE = 16;
+    enum class CounterStatus { Pass, Ignore, End };
+
+    struct AllocHandleLess
+    {
+        bool operator()(AllocHandle lhs, AllocHandle rhs) const { return lhs < rhs; }
+    };
+
+    UINT64 m_MaxPassBytes;
+    UINT32 m_MaxPassAllocations;
+    const UINT32 m_Algorithm;
+    const UINT64 m_Alignment;
+    BlockMetadata* const m_Metadata;
+
+    Vector<VIRTUAL_DEFRAGMENTATION_MOVE> m_Moves;
+    // Allocations whose move was ignored, never proposed again. Sorted.
+    Vector<AllocHandle> m_Immovable;
+
+    UINT8 m_IgnoredAllocs = 0;
+    DEFRAGMENTATION_STATS m_GlobalStats = { 0 };
+    DEFRAGMENTATION_STATS m_PassStats = { 0 };
+
+    CounterStatus CheckCounters(UINT64 bytes);
+    bool IncrementCounters(UINT64 bytes);
+    // Moves the allocation to the lowest offset below its current one. Returns true when the pass is full.
+    bool MoveLower(AllocHandle handle, const VIRTUAL_ALLOCATION_INFO& info);
+    bool ComputeDefragmentation();
+};
+
+#ifndef _D3D12MA_VIRTUAL_DEFRAGMENTATION_CONTEXT_PIMPL_FUNCTIONS
+VirtualDefragmentationContextPimpl::VirtualDefragmentationContextPimpl(
+    const ALLOCATION_CALLBACKS& allocs,
+    const VIRTUAL_DEFRAGMENTATION_DESC& desc,
+    BlockMetadata* metadata)
+    : m_MaxPassBytes(desc.MaxBytesPerPass == 0 ? UINT64_MAX : desc.MaxBytesPerPass),
+    m_MaxPassAllocations(desc.MaxAllocationsPerPass == 0 ? UINT32_MAX : desc.MaxAllocationsPerPass),
+    m_Algorithm(desc.Flags & DEFRAGMENTATION_FLAG_ALGORITHM_MASK),
+    m_Alignment(desc.Alignment),
+    m_Metadata(metadata),
+    m_Moves(allocs),
+    m_Immovable(allocs)
+{
+    D3D12MA_ASSERT(IsPow2(desc.Alignment));
+}
+
+void VirtualDefragmentationContextPimpl::SetPassLimits(UINT64 maxBytesPerPass, UINT32 maxAllocationsPerPass)
+{
+    D3D12MA_ASSERT(m_Moves.empty() && "Pass limits can only be changed between passes!");
+    m_MaxPassBytes = maxBytesPerPass == 0 ? UINT64_MAX : maxBytesPerPass;
+    m_MaxPassAllocations = maxAllocationsPerPass == 0 ? UINT32_MAX : maxAllocationsPerPass;
+}
+
+HRESULT VirtualDefragmentationContextPimpl::DefragmentPassBegin(VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO& moveInfo)
+{
+    D3D12MA_ASSERT(m_Moves.empty() && "Previous pass was not ended!");
+    m_IgnoredAllocs = 0;
+    ComputeDefragmentation();
+    D3D12MA_HEAVY_ASSERT(m_Metadata->Validate());
+
+    moveInfo.MoveCount = static_cast<UINT32>(m_Moves.size());
+    if (moveInfo.MoveCount > 0)
+    {
+        moveInfo.pMoves = m_Moves.data();
+        return S_FALSE;
+    }
+
+    moveInfo.pMoves = NULL;
+    return S_OK;
+}
+
+HRESULT VirtualDefragmentationContextPimpl::DefragmentPassEnd(VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO& moveInfo)
+{
+    D3D12MA_ASSERT(moveInfo.MoveCount > 0 ? moveInfo.pMoves != NULL : true);
+
+    HRESULT result = S_OK;
+    for (UINT32 i = 0; i < moveInfo.MoveCount; ++i)
+    {
+        VIRTUAL_DEFRAGMENTATION_MOVE& move = moveInfo.pMoves[i];
+        switch (move.Operation)
+        {
+        case DEFRAGMENTATION_MOVE_OPERATION_COPY:
+            m_Metadata->SetAllocationPrivateData(move.DstAllocation.AllocHandle, move.pPrivateData);
+            m_Metadata->Free(move.SrcAllocation.AllocHandle);
+            result = S_FALSE;
+            break;
+        case DEFRAGMENTATION_MOVE_OPERATION_IGNORE:
+            m_PassStats.BytesMoved -= move.Size;
+            --m_PassStats.AllocationsMoved;
+            m_Metadata->Free(move.DstAllocation.AllocHandle);
+            m_Immovable.InsertSorted(move.SrcAllocation.AllocHandle, AllocHandleLess());
+            break;
+        case DEFRAGMENTATION_MOVE_OPERATION_DESTROY:
+            m_PassStats.BytesMoved -= move.Size;
+            --m_PassStats.AllocationsMoved;
+            m_Metadata->Free(move.DstAllocation.AllocHandle);
+            m_Metadata->Free(move.SrcAllocation.AllocHandle);
+            result = S_FALSE;
+            break;
+        default:
+            D3D12MA_ASSERT(0);
+        }
+    }
+    D3D12MA_HEAVY_ASSERT(m_Metadata->Validate());
+    moveInfo.MoveCount = 0;
+    moveInfo.pMoves = NULL;
+    m_Moves.clear();
+
+    m_GlobalStats.AllocationsMoved += m_PassStats.AllocationsMoved;
+    m_GlobalStats.BytesMoved += m_PassStats.BytesMoved;
+    m_PassStats = { 0 };
+    return result;
+}
+
+VirtualDefragmentationContextPimpl::CounterStatus VirtualDefragmentationContextPimpl::CheckCounters(UINT64 bytes)
 {
-    json.BeginObject();
+    // Ignore allocation if will exceed max size for copy
+    if (m_PassStats.BytesMoved + bytes > m_MaxPassBytes)
     {
-        json.WriteString(L"BudgetBytes");
-        json.WriteNumber(budget.BudgetBytes);
-        json.WriteString(L"UsageBytes");
-        json.WriteNumber(budget.UsageBytes);
+        if (++m_IgnoredAllocs < MAX_ALLOCS_TO_IGNORE)
+            return CounterStatus::Ignore;
+        else
+            return CounterStatus::End;
     }
-    json.EndObject();
+    return CounterStatus::Pass;
 }
-#endif // _D3D12MA_ALLOCATOR_PIMPL
-#endif // _D3D12MA_ALLOCATOR_PIMPL
-
-#ifndef _D3D12MA_VIRTUAL_BLOCK_PIMPL
-class VirtualBlockPimpl
-{
-public:
-    const ALLOCATION_CALLBACKS m_AllocationCallbacks;
-    const UINT64 m_Size;
-    BlockMetadata* m_Metadata;
-
-    VirtualBlockPimpl(const ALLOCATION_CALLBACKS& allocationCallbacks, const VIRTUAL_BLOCK_DESC& desc);
-    ~VirtualBlockPimpl();
-};
 
-#ifndef _D3D12MA_VIRTUAL_BLOCK_PIMPL_FUNCTIONS
-VirtualBlockPimpl::VirtualBlockPimpl(const ALLOCATION_CALLBACKS& allocationCallbacks, const VIRTUAL_BLOCK_DESC& desc)
-    : m_AllocationCallbacks(allocationCallbacks), m_Size(desc.Size)
+bool VirtualDefragmentationContextPimpl::IncrementCounters(UINT64 bytes)
 {
-    switch (desc.Flags & VIRTUAL_BLOCK_FLAG_ALGORITHM_MASK)
+    m_PassStats.BytesMoved += bytes;
+    // Early return when max found
+    if (++m_PassStats.AllocationsMoved >= m_MaxPassAllocations || m_PassStats.BytesMoved >= m_MaxPassBytes)
     {
-    case VIRTUAL_BLOCK_FLAG_ALGORITHM_LINEAR:
-        m_Metadata = D3D12MA_NEW(allocationCallbacks, BlockMetadata_Linear)(&m_AllocationCallbacks, true);
-        break;
-    default:
-        D3D12MA_ASSERT(0);
-    case 0:
-        m_Metadata = D3D12MA_NEW(allocationCallbacks, BlockMetadata_TLSF)(&m_AllocationCallbacks, true);
-        break;
+        D3D12MA_ASSERT((m_PassStats.AllocationsMoved == m_MaxPassAllocations ||
+            m_PassStats.BytesMoved == m_MaxPassBytes) && "Exceeded maximal pass threshold!");
+        return true;
     }
-    m_Metadata->Init(m_Size);
+    return false;
 }
 
-VirtualBlockPimpl::~VirtualBlockPimpl()
+bool VirtualDefragmentationContextPimpl::MoveLower(AllocHandle handle, const VIRTUAL_ALLOCATION_INFO& info)
 {
-    D3D12MA_DELETE(m_AllocationCallbacks, m_Metadata);
+    if (info.Offset == 0 || m_Metadata->GetSumFreeSize() < info.Size)
+        return false;
+
+    // Without a given alignment keep the one the current offset has.
+    const UINT64 alignment = m_Alignment != 0 ? m_Alignment : (info.Offset & (~info.Offset + 1));
+    AllocationRequest request = {};
+    if (!m_Metadata->CreateAllocationRequest(
+        info.Size,
+        alignment,
+        false,
+        ALLOCATION_FLAG_STRATEGY_MIN_OFFSET,
+        &request))
+        return false;
+    if (m_Metadata->GetAllocationOffset(request.allocHandle) >= info.Offset)
+        return false;
+
+    // Marked as the context's own until committed, so it isn't moved again in this pass.
+    m_Metadata->Alloc(request, info.Size, this);
+    VIRTUAL_DEFRAGMENTATION_MOVE move = {};
+    move.Operation = DEFRAGMENTATION_MOVE_OPERATION_COPY;
+    move.SrcAllocation.AllocHandle = handle;
+    move.DstAllocation.AllocHandle = request.allocHandle;
+    move.SrcOffset = info.Offset;
+    move.DstOffset = m_Metadata->GetAllocationOffset(request.allocHandle);
+    move.Size = info.Size;
+    move.pPrivateData = info.pPrivateData;
+    D3D12MA_ASSERT(move.DstOffset + move.Size <= move.SrcOffset);
+    m_Moves.push_back(move);
+    return IncrementCounters(info.Size);
+}
+
+bool VirtualDefragmentationContextPimpl::ComputeDefragmentation()
+{
+    // FAST: only what lies past the end of a perfectly packed block, the last blocks of a pool.
+    const UINT64 packedEnd = m_Metadata->GetSize() - m_Metadata->GetSumFreeSize();
+    // BALANCED: realloc only when there are noticable gaps next to the allocation (some heuristic,
+    // ex. average size of allocation in block), as within a pool's block.
+    UINT64 avgFreeSize = 0, avgAllocSize = 0;
+    if (m_Algorithm == DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED || m_Algorithm == 0)
+    {
+        const size_t freeCount = m_Metadata->GetFreeRegionsCount();
+        const size_t allocCount = m_Metadata->GetAllocationCount();
+        avgFreeSize = freeCount > 0 ? m_Metadata->GetSumFreeSize() / freeCount : 0;
+        avgAllocSize = allocCount > 0 ? packedEnd / allocCount : 0;
+    }
+    const UINT64 minimalFreeRegion = avgFreeSize / 2;
+    UINT64 prevFreeRegionSize = 0;
+
+    for (AllocHandle handle = m_Metadata->GetAllocationListBegin();
+        handle != (AllocHandle)0;
+        handle = m_Metadata->GetNextAllocation(handle))
+    {
+        VIRTUAL_ALLOCATION_INFO info = {};
+        m_Metadata->GetAllocationInfo(handle, info);
+        // Ignore newly created allocations by defragmentation algorithm
+        if (info.pPrivateData == this)
+            continue;
+        if (BinaryFindSorted(m_Immovable.cbegin(), m_Immovable.cend(), handle, AllocHandleLess()) != m_Immovable.cend())
+            continue;
+        switch (CheckCounters(info.Size))
+        {
+        case CounterStatus::Ignore:
+            continue;
+        case CounterStatus::End:
+            return true;
+        default:
+            D3D12MA_ASSERT(0);
+        case CounterStatus::Pass:
+            break;
+        }
+
+        bool move;
+        switch (m_Algorithm)
+        {
+        case DEFRAGMENTATION_FLAG_ALGORITHM_FAST:
+            move = info.Offset + info.Size > packedEnd;
+            break;
+        default:
+            D3D12MA_ASSERT(0);
+        case 0:
+        case DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED:
+        {
+            const UINT64 nextFreeRegionSize = m_Metadata->GetNextFreeRegionSize(handle);
+            move = prevFreeRegionSize >= minimalFreeRegion ||
+                nextFreeRegionSize >= minimalFreeRegion ||
+                info.Size <= avgFreeSize ||
+                info.Size <= avgAllocSize;
+            prevFreeRegionSize = nextFreeRegionSize;
+            break;
+        }
+        case DEFRAGMENTATION_FLAG_ALGORITHM_FULL:
+            move = true;
+            break;
+        }
+        if (move && MoveLower(handle, info))
+            return true;
+    }
+    return false;
 }
-#endif // _D3D12MA_VIRTUAL_BLOCK_PIMPL_FUNCTIONS
-#endif // _D3D12MA_VIRTUAL_BLOCK_PIMPL
+#endif // _D3D12MA_VIRTUAL_DEFRAGMENTATION_CONTEXT_PIMPL_FUNCTIONS
+#endif // _D3D12MA_VIRTUAL_DEFRAGMENTATION_CONTEXT_PIMPL
 
 
 #ifndef _D3D12MA_MEMORY_BLOCK_FUNCTIONS
@@ -8151,6 +9288,9 @@ HRESULT NormalBlock::Init(UINT32 algorithm, ID3D12ProtectedResourceSession* pPro
     case POOL_FLAG_ALGORITHM_LINEAR:
         m_pMetadata = D3D12MA_NEW(m_Allocator->GetAllocs(), BlockMetadata_Linear)(&m_Allocator->GetAllocs(), false);
         break;
+    case POOL_FLAG_ALGORITHM_BUDDY:
+        m_pMetadata = D3D12MA_NEW(m_Allocator->GetAllocs(), BlockMetadata_Buddy)(&m_Allocator->GetAllocs(), false);
+        break;
     default:
         D3D12MA_ASSERT(0);
     case 0:
@@ -8252,6 +9392,20 @@ void CommittedAllocationList::Unregister(Allocation* alloc)
 #endif // _D3D12MA_COMMITTED_ALLOCATION_LIST_FUNCTIONS
 
 #ifndef _D3D12MA_BLOCK_VECTOR_FUNCTIONS
+// Gives every BlockVector an id that is never reused, so stale entries in t_ThreadCacheLookup of
+// destroyed block vectors can't match.
+static D3D12MA_ATOMIC_UINT64 g_ThreadCacheBlockVectorId = 0;
+
+// Last thread caches used by this thread, saves locking m_ThreadCacheMutex to find them.
+struct ThreadCacheLookupEntry
+{
+    UINT64 blockVectorId;
+    void* cache;
+};
+static constexpr UINT THREAD_CACHE_LOOKUP_SIZE = 8;
+static thread_local ThreadCacheLookupEntry t_ThreadCacheLookup[THREAD_CACHE_LOOKUP_SIZE] = {};
+static thread_local UINT t_ThreadCacheLookupNext = 0;
+
 BlockVector::BlockVector(
     AllocatorPimpl* hAllocator,
     const D3D12_HEAP_PROPERTIES& heapProps,
@@ -8263,7 +9417,8 @@ BlockVector::BlockVector(
     UINT64 minAllocationAlignment,
     UINT32 algorithm,
     bool denyMsaaTextures,
-    ID3D12ProtectedResourceSession* pProtectedSession)
+    ID3D12ProtectedResourceSession* pProtectedSession,
+    bool threadCache)
     : m_hAllocator(hAllocator),
     m_HeapProps(heapProps),
     m_HeapFlags(heapFlags),
@@ -8277,10 +9432,19 @@ BlockVector::BlockVector(
     m_ProtectedSession(pProtectedSession),
     m_HasEmptyBlock(false),
     m_Blocks(hAllocator->GetAllocs()),
-    m_NextBlockId(0) {}
+    m_NextBlockId(0),
+    // Caches only pay off when there is a mutex to avoid. The linear algorithm can't free out of order.
+    m_ThreadCacheEnabled(threadCache && algorithm == 0 && hAllocator->UseMutex() && D3D12MA_DEBUG_MARGIN == 0),
+    m_ThreadCacheId(++g_ThreadCacheBlockVectorId),
+    m_ThreadCaches(hAllocator->GetAllocs()) {}
 
 BlockVector::~BlockVector()
 {
+    FlushThreadCaches();
+    for (size_t i = m_ThreadCaches.size(); i--; )
+    {
+        D3D12MA_DELETE(m_hAllocator->GetAllocs(), m_ThreadCaches[i]);
+    }
     for (size_t i = m_Blocks.size(); i--; )
     {
         D3D12MA_DELETE(m_hAllocator->GetAllocs(), m_Blocks[i]);
@@ -8312,6 +9476,45 @@ HRESULT BlockVector::Allocate(
     const ALLOCATION_DESC& allocDesc,
     size_t allocationCount,
     Allocation** pAllocations)
+{
+    if (m_ThreadCacheEnabled && allocationCount == 1 &&
+        AllocateFromThreadCache(size, alignment, allocDesc, pAllocations))
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = AllocatePages(size, alignment, allocDesc, allocationCount, pAllocations);
+    if (hr == E_OUTOFMEMORY && m_ThreadCachedCount.load() > 0)
+    {
+        // The memory may be sitting in thread caches, give it back and try once more.
+        FlushThreadCaches();
+        hr = AllocatePages(size, alignment, allocDesc, allocationCount, pAllocations);
+    }
+    return hr;
+}
+
+HRESULT BlockVector::AllocateBatch(
+    const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfos,
+    const UINT* pIndices,
+    size_t allocationCount,
+    const ALLOCATION_DESC& allocDesc,
+    Allocation** pAllocations)
+{
+    HRESULT hr = AllocateBatchPages(pAllocInfos, pIndices, allocationCount, allocDesc, pAllocations);
+    if (hr == E_OUTOFMEMORY && m_ThreadCachedCount.load() > 0)
+    {
+        FlushThreadCaches();
+        hr = AllocateBatchPages(pAllocInfos, pIndices, allocationCount, allocDesc, pAllocations);
+    }
+    return hr;
+}
+
+HRESULT BlockVector::AllocatePages(
+    UINT64 size,
+    UINT64 alignment,
+    const ALLOCATION_DESC& allocDesc,
+    size_t allocationCount,
+    Allocation** pAllocations)
 {
     size_t allocIndex;
     HRESULT hr = S_OK;
@@ -8334,76 +9537,314 @@ HRESULT BlockVector::Allocate(
 
     if (FAILED(hr))
     {
-        // Free all already created allocations.
-        while (allocIndex--)
+        // Free all already created allocations.
+        while (allocIndex--)
+        {
+            Free(pAllocations[allocIndex]);
+        }
+        ZeroMemory(pAllocations, sizeof(Allocation*) * allocationCount);
+    }
+
+    return hr;
+}
+
+void BlockVector::Free(Allocation* hAllocation)
+{
+    NormalBlock* pBlockToDelete = NULL;
+
+    bool budgetExceeded = false;
+    if (IsHeapTypeStandard(m_HeapProps.Type))
+    {
+        Budget budget = {};
+        m_hAllocator->GetBudgetForHeapType(budget, m_HeapProps.Type);
+        budgetExceeded = budget.UsageBytes >= budget.BudgetBytes;
+    }
+
+    // Scope for lock.
+    {
+        MutexLockWrite lock(m_Mutex, m_hAllocator->UseMutex());
+
+        NormalBlock* pBlock = hAllocation->m_Placed.block;
+
+        pBlock->m_pMetadata->Free(hAllocation->GetAllocHandle());
+        D3D12MA_HEAVY_ASSERT(pBlock->Validate());
+
+        const size_t blockCount = m_Blocks.size();
+        // pBlock became empty after this deallocation.
+        if (pBlock->m_pMetadata->IsEmpty())
+        {
+            // Already has empty Allocation. We don't want to have two, so delete this one.
+            if ((m_HasEmptyBlock || budgetExceeded) &&
+                blockCount > m_MinBlockCount)
+            {
+                pBlockToDelete = pBlock;
+                Remove(pBlock);
+            }
+            // We now have first empty block.
+            else
+            {
+                m_HasEmptyBlock = true;
+            }
+        }
+        // pBlock didn't become empty, but we have another empty block - find and free that one.
+        // (This is optional, heuristics.)
+        else if (m_HasEmptyBlock && blockCount > m_MinBlockCount)
+        {
+            NormalBlock* pLastBlock = m_Blocks.back();
+            if (pLastBlock->m_pMetadata->IsEmpty())
+            {
+                pBlockToDelete = pLastBlock;
+                m_Blocks.pop_back();
+                m_HasEmptyBlock = false;
+            }
+        }
+
+        IncrementallySortBlocks();
+    }
+
+    // Destruction of a free Allocation. Deferred until this point, outside of mutex
+    // lock, for performance reason.
+    if (pBlockToDelete != NULL)
+    {
+        D3D12MA_DELETE(m_hAllocator->GetAllocs(), pBlockToDelete);
+    }
+}
+
+void BlockVector::FreeBatch(Allocation* const* pAllocations, size_t allocationCount, bool threadCached)
+{
+    const bool budgetExceeded = IsBudgetExceeded();
+
+    Vector<NormalBlock*> blocksToDelete(m_hAllocator->GetAllocs());
+    // Scope for lock.
+    {
+        MutexLockWrite lock(m_Mutex, m_hAllocator->UseMutex());
+        FreeBatchLocked(pAllocations, allocationCount, threadCached, budgetExceeded, blocksToDelete);
+    }
+
+    // Destruction of empty blocks deferred until this point, outside of mutex lock.
+    for (NormalBlock* pBlock : blocksToDelete)
+    {
+        D3D12MA_DELETE(m_hAllocator->GetAllocs(), pBlock);
+    }
+}
+
+bool BlockVector::FreeToThreadCache(Allocation* hAllocation)
+{
+    const UINT64 size = hAllocation->GetSize();
+    // Only allocations that look like the ones the cache hands out: class size, aligned to it.
+    if (!m_ThreadCacheEnabled ||
+        size < D3D12MA_THREAD_CACHE_MIN_SIZE || size > D3D12MA_THREAD_CACHE_MAX_SIZE || !IsPow2(size) ||
+        hAllocation->GetOffset() % size != 0 ||
+        m_ThreadCacheBlocked.load() != 0)
+    {
+        return false;
+    }
+    ThreadCache* const cache = GetThreadCache();
+    const UINT sizeClassIndex = GetThreadCacheClass(size);
+
+    Allocation* overflow[THREAD_CACHE_MAX_ENTRIES];
+    UINT overflowCount = 0;
+    bool keep = false;
+    {
+        MutexLock lock(cache->mutex);
+        // Checked again under the lock, SetThreadCacheBlocked flushes every cache after raising it.
+        if (m_ThreadCacheBlocked.load() != 0)
+            return false;
+
+        ThreadCache::SizeClass& sizeClass = cache->classes[sizeClassIndex];
+        if (sizeClass.count >= GetThreadCacheCapacity(sizeClassIndex) ||
+            cache->bytes + size > D3D12MA_THREAD_CACHE_BYTES)
+        {
+            // Full, the oldest half goes back to the blocks.
+            overflowCount = (sizeClass.count + 1) / 2;
+            memcpy(overflow, sizeClass.entries, overflowCount * sizeof(Allocation*));
+            sizeClass.count -= overflowCount;
+            memmove(sizeClass.entries, sizeClass.entries + overflowCount, sizeClass.count * sizeof(Allocation*));
+            cache->bytes -= overflowCount * size;
+        }
+
+        // Still no room when other classes take up the cache, then it is freed normally.
+        keep = cache->bytes + size <= D3D12MA_THREAD_CACHE_BYTES;
+        if (keep)
+        {
+            // The object stays registered in the block metadata, reset it to a fresh allocation of the class.
+            const AllocHandle allocHandle = hAllocation->m_Placed.allocHandle;
+            NormalBlock* const pBlock = hAllocation->m_Placed.block;
+            hAllocation->FreeName();
+            hAllocation->~Allocation();
+            new(hAllocation) Allocation(m_hAllocator, size, size, FALSE);
+            hAllocation->InitPlaced(allocHandle, pBlock);
+
+            sizeClass.entries[sizeClass.count++] = hAllocation;
+            cache->bytes += size;
+            ++m_ThreadCachedCount;
+            m_ThreadCachedBytes += size;
+        }
+    }
+
+    if (overflowCount > 0)
+    {
+        ReleaseThreadCacheEntries(overflow, overflowCount);
+    }
+    return keep;
+}
+
+void BlockVector::FlushThreadCaches()
+{
+    if (!m_ThreadCacheEnabled || m_ThreadCachedCount.load() == 0)
+        return;
+
+    Vector<Allocation*> entries(m_hAllocator->GetAllocs());
+    {
+        MutexLock lock(m_ThreadCacheMutex);
+        for (size_t cacheIndex = 0; cacheIndex < m_ThreadCaches.size(); ++cacheIndex)
+        {
+            ThreadCache* const cache = m_ThreadCaches[cacheIndex];
+            MutexLock cacheLock(cache->mutex);
+            for (UINT sizeClassIndex = 0; sizeClassIndex < THREAD_CACHE_CLASS_COUNT; ++sizeClassIndex)
+            {
+                ThreadCache::SizeClass& sizeClass = cache->classes[sizeClassIndex];
+                for (UINT i = 0; i < sizeClass.count; ++i)
+                {
+                    entries.push_back(sizeClass.entries[i]);
+                }
+                sizeClass.count = 0;
+            }
+            cache->bytes = 0;
+        }
+    }
+
+    if (!entries.empty())
+    {
+        ReleaseThreadCacheEntries(entries.data(), entries.size());
+    }
+}
+
+void BlockVector::SetThreadCacheBlocked(bool blocked)
+{
+    if (!m_ThreadCacheEnabled)
+        return;
+    if (blocked)
+    {
+        ++m_ThreadCacheBlocked;
+        FlushThreadCaches();
+    }
+    else
+    {
+        D3D12MA_ASSERT(m_ThreadCacheBlocked.load() > 0);
+        --m_ThreadCacheBlocked;
+    }
+}
+
+BlockVector::ThreadCache* BlockVector::GetThreadCache()
+{
+    for (UINT i = 0; i < THREAD_CACHE_LOOKUP_SIZE; ++i)
+    {
+        if (t_ThreadCacheLookup[i].blockVectorId == m_ThreadCacheId)
+            return static_cast<ThreadCache*>(t_ThreadCacheLookup[i].cache);
+    }
+
+    // Not among the recently used ones. A thread keeps its cache for the lifetime of the block
+    // vector, so look it up in the registry before creating one.
+    const std::thread::id thread = std::this_thread::get_id();
+    ThreadCache* cache = NULL;
+    {
+        MutexLock lock(m_ThreadCacheMutex);
+        for (size_t i = 0; i < m_ThreadCaches.size() && cache == NULL; ++i)
         {
-            Free(pAllocations[allocIndex]);
+            if (m_ThreadCaches[i]->thread == thread)
+                cache = m_ThreadCaches[i];
+        }
+        if (cache == NULL)
+        {
+            cache = D3D12MA_NEW(m_hAllocator->GetAllocs(), ThreadCache)();
+            cache->thread = thread;
+            m_ThreadCaches.push_back(cache);
         }
-        ZeroMemory(pAllocations, sizeof(Allocation*) * allocationCount);
     }
 
-    return hr;
+    ThreadCacheLookupEntry& entry = t_ThreadCacheLookup[t_ThreadCacheLookupNext++ % THREAD_CACHE_LOOKUP_SIZE];
+    entry.blockVectorId = m_ThreadCacheId;
+    entry.cache = cache;
+    return cache;
 }
 
-void BlockVector::Free(Allocation* hAllocation)
+bool BlockVector::AllocateFromThreadCache(
+    UINT64 size,
+    UINT64 alignment,
+    const ALLOCATION_DESC& allocDesc,
+    Allocation** pAllocation)
 {
-    NormalBlock* pBlockToDelete = NULL;
-
-    bool budgetExceeded = false;
-    if (IsHeapTypeStandard(m_HeapProps.Type))
+    if ((allocDesc.Flags & (ALLOCATION_FLAG_UPPER_ADDRESS | ALLOCATION_FLAG_NEVER_ALLOCATE)) != 0 ||
+        size > D3D12MA_THREAD_CACHE_MAX_SIZE ||
+        m_ThreadCacheBlocked.load() != 0)
     {
-        Budget budget = {};
-        m_hAllocator->GetBudgetForHeapType(budget, m_HeapProps.Type);
-        budgetExceeded = budget.UsageBytes >= budget.BudgetBytes;
+        return false;
+    }
+    const UINT sizeClassIndex = GetThreadCacheClass(size);
+    const UINT64 classSize = GetThreadCacheClassSize(sizeClassIndex);
+    // Entries are aligned to their size, nothing more. Requests that would waste more than a
+    // quarter of the class go the usual way.
+    if (D3D12MA_MAX(alignment, m_MinAllocationAlignment) > classSize ||
+        classSize - size > classSize / 4)
+    {
+        return false;
     }
 
-    // Scope for lock.
+    ThreadCache* const cache = GetThreadCache();
+    Allocation* alloc = NULL;
     {
-        MutexLockWrite lock(m_Mutex, m_hAllocator->UseMutex());
+        MutexLock lock(cache->mutex);
+        if (m_ThreadCacheBlocked.load() != 0)
+            return false;
 
-        NormalBlock* pBlock = hAllocation->m_Placed.block;
+        ThreadCache::SizeClass& sizeClass = cache->classes[sizeClassIndex];
+        if (sizeClass.count == 0 && FAILED(RefillThreadCache(*cache, sizeClassIndex)))
+            return false;
+        alloc = sizeClass.entries[--sizeClass.count];
+        cache->bytes -= classSize;
+        --m_ThreadCachedCount;
+        m_ThreadCachedBytes -= classSize;
+    }
 
-        pBlock->m_pMetadata->Free(hAllocation->GetAllocHandle());
-        D3D12MA_HEAVY_ASSERT(pBlock->Validate());
+    alloc->SetPrivateData(allocDesc.pPrivateData);
+    m_hAllocator->m_Budget.AddAllocation(m_hAllocator->HeapPropertiesToMemorySegmentGroup(m_HeapProps), classSize);
+    *pAllocation = alloc;
+    return true;
+}
 
-        const size_t blockCount = m_Blocks.size();
-        // pBlock became empty after this deallocation.
-        if (pBlock->m_pMetadata->IsEmpty())
-        {
-            // Already has empty Allocation. We don't want to have two, so delete this one.
-            if ((m_HasEmptyBlock || budgetExceeded) &&
-                blockCount > m_MinBlockCount)
-            {
-                pBlockToDelete = pBlock;
-                Remove(pBlock);
-            }
-            // We now have first empty block.
-            else
-            {
-                m_HasEmptyBlock = true;
-            }
-        }
-        // pBlock didn't become empty, but we have another empty block - find and free that one.
-        // (This is optional, heuristics.)
-        else if (m_HasEmptyBlock && blockCount > m_MinBlockCount)
-        {
-            NormalBlock* pLastBlock = m_Blocks.back();
-            if (pLastBlock->m_pMetadata->IsEmpty())
-            {
-                pBlockToDelete = pLastBlock;
-                m_Blocks.pop_back();
-                m_HasEmptyBlock = false;
-            }
-        }
+HRESULT BlockVector::RefillThreadCache(ThreadCache& cache, UINT sizeClassIndex)
+{
+    ThreadCache::SizeClass& sizeClass = cache.classes[sizeClassIndex];
+    const UINT64 classSize = GetThreadCacheClassSize(sizeClassIndex);
+    // Half the class capacity, as much as the cache has room for, but at least the one requested.
+    const UINT64 room = cache.bytes < D3D12MA_THREAD_CACHE_BYTES ? (D3D12MA_THREAD_CACHE_BYTES - cache.bytes) / classSize : 0;
+    const UINT refillCount = (UINT)D3D12MA_MAX(D3D12MA_MIN((UINT64)GetThreadCacheCapacity(sizeClassIndex) / 2, room), (UINT64)1);
+    const ALLOCATION_DESC allocDesc = {};
 
-        IncrementallySortBlocks();
+    HRESULT hr = S_OK;
+    MutexLockWrite lock(m_Mutex, m_hAllocator->UseMutex());
+    while (sizeClass.count < refillCount)
+    {
+        // Not in the budget while cached, AllocateFromThreadCache adds it when handing it out.
+        hr = AllocatePage(classSize, classSize, allocDesc, sizeClass.entries + sizeClass.count, false);
+        if (FAILED(hr))
+            break;
+        ++sizeClass.count;
+        cache.bytes += classSize;
+        ++m_ThreadCachedCount;
+        m_ThreadCachedBytes += classSize;
     }
+    // A partial refill is fine.
+    return sizeClass.count > 0 ? S_OK : hr;
+}
 
-    // Destruction of a free Allocation. Deferred until this point, outside of mutex
-    // lock, for performance reason.
-    if (pBlockToDelete != NULL)
+void BlockVector::ReleaseThreadCacheEntries(Allocation* const* pAllocations, size_t allocationCount)
+{
+    FreeBatch(pAllocations, allocationCount, true);
+    for (size_t i = 0; i < allocationCount; ++i)
     {
-        D3D12MA_DELETE(m_hAllocator->GetAllocs(), pBlockToDelete);
+        m_hAllocator->GetAllocationObjectAllocator().Free(pAllocations[i]);
     }
 }
 
@@ -8518,10 +9959,15 @@ void BlockVector::AddStatistics(Statistics& inoutStats)
         D3D12MA_HEAVY_ASSERT(pBlock->Validate());
         pBlock->m_pMetadata->AddStatistics(inoutStats);
     }
+    // Cached allocations are free memory for the user.
+    inoutStats.AllocationCount -= m_ThreadCachedCount.load();
+    inoutStats.AllocationBytes -= m_ThreadCachedBytes.load();
 }
 
 void BlockVector::AddDetailedStatistics(DetailedStatistics& inoutStats)
 {
+    // Free ranges can't be corrected for cached allocations, give them back first.
+    FlushThreadCaches();
     MutexLockRead lock(m_Mutex, m_hAllocator->UseMutex());
 
     for (size_t i = 0; i < m_Blocks.size(); ++i)
@@ -8535,6 +9981,7 @@ void BlockVector::AddDetailedStatistics(DetailedStatistics& inoutStats)
 
 void BlockVector::WriteBlockInfoToJson(JsonWriter& json)
 {
+    FlushThreadCaches();
     MutexLockRead lock(m_Mutex, m_hAllocator->UseMutex());
 
     json.BeginObject();
@@ -8556,6 +10003,123 @@ void BlockVector::WriteBlockInfoToJson(JsonWriter& json)
     json.EndObject();
 }
 
+HRESULT BlockVector::AllocateBatchPages(
+    const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfos,
+    const UINT* pIndices,
+    size_t allocationCount,
+    const ALLOCATION_DESC& allocDesc,
+    Allocation** pAllocations)
+{
+    Vector<NormalBlock*> blocksToDelete(m_hAllocator->GetAllocs());
+    UINT64 allocatedBytes = 0;
+    size_t allocIndex;
+    HRESULT hr = S_OK;
+
+    {
+        MutexLockWrite lock(m_Mutex, m_hAllocator->UseMutex());
+        for (allocIndex = 0; allocIndex < allocationCount; ++allocIndex)
+        {
+            const D3D12_RESOURCE_ALLOCATION_INFO& allocInfo = pAllocInfos[pIndices[allocIndex]];
+            hr = AllocatePage(
+                allocInfo.SizeInBytes,
+                allocInfo.Alignment,
+                allocDesc,
+                pAllocations + pIndices[allocIndex],
+                false); // addToBudget
+            if (FAILED(hr))
+            {
+                break;
+            }
+            allocatedBytes += allocInfo.SizeInBytes;
+        }
+
+        if (FAILED(hr))
+        {
+            // Roll back under the same lock, so no other thread sees a part of the batch.
+            Vector<Allocation*> allocated(m_hAllocator->GetAllocs());
+            allocated.reserve(allocIndex);
+            for (size_t i = 0; i < allocIndex; ++i)
+                allocated.push_back(pAllocations[pIndices[i]]);
+            FreeBatchLocked(allocated.data(), allocated.size(), false, IsBudgetExceeded(), blocksToDelete);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        for (size_t i = 0; i < allocIndex; ++i)
+        {
+            Allocation*& alloc = pAllocations[pIndices[i]];
+            m_hAllocator->GetAllocationObjectAllocator().Free(alloc);
+            alloc = NULL;
+        }
+        for (NormalBlock* pBlock : blocksToDelete)
+        {
+            D3D12MA_DELETE(m_hAllocator->GetAllocs(), pBlock);
+        }
+        return hr;
+    }
+
+    m_hAllocator->m_Budget.AddAllocation(m_hAllocator->HeapPropertiesToMemorySegmentGroup(m_HeapProps),
+        allocatedBytes, (UINT)allocationCount);
+    return S_OK;
+}
+
+void BlockVector::FreeBatchLocked(
+    Allocation* const* pAllocations,
+    size_t allocationCount,
+    bool threadCached,
+    bool budgetExceeded,
+    Vector<NormalBlock*>& blocksToDelete)
+{
+    for (size_t allocIndex = 0; allocIndex < allocationCount; ++allocIndex)
+    {
+        NormalBlock* pBlock = pAllocations[allocIndex]->m_Placed.block;
+        D3D12MA_ASSERT(pBlock->GetBlockVector() == this);
+        pBlock->m_pMetadata->Free(pAllocations[allocIndex]->GetAllocHandle());
+        D3D12MA_HEAVY_ASSERT(pBlock->Validate());
+        if (threadCached)
+        {
+            --m_ThreadCachedCount;
+            m_ThreadCachedBytes -= pAllocations[allocIndex]->GetSize();
+        }
+    }
+
+    // Same policy as Free(), applied once: keep at most one empty block
+    // (none when over budget), never going below m_MinBlockCount.
+    bool keptEmpty = false;
+    for (size_t blockIndex = m_Blocks.size(); blockIndex--; )
+    {
+        NormalBlock* const pBlock = m_Blocks[blockIndex];
+        if (!pBlock->m_pMetadata->IsEmpty())
+            continue;
+        if (!keptEmpty && !budgetExceeded)
+        {
+            keptEmpty = true;
+            continue;
+        }
+        if (m_Blocks.size() <= m_MinBlockCount)
+        {
+            keptEmpty = true;
+            break;
+        }
+        blocksToDelete.push_back(pBlock);
+        m_Blocks.remove(blockIndex);
+    }
+    m_HasEmptyBlock = keptEmpty;
+
+    if (m_IncrementalSort)
+        SortByFreeSize();
+}
+
+bool BlockVector::IsBudgetExceeded() const
+{
+    if (!IsHeapTypeStandard(m_HeapProps.Type))
+        return false;
+    Budget budget = {};
+    m_hAllocator->GetBudgetForHeapType(budget, m_HeapProps.Type);
+    return budget.UsageBytes >= budget.BudgetBytes;
+}
+
 UINT64 BlockVector::CalcSumBlockSize() const
 {
     UINT64 result = 0;
@@ -8621,7 +10185,8 @@ HRESULT BlockVector::AllocatePage(
     UINT64 size,
     UINT64 alignment,
     const ALLOCATION_DESC& allocDesc,
-    Allocation** pAllocation)
+    Allocation** pAllocation,
+    bool addToBudget)
 {
     // Early reject: requested allocation size is larger that maximum block size for this block vector.
     if (size + D3D12MA_DEBUG_MARGIN > m_PreferredBlockSize)
@@ -8659,7 +10224,8 @@ HRESULT BlockVector::AllocatePage(
                 allocDesc.Flags,
                 allocDesc.pPrivateData,
                 allocDesc.Flags & ALLOCATION_FLAG_STRATEGY_MASK,
-                pAllocation);
+                pAllocation,
+                addToBudget);
             if (SUCCEEDED(hr))
             {
                 return hr;
@@ -8728,7 +10294,8 @@ HRESULT BlockVector::AllocatePage(
                 allocDesc.Flags,
                 allocDesc.pPrivateData,
                 allocDesc.Flags & ALLOCATION_FLAG_STRATEGY_MASK,
-                pAllocation);
+                pAllocation,
+                addToBudget);
             if (SUCCEEDED(hr))
             {
                 return hr;
@@ -8751,7 +10318,8 @@ HRESULT BlockVector::AllocateFromBlock(
     ALLOCATION_FLAGS allocFlags,
     void* pPrivateData,
     UINT32 strategy,
-    Allocation** pAllocation)
+    Allocation** pAllocation,
+    bool addToBudget)
 {
     alignment = D3D12MA_MAX(alignment, m_MinAllocationAlignment);
 
@@ -8763,7 +10331,7 @@ HRESULT BlockVector::AllocateFromBlock(
         strategy,
         &currRequest))
     {
-        return CommitAllocationRequest(currRequest, pBlock, size, alignment, pPrivateData, pAllocation);
+        return CommitAllocationRequest(currRequest, pBlock, size, alignment, pPrivateData, pAllocation, addToBudget);
     }
     return E_OUTOFMEMORY;
 }
@@ -8774,7 +10342,8 @@ HRESULT BlockVector::CommitAllocationRequest(
     UINT64 size,
     UINT64 alignment,
     void* pPrivateData,
-    Allocation** pAllocation)
+    Allocation** pAllocation,
+    bool addToBudget)
 {
     // We no longer have an empty Allocation.
     if (pBlock->m_pMetadata->IsEmpty())
@@ -8787,7 +10356,8 @@ HRESULT BlockVector::CommitAllocationRequest(
     (*pAllocation)->SetPrivateData(pPrivateData);
 
     D3D12MA_HEAVY_ASSERT(pBlock->Validate());
-    m_hAllocator->m_Budget.AddAllocation(m_hAllocator->HeapPropertiesToMemorySegmentGroup(m_HeapProps), size);
+    if (addToBudget)
+        m_hAllocator->m_Budget.AddAllocation(m_hAllocator->HeapPropertiesToMemorySegmentGroup(m_HeapProps), size);
 
     return S_OK;
 }
@@ -8836,6 +10406,7 @@ DefragmentationContextPimpl::DefragmentationContextPimpl(
         m_BlockVectorCount = 1;
         m_PoolBlockVector = poolVector;
         m_pBlockVectors = &m_PoolBlockVector;
+        m_PoolBlockVector->SetThreadCacheBlocked(true);
         m_PoolBlockVector->SetIncrementalSort(false);
         m_PoolBlockVector->SortByFreeSize();
     }
@@ -8849,6 +10420,7 @@ DefragmentationContextPimpl::DefragmentationContextPimpl(
             BlockVector* vector = m_pBlockVectors[i];
             if (vector != NULL)
             {
+                vector->SetThreadCacheBlocked(true);
                 vector->SetIncrementalSort(false);
                 vector->SortByFreeSize();
             }
@@ -8870,14 +10442,20 @@ DefragmentationContextPimpl::DefragmentationContextPimpl(
 DefragmentationContextPimpl::~DefragmentationContextPimpl()
 {
     if (m_PoolBlockVector != NULL)
+    {
         m_PoolBlockVector->SetIncrementalSort(true);
+        m_PoolBlockVector->SetThreadCacheBlocked(false);
+    }
     else
     {
         for (UINT32 i = 0; i < m_BlockVectorCount; ++i)
         {
             BlockVector* vector = m_pBlockVectors[i];
             if (vector != NULL)
+            {
                 vector->SetIncrementalSort(true);
+                vector->SetThreadCacheBlocked(false);
+            }
         }
     }
 
@@ -8894,6 +10472,14 @@ DefragmentationContextPimpl::~DefragmentationContextPimpl()
     }
 }
 
+void DefragmentationContextPimpl::SetPassLimits(UINT64 maxBytesPerPass, UINT32 maxAllocationsPerPass)
+{
+    // Counters of the pass in progress were checked against the old limits.
+    D3D12MA_ASSERT(m_Moves.empty() && "Pass limits can only be changed between passes!");
+    m_MaxPassBytes = maxBytesPerPass == 0 ? UINT64_MAX : maxBytesPerPass;
+    m_MaxPassAllocations = maxAllocationsPerPass == 0 ? UINT32_MAX : maxAllocationsPerPass;
+}
+
 HRESULT DefragmentationContextPimpl::DefragmentPassBegin(DEFRAGMENTATION_PASS_MOVE_INFO& moveInfo)
 {
     if (m_PoolBlockVector != NULL)
@@ -9472,7 +11058,8 @@ PoolPimpl::PoolPimpl(AllocatorPimpl* allocator, const POOL_DESC& desc)
         D3D12MA_MAX(desc.MinAllocationAlignment, (UINT64)D3D12MA_DEBUG_ALIGNMENT),
         desc.Flags & POOL_FLAG_ALGORITHM_MASK,
         desc.Flags & POOL_FLAG_MSAA_TEXTURES_ALWAYS_COMMITTED,
-        desc.pProtectedSession);
+        desc.pProtectedSession,
+        (desc.Flags & POOL_FLAG_THREAD_CACHE) != 0);
 }
 
 PoolPimpl::~PoolPimpl()
@@ -9558,7 +11145,8 @@ HRESULT CreateAllocator(const ALLOCATOR_DESC* pDesc, Allocator** ppAllocator)
 
 HRESULT CreateVirtualBlock(const VIRTUAL_BLOCK_DESC* pDesc, VirtualBlock** ppVirtualBlock)
 {
-    if (!pDesc || !ppVirtualBlock)
+    if (!pDesc || !ppVirtualBlock ||
+        (pDesc->Flags & VIRTUAL_BLOCK_FLAG_ALGORITHM_MASK) == VIRTUAL_BLOCK_FLAG_ALGORITHM_MASK)
     {
         D3D12MA_ASSERT(0 && "Invalid arguments passed to CreateVirtualBlock.");
         return E_INVALIDARG;
@@ -9703,7 +11291,8 @@ void Allocation::ReleaseThis()
         m_Allocator->FreeCommittedMemory(this);
         break;
     case TYPE_PLACED:
-        m_Allocator->FreePlacedMemory(this);
+        if (m_Allocator->FreePlacedMemory(this))
+            return; // Kept by a thread cache, still allocated in its block.
         break;
     case TYPE_HEAP:
         m_Allocator->FreeHeapMemory(this);
@@ -9839,6 +11428,11 @@ void DefragmentationContext::GetStats(DEFRAGMENTATION_STATS* pStats)
     m_Pimpl->GetStats(*pStats);
 }
 
+void DefragmentationContext::SetPassLimits(UINT64 MaxBytesPerPass, UINT32 MaxAllocationsPerPass)
+{
+    m_Pimpl->SetPassLimits(MaxBytesPerPass, MaxAllocationsPerPass);
+}
+
 void DefragmentationContext::ReleaseThis()
 {
     if (this == NULL)
@@ -9896,7 +11490,7 @@ HRESULT Pool::BeginDefragmentation(const DEFRAGMENTATION_DESC* pDesc, Defragment
     D3D12MA_ASSERT(pDesc && ppContext);
 
     // Check for support
-    if (m_Pimpl->GetBlockVector()->GetAlgorithm() & POOL_FLAG_ALGORITHM_LINEAR)
+    if (m_Pimpl->GetBlockVector()->GetAlgorithm() & (POOL_FLAG_ALGORITHM_LINEAR | POOL_FLAG_ALGORITHM_BUDDY))
         return E_NOINTERFACE;
 
     AllocatorPimpl* allocator = m_Pimpl->GetAllocator();
@@ -10016,13 +11610,49 @@ HRESULT Allocator::CreateAliasingResource(
         return m_Pimpl->CreateAliasingResource(pAllocation, AllocationLocalOffset, pResourceDesc, InitialResourceState, pOptimizedClearValue, riidResource, ppvResource);
 }
 
+HRESULT Allocator::AllocateMemoryBatch(
+    const ALLOCATION_DESC* pAllocDesc,
+    UINT NumAllocations,
+    const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfos,
+    Allocation** ppAllocations)
+{
+    if (NumAllocations == 0)
+        return S_OK;
+    bool valid = pAllocInfos != NULL;
+    for (UINT i = 0; valid && i < NumAllocations; ++i)
+        valid = ValidateAllocateMemoryParameters(pAllocDesc, pAllocInfos + i, ppAllocations);
+    if (!valid)
+    {
+        D3D12MA_ASSERT(0 && "Invalid arguments passed to Allocator::AllocateMemoryBatch.");
+        return E_INVALIDARG;
+    }
+    D3D12MA_DEBUG_GLOBAL_MUTEX_LOCK
+        return m_Pimpl->AllocateMemoryBatch(pAllocDesc, NumAllocations, pAllocInfos, ppAllocations);
+}
+
+void Allocator::FreeBatch(
+    UINT NumAllocations,
+    Allocation* const* ppAllocations)
+{
+    if (NumAllocations == 0)
+        return;
+    if (!ppAllocations)
+    {
+        D3D12MA_ASSERT(0 && "Invalid arguments passed to Allocator::FreeBatch.");
+        return;
+    }
+    D3D12MA_DEBUG_GLOBAL_MUTEX_LOCK
+        m_Pimpl->FreeBatch(NumAllocations, ppAllocations);
+}
+
 HRESULT Allocator::CreatePool(
     const POOL_DESC* pPoolDesc,
     Pool** ppPool)
 {
     if (!pPoolDesc || !ppPool ||
         (pPoolDesc->MaxBlockCount > 0 && pPoolDesc->MaxBlockCount < pPoolDesc->MinBlockCount) ||
-        (pPoolDesc->MinAllocationAlignment > 0 && !IsPow2(pPoolDesc->MinAllocationAlignment)))
+        (pPoolDesc->MinAllocationAlignment > 0 && !IsPow2(pPoolDesc->MinAllocationAlignment)) ||
+        (pPoolDesc->Flags & POOL_FLAG_ALGORITHM_MASK) == POOL_FLAG_ALGORITHM_MASK)
     {
         D3D12MA_ASSERT(0 && "Invalid arguments passed to Allocator::CreatePool.");
         return E_INVALIDARG;
@@ -10172,6 +11802,93 @@ void VirtualBlock::FreeAllocation(VirtualAllocation allocation)
     D3D12MA_HEAVY_ASSERT(m_Pimpl->m_Metadata->Validate());
 }
 
+HRESULT VirtualBlock::AllocateBatch(UINT NumAllocations, const VIRTUAL_ALLOCATION_DESC* pDescs, VirtualAllocation* pAllocations, UINT64* pOffsets)
+{
+    if (NumAllocations == 0)
+        return S_OK;
+    bool valid = pDescs && pAllocations;
+    for (UINT i = 0; valid && i < NumAllocations; ++i)
+        valid = pDescs[i].Size != 0 && IsPow2(pDescs[i].Alignment);
+    if (!valid)
+    {
+        D3D12MA_ASSERT(0 && "Invalid arguments passed to VirtualBlock::AllocateBatch.");
+        return E_INVALIDARG;
+    }
+
+    D3D12MA_DEBUG_GLOBAL_MUTEX_LOCK
+
+        BlockMetadata* const metadata = m_Pimpl->m_Metadata;
+    // Largest first packs better, small ones fill the gaps left by the big ones.
+    Vector<UINT> order(m_Pimpl->m_AllocationCallbacks);
+    order.resize(NumAllocations);
+    for (UINT i = 0; i < NumAllocations; ++i)
+        order[i] = i;
+    D3D12MA_SORT(order.begin(), order.end(),
+        [pDescs](UINT i1, UINT i2)
+        {
+            return pDescs[i1].Size > pDescs[i2].Size;
+        });
+
+    UINT allocIndex;
+    for (allocIndex = 0; allocIndex < NumAllocations; ++allocIndex)
+    {
+        const VIRTUAL_ALLOCATION_DESC& desc = pDescs[order[allocIndex]];
+        AllocationRequest allocRequest = {};
+        if (!metadata->CreateAllocationRequest(
+            desc.Size,
+            desc.Alignment != 0 ? desc.Alignment : 1,
+            desc.Flags & VIRTUAL_ALLOCATION_FLAG_UPPER_ADDRESS,
+            desc.Flags & VIRTUAL_ALLOCATION_FLAG_STRATEGY_MASK,
+            &allocRequest))
+        {
+            break;
+        }
+        metadata->Alloc(allocRequest, desc.Size, desc.pPrivateData);
+        pAllocations[order[allocIndex]].AllocHandle = allocRequest.allocHandle;
+    }
+    D3D12MA_HEAVY_ASSERT(metadata->Validate());
+
+    if (allocIndex < NumAllocations)
+    {
+        while (allocIndex--)
+            metadata->Free(pAllocations[order[allocIndex]].AllocHandle);
+        for (UINT i = 0; i < NumAllocations; ++i)
+        {
+            pAllocations[i].AllocHandle = (AllocHandle)0;
+            if (pOffsets)
+                pOffsets[i] = UINT64_MAX;
+        }
+        return E_OUTOFMEMORY;
+    }
+
+    if (pOffsets)
+    {
+        for (UINT i = 0; i < NumAllocations; ++i)
+            pOffsets[i] = metadata->GetAllocationOffset(pAllocations[i].AllocHandle);
+    }
+    return S_OK;
+}
+
+void VirtualBlock::FreeBatch(UINT NumAllocations, const VirtualAllocation* pAllocations)
+{
+    if (NumAllocations == 0)
+        return;
+    if (!pAllocations)
+    {
+        D3D12MA_ASSERT(0 && "Invalid arguments passed to VirtualBlock::FreeBatch.");
+        return;
+    }
+
+    D3D12MA_DEBUG_GLOBAL_MUTEX_LOCK
+
+        for (UINT i = 0; i < NumAllocations; ++i)
+        {
+            if (pAllocations[i].AllocHandle != (AllocHandle)0)
+                m_Pimpl->m_Metadata->Free(pAllocations[i].AllocHandle);
+        }
+    D3D12MA_HEAVY_ASSERT(m_Pimpl->m_Metadata->Validate());
+}
+
 void VirtualBlock::Clear()
 {
     D3D12MA_DEBUG_GLOBAL_MUTEX_LOCK
@@ -10243,6 +11960,24 @@ void VirtualBlock::ReleaseThis()
     D3D12MA_DELETE(allocationCallbacksCopy, this);
 }
 
+HRESULT VirtualBlock::BeginDefragmentation(const VIRTUAL_DEFRAGMENTATION_DESC* pDesc, VirtualDefragmentationContext** ppContext)
+{
+    if (!pDesc || !ppContext || !IsPow2(pDesc->Alignment))
+    {
+        D3D12MA_ASSERT(0 && "Invalid arguments passed to VirtualBlock::BeginDefragmentation.");
+        return E_INVALIDARG;
+    }
+
+    // Check for support
+    if (m_Pimpl->m_Algorithm & (VIRTUAL_BLOCK_FLAG_ALGORITHM_LINEAR | VIRTUAL_BLOCK_FLAG_ALGORITHM_BUDDY))
+        return E_NOINTERFACE;
+
+    D3D12MA_DEBUG_GLOBAL_MUTEX_LOCK
+
+    *ppContext = D3D12MA_NEW(m_Pimpl->m_AllocationCallbacks, VirtualDefragmentationContext)(m_Pimpl->m_AllocationCallbacks, *pDesc, m_Pimpl);
+    return S_OK;
+}
+
 VirtualBlock::VirtualBlock(const ALLOCATION_CALLBACKS& allocationCallbacks, const VIRTUAL_BLOCK_DESC& desc)
     : m_Pimpl(D3D12MA_NEW(allocationCallbacks, VirtualBlockPimpl)(allocationCallbacks, desc)) {}
 
@@ -10255,5 +11990,55 @@ VirtualBlock::~VirtualBlock()
     D3D12MA_DELETE(m_Pimpl->m_AllocationCallbacks, m_Pimpl);
 }
 #endif // _D3D12MA_VIRTUAL_BLOCK_FUNCTIONS
+
+#ifndef _D3D12MA_VIRTUAL_DEFRAGMENTATION_CONTEXT_FUNCTIONS
+HRESULT VirtualDefragmentationContext::BeginPass(VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO* pPassInfo)
+{
+    D3D12MA_ASSERT(pPassInfo);
+    D3D12MA_DEBUG_GLOBAL_MUTEX_LOCK
+    return m_Pimpl->DefragmentPassBegin(*pPassInfo);
+}
+
+HRESULT VirtualDefragmentationContext::EndPass(VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO* pPassInfo)
+{
+    D3D12MA_ASSERT(pPassInfo);
+    D3D12MA_DEBUG_GLOBAL_MUTEX_LOCK
+    return m_Pimpl->DefragmentPassEnd(*pPassInfo);
+}
+
+void VirtualDefragmentationContext::GetStats(DEFRAGMENTATION_STATS* pStats)
+{
+    D3D12MA_ASSERT(pStats);
+    m_Pimpl->GetStats(*pStats);
+}
+
+void VirtualDefragmentationContext::SetPassLimits(UINT64 MaxBytesPerPass, UINT32 MaxAllocationsPerPass)
+{
+    m_Pimpl->SetPassLimits(MaxBytesPerPass, MaxAllocationsPerPass);
+}
+
+void VirtualDefragmentationContext::ReleaseThis()
+{
+    if (this == NULL)
+    {
+        return;
+    }
+
+    // Copy is needed because otherwise we would call destructor and invalidate the structure with callbacks before using it to free memory.
+    const ALLOCATION_CALLBACKS allocationCallbacksCopy = m_Pimpl->GetAllocs();
+    D3D12MA_DELETE(allocationCallbacksCopy, this);
+}
+
+VirtualDefragmentationContext::VirtualDefragmentationContext(const ALLOCATION_CALLBACKS& allocationCallbacks,
+    const VIRTUAL_DEFRAGMENTATION_DESC& desc,
+    VirtualBlockPimpl* block)
+    : m_Pimpl(D3D12MA_NEW(allocationCallbacks, VirtualDefragmentationContextPimpl)(allocationCallbacks, desc, block->m_Metadata)) {}
+
+VirtualDefragmentationContext::~VirtualDefragmentationContext()
+{
+    const ALLOCATION_CALLBACKS allocationCallbacksCopy = m_Pimpl->GetAllocs();
+    D3D12MA_DELETE(allocationCallbacksCopy, m_Pimpl);
+}
+#endif // _D3D12MA_VIRTUAL_DEFRAGMENTATION_CONTEXT_FUNCTIONS
 #endif // _D3D12MA_PUBLIC_INTERFACE
 } // namespace D3D12MA
@@ -43,6 +43,7 @@ Documentation of all members: D3D12MemAlloc.h
 - \subpage statistics
 - \subpage resource_aliasing
 - \subpage linear_algorithm
+- \subpage buddy_algorithm
 - \subpage virtual_allocator
 - \subpage configuration
   - [Custom CPU memory allocator](@ref custom_memory_allocator)
@@ -144,6 +145,8 @@ public:
     virtual ULONG STDMETHODCALLTYPE Release();
 protected:
     virtual void ReleaseThis() { delete this; }
+    // Drops one reference without destroying the object, returns the new count. For batched releases.
+    ULONG ReleaseReference() { return --m_RefCount; }
 private:
     D3D12MA_ATOMIC_UINT32 m_RefCount = 1;
 };
@@ -163,10 +166,12 @@ class BlockVector;
 class CommittedAllocationList;
 class JsonWriter;
 class VirtualBlockPimpl;
+class VirtualDefragmentationContextPimpl;
 /// \endcond
 
 class Pool;
 class Allocator;
+class VirtualDefragmentationContext;
 struct Statistics;
 struct DetailedStatistics;
 struct TotalStatistics;
@@ -797,6 +802,13 @@ public:
     /** \brief Returns statistics of the defragmentation performed so far.
     */
     void GetStats(DEFRAGMENTATION_STATS* pStats);
+    /** \brief Changes DEFRAGMENTATION_DESC::MaxBytesPerPass and DEFRAGMENTATION_DESC::MaxAllocationsPerPass for the following passes.
+
+    Can only be called between passes, not between DefragmentationContext::BeginPass() and DefragmentationContext::EndPass().
+    0 means no limit, as in the description. Lets a caller with a per-frame time budget size every pass
+    to what the current frame can afford.
+    */
+    void SetPassLimits(UINT64 MaxBytesPerPass, UINT32 MaxAllocationsPerPass);
 
 protected:
     void ReleaseThis() override;
@@ -843,8 +855,36 @@ enum POOL_FLAGS
     */
     POOL_FLAG_MSAA_TEXTURES_ALWAYS_COMMITTED = 0x2,
 
+    /** \brief Optimization, keep per-thread caches of small allocations in this pool.
+
+    Allocations in power-of-two size classes from `D3D12MA_THREAD_CACHE_MIN_SIZE` to
+    `D3D12MA_THREAD_CACHE_MAX_SIZE` are taken from and freed to a small cache owned by the calling
+    thread, which is refilled and flushed in batches. Most allocations and frees then don't
+    lock the pool at all, which helps when many threads create placed resources at once.
+
+    Requests at most a quarter below their class are rounded up to it, Allocation::GetSize()
+    returns the rounded size. Other sizes are allocated as usual. One thread keeps at most
+    `D3D12MA_THREAD_CACHE_BYTES` cached per pool. Memory held by the caches is reported as free
+    in statistics and not counted as allocation usage in the budget. Caches are flushed when the
+    pool runs out of memory and during defragmentation.
+
+    Ignored with #POOL_FLAG_ALGORITHM_LINEAR, #POOL_FLAG_ALGORITHM_BUDDY and with #ALLOCATOR_FLAG_SINGLETHREADED.
+    */
+    POOL_FLAG_THREAD_CACHE = 0x4,
+
+    /** \brief Enables alternative, buddy allocation algorithm in this pool.
+
+    Every allocation takes a power-of-two node of the heap, found and split or merged back
+    with its buddy in O(log n) time. Allocation and free take the same short time no matter
+    how fragmented the heap is, at the cost of internal fragmentation: up to half of a node is
+    wasted when the size is not a power of two. Best for sizes that are powers of two already,
+    like most textures. Cannot be combined with #POOL_FLAG_ALGORITHM_LINEAR.
+    For details, see documentation chapter \ref buddy_algorithm.
+    */
+    POOL_FLAG_ALGORITHM_BUDDY = 0x8,
+
     // Bit mask to extract only `ALGORITHM` bits from entire set of flags.
-    POOL_FLAG_ALGORITHM_MASK = POOL_FLAG_ALGORITHM_LINEAR
+    POOL_FLAG_ALGORITHM_MASK = POOL_FLAG_ALGORITHM_LINEAR | POOL_FLAG_ALGORITHM_BUDDY
 };
 
 /// \brief Parameters of created D3D12MA::Pool object. To be used with D3D12MA::Allocator::CreatePool.
@@ -1022,6 +1062,12 @@ enum ALLOCATOR_FLAGS
     to create its heaps on smaller alignment not suitable for MSAA textures.
     */
     ALLOCATOR_FLAG_MSAA_TEXTURES_ALWAYS_COMMITTED = 0x8,
+
+    /** \brief Optimization, keep per-thread caches of small allocations in the default pools.
+
+    Same as #POOL_FLAG_THREAD_CACHE, applied to all default pools.
+    */
+    ALLOCATOR_FLAG_DEFAULT_POOLS_THREAD_CACHE = 0x10,
 };
 
 /// \brief Parameters of created Allocator object. To be used with CreateAllocator().
@@ -1183,6 +1229,28 @@ public:
         const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfo,
         Allocation** ppAllocation);
 
+    /** \brief Allocates memory for multiple resources at once.
+
+    \param pAllocDesc Parameters shared by all the allocations.
+    \param NumAllocations Number of elements in `pAllocInfos` and `ppAllocations`.
+    \param pAllocInfos Sizes and alignments, with the same requirements as in AllocateMemory().
+    \param[out] ppAllocations Created allocations, in the order of `pAllocInfos`.
+
+    Equivalent to calling AllocateMemory() for every element, but the ones that end up placed
+    are sorted by size, largest first, for better packing and created with one lock of their
+    block vector, and the budget is updated once. Sizes that AllocateMemory() would rather
+    allocate as committed are still allocated one by one. Use it when many resources are
+    created at the same time, e.g. while loading a level.
+
+    All or nothing: if any allocation fails, the ones already created are freed, all elements
+    of `ppAllocations` are set to null and the error is returned.
+    */
+    HRESULT AllocateMemoryBatch(
+        const ALLOCATION_DESC* pAllocDesc,
+        UINT NumAllocations,
+        const D3D12_RESOURCE_ALLOCATION_INFO* pAllocInfos,
+        Allocation** ppAllocations);
+
     /** \brief Creates a new resource in place of an existing allocation. This is useful for memory aliasing.
 
     \param pAllocation Existing allocation indicating the memory where the new resource should be created.
@@ -1214,6 +1282,21 @@ public:
         REFIID riidResource,
         void** ppvResource);
 
+    /** \brief Releases multiple allocations at once.
+
+    \param NumAllocations Number of elements in `ppAllocations`.
+    \param ppAllocations Allocations to release. Null elements are ignored.
+
+    Equivalent to calling `Release()` on every allocation, but placed allocations that drop their
+    last reference are returned to their block vectors with one lock per block vector instead of
+    one lock per allocation, empty blocks are trimmed once at the end and the budget is updated
+    once. Use it when many allocations die at the same time, e.g. everything retired by one
+    frame's fence.
+    */
+    void FreeBatch(
+        UINT NumAllocations,
+        Allocation* const* ppAllocations);
+
     /** \brief Creates custom pool.
     */
     HRESULT CreatePool(
@@ -1316,6 +1399,13 @@ enum VIRTUAL_BLOCK_FLAGS
     */
     VIRTUAL_BLOCK_FLAG_ALGORITHM_LINEAR = POOL_FLAG_ALGORITHM_LINEAR,
 
+    /** \brief Enables alternative, buddy allocation algorithm in this virtual block.
+
+    Allocations take power-of-two nodes of the block, in O(log n) time.
+    For details, see documentation chapter \ref buddy_algorithm.
+    */
+    VIRTUAL_BLOCK_FLAG_ALGORITHM_BUDDY = POOL_FLAG_ALGORITHM_BUDDY,
+
     // Bit mask to extract only `ALGORITHM` bits from entire set of flags.
     VIRTUAL_BLOCK_FLAG_ALGORITHM_MASK = POOL_FLAG_ALGORITHM_MASK
 };
@@ -1404,6 +1494,78 @@ struct VIRTUAL_ALLOCATION_INFO
     void* pPrivateData;
 };
 
+/** \brief Parameters for defragmentation of a virtual block.
+
+To be used with function VirtualBlock::BeginDefragmentation().
+*/
+struct VIRTUAL_DEFRAGMENTATION_DESC
+{
+    /// Flags, the algorithm as in DEFRAGMENTATION_DESC::Flags.
+    DEFRAGMENTATION_FLAGS Flags;
+    /** \brief Maximum numbers of bytes that can be moved during single pass.
+
+    0 means no limit.
+    */
+    UINT64 MaxBytesPerPass;
+    /** \brief Maximum number of allocations that can be moved during single pass.
+
+    0 means no limit.
+    */
+    UINT32 MaxAllocationsPerPass;
+    /** \brief Alignment of the new offsets.
+
+    A virtual block doesn't remember the alignment each allocation was made with.
+    0 means every allocation keeps the alignment of its current offset (its largest power-of-two divisor),
+    which is always correct but leaves fewer places to move to. Must be power of two.
+    */
+    UINT64 Alignment;
+};
+
+/// Single move of a virtual allocation to be done for defragmentation.
+struct VIRTUAL_DEFRAGMENTATION_MOVE
+{
+    /** \brief Operation to be performed on the allocation by VirtualDefragmentationContext::EndPass().
+    Default value is #DEFRAGMENTATION_MOVE_OPERATION_COPY. You can modify it.
+    */
+    DEFRAGMENTATION_MOVE_OPERATION Operation;
+    /// %Allocation that should be moved.
+    VirtualAllocation SrcAllocation;
+    /** \brief Allocation reserving the destination.
+
+    After VirtualDefragmentationContext::EndPass() with #DEFRAGMENTATION_MOVE_OPERATION_COPY, `SrcAllocation` is freed
+    and this one takes its place, with the same custom pointer: replace the handle you store.
+    With #DEFRAGMENTATION_MOVE_OPERATION_IGNORE or #DEFRAGMENTATION_MOVE_OPERATION_DESTROY it is freed.
+    */
+    VirtualAllocation DstAllocation;
+    /// Current offset of the allocation.
+    UINT64 SrcOffset;
+    /// Offset it is moved to.
+    UINT64 DstOffset;
+    /// Size of the allocation.
+    UINT64 Size;
+    /// Custom pointer of `SrcAllocation`.
+    void* pPrivateData;
+};
+
+/** \brief Moves of one defragmentation pass of a virtual block.
+
+To be used with function VirtualDefragmentationContext::BeginPass().
+*/
+struct VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO
+{
+    /// Number of elements in the `pMoves` array.
+    UINT32 MoveCount;
+    /** \brief Array of moves to be performed by the user in the current defragmentation pass.
+
+    Pointer to an array of `MoveCount` elements, owned by %D3D12MA, created in VirtualDefragmentationContext::BeginPass(),
+    destroyed in VirtualDefragmentationContext::EndPass().
+
+    For each element, copy `Size` units of your data from `SrcOffset` to `DstOffset` (the ranges never overlap), or set
+    `Operation` to #DEFRAGMENTATION_MOVE_OPERATION_IGNORE to cancel the move, then call VirtualDefragmentationContext::EndPass().
+    */
+    VIRTUAL_DEFRAGMENTATION_MOVE* pMoves;
+};
+
 /** \brief Represents pure allocation algorithm and a data structure with allocations in some memory block, without actually allocating any GPU memory.
 
 This class allows to use the core algorithm of the library custom allocations e.g. CPU memory or
@@ -1439,6 +1601,23 @@ public:
     Calling this function with `allocation.AllocHandle == 0` is correct and does nothing.
     */
     void FreeAllocation(VirtualAllocation allocation);
+    /** \brief Creates multiple allocations at once.
+    \param NumAllocations Number of elements in `pDescs`, `pAllocations` and `pOffsets`.
+    \param pDescs
+    \param[out] pAllocations Created allocations, in the order of `pDescs`.
+    \param[out] pOffsets Offsets of the created allocations. Optional, can be null.
+    \return `S_OK` if all the allocations succeeded, `E_OUTOFMEMORY` if any of them failed.
+
+    Allocations are made largest first, which packs better than the order of `pDescs` usually does.
+    All or nothing: if any allocation fails, the ones already made are freed, all elements of
+    `pAllocations` get `AllocHandle` 0 and all elements of `pOffsets` `UINT64_MAX`.
+    */
+    HRESULT AllocateBatch(UINT NumAllocations, const VIRTUAL_ALLOCATION_DESC* pDescs, VirtualAllocation* pAllocations, UINT64* pOffsets);
+    /** \brief Frees multiple allocations at once.
+
+    Elements with `AllocHandle == 0` are ignored.
+    */
+    void FreeBatch(UINT NumAllocations, const VirtualAllocation* pAllocations);
     /** \brief Frees all the allocations.
     */
     void Clear();
@@ -1464,6 +1643,19 @@ public:
     /** \brief Frees memory of a string returned from VirtualBlock::BuildStatsString.
     */
     void FreeStatsString(WCHAR* pStatsString) const;
+
+    /** \brief Begins defragmentation process of this virtual block.
+
+    \param pDesc Structure filled with parameters of defragmentation.
+    \param[out] ppContext Context object that will manage defragmentation.
+    \returns
+    - `S_OK` if defragmentation can begin.
+    - `E_NOINTERFACE` if defragmentation is not supported.
+
+    For more information about defragmentation, see documentation chapter:
+    [Virtual allocator - Defragmentation](@ref virtual_allocator_defragmentation).
+    */
+    HRESULT BeginDefragmentation(const VIRTUAL_DEFRAGMENTATION_DESC* pDesc, VirtualDefragmentationContext** ppContext);
    
 protected:
     void ReleaseThis() override;
@@ -1480,6 +1672,57 @@ private:
     D3D12MA_CLASS_NO_COPY(VirtualBlock)
 };
 
+/** \brief Represents defragmentation process of a virtual block in progress.
+
+You can create this object using VirtualBlock::BeginDefragmentation.
+It must be released before the virtual block. Like the block, it is not thread-safe.
+*/
+class D3D12MA_API VirtualDefragmentationContext : public IUnknownImpl
+{
+public:
+    /** \brief Starts single defragmentation pass.
+
+    \param[out] pPassInfo Computed informations for current pass.
+    \returns
+    - `S_OK` if no more moves are possible. Then you can omit call to VirtualDefragmentationContext::EndPass() and simply end whole defragmentation.
+    - `S_FALSE` if there are pending moves returned in `pPassInfo`. You need to perform them, call VirtualDefragmentationContext::EndPass(),
+      and then preferably try another pass with VirtualDefragmentationContext::BeginPass().
+    */
+    HRESULT BeginPass(VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO* pPassInfo);
+    /** \brief Ends single defragmentation pass.
+
+    \param pPassInfo Computed informations for current pass filled by VirtualDefragmentationContext::BeginPass() and possibly modified by you.
+    \return Returns `S_OK` if no more moves are possible or `S_FALSE` if more defragmentations are possible.
+
+    Commits or cancels every move according to its VIRTUAL_DEFRAGMENTATION_MOVE::Operation.
+    Allocations whose move was cancelled with #DEFRAGMENTATION_MOVE_OPERATION_IGNORE are not proposed again by this context.
+    */
+    HRESULT EndPass(VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO* pPassInfo);
+    /** \brief Returns statistics of the defragmentation performed so far.
+
+    `BytesFreed` and `HeapsFreed` are always 0 - a virtual block doesn't release memory.
+    */
+    void GetStats(DEFRAGMENTATION_STATS* pStats);
+    /// Changes VIRTUAL_DEFRAGMENTATION_DESC::MaxBytesPerPass and VIRTUAL_DEFRAGMENTATION_DESC::MaxAllocationsPerPass, between passes.
+    void SetPassLimits(UINT64 MaxBytesPerPass, UINT32 MaxAllocationsPerPass);
+
+protected:
+    void ReleaseThis() override;
+
+private:
+    friend class VirtualBlock;
+    template<typename T> friend void D3D12MA_DELETE(const ALLOCATION_CALLBACKS&, T*);
+
+    VirtualDefragmentationContextPimpl* m_Pimpl;
+
+    VirtualDefragmentationContext(const ALLOCATION_CALLBACKS& allocationCallbacks,
+        const VIRTUAL_DEFRAGMENTATION_DESC& desc,
+        VirtualBlockPimpl* block);
+    ~VirtualDefragmentationContext();
+
+    D3D12MA_CLASS_NO_COPY(VirtualDefragmentationContext)
+};
+
 
 /** \brief Creates new main D3D12MA::Allocator object and returns it through `ppAllocator`.
 
@@ -1983,7 +2226,8 @@ calling `allocation->Release()`, or simply deferring the release to the time aft
 <b>Mapping</b> is out of scope of this library and so it is not preserved after an allocation is moved during defragmentation.
 You need to map the new resource yourself if needed.
 
-\note Defragmentation is not supported in custom pools created with D3D12MA::POOL_FLAG_ALGORITHM_LINEAR.
+\note Defragmentation is not supported in custom pools created with D3D12MA::POOL_FLAG_ALGORITHM_LINEAR
+or D3D12MA::POOL_FLAG_ALGORITHM_BUDDY.
 
 
 \page statistics Statistics
@@ -2245,6 +2489,40 @@ Linear algorithm can also be used with \ref virtual_allocator.
 See flag D3D12MA::VIRTUAL_BLOCK_FLAG_ALGORITHM_LINEAR.
 
 
+\page buddy_algorithm Buddy allocation algorithm
+
+The buddy algorithm splits the heap into nodes whose sizes are powers of two. An
+allocation takes the smallest free node that fits, splitting a bigger one in halves
+as many times as needed. When an allocation is freed and the other half of its
+parent (its "buddy") is free too, both are merged back, up the tree. Free nodes of
+every size are kept in separate lists with a bit mask of the non-empty ones, so both
+allocation and free take O(log n) time and don't depend on how fragmented the heap is.
+
+To use it, add D3D12MA::POOL_FLAG_ALGORITHM_BUDDY to D3D12MA::POOL_DESC::Flags while
+creating a custom pool, or D3D12MA::VIRTUAL_BLOCK_FLAG_ALGORITHM_BUDDY to
+D3D12MA::VIRTUAL_BLOCK_DESC::Flags while creating a virtual block.
+
+\section buddy_algorithm_fragmentation Internal fragmentation
+
+Allocation sizes are rounded up to the node size, so a resource of 65 KB takes 128 KB.
+The unused rest of the node is reported as free bytes and as an unused range in
+statistics, but nothing else can be allocated there. If the heap size is not a power
+of two, only the largest power of two that fits is used, the tail is reported the
+same way. The smallest node of a heap is 4 KB, of a virtual block 1 byte.
+
+The algorithm works best when most sizes are powers of two already, like textures
+with power-of-two dimensions, and when allocation time matters more than memory.
+Compare it with the default TLSF algorithm on the sizes you really allocate before
+choosing it.
+
+\section buddy_algorithm_limitations Limitations
+
+- Cannot be combined with D3D12MA::POOL_FLAG_ALGORITHM_LINEAR.
+- D3D12MA::ALLOCATION_FLAG_UPPER_ADDRESS is not supported.
+- Defragmentation is not supported.
+- Allocation strategy flags are ignored, there is only one way to pick a node.
+
+
 \page virtual_allocator Virtual allocator
 
 As an extra feature, the core allocation algorithm of the library is exposed through a simple and convenient API of "virtual allocator".
@@ -2394,6 +2672,55 @@ D3D12MA::VirtualBlock::BuildStatsString.
 Returned string must be later freed using D3D12MA::VirtualBlock::FreeStatsString.
 The format of this string may differ from the one returned by the main D3D12 allocator, but it is similar.
 
+\section virtual_allocator_defragmentation Defragmentation
+
+A virtual block fragments like any other allocator. It can be compacted with the same algorithms as the pools
+(see \ref defragmentation), only %D3D12MA never touches your data: each pass returns a list of moves,
+old offset to new offset, you copy the data yourself and commit or cancel every move.
+
+\code
+D3D12MA::VIRTUAL_DEFRAGMENTATION_DESC defragDesc = {};
+defragDesc.Flags = D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_FULL;
+defragDesc.Alignment = 16;
+
+D3D12MA::VirtualDefragmentationContext* defragCtx;
+hr = block->BeginDefragmentation(&defragDesc, &defragCtx);
+
+D3D12MA::VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO pass;
+while (defragCtx->BeginPass(&pass) == S_FALSE)
+{
+    for (UINT32 i = 0; i < pass.MoveCount; ++i)
+    {
+        D3D12MA::VIRTUAL_DEFRAGMENTATION_MOVE& move = pass.pMoves[i];
+        MyObject* obj = (MyObject*)move.pPrivateData;
+        if (obj->IsInUse())
+        {
+            move.Operation = D3D12MA::DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+        memcpy(myData + move.DstOffset, myData + move.SrcOffset, move.Size);
+        obj->Allocation = move.DstAllocation;
+        obj->Offset = move.DstOffset;
+    }
+    if (defragCtx->EndPass(&pass) == S_OK)
+        break;
+}
+defragCtx->Release();
+\endcode
+
+With a single block the algorithms differ in what they bother to move, everything moves to lower offsets:
+
+- D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_FAST moves only the allocations that lie past the end a perfectly packed block would have,
+  the fewest moves that leave one free region at the end.
+- D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED moves an allocation when a noticeable gap is next to it or it is small,
+  compared to the average free region and allocation.
+- D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_FULL moves every allocation that fits lower.
+
+Allocations can be made and freed between passes, but not the ones in the current pass. Set their operation to
+D3D12MA::DEFRAGMENTATION_MOVE_OPERATION_DESTROY instead of freeing them.
+Defragmentation is not supported in virtual blocks created with D3D12MA::VIRTUAL_BLOCK_FLAG_ALGORITHM_LINEAR
+or D3D12MA::VIRTUAL_BLOCK_FLAG_ALGORITHM_BUDDY.
+
 \section virtual_allocator_additional_considerations Additional considerations
 
 Alternative, linear algorithm can be used with virtual allocator - see flag
@@ -1,6 +1,13 @@
 #include "VRD3D12.h"
+#include "VRGameLoop.h"
 
 VRD3D12 dx;
+// Nothing is simulated yet, the state only carries the simulation clock.
+struct SimulationState
+{
+	double Time = 0.0;
+};
+GameLoop<SimulationState> loop;
 int saved_width = 0;
 int saved_height = 0;
 
@@ -12,19 +19,15 @@ void DestroyEngine()
 	dx.Queue.Reset();
 	dx.Factory.Reset();
 	dx.Swap.Reset();
-	dx.List.Reset();
-	dx.RTVH.Reset();
 	dx.PSO.Reset();
 	dx.RSO.Reset();
+	dx.BindlessRSO.Reset();
 	dx.VertexBuffer.Reset();
 
 	{
-		dx.Alloc->Reset();
-		dx.Fence->Release();
 		dx.RT->Reset();
 	}
 	dx.Debug.Reset();
-	CloseHandle(dx.FenceEvent);
 }
 HWND InitWindow(LPCWSTR name, HINSTANCE inst, int show_cmd, int width, int height, bool fullscreen)
 {
@@ -83,11 +86,22 @@ LRESULT WindowProc(HWND hWnd, UINT msg, WPARAM w_param, LPARAM l_param)
 	switch (msg) {
 	case WM_DESTROY:
 		PostQuitMessage(0);
-		GameTimer::Stop();
+		dx.g.Stop();
+		return 0;
+	case WM_CLOSE:
+		// The render thread presents to this window, it has to stop first.
+		loop.Stop();
+		DestroyWindow(hWnd);
 		return 0;
 	case WM_KEYDOWN:
 		if (w_param == VK_ESCAPE)
+		{
+			loop.Stop();
 			DestroyWindow(hWnd);
+		}
+		// Open in chrome://tracing or ui.perfetto.dev.
+		if (w_param == VK_F12)
+			Profiler::WriteChromeTrace("Trace.json", 120);
 		return 0;
 	}
 
@@ -97,27 +111,35 @@ LRESULT WindowProc(HWND hWnd, UINT msg, WPARAM w_param, LPARAM l_param)
 
 void StartLoop(std::function<void()> init, std::function<void()> render)
 {
-	MSG msg;
-	ZeroMemory(&msg, sizeof(MSG));
-
 	init();
 
-	while (true) {
-		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+	GameLoopBase::Options options;
+	options.SimulationHz = dx.TargetRefreshHz;
+	loop.Initialize(options, SimulationState(),
+		[](const SimulationState& current, SimulationState& next, double dt) { next.Time = current.Time + dt; },
+		[render](const SimulationState&, const SimulationState&, double) { render(); });
+	loop.Run([]()
+	{
+		MSG msg;
+		// Every pending message per iteration, not one per rendered frame.
+		while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
 			if (msg.message == WM_QUIT)
-				break;
+				return false;
+			if ((msg.message >= WM_KEYFIRST && msg.message <= WM_KEYLAST) ||
+				(msg.message >= WM_MOUSEFIRST && msg.message <= WM_MOUSELAST) || msg.message == WM_INPUT)
+				loop.NotifyInput();
 
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
 		}
-		else {
-			render();
-		}
-	}
+		// Sleeps until the next message, rendering and simulation run on their own threads.
+		MsgWaitForMultipleObjects(0, nullptr, FALSE, 1, QS_ALLINPUT);
+		return true;
+	});
 }
 
 INT CALLBACK WinMain(HINSTANCE inst, HINSTANCE prev_inst, LPSTR arg, int show_cmd) {
-	GameTimer::Start();
+	dx.g.Start();
 	//int fc{ 0 };
 	//auto fps = fc / (int)dx.g.GameTime();
 	InitWindow(L"VREngine - D3D12", prev_inst, show_cmd, 1024, 764, false);
@@ -128,6 +150,8 @@ INT CALLBACK WinMain(HINSTANCE inst, HINSTANCE prev_inst, LPSTR arg, int show_cm
 
 void Init()
 {
+	SystemTime::Initialize();
+	VR_PROFILE_THREAD("Main");
 	dx.Width = 1024;
 	dx.Height = 764;
 	dx.Windowed = true;
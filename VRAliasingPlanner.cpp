@@ -0,0 +1,190 @@
+#include "VRAliasingPlanner.h"
+#include "BlackSpaceDirectX.h"
+#include <queue>
+
+static inline UINT64 AlignUp(UINT64 Value, UINT64 Alignment)
+{
+	return (Value + Alignment - 1) & ~(Alignment - 1);
+}
+
+static const D3D12_HEAP_FLAGS TransientHeapFlags[(size_t)TransientClass::Count] =
+{
+	D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS,
+	D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES,
+	D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES,
+};
+
+void AliasingPlanner::Reset()
+{
+	ReleaseHeaps();
+	m_Resources.clear();
+	m_Placements.clear();
+	m_Heaps.clear();
+	m_Stats = AliasingPlanStats();
+}
+
+UINT AliasingPlanner::AddResource(const TransientResourceDesc& Desc)
+{
+	RAID_ASSERT(Desc.Size > 0 && Desc.FirstPass <= Desc.LastPass);
+	TransientResourceDesc d = Desc;
+	if (d.Alignment == 0)
+		d.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	m_Resources.push_back(d);
+	return (UINT)m_Resources.size() - 1;
+}
+
+UINT AliasingPlanner::AddResource(ID3D12Device* Device, const char* Name, const D3D12_RESOURCE_DESC& Desc, UINT FirstPass, UINT LastPass)
+{
+	const D3D12_RESOURCE_ALLOCATION_INFO info = Device->GetResourceAllocationInfo(0, 1, &Desc);
+	TransientResourceDesc d;
+	d.Name = Name;
+	d.Size = info.SizeInBytes;
+	d.Alignment = info.Alignment;
+	if (Desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+		d.Class = TransientClass::Buffer;
+	else if (Desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL))
+		d.Class = TransientClass::RT_DS_Texture;
+	else
+		d.Class = TransientClass::Non_RT_DS_Texture;
+	d.FirstPass = FirstPass;
+	d.LastPass = LastPass;
+	return AddResource(d);
+}
+
+void AliasingPlanner::Plan(bool ResourceHeapTier2)
+{
+	ReleaseHeaps();
+	m_Heaps.clear();
+	m_Placements.assign(m_Resources.size(), TransientPlacement());
+	m_Stats = AliasingPlanStats();
+
+	// Tier 2 lets every class share memory, tier 1 needs one heap per class.
+	std::vector<UINT> members[(size_t)TransientClass::Count];
+	for (UINT i = 0; i < m_Resources.size(); i++)
+	{
+		const size_t heap_class = ResourceHeapTier2 ? 0 : (size_t)m_Resources[i].Class;
+		members[heap_class].push_back(i);
+		m_Stats.UnaliasedBytes += AlignUp(m_Resources[i].Size, m_Resources[i].Alignment);
+	}
+	for (size_t c = 0; c < (size_t)TransientClass::Count; c++)
+	{
+		if (members[c].empty())
+			continue;
+		Heap heap = {};
+		heap.Flags = ResourceHeapTier2 ? D3D12_HEAP_FLAG_NONE : TransientHeapFlags[c];
+		m_Heaps.push_back(heap);
+		PlanHeap((UINT)m_Heaps.size() - 1, members[c]);
+		m_Stats.AliasedBytes += m_Heaps.back().Size;
+	}
+}
+
+void AliasingPlanner::PlanHeap(UINT HeapIndex, const std::vector<UINT>& Members)
+{
+	// Start order: by first pass, bigger resources first so small ones fill the holes around them.
+	std::vector<UINT> order(Members);
+	std::sort(order.begin(), order.end(), [this](UINT a, UINT b)
+	{
+		const TransientResourceDesc& ra = m_Resources[a];
+		const TransientResourceDesc& rb = m_Resources[b];
+		if (ra.FirstPass != rb.FirstPass)
+			return ra.FirstPass < rb.FirstPass;
+		return ra.Size > rb.Size;
+	});
+
+	UINT64 capacity = 0;
+	UINT64 max_alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	for (UINT r : order)
+	{
+		capacity += AlignUp(m_Resources[r].Size, m_Resources[r].Alignment);
+		max_alignment = (std::max)(max_alignment, m_Resources[r].Alignment);
+	}
+
+	// Offsets only, so a block as large as the unaliased sum can never run out.
+	D3D12MA::VIRTUAL_BLOCK_DESC block_desc = {};
+	block_desc.Size = capacity + max_alignment;
+	COM<D3D12MA::VirtualBlock> block;
+	ThrowIfFailed(D3D12MA::CreateVirtualBlock(&block_desc, &block));
+
+	struct Live
+	{
+		UINT LastPass;
+		D3D12MA::VirtualAllocation Allocation;
+		bool operator<(const Live& o) const { return LastPass > o.LastPass; }
+	};
+	std::priority_queue<Live> live;
+	UINT64 peak = 0;
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const UINT r = order[i];
+		const TransientResourceDesc& res = m_Resources[r];
+		while (!live.empty() && live.top().LastPass < res.FirstPass)
+		{
+			block->FreeAllocation(live.top().Allocation);
+			live.pop();
+		}
+
+		D3D12MA::VIRTUAL_ALLOCATION_DESC alloc_desc = {};
+		alloc_desc.Flags = D3D12MA::VIRTUAL_ALLOCATION_FLAG_STRATEGY_MIN_OFFSET;
+		alloc_desc.Size = res.Size;
+		alloc_desc.Alignment = res.Alignment;
+		Live l;
+		l.LastPass = res.LastPass;
+		UINT64 offset = 0;
+		ThrowIfFailed(block->Allocate(&alloc_desc, &l.Allocation, &offset));
+		live.push(l);
+		peak = (std::max)(peak, offset + res.Size);
+
+		TransientPlacement& p = m_Placements[r];
+		p.Heap = HeapIndex;
+		p.Offset = offset;
+		// Any earlier resource of this heap that overlaps these bytes is dead by now.
+		for (size_t j = 0; j < i && !p.NeedsAliasingBarrier; j++)
+		{
+			const UINT o = order[j];
+			const TransientPlacement& po = m_Placements[o];
+			p.NeedsAliasingBarrier = po.Offset < offset + res.Size && offset < po.Offset + m_Resources[o].Size;
+		}
+	}
+	block->Clear();
+
+	Heap& heap = m_Heaps[HeapIndex];
+	heap.Alignment = max_alignment;
+	heap.Size = AlignUp(peak, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
+}
+
+void AliasingPlanner::CreateHeaps(D3D12MA::Allocator* Allocator)
+{
+	ReleaseHeaps();
+	m_Allocator = Allocator;
+	for (auto& heap : m_Heaps)
+	{
+		D3D12MA::ALLOCATION_DESC alloc_desc = {};
+		alloc_desc.HeapType = D3D12_HEAP_TYPE_DEFAULT;
+		alloc_desc.ExtraHeapFlags = heap.Flags;
+		alloc_desc.Flags = D3D12MA::ALLOCATION_FLAG_CAN_ALIAS;
+		D3D12_RESOURCE_ALLOCATION_INFO info = {};
+		info.SizeInBytes = heap.Size;
+		info.Alignment = heap.Alignment;
+		ThrowIfFailed(Allocator->AllocateMemory(&alloc_desc, &info, &heap.Allocation));
+	}
+}
+
+void AliasingPlanner::ReleaseHeaps()
+{
+	for (auto& heap : m_Heaps)
+	{
+		SAFE_RELEASE(heap.Allocation);
+		heap.Allocation = nullptr;
+	}
+	m_Allocator = nullptr;
+}
+
+HRESULT AliasingPlanner::CreateResource(UINT Resource, const D3D12_RESOURCE_DESC& Desc, D3D12_RESOURCE_STATES InitialState,
+	const D3D12_CLEAR_VALUE* ClearValue, ID3D12Resource** Out)
+{
+	RAID_ASSERT(m_Allocator != nullptr);
+	const TransientPlacement& p = m_Placements[Resource];
+	return m_Allocator->CreateAliasingResource(m_Heaps[p.Heap].Allocation, p.Offset, &Desc, InitialState,
+		ClearValue, IID_PPV_ARGS(Out));
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "VRCore.h"
+#include <d3d12.h>
+#include <wrl.h>
+#include "D3D12MemAlloc.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Memory aliasing for transient (frame-local) resources.
+* Every transient resource is described by its size/alignment and the [FirstPass, LastPass]
+* range of passes that use it. Plan() sweeps the passes in order through a D3D12MA::VirtualBlock
+* per heap: resources whose last pass is over are freed before the resources starting at the
+* current pass are placed at the lowest free offset. Resources with disjoint lifetimes end up
+* sharing bytes, and the heap only has to be as large as the peak of what is live at once.
+*
+* On D3D12_RESOURCE_HEAP_TIER_1 buffers, RT/DS textures and other textures cannot share a heap,
+* so each class gets its own heap. Tier 2 puts everything in one heap.
+*
+* Plan() is CPU only. CreateHeaps()/CreateResource() turn the plan into one D3D12MA allocation
+* per heap and placed resources created with Allocator::CreateAliasingResource.
+*/
+
+enum class TransientClass
+{
+    Buffer = 0,
+    RT_DS_Texture,
+    Non_RT_DS_Texture,
+    Count
+};
+
+struct TransientResourceDesc
+{
+    const char* Name = nullptr;
+    UINT64 Size = 0;
+    UINT64 Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+    TransientClass Class = TransientClass::RT_DS_Texture;
+    UINT FirstPass = 0;
+    UINT LastPass = 0;
+};
+
+struct TransientPlacement
+{
+    UINT Heap = 0;
+    UINT64 Offset = 0;
+    // Some earlier resource used these bytes this frame. The first use needs an ALIASING barrier
+    // and a full Clear/Discard/Copy before reading.
+    bool NeedsAliasingBarrier = false;
+};
+
+struct AliasingPlanStats
+{
+    // What the resources would need with one allocation each.
+    UINT64 UnaliasedBytes = 0;
+    // Sum of the planned heap sizes.
+    UINT64 AliasedBytes = 0;
+    UINT64 SavedBytes() const { return UnaliasedBytes - AliasedBytes; }
+    double SavedRatio() const { return UnaliasedBytes ? (double)SavedBytes() / (double)UnaliasedBytes : 0.0; }
+};
+
+class AliasingPlanner
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    ~AliasingPlanner() { ReleaseHeaps(); }
+
+    void Reset();
+    UINT AddResource(const TransientResourceDesc& Desc);
+    // Size, alignment and class come from Device->GetResourceAllocationInfo.
+    UINT AddResource(ID3D12Device* Device, const char* Name, const D3D12_RESOURCE_DESC& Desc, UINT FirstPass, UINT LastPass);
+
+    // ResourceHeapTier2 as in Allocator::GetD3D12Options().ResourceHeapTier >= D3D12_RESOURCE_HEAP_TIER_2.
+    void Plan(bool ResourceHeapTier2);
+
+    UINT GetResourceCount() const { return (UINT)m_Resources.size(); }
+    const TransientPlacement& GetPlacement(UINT Resource) const { return m_Placements[Resource]; }
+    UINT GetHeapCount() const { return (UINT)m_Heaps.size(); }
+    UINT64 GetHeapSize(UINT Heap) const { return m_Heaps[Heap].Size; }
+    // Heap flags the heap has to be allocated with (0 on tier 2).
+    D3D12_HEAP_FLAGS GetHeapFlags(UINT Heap) const { return m_Heaps[Heap].Flags; }
+    const AliasingPlanStats& GetStats() const { return m_Stats; }
+
+    // Allocates one D3D12MA allocation per planned heap.
+    void CreateHeaps(D3D12MA::Allocator* Allocator);
+    void ReleaseHeaps();
+    // Creates the placed resource for Resource at its planned offset.
+    HRESULT CreateResource(UINT Resource, const D3D12_RESOURCE_DESC& Desc, D3D12_RESOURCE_STATES InitialState,
+        const D3D12_CLEAR_VALUE* ClearValue, ID3D12Resource** Out);
+    D3D12MA::Allocation* GetHeapAllocation(UINT Heap) const { return m_Heaps[Heap].Allocation; }
+
+private:
+    struct Heap
+    {
+        D3D12_HEAP_FLAGS Flags;
+        UINT64 Size;
+        UINT64 Alignment;
+        D3D12MA::Allocation* Allocation;
+    };
+
+    void PlanHeap(UINT HeapIndex, const std::vector<UINT>& Members);
+
+    D3D12MA::Allocator* m_Allocator = nullptr;
+    std::vector<TransientResourceDesc> m_Resources;
+    std::vector<TransientPlacement> m_Placements;
+    std::vector<Heap> m_Heaps;
+    AliasingPlanStats m_Stats;
+};
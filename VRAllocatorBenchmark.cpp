@@ -0,0 +1,438 @@
+#include "VRAllocatorBenchmark.h"
+#include "BlackSpaceDirectX.h"
+#include "BSTime.h"
+#include <atomic>
+#include <mutex>
+#include <wrl.h>
+
+template<typename A>
+using COM = Microsoft::WRL::ComPtr<A>;
+
+// Live allocations per thread, the oldest is replaced by every operation.
+static const UINT BenchmarkWindow = 32;
+
+// Xorshift, so the sequence costs next to nothing.
+static uint32_t NextRandom(uint32_t& State)
+{
+	State ^= State << 13;
+	State ^= State >> 17;
+	State ^= State << 5;
+	return State;
+}
+
+// 64, 128 or 256 KB.
+static UINT64 BenchmarkSize(uint32_t& State)
+{
+	return (64 * 1024ull) << (NextRandom(State) % 3);
+}
+
+// Three in four are powers of two from 64 KB to 4 MB, the rest any multiple of 64 KB up to 4 MB.
+static UINT64 TextureSize(uint32_t& State)
+{
+	const uint32_t r = NextRandom(State);
+	if (r % 4 != 0)
+		return (64 * 1024ull) << (r / 4 % 7);
+	return (64 * 1024ull) * (1 + r / 4 % 64);
+}
+
+static UINT64 RoundUpPow2(UINT64 Size)
+{
+	UINT64 pow2 = 1;
+	while (pow2 < Size)
+		pow2 <<= 1;
+	return pow2;
+}
+
+// Starts all threads together, returns the seconds until the last one is done.
+static double RunThreads(UINT Threads, const std::function<void(UINT)>& Body)
+{
+	std::atomic<bool> go{ false };
+	std::vector<std::thread> threads;
+	for (UINT t = 0; t < Threads; t++)
+	{
+		threads.emplace_back([&go, &Body, t]
+		{
+			while (!go.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			Body(t);
+		});
+	}
+	const int64_t start = SystemTime::GetCurrentTick();
+	go.store(true, std::memory_order_release);
+	for (std::thread& t : threads)
+		t.join();
+	return SystemTime::TicksToSeconds(SystemTime::GetCurrentTick() - start);
+}
+
+static double MeasurePool(D3D12MA::Allocator* Allocator, D3D12MA::POOL_FLAGS Flags, UINT Threads, UINT Operations)
+{
+	D3D12MA::POOL_DESC pool_desc = {};
+	pool_desc.Flags = Flags;
+	pool_desc.HeapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
+	pool_desc.HeapFlags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+	COM<D3D12MA::Pool> pool;
+	ThrowIfFailed(Allocator->CreatePool(&pool_desc, &pool));
+
+	auto body = [&](UINT Thread)
+	{
+		D3D12MA::ALLOCATION_DESC alloc_desc = {};
+		alloc_desc.CustomPool = pool.Get();
+		D3D12MA::Allocation* window[BenchmarkWindow] = {};
+		uint32_t state = 0x9E3779B9u * (Thread + 1);
+		for (UINT i = 0; i < Operations; i++)
+		{
+			D3D12MA::Allocation*& slot = window[i % BenchmarkWindow];
+			if (slot)
+				slot->Release();
+			D3D12_RESOURCE_ALLOCATION_INFO info = {};
+			info.SizeInBytes = BenchmarkSize(state);
+			info.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+			slot = nullptr;
+			const HRESULT hr = Allocator->AllocateMemory(&alloc_desc, &info, &slot);
+			RAID_ASSERT(SUCCEEDED(hr));
+		}
+		for (D3D12MA::Allocation* a : window)
+		{
+			if (a)
+				a->Release();
+		}
+	};
+	// Untimed run, creates the heaps the timed one needs.
+	RunThreads(Threads, body);
+	const double seconds = RunThreads(Threads, body);
+	return (double)Operations * Threads / seconds * 1e-6;
+}
+
+static double MeasureVirtualBlock(UINT Threads, UINT Operations)
+{
+	D3D12MA::VIRTUAL_BLOCK_DESC block_desc = {};
+	block_desc.Size = (UINT64)Threads * BenchmarkWindow * 256 * 1024 * 2;
+	COM<D3D12MA::VirtualBlock> block;
+	ThrowIfFailed(D3D12MA::CreateVirtualBlock(&block_desc, &block));
+	// VirtualBlock is not thread-safe.
+	std::mutex mutex;
+
+	auto body = [&](UINT Thread)
+	{
+		D3D12MA::VirtualAllocation window[BenchmarkWindow] = {};
+		uint32_t state = 0x9E3779B9u * (Thread + 1);
+		for (UINT i = 0; i < Operations; i++)
+		{
+			D3D12MA::VirtualAllocation& slot = window[i % BenchmarkWindow];
+			D3D12MA::VIRTUAL_ALLOCATION_DESC alloc_desc = {};
+			alloc_desc.Size = BenchmarkSize(state);
+			alloc_desc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+			std::lock_guard<std::mutex> lock(mutex);
+			if (slot.AllocHandle)
+				block->FreeAllocation(slot);
+			const HRESULT hr = block->Allocate(&alloc_desc, &slot, nullptr);
+			RAID_ASSERT(SUCCEEDED(hr));
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		for (D3D12MA::VirtualAllocation a : window)
+		{
+			if (a.AllocHandle)
+				block->FreeAllocation(a);
+		}
+	};
+	RunThreads(Threads, body);
+	const double seconds = RunThreads(Threads, body);
+	return (double)Operations * Threads / seconds * 1e-6;
+}
+
+AllocatorScalingResult BenchmarkAllocatorScaling(D3D12MA::Allocator* Allocator, UINT MaxThreads, UINT Operations)
+{
+	AllocatorScalingResult r;
+	if (MaxThreads == 0)
+		MaxThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+	for (UINT threads = 1; threads <= MaxThreads; threads++)
+	{
+		AllocatorScalingPoint p;
+		p.Threads = threads;
+		p.VirtualBlockMops = MeasureVirtualBlock(threads, Operations);
+		p.PoolMops = MeasurePool(Allocator, D3D12MA::POOL_FLAG_NONE, threads, Operations);
+		p.ThreadCachePoolMops = MeasurePool(Allocator, D3D12MA::POOL_FLAG_THREAD_CACHE, threads, Operations);
+		r.Points.push_back(p);
+	}
+	return r;
+}
+
+static AlgorithmBenchmarkResult MeasureAlgorithm(D3D12MA::VIRTUAL_BLOCK_FLAGS Flags, UINT64 BlockSize, UINT Operations)
+{
+	D3D12MA::VIRTUAL_BLOCK_DESC block_desc = {};
+	block_desc.Flags = Flags;
+	block_desc.Size = BlockSize;
+	COM<D3D12MA::VirtualBlock> block;
+	ThrowIfFailed(D3D12MA::CreateVirtualBlock(&block_desc, &block));
+
+	AlgorithmBenchmarkResult r;
+	const bool buddy = (Flags & D3D12MA::VIRTUAL_BLOCK_FLAG_ALGORITHM_BUDDY) != 0;
+	uint32_t state = 0x9E3779B9u;
+	D3D12MA::VIRTUAL_ALLOCATION_DESC alloc_desc = {};
+	alloc_desc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+
+	// Fill until the first failure. Sizes are multiples of the alignment, so TLSF occupies
+	// exactly what was requested and buddy the next power of two.
+	std::vector<D3D12MA::VirtualAllocation> live;
+	UINT64 requested = 0;
+	UINT64 occupied = 0;
+	for (;;)
+	{
+		alloc_desc.Size = TextureSize(state);
+		D3D12MA::VirtualAllocation a = {};
+		if (FAILED(block->Allocate(&alloc_desc, &a, nullptr)))
+			break;
+		live.push_back(a);
+		requested += alloc_desc.Size;
+		occupied += buddy ? RoundUpPow2(alloc_desc.Size) : alloc_desc.Size;
+	}
+	r.FillRatio = (double)requested / BlockSize;
+	r.InternalFragmentation = occupied ? (double)(occupied - requested) / occupied : 0.0;
+
+	// Churn around half full: free a random half of the live allocations, then allocate as
+	// many with new sizes. Frees and allocations are timed separately, sizes are not.
+	for (size_t i = 0; i < live.size(); i += 2)
+		block->FreeAllocation(live[i]);
+	for (size_t i = 1, j = 0; i < live.size(); i += 2, j++)
+		live[j] = live[i];
+	live.resize(live.size() / 2);
+	live.reserve(live.size() * 2);
+
+	std::vector<UINT64> sizes;
+	int64_t free_ticks = 0;
+	int64_t alloc_ticks = 0;
+	UINT frees = 0;
+	UINT allocs = 0;
+	while (frees < Operations && !live.empty())
+	{
+		const size_t batch = (std::max)(live.size() / 2, (size_t)1);
+		for (size_t i = 0; i < batch; i++)
+			std::swap(live[i], live[i + NextRandom(state) % (live.size() - i)]);
+		sizes.clear();
+		for (size_t i = 0; i < batch; i++)
+			sizes.push_back(TextureSize(state));
+
+		int64_t start = SystemTime::GetCurrentTick();
+		for (size_t i = 0; i < batch; i++)
+			block->FreeAllocation(live[i]);
+		free_ticks += SystemTime::GetCurrentTick() - start;
+		live.erase(live.begin(), live.begin() + batch);
+
+		start = SystemTime::GetCurrentTick();
+		for (UINT64 size : sizes)
+		{
+			alloc_desc.Size = size;
+			D3D12MA::VirtualAllocation a = {};
+			if (SUCCEEDED(block->Allocate(&alloc_desc, &a, nullptr)))
+				live.push_back(a);
+		}
+		alloc_ticks += SystemTime::GetCurrentTick() - start;
+		frees += (UINT)batch;
+		allocs += (UINT)batch;
+	}
+	r.FreeNanosecs = frees ? SystemTime::TicksToSeconds(free_ticks) * 1e9 / frees : 0.0;
+	r.AllocNanosecs = allocs ? SystemTime::TicksToSeconds(alloc_ticks) * 1e9 / allocs : 0.0;
+
+	block->Clear();
+	return r;
+}
+
+BuddyVsTlsfResult BenchmarkBuddyVsTlsf(UINT64 BlockSize, UINT Operations)
+{
+	BuddyVsTlsfResult r;
+	r.Tlsf = MeasureAlgorithm(D3D12MA::VIRTUAL_BLOCK_FLAG_NONE, BlockSize, Operations);
+	r.Buddy = MeasureAlgorithm(D3D12MA::VIRTUAL_BLOCK_FLAG_ALGORITHM_BUDDY, BlockSize, Operations);
+	return r;
+}
+
+static void MeasurePoolBatching(D3D12MA::Allocator* Allocator, UINT Allocations, AllocatorBatchPoint& Point)
+{
+	D3D12MA::POOL_DESC pool_desc = {};
+	pool_desc.HeapProperties.Type = D3D12_HEAP_TYPE_DEFAULT;
+	pool_desc.HeapFlags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
+	COM<D3D12MA::Pool> pool;
+	ThrowIfFailed(Allocator->CreatePool(&pool_desc, &pool));
+
+	D3D12MA::ALLOCATION_DESC alloc_desc = {};
+	alloc_desc.CustomPool = pool.Get();
+	std::vector<D3D12_RESOURCE_ALLOCATION_INFO> infos(Allocations);
+	uint32_t state = 0x9E3779B9u;
+	for (D3D12_RESOURCE_ALLOCATION_INFO& info : infos)
+	{
+		info.SizeInBytes = BenchmarkSize(state);
+		info.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	}
+	std::vector<D3D12MA::Allocation*> allocations(Allocations);
+
+	int64_t alloc_ticks = 0;
+	int64_t free_ticks = 0;
+	// First run creates the heaps and is not counted.
+	for (UINT run = 0; run < 2; run++)
+	{
+		int64_t start = SystemTime::GetCurrentTick();
+		for (UINT first = 0; first < Allocations; first += Point.BatchSize)
+		{
+			const UINT count = (std::min)(Point.BatchSize, Allocations - first);
+			const HRESULT hr = Point.BatchSize == 1 ?
+				Allocator->AllocateMemory(&alloc_desc, &infos[first], &allocations[first]) :
+				Allocator->AllocateMemoryBatch(&alloc_desc, count, &infos[first], &allocations[first]);
+			RAID_ASSERT(SUCCEEDED(hr));
+		}
+		const int64_t mid = SystemTime::GetCurrentTick();
+		for (UINT first = 0; first < Allocations; first += Point.BatchSize)
+		{
+			const UINT count = (std::min)(Point.BatchSize, Allocations - first);
+			if (Point.BatchSize == 1)
+				allocations[first]->Release();
+			else
+				Allocator->FreeBatch(count, &allocations[first]);
+		}
+		if (run == 1)
+		{
+			alloc_ticks = mid - start;
+			free_ticks = SystemTime::GetCurrentTick() - mid;
+		}
+	}
+	Point.PoolAllocNanosecs = SystemTime::TicksToSeconds(alloc_ticks) * 1e9 / Allocations;
+	Point.PoolFreeNanosecs = SystemTime::TicksToSeconds(free_ticks) * 1e9 / Allocations;
+}
+
+static void MeasureVirtualBatching(UINT Allocations, AllocatorBatchPoint& Point)
+{
+	D3D12MA::VIRTUAL_BLOCK_DESC block_desc = {};
+	block_desc.Size = (UINT64)Allocations * 256 * 1024;
+	COM<D3D12MA::VirtualBlock> block;
+	ThrowIfFailed(D3D12MA::CreateVirtualBlock(&block_desc, &block));
+
+	std::vector<D3D12MA::VIRTUAL_ALLOCATION_DESC> descs(Allocations);
+	uint32_t state = 0x9E3779B9u;
+	for (D3D12MA::VIRTUAL_ALLOCATION_DESC& desc : descs)
+	{
+		desc.Size = BenchmarkSize(state);
+		desc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+	}
+	std::vector<D3D12MA::VirtualAllocation> allocations(Allocations);
+
+	const int64_t start = SystemTime::GetCurrentTick();
+	for (UINT first = 0; first < Allocations; first += Point.BatchSize)
+	{
+		const UINT count = (std::min)(Point.BatchSize, Allocations - first);
+		const HRESULT hr = Point.BatchSize == 1 ?
+			block->Allocate(&descs[first], &allocations[first], nullptr) :
+			block->AllocateBatch(count, &descs[first], &allocations[first], nullptr);
+		RAID_ASSERT(SUCCEEDED(hr));
+	}
+	const int64_t mid = SystemTime::GetCurrentTick();
+	for (UINT first = 0; first < Allocations; first += Point.BatchSize)
+	{
+		const UINT count = (std::min)(Point.BatchSize, Allocations - first);
+		if (Point.BatchSize == 1)
+			block->FreeAllocation(allocations[first]);
+		else
+			block->FreeBatch(count, &allocations[first]);
+	}
+	const int64_t end = SystemTime::GetCurrentTick();
+	Point.VirtualAllocNanosecs = SystemTime::TicksToSeconds(mid - start) * 1e9 / Allocations;
+	Point.VirtualFreeNanosecs = SystemTime::TicksToSeconds(end - mid) * 1e9 / Allocations;
+}
+
+AllocatorBatchResult BenchmarkAllocatorBatching(D3D12MA::Allocator* Allocator, UINT Allocations)
+{
+	AllocatorBatchResult r;
+	for (UINT batch = 1; ; batch *= 4)
+	{
+		AllocatorBatchPoint p;
+		p.BatchSize = (std::min)(batch, Allocations);
+		MeasurePoolBatching(Allocator, Allocations, p);
+		MeasureVirtualBatching(Allocations, p);
+		r.Points.push_back(p);
+		if (batch >= Allocations)
+			break;
+	}
+	return r;
+}
+
+static double LargestFreeShare(D3D12MA::VirtualBlock* Block)
+{
+	D3D12MA::DetailedStatistics stats = {};
+	Block->CalculateStatistics(&stats);
+	const UINT64 free = stats.Stats.BlockBytes - stats.Stats.AllocationBytes;
+	return free ? (double)stats.UnusedRangeSizeMax / free : 1.0;
+}
+
+static VirtualDefragPoint MeasureVirtualDefragmentation(D3D12MA::DEFRAGMENTATION_FLAGS Algorithm, UINT64 BlockSize, UINT MovesPerPass)
+{
+	D3D12MA::VIRTUAL_BLOCK_DESC block_desc = {};
+	block_desc.Size = BlockSize;
+	COM<D3D12MA::VirtualBlock> block;
+	ThrowIfFailed(D3D12MA::CreateVirtualBlock(&block_desc, &block));
+
+	// Same sequence for every algorithm: fill, then free a random half.
+	const UINT64 alignment = 256;
+	uint32_t state = 0x9E3779B9u;
+	D3D12MA::VIRTUAL_ALLOCATION_DESC alloc_desc = {};
+	alloc_desc.Alignment = alignment;
+	std::vector<D3D12MA::VirtualAllocation> live;
+	for (;;)
+	{
+		alloc_desc.Size = alignment * (1 + NextRandom(state) % 256);
+		D3D12MA::VirtualAllocation a = {};
+		if (FAILED(block->Allocate(&alloc_desc, &a, nullptr)))
+			break;
+		live.push_back(a);
+	}
+	for (D3D12MA::VirtualAllocation& a : live)
+	{
+		if (NextRandom(state) & 1)
+		{
+			block->FreeAllocation(a);
+			a.AllocHandle = 0;
+		}
+	}
+
+	VirtualDefragPoint p;
+	p.LargestFreeBefore = LargestFreeShare(block.Get());
+
+	D3D12MA::VIRTUAL_DEFRAGMENTATION_DESC defrag_desc = {};
+	defrag_desc.Flags = Algorithm;
+	defrag_desc.MaxAllocationsPerPass = MovesPerPass;
+	defrag_desc.Alignment = alignment;
+	COM<D3D12MA::VirtualDefragmentationContext> context;
+	ThrowIfFailed(block->BeginDefragmentation(&defrag_desc, &context));
+	D3D12MA::VIRTUAL_DEFRAGMENTATION_PASS_MOVE_INFO pass = {};
+	int64_t ticks = 0;
+	for (;;)
+	{
+		const int64_t start = SystemTime::GetCurrentTick();
+		if (context->BeginPass(&pass) == S_OK)
+		{
+			ticks += SystemTime::GetCurrentTick() - start;
+			break;
+		}
+		const HRESULT hr = context->EndPass(&pass);
+		ticks += SystemTime::GetCurrentTick() - start;
+		p.Passes++;
+		if (hr == S_OK)
+			break;
+	}
+	D3D12MA::DEFRAGMENTATION_STATS stats = {};
+	context->GetStats(&stats);
+	context.Reset();
+
+	p.AllocationsMoved = stats.AllocationsMoved;
+	p.BytesMoved = stats.BytesMoved;
+	p.PassMicrosecs = p.Passes ? SystemTime::TicksToSeconds(ticks) * 1e6 / p.Passes : 0.0;
+	p.LargestFreeAfter = LargestFreeShare(block.Get());
+	// Moves left the handles in live stale, Clear() frees everything.
+	block->Clear();
+	return p;
+}
+
+VirtualDefragResult BenchmarkVirtualDefragmentation(UINT64 BlockSize, UINT MovesPerPass)
+{
+	VirtualDefragResult r;
+	r.Fast = MeasureVirtualDefragmentation(D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_FAST, BlockSize, MovesPerPass);
+	r.Balanced = MeasureVirtualDefragmentation(D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED, BlockSize, MovesPerPass);
+	r.Full = MeasureVirtualDefragmentation(D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_FULL, BlockSize, MovesPerPass);
+	return r;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "VRCore.h"
+#include <d3d12.h>
+#include "D3D12MemAlloc.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Contention benchmark of the D3D12MA allocators, the way streaming threads use them: every thread
+* keeps a window of live placed allocations of 64 KB to 256 KB and replaces the oldest one per
+* operation, all threads on the same pool.
+*   AllocatorScalingResult r = BenchmarkAllocatorScaling(MemAllocator.Get());
+*   for (const AllocatorScalingPoint& p : r.Points) ...   // one point per thread count
+*
+* Three allocators per thread count:
+*   VirtualBlock          - one VirtualBlock behind a std::mutex, the CPU-only reference.
+*   Pool                  - custom DEFAULT buffer pool, every operation takes the pool's lock.
+*   ThreadCachePool       - same pool with POOL_FLAG_THREAD_CACHE.
+* The thread-cached pool should stay flat as threads are added while the others drop. No
+* resources are created, only memory (AllocateMemory), so the numbers are the allocator's.
+* Heaps are created in an untimed warm-up run. With fewer cores than threads, the threads take turns
+* and the points show the cost of an operation, not lock contention. Only a run on at least
+* MaxThreads cores gives the scaling curve.
+*
+* BenchmarkBuddyVsTlsf compares the default TLSF algorithm with the buddy one
+* (VIRTUAL_BLOCK_FLAG_ALGORITHM_BUDDY) on a VirtualBlock, single-threaded, with texture-like sizes:
+* mostly powers of two from 64 KB to 4 MB, the rest arbitrary multiples of 64 KB.
+*   BuddyVsTlsfResult r = BenchmarkBuddyVsTlsf();
+*
+* BenchmarkAllocatorBatching measures the cost per allocation of loading many buffers at once
+* with AllocateMemoryBatch / FreeBatch (and the VirtualBlock equivalents) against the batch size.
+* Batch size 1 uses AllocateMemory / Release and Allocate / FreeAllocation, the baseline.
+*   for (const AllocatorBatchPoint& p : BenchmarkAllocatorBatching(MemAllocator.Get()).Points) ...
+*
+* BenchmarkVirtualDefragmentation fragments a VirtualBlock the way a big mapped buffer gets
+* fragmented (256 B to 64 KB, half of them freed) and compacts it with each algorithm, committing
+* every move. Only the allocator's bookkeeping is timed, no data is copied.
+*   VirtualDefragResult r = BenchmarkVirtualDefragmentation();
+*/
+
+struct AllocatorScalingPoint
+{
+    UINT Threads = 0;
+    // Million operations (one free + one allocation) per second, all threads together.
+    double VirtualBlockMops = 0.0;
+    double PoolMops = 0.0;
+    double ThreadCachePoolMops = 0.0;
+};
+
+struct AllocatorScalingResult
+{
+    std::vector<AllocatorScalingPoint> Points;
+};
+
+// MaxThreads 0 = hardware_concurrency. Operations per thread per run.
+AllocatorScalingResult BenchmarkAllocatorScaling(D3D12MA::Allocator* Allocator, UINT MaxThreads = 0, UINT Operations = 100000);
+
+struct AlgorithmBenchmarkResult
+{
+    // Average nanoseconds per allocation and per free while churning a half-full block.
+    double AllocNanosecs = 0.0;
+    double FreeNanosecs = 0.0;
+    // Requested bytes / block size when the first allocation fails, filling an empty block.
+    double FillRatio = 0.0;
+    // Share of occupied bytes lost to rounding inside allocations (buddy nodes), at that point.
+    double InternalFragmentation = 0.0;
+};
+
+struct BuddyVsTlsfResult
+{
+    AlgorithmBenchmarkResult Tlsf;
+    AlgorithmBenchmarkResult Buddy;
+};
+
+// BlockSize of the VirtualBlock, Operations free + allocation pairs in the timed churn.
+BuddyVsTlsfResult BenchmarkBuddyVsTlsf(UINT64 BlockSize = 256ull * 1024 * 1024, UINT Operations = 200000);
+
+struct AllocatorBatchPoint
+{
+    UINT BatchSize = 0;
+    // Average nanoseconds per allocation, allocating and then freeing everything.
+    double PoolAllocNanosecs = 0.0;
+    double PoolFreeNanosecs = 0.0;
+    double VirtualAllocNanosecs = 0.0;
+    double VirtualFreeNanosecs = 0.0;
+};
+
+struct AllocatorBatchResult
+{
+    std::vector<AllocatorBatchPoint> Points;
+};
+
+// Allocations per run, in batch sizes 1, 4, 16 ... up to Allocations.
+AllocatorBatchResult BenchmarkAllocatorBatching(D3D12MA::Allocator* Allocator, UINT Allocations = 4096);
+
+struct VirtualDefragPoint
+{
+    UINT Passes = 0;
+    UINT AllocationsMoved = 0;
+    UINT64 BytesMoved = 0;
+    // Average microseconds per pass, BeginPass and EndPass together.
+    double PassMicrosecs = 0.0;
+    // Largest free region / all free bytes, before and after. 1 = a single free region.
+    double LargestFreeBefore = 0.0;
+    double LargestFreeAfter = 0.0;
+};
+
+struct VirtualDefragResult
+{
+    VirtualDefragPoint Fast;
+    VirtualDefragPoint Balanced;
+    VirtualDefragPoint Full;
+};
+
+// BlockSize of the VirtualBlock, at most MovesPerPass allocations moved per pass.
+VirtualDefragResult BenchmarkVirtualDefragmentation(UINT64 BlockSize = 64ull * 1024 * 1024, UINT MovesPerPass = 64);
@@ -0,0 +1,211 @@
+#include "VRBindlessTable.h"
+#include "BlackSpaceDirectX.h"
+
+static inline UINT NextGeneration(UINT Generation)
+{
+	// Generation 0 is reserved so that a null handle is never valid.
+	const UINT next = (Generation + 1) & BindlessTable::GenerationMask;
+	return next ? next : 1;
+}
+
+void BindlessTable::Initialize(ShaderVisibleDescriptorHeap* Heap)
+{
+	InitializeHeadless(Heap->GetPersistentCount());
+	m_Heap = Heap;
+}
+
+void BindlessTable::InitializeHeadless(UINT Capacity)
+{
+	RAID_ASSERT(Capacity <= MaxCapacity);
+	m_Heap = nullptr;
+	m_Capacity = Capacity;
+	m_Free.Initialize(Capacity);
+	m_Generations = std::make_unique<std::atomic<UINT>[]>(Capacity);
+	for (UINT i = 0; i < Capacity; i++)
+	{
+		m_Generations[i].store(1, std::memory_order_relaxed);
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Freed.clear();
+	m_Freed.reserve(ReservedFreesPerFrame);
+	m_Retiring.resize(MaxRetiringFrames);
+	for (Retiring& r : m_Retiring)
+	{
+		r.FenceValue = 0;
+		r.Slots.clear();
+		r.Slots.reserve(ReservedFreesPerFrame);
+	}
+	m_FirstRetiring = 0;
+	m_RetiringCount = 0;
+	m_PendingCount = 0;
+	m_Failed.store(0, std::memory_order_relaxed);
+	m_StaleFrees.store(0, std::memory_order_relaxed);
+}
+
+void BindlessTable::Destroy()
+{
+	m_Free.Destroy();
+	m_Generations.reset();
+	m_Capacity = 0;
+	m_Heap = nullptr;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Freed.clear();
+	m_Retiring.clear();
+	m_FirstRetiring = 0;
+	m_RetiringCount = 0;
+	m_PendingCount = 0;
+}
+
+void BindlessTable::BeginFrame(UINT64 CompletedFenceValue)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	while (m_RetiringCount > 0 && m_Retiring[m_FirstRetiring].FenceValue <= CompletedFenceValue)
+	{
+		Retiring& r = m_Retiring[m_FirstRetiring];
+		for (UINT slot : r.Slots)
+		{
+			m_Free.Free(slot);
+		}
+		m_PendingCount -= (UINT)r.Slots.size();
+		// Keeps its capacity for the batch that lands here next.
+		r.Slots.clear();
+		m_FirstRetiring = (m_FirstRetiring + 1) % (UINT)m_Retiring.size();
+		m_RetiringCount--;
+	}
+}
+
+void BindlessTable::EndFrame(UINT64 FenceValue)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Freed.empty())
+		return;
+	if (m_RetiringCount == (UINT)m_Retiring.size())
+	{
+		// No batch free, the newest one waits for this frame's fence instead.
+		Retiring& newest = m_Retiring[(m_FirstRetiring + m_RetiringCount - 1) % m_Retiring.size()];
+		newest.FenceValue = FenceValue;
+		newest.Slots.insert(newest.Slots.end(), m_Freed.begin(), m_Freed.end());
+		m_Freed.clear();
+		return;
+	}
+	Retiring& r = m_Retiring[(m_FirstRetiring + m_RetiringCount) % m_Retiring.size()];
+	r.FenceValue = FenceValue;
+	// The batch takes the frame's list, the frame goes on with the batch's empty one.
+	r.Slots.swap(m_Freed);
+	m_RetiringCount++;
+}
+
+BindlessHandle BindlessTable::Allocate()
+{
+	const UINT index = m_Free.Allocate();
+	if (index == DescriptorFreeList::Invalid)
+	{
+		m_Failed.fetch_add(1, std::memory_order_relaxed);
+		return BindlessHandle();
+	}
+	return MakeHandle(index, m_Generations[index].load(std::memory_order_acquire));
+}
+
+BindlessHandle BindlessTable::Allocate(D3D12_CPU_DESCRIPTOR_HANDLE Source)
+{
+	const BindlessHandle handle = Allocate();
+	if (!handle.IsNull() && m_Heap)
+	{
+		m_Heap->GetDevice()->CopyDescriptorsSimple(1, GetCPUHandle(handle), Source,
+			D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	}
+	return handle;
+}
+
+void BindlessTable::Free(BindlessHandle Handle)
+{
+	const UINT index = GetIndex(Handle);
+	UINT generation = GetGeneration(Handle);
+	// Only the holder of the current generation may free, and only once.
+	if (Handle.IsNull() || index >= m_Capacity ||
+		!m_Generations[index].compare_exchange_strong(generation, NextGeneration(generation), std::memory_order_acq_rel))
+	{
+		m_StaleFrees.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Freed.push_back(index);
+	m_PendingCount++;
+}
+
+bool BindlessTable::IsValid(BindlessHandle Handle) const
+{
+	const UINT index = GetIndex(Handle);
+	return !Handle.IsNull() && index < m_Capacity &&
+		m_Generations[index].load(std::memory_order_acquire) == GetGeneration(Handle);
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE BindlessTable::GetCPUHandle(BindlessHandle Handle) const
+{
+	RAID_ASSERT(m_Heap != nullptr);
+	// The persistent descriptors start at index 0 of the heap, slot == heap index.
+	return m_Heap->GetCPUHandle(GetIndex(Handle));
+}
+
+D3D12_GPU_DESCRIPTOR_HANDLE BindlessTable::GetTableStart() const
+{
+	RAID_ASSERT(m_Heap != nullptr);
+	return m_Heap->GetGPUHandle(0);
+}
+
+BindlessTableStats BindlessTable::GetStats()
+{
+	BindlessTableStats s;
+	s.Capacity = m_Capacity;
+	s.Allocated = m_Free.GetAllocatedCount();
+	s.FailedAllocations = m_Failed.load(std::memory_order_relaxed);
+	s.StaleFrees = m_StaleFrees.load(std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	s.PendingFree = m_PendingCount;
+	// Pending slots are still counted by the free list.
+	s.Allocated -= m_PendingCount;
+	return s;
+}
+
+void BindlessRootSignature::Build(const Desc& Config)
+{
+	RAID_ASSERT(Config.RootConstants > 0 && Config.SRVSpaces + Config.UAVSpaces > 0);
+	m_Config = Config;
+
+	// Slots are written between frames while the table stays bound, so descriptors are volatile.
+	const D3D12_DESCRIPTOR_RANGE_FLAGS flags = D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE;
+	m_Ranges.resize(Config.SRVSpaces + Config.UAVSpaces);
+	UINT space = 1;
+	for (UINT s = 0; s < Config.SRVSpaces; s++, space++)
+	{
+		CD3DX12_DESCRIPTOR_RANGE1::Init(m_Ranges[s], D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, space, flags, 0);
+	}
+	for (UINT u = 0; u < Config.UAVSpaces; u++, space++)
+	{
+		CD3DX12_DESCRIPTOR_RANGE1::Init(m_Ranges[Config.SRVSpaces + u], D3D12_DESCRIPTOR_RANGE_TYPE_UAV, UINT_MAX, 0, space, flags, 0);
+	}
+
+	m_Parameters.resize(2);
+	CD3DX12_ROOT_PARAMETER1::InitAsConstants(m_Parameters[ConstantsParameter], Config.RootConstants, 0, 0);
+	CD3DX12_ROOT_PARAMETER1::InitAsDescriptorTable(m_Parameters[TableParameter], (UINT)m_Ranges.size(), m_Ranges.data());
+
+	CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC::Init_1_1(m_Desc, (UINT)m_Parameters.size(), m_Parameters.data(),
+		(UINT)m_Config.StaticSamplers.size(), m_Config.StaticSamplers.data(), Config.Flags);
+}
+
+HRESULT BindlessRootSignature::Create(ID3D12Device* Device, ID3D12RootSignature** Out, ID3DBlob** Blob) const
+{
+	COM<ID3DBlob> serialized;
+	COM<ID3DBlob> error;
+	HRESULT hr = D3DX12SerializeVersionedRootSignature(&m_Desc, D3D_ROOT_SIGNATURE_VERSION_1_1, &serialized, &error);
+	if (FAILED(hr))
+	{
+		if (error)
+			OutputDebugStringA((const char*)error->GetBufferPointer());
+		return hr;
+	}
+	hr = Device->CreateRootSignature(0, serialized->GetBufferPointer(), serialized->GetBufferSize(), IID_PPV_ARGS(Out));
+	if (SUCCEEDED(hr) && Blob)
+		*Blob = serialized.Detach();
+	return hr;
+}
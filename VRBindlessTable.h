@@ -0,0 +1,144 @@
+#pragma once
+#include "VRCore.h"
+#include <mutex>
+#include "VRDescriptorAllocator.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Bindless resources. Every texture/buffer view gets a stable slot in the persistent part of the
+* shader-visible CBV/SRV/UAV heap, and shaders index one unbounded descriptor range with it.
+* Materials and draws only pass indices (root constants or a constant buffer), the descriptor
+* table is set once per command list instead of once per draw.
+*
+* A BindlessHandle packs the slot index (low IndexBits) and a generation (high bits). Free()
+* bumps the generation immediately, so a stale handle fails IsValid() on the CPU. The slot itself
+* is only reused after the fence of the frame that freed it completed, so the GPU never reads a
+* descriptor that was overwritten under it.
+* Frees of a frame retire as one batch in a ring of MaxRetiringFrames batches made in Initialize,
+* the slot lists are reused in place, so freeing inside the frame does not allocate once every
+* list grew to the frees of a busy frame. With the ring full, EndFrame folds the frame's frees
+* into the newest batch (they wait for the later fence).
+*
+* BindlessRootSignature builds the matching root signature with CD3DX12_DESCRIPTOR_RANGE1 /
+* CD3DX12_ROOT_PARAMETER1:
+*   parameter 0: RootConstants 32 bit constants at b0, space0
+*   parameter 1: descriptor table, for each SRV space s: Texture2D/Buffer[] at t0, space(1 + s),
+*                for each UAV space u: RW*[] at u0, space(1 + SRVSpaces + u), all unbounded at offset 0
+* Building the description needs no device, Create() serializes it as root signature 1.1.
+*/
+
+struct BindlessHandle
+{
+    UINT Value = 0;
+
+    bool IsNull() const { return Value == 0; }
+    bool operator==(const BindlessHandle& o) const { return Value == o.Value; }
+    bool operator!=(const BindlessHandle& o) const { return Value != o.Value; }
+};
+
+struct BindlessTableStats
+{
+    UINT Capacity = 0;
+    UINT Allocated = 0;
+    // Freed but waiting for their frame's fence.
+    UINT PendingFree = 0;
+    UINT64 FailedAllocations = 0;
+    UINT64 StaleFrees = 0;
+};
+
+class BindlessTable
+{
+public:
+    const static UINT IndexBits = 20;
+    const static UINT IndexMask = (1u << IndexBits) - 1;
+    const static UINT GenerationMask = (1u << (32 - IndexBits)) - 1;
+    const static UINT MaxCapacity = 1u << IndexBits;
+    // Frames with frees in flight at once, as many as FrameScheduler::MaxSlots.
+    const static UINT MaxRetiringFrames = 8;
+    // Slot list size each batch starts with.
+    const static UINT ReservedFreesPerFrame = 256;
+
+    // Uses the persistent descriptors of Heap.
+    void Initialize(ShaderVisibleDescriptorHeap* Heap);
+    // Bookkeeping only.
+    void InitializeHeadless(UINT Capacity);
+    void Destroy();
+
+    // Call with the queue's completed fence value, recycles slots freed by finished frames.
+    void BeginFrame(UINT64 CompletedFenceValue);
+    // Call with the fence value signaled after the frame, stamps the slots freed during it.
+    void EndFrame(UINT64 FenceValue);
+
+    // Thread-safe. Returns a null handle when the table is full.
+    BindlessHandle Allocate();
+    // Thread-safe. Allocates and copies Source (a staging CBV/SRV/UAV) into the slot.
+    BindlessHandle Allocate(D3D12_CPU_DESCRIPTOR_HANDLE Source);
+    // Thread-safe. Stale or double frees are ignored (and counted).
+    void Free(BindlessHandle Handle);
+    bool IsValid(BindlessHandle Handle) const;
+
+    // What the shader indexes with.
+    static UINT GetIndex(BindlessHandle Handle) { return Handle.Value & IndexMask; }
+    static UINT GetGeneration(BindlessHandle Handle) { return Handle.Value >> IndexBits; }
+    static BindlessHandle MakeHandle(UINT Index, UINT Generation) { return { (Generation << IndexBits) | Index }; }
+
+    // Slot descriptor, to create a view directly into it (CreateShaderResourceView etc).
+    D3D12_CPU_DESCRIPTOR_HANDLE GetCPUHandle(BindlessHandle Handle) const;
+    // Pass to SetGraphicsRootDescriptorTable(BindlessRootSignature::TableParameter, ...).
+    D3D12_GPU_DESCRIPTOR_HANDLE GetTableStart() const;
+
+    BindlessTableStats GetStats();
+
+private:
+    struct Retiring
+    {
+        UINT64 FenceValue;
+        std::vector<UINT> Slots;
+    };
+
+    ShaderVisibleDescriptorHeap* m_Heap = nullptr;
+    DescriptorFreeList m_Free;
+    std::unique_ptr<std::atomic<UINT>[]> m_Generations;
+    UINT m_Capacity = 0;
+
+    std::mutex m_Mutex;
+    std::vector<UINT> m_Freed;
+    // Ring of MaxRetiringFrames batches, oldest at m_FirstRetiring.
+    std::vector<Retiring> m_Retiring;
+    UINT m_FirstRetiring = 0;
+    UINT m_RetiringCount = 0;
+    UINT m_PendingCount = 0;
+    std::atomic<UINT64> m_Failed{ 0 };
+    std::atomic<UINT64> m_StaleFrees{ 0 };
+};
+
+class BindlessRootSignature
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    const static UINT ConstantsParameter = 0;
+    const static UINT TableParameter = 1;
+
+    struct Desc
+    {
+        UINT RootConstants = 16;
+        UINT SRVSpaces = 1;
+        UINT UAVSpaces = 1;
+        D3D12_ROOT_SIGNATURE_FLAGS Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
+        std::vector<D3D12_STATIC_SAMPLER_DESC> StaticSamplers;
+    };
+
+    // Fills the versioned description, pointers stay valid until the next Build().
+    void Build(const Desc& Config);
+    const D3D12_VERSIONED_ROOT_SIGNATURE_DESC& GetDesc() const { return m_Desc; }
+
+    // Serializes and creates the root signature. Blob (optional) receives the serialized form.
+    HRESULT Create(ID3D12Device* Device, ID3D12RootSignature** Out, ID3DBlob** Blob = nullptr) const;
+
+private:
+    Desc m_Config;
+    std::vector<D3D12_DESCRIPTOR_RANGE1> m_Ranges;
+    std::vector<D3D12_ROOT_PARAMETER1> m_Parameters;
+    D3D12_VERSIONED_ROOT_SIGNATURE_DESC m_Desc = {};
+};
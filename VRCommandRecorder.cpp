@@ -0,0 +1,55 @@
+#include "VRCommandRecorder.h"
+#include "BlackSpaceDirectX.h"
+
+void D3D12CommandListBackend::Initialize(ID3D12Device* Device, ID3D12CommandQueue* Queue, D3D12_COMMAND_LIST_TYPE Type)
+{
+	m_Device = Device;
+	m_Queue = Queue;
+	m_Type = Type;
+}
+
+D3D12CommandListBackend::Allocator D3D12CommandListBackend::CreateAllocator()
+{
+	ID3D12CommandAllocator* alloc = nullptr;
+	ThrowIfFailed(m_Device->CreateCommandAllocator(m_Type, IID_PPV_ARGS(&alloc)));
+	return alloc;
+}
+
+D3D12CommandListBackend::List D3D12CommandListBackend::CreateList(Allocator Alloc)
+{
+	ID3D12GraphicsCommandList* list = nullptr;
+	ThrowIfFailed(m_Device->CreateCommandList(0, m_Type, Alloc, nullptr, IID_PPV_ARGS(&list)));
+	ThrowIfFailed(list->Close());
+	return list;
+}
+
+void D3D12CommandListBackend::ResetAllocator(Allocator Alloc)
+{
+	ThrowIfFailed(Alloc->Reset());
+}
+
+void D3D12CommandListBackend::ResetList(List CmdList, Allocator Alloc)
+{
+	ThrowIfFailed(CmdList->Reset(Alloc, nullptr));
+}
+
+void D3D12CommandListBackend::CloseList(List CmdList)
+{
+	ThrowIfFailed(CmdList->Close());
+}
+
+void D3D12CommandListBackend::Execute(const List* Lists, UINT Count)
+{
+	m_Submit.assign(Lists, Lists + Count);
+	m_Queue->ExecuteCommandLists(Count, m_Submit.data());
+}
+
+void D3D12CommandListBackend::ReleaseAllocator(Allocator Alloc)
+{
+	SAFE_RELEASE(Alloc);
+}
+
+void D3D12CommandListBackend::ReleaseList(List CmdList)
+{
+	SAFE_RELEASE(CmdList);
+}
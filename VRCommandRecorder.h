@@ -0,0 +1,201 @@
+#pragma once
+#include "VRCore.h"
+#include <deque>
+#include <mutex>
+#include <d3d12.h>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Multi-threaded command list recording.
+* CommandListPool keeps a pool of (allocator, list) pairs per back buffer. Every recording thread
+* acquires its own pair for the frame, so no two threads ever touch the same allocator.
+* Submit() closes everything that was acquired and hands it to the queue in one
+* ExecuteCommandLists batch, ordered by the key given at Acquire time.
+*
+* The pool is written against a Backend so the scheduling can be checked with a stand-in
+* that just logs calls. A Backend provides:
+*   typedef ... Allocator; typedef ... List;
+*   Allocator CreateAllocator();
+*   List CreateList(Allocator);               (returned closed)
+*   void ResetAllocator(Allocator);
+*   void ResetList(List, Allocator);
+*   void CloseList(List);
+*   void Execute(const List* Lists, UINT Count);
+*   void ReleaseAllocator(Allocator); void ReleaseList(List);
+*/
+
+struct CommandListPoolStats
+{
+    UINT64 ListsSubmitted = 0;
+    UINT64 Batches = 0;
+    // Pairs created since Initialize. Stops growing once the pool is warm.
+    UINT64 ContextsCreated = 0;
+    UINT PeakContextsPerFrame = 0;
+};
+
+template<typename Backend>
+class CommandListPool
+{
+public:
+    typedef typename Backend::Allocator AllocatorT;
+    typedef typename Backend::List ListT;
+
+    struct Context
+    {
+        AllocatorT Allocator{};
+        ListT List{};
+        // Position of this list in the submitted batch.
+        UINT Order = 0;
+        bool Closed = true;
+    };
+
+    const static UINT MaxSlots = 8;
+
+    ~CommandListPool() { Destroy(); }
+
+    void Initialize(Backend* Api, UINT Slots)
+    {
+        RAID_ASSERT(Api != nullptr);
+        RAID_ASSERT(Slots > 0 && Slots <= MaxSlots);
+        m_Api = Api;
+        m_Slots = Slots;
+        m_Slot = 0;
+        m_Stats = CommandListPoolStats();
+    }
+
+    void Destroy()
+    {
+        if (m_Api == nullptr)
+            return;
+        for (UINT s = 0; s < m_Slots; s++)
+        {
+            for (auto& c : m_Pools[s].Contexts)
+            {
+                m_Api->ReleaseList(c.List);
+                m_Api->ReleaseAllocator(c.Allocator);
+            }
+            m_Pools[s].Contexts.clear();
+            m_Pools[s].Used = 0;
+        }
+        m_Api = nullptr;
+    }
+
+    // Call after FrameScheduler::BeginFrame(Slot), the GPU is done with this slot's allocators.
+    void BeginFrame(UINT Slot)
+    {
+        RAID_ASSERT(Slot < m_Slots);
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        SlotPool& pool = m_Pools[Slot];
+        for (UINT i = 0; i < pool.Used; i++)
+        {
+            m_Api->ResetAllocator(pool.Contexts[i].Allocator);
+        }
+        pool.Used = 0;
+        m_Submitted = 0;
+        m_Slot = Slot;
+    }
+
+    // Thread-safe. Returns an open list owned by the caller until Submit().
+    Context* Acquire(UINT Order)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        SlotPool& pool = m_Pools[m_Slot];
+        if (pool.Used == pool.Contexts.size())
+        {
+            Context c;
+            c.Allocator = m_Api->CreateAllocator();
+            c.List = m_Api->CreateList(c.Allocator);
+            pool.Contexts.push_back(c);
+            m_Stats.ContextsCreated++;
+        }
+        Context* context = &pool.Contexts[pool.Used++];
+        m_Stats.PeakContextsPerFrame = (std::max)(m_Stats.PeakContextsPerFrame, pool.Used);
+        // Allocator was reset in BeginFrame (or is fresh), only the list needs reopening.
+        m_Api->ResetList(context->List, context->Allocator);
+        context->Order = Order;
+        context->Closed = false;
+        return context;
+    }
+
+    // Recording threads may close their own list when they finish, Submit() closes the rest.
+    void Close(Context* context)
+    {
+        if (!context->Closed)
+        {
+            m_Api->CloseList(context->List);
+            context->Closed = true;
+        }
+    }
+
+    // Submits every list acquired since the last Submit in one ExecuteCommandLists call, sorted by Order.
+    // Must be called once all recording threads are done.
+    void Submit()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        SlotPool& pool = m_Pools[m_Slot];
+        if (pool.Used == m_Submitted)
+            return;
+        m_Batch.clear();
+        for (UINT i = m_Submitted; i < pool.Used; i++)
+        {
+            m_Batch.push_back(&pool.Contexts[i]);
+        }
+        std::stable_sort(m_Batch.begin(), m_Batch.end(),
+            [](const Context* a, const Context* b) { return a->Order < b->Order; });
+        m_Lists.clear();
+        for (Context* c : m_Batch)
+        {
+            Close(c);
+            m_Lists.push_back(c->List);
+        }
+        m_Api->Execute(m_Lists.data(), (UINT)m_Lists.size());
+        m_Submitted = pool.Used;
+        m_Stats.ListsSubmitted += m_Lists.size();
+        m_Stats.Batches++;
+    }
+
+    UINT GetCurrentSlot() const { return m_Slot; }
+    const CommandListPoolStats& GetStats() const { return m_Stats; }
+
+private:
+    struct SlotPool
+    {
+        // deque keeps Context pointers stable while the pool grows.
+        std::deque<Context> Contexts;
+        UINT Used = 0;
+    };
+
+    Backend* m_Api = nullptr;
+    SlotPool m_Pools[MaxSlots];
+    UINT m_Slots = 0;
+    UINT m_Slot = 0;
+    UINT m_Submitted = 0;
+    std::mutex m_Mutex;
+    std::vector<Context*> m_Batch;
+    std::vector<ListT> m_Lists;
+    CommandListPoolStats m_Stats;
+};
+
+// Backend for CommandListPool on a real device and queue.
+class D3D12CommandListBackend
+{
+public:
+    typedef ID3D12CommandAllocator* Allocator;
+    typedef ID3D12GraphicsCommandList* List;
+
+    void Initialize(ID3D12Device* Device, ID3D12CommandQueue* Queue, D3D12_COMMAND_LIST_TYPE Type);
+
+    Allocator CreateAllocator();
+    List CreateList(Allocator Alloc);
+    void ResetAllocator(Allocator Alloc);
+    void ResetList(List CmdList, Allocator Alloc);
+    void CloseList(List CmdList);
+    void Execute(const List* Lists, UINT Count);
+    void ReleaseAllocator(Allocator Alloc);
+    void ReleaseList(List CmdList);
+
+private:
+    ID3D12Device* m_Device = nullptr;
+    ID3D12CommandQueue* m_Queue = nullptr;
+    D3D12_COMMAND_LIST_TYPE m_Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
+    std::vector<ID3D12CommandList*> m_Submit;
+};
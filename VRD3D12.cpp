@@ -18,6 +18,13 @@ void VRD3D12::CreateContexts(HWND win)
 	ThrowIfFailed(Device->CreateCommandQueue(&cmd_queue_desc, IID_PPV_ARGS(&Queue)));
 	FindAdaptors();
 
+	D3D12MA::ALLOCATOR_DESC allocator_desc = {};
+	allocator_desc.pDevice = Device.Get();
+	allocator_desc.pAdapter = Adapter.Get();
+	// Streaming and recording threads allocate placed resources concurrently, keep small ones per thread.
+	allocator_desc.Flags = D3D12MA::ALLOCATOR_FLAG_DEFAULT_POOLS_THREAD_CACHE;
+	ThrowIfFailed(D3D12MA::CreateAllocator(&allocator_desc, &MemAllocator));
+
 	DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
 	swapChainDesc.BufferDesc.Width = Width;
 	swapChainDesc.BufferDesc.Height = Height;
@@ -39,30 +46,44 @@ void VRD3D12::CreateContexts(HWND win)
 	ThrowIfFailed(swapChain.As(&Swap));
 	BBIndex = Swap->GetCurrentBackBufferIndex();
 
-	D3D12_DESCRIPTOR_HEAP_DESC d = {};
-	d.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
-	d.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
-	d.NumDescriptors = Buffers;
-	ThrowIfFailed(Device->CreateDescriptorHeap(&d, IID_PPV_ARGS(&RTVH)));
-	RTVSize = Device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-	CD3DX12_CPU_DESCRIPTOR_HANDLE rtv_handle(RTVH->GetCPUDescriptorHandleForHeapStart());
+	DescriptorAllocator::Desc descriptor_desc;
+	descriptor_desc.BindlessCount = BindlessSlots;
+	Descriptors.Initialize(Device.Get(), descriptor_desc);
+	Bindless.Initialize(&Descriptors.GetShaderVisible());
 	for (UINT a = 0; a < Buffers; a++)
 	{
 		ThrowIfFailed(Swap->GetBuffer(a, IID_PPV_ARGS(&RT[a])));
-		Device->CreateRenderTargetView(RT[a].Get(), nullptr, rtv_handle);
-		rtv_handle.Offset(1, RTVSize);
-		/// Push Resources to ResourcePool for destruction.
-		ResourcePool.push_back(RT[a].Get());
+		BackBufferRTV[a] = Descriptors.AllocateStaging(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+		Device->CreateRenderTargetView(RT[a].Get(), nullptr, BackBufferRTV[a]);
 	}
 	BBIndex = Swap->GetCurrentBackBufferIndex();
-	for (static int l = 0; l < Buffers; l++)
-	{
-		ThrowIfFailed(Device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&Alloc[l])));
-	}
-	ThrowIfFailed(Device->CreateCommandList(NULL, D3D12_COMMAND_LIST_TYPE_DIRECT, Alloc[BBIndex].Get(), NULL, IID_PPV_ARGS(&List)));
-	ThrowIfFailed(List->Close());
-	Alloc[Buffers]->Reset();
+	// Allocators and lists are created on demand, one pair per recording thread per back buffer.
+	CommandListApi.Initialize(Device.Get(), Queue.Get(), D3D12_COMMAND_LIST_TYPE_DIRECT);
+	CommandLists.Initialize(&CommandListApi, Buffers);
+	JobSystem::Options job_options;
+	job_options.Workers = RecordThreads;
+	job_options.PinWorkers = PinRenderThread;
+	job_options.ReserveRenderCore = PinRenderThread;
+	Jobs.Initialize(job_options);
 	SetFenceEvents();
+	Upload.Initialize(Device.Get(), Buffers, UploadBytesPerFrame);
+	FrameMemory.Initialize(Buffers, FrameMemoryChunkBytes);
+	// Big texture copies into staging are split over the job threads (idle at that point of the frame).
+	CopyQueue.Initialize(Device.Get(), StreamingStagingBytes,
+		[this](UINT Tasks, const std::function<void(UINT)>& Task) { Jobs.Run(Tasks, Task); });
+	Streamer.Initialize(&CopyQueue, StreamingStagingBytes, StreamingBytesPerFrame, D3D12UploadQueue::MaxBatches);
+	// One slot more than back buffers, so a frame never waits for the readback of another.
+	TimestampQueries.Initialize(Device.Get(), Queue.Get(), Buffers + 1, GpuTimedPasses * 2);
+	GpuTimings.Initialize(&TimestampQueries, Buffers + 1, GpuTimedPasses);
+	FrameTimes.Initialize(TargetRefreshHz);
+	FramePacer::Options pacing;
+	pacing.RefreshHz = TargetRefreshHz;
+	Pacer.Initialize(pacing);
+	Graph.SetPassHooks(
+		[this](ID3D12GraphicsCommandList* l, const char* name) { return GpuTimings.BeginPass(l, name); },
+		[this](ID3D12GraphicsCommandList* l, UINT pass) { GpuTimings.EndPass(l, pass); });
+	Shaders.Initialize(&ShaderCompiler, L"ShaderCache");
+	Pipelines.Initialize(Device.Get(), Adapter.Get(), L"ShaderCache/Pipelines.bin");
 }
 
 void VRD3D12::InitBaseAssets()
@@ -88,6 +109,13 @@ void VRD3D12::InitBaseAssets()
 	ThrowIfFailed(D3D12SerializeRootSignature(&rsd, D3D_ROOT_SIGNATURE_VERSION_1, &Sign, nullptr));
 	ThrowIfFailed(Device->CreateRootSignature(NULL, Sign->GetBufferPointer(), Sign->GetBufferSize(), IID_PPV_ARGS(&RSO)));
 	RSO->SetName(L"MainRSO");
+	Pipelines.GetHasher().RegisterRootSignature(RSO.Get(), Sign->GetBufferPointer(), Sign->GetBufferSize());
+
+	COM<ID3DBlob> bindless_blob;
+	BindlessLayout.Build(BindlessRootSignature::Desc());
+	ThrowIfFailed(BindlessLayout.Create(Device.Get(), &BindlessRSO, &bindless_blob));
+	BindlessRSO->SetName(L"BindlessRSO");
+	Pipelines.GetHasher().RegisterRootSignature(BindlessRSO.Get(), bindless_blob->GetBufferPointer(), bindless_blob->GetBufferSize());
 	// CreateShader()
 }
 
@@ -95,23 +123,37 @@ void VRD3D12::DestroyResources()
 {
 	if (Queue)
 		WaitForPrevFrame();
-
-	for (auto& r : ResourcePool)
-	{
-		r->Release();
-	}
+	// The GPU is idle, everything still queued can go.
+	Defrag.Flush();
+	Deferred.ReleaseAll();
+	FrameFence.Destroy();
+	Pipelines.Save();
+	Pipelines.Destroy();
+	Streamer.Destroy();
+	CopyQueue.Destroy();
+	GpuTimings.Destroy();
+	TimestampQueries.Destroy();
+	Upload.Destroy();
+	FrameMemory.Destroy();
+	Bindless.Destroy();
+	Descriptors.Destroy();
+	Jobs.Shutdown();
+	CommandLists.Destroy();
+	MemAllocator.Reset();
 }
 
 void VRD3D12::SetFenceEvents()
 {
-	auto num_back_buffers = BBIndex;
-	// create the fence
-	ThrowIfFailed(Device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&Fence)));
-	FenceValue = 0; // set the initial fence value to 0
-	// create a handle to a fence event
-	FenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-	if (FenceEvent == nullptr) {
-		throw "Failed to create fence event.";
+	FrameFence.Initialize(Device.Get(), Queue.Get());
+	// One slot per back buffer, each with its own allocator.
+	Frames.Initialize(&FrameFence, Buffers, FrameLatency);
+	Deferred.Initialize(&FrameFence, MemAllocator.Get());
+	if (DefragClient)
+	{
+		const IncrementalDefragDesc defrag_desc;
+		DefragBackend.Initialize(Device.Get(), MemAllocator.Get(), DefragClient, nullptr,
+			D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_FAST, defrag_desc.MaxMovesPerPass);
+		Defrag.Initialize(&FrameFence, &DefragBackend, defrag_desc);
 	}
 }
 
@@ -132,7 +174,10 @@ void VRD3D12::FindAdaptors()
 		}
 		hr = D3D12CreateDevice(ta.Get(), D3D_FEATURE_LEVEL_12_1, IID_PPV_ARGS(&Device));
 		if (SUCCEEDED(hr))
+		{
+			Adapter = ta;
 			break;
+		}
 
 		index++;
 	}
@@ -144,75 +189,207 @@ void VRD3D12::FindAdaptors()
 
 void VRD3D12::Render()
 {
-	Alloc[BBIndex]->Reset();
-	auto index = Swap->GetCurrentBackBufferIndex();
 	static float clear_color[4] = { 0.568f, 0.733f, 1.0f, 1.0f };
+	if (PaceToVsync)
+	{
+		VR_PROFILE_SCOPE("Pace");
+		Pacer.WaitForVsync(PaceLeadMs);
+	}
+	if (PinRenderThread)
+		Jobs.PinRenderThread();
+	VR_PROFILE_FRAME();
+	FrameTimes.BeginFrame();
+	NoHeapAllocationScope frame_allocations(IsSteadyState());
+	VR_PROFILE_SCOPE("Render");
 	BBIndex = Swap->GetCurrentBackBufferIndex();
-	ThrowIfFailed(List->Reset(Alloc[BBIndex].Get(), nullptr));
+	{
+		VR_PROFILE_SCOPE("WaitForFrame");
+		// Only blocks if the GPU is still executing the last frame recorded with this allocator.
+		Frames.BeginFrame(BBIndex);
+	}
+	Upload.BeginFrame(BBIndex);
+	FrameMemory.BeginFrame(BBIndex);
+	// Releases from here on are stamped with the value this frame will signal.
+	Deferred.BeginFrame(Frames.GetLastSignaledValue() + 1);
+	{
+		VR_PROFILE_SCOPE("UploadStreamer");
+		// Copies queued by streaming go out in one batch, the frame's lists wait for them on the GPU.
+		if (Streamer.Update() > 0)
+			CopyQueue.GPUWait(Queue.Get(), Streamer.GetLastSubmittedValue());
+	}
+	const UINT64 completed = FrameFence.GetCompletedValue();
+	Descriptors.BeginFrame(completed);
+	Bindless.BeginFrame(completed);
+	GpuTimings.BeginFrame(completed);
+	CommandLists.BeginFrame(BBIndex);
+	ID3D12GraphicsCommandList* list = CommandLists.Acquire(0)->List;
+	if (DefragClient)
+	{
+		VR_PROFILE_SCOPE("Defragment");
+		// Copies go first in the frame, heaps emptied by earlier passes are freed here.
+		DefragBackend.SetCommandList(list);
+		Defrag.Update(Frames.GetLastSignaledValue() + 1, DefragMillisecsPerFrame, DefragBytesPerFrame);
+	}
+
+	// The graph derives PRESENT -> RENDER_TARGET -> PRESENT from the declared accesses.
+	Graph.Reset();
+	const RGResource back_buffer = Graph.ImportResource("BackBuffer", RT[BBIndex].Get(),
+		D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_PRESENT);
+	const D3D12_CPU_DESCRIPTOR_HANDLE rtv_handle = BackBufferRTV[BBIndex];
+	Graph.AddPass("Clear", [&](ID3D12GraphicsCommandList* l)
+	{
+		l->OMSetRenderTargets(1, &rtv_handle, false, nullptr);
+		l->ClearRenderTargetView(rtv_handle, clear_color, NULL, nullptr);
+	});
+	Graph.Write(back_buffer, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	{
+		VR_PROFILE_SCOPE("RenderGraph");
+		Graph.Compile();
+		Graph.ExecutePasses(list);
+	}
 	//DrawCommands Here
-	// Transition to RENDER_TARGET
-	CD3DX12_RESOURCE_BARRIER begin_transition = CD3DX12_RESOURCE_BARRIER::Transition(
-		RT[BBIndex].Get(),
-		D3D12_RESOURCE_STATE_PRESENT,
-		D3D12_RESOURCE_STATE_RENDER_TARGET
-	);
-	List->ResourceBarrier(1, &begin_transition);
-	CD3DX12_CPU_DESCRIPTOR_HANDLE rtv_handle(RTVH->GetCPUDescriptorHandleForHeapStart(), BBIndex, RTVSize);
-	List->OMSetRenderTargets(1, &rtv_handle, false, nullptr);
-	List->ClearRenderTargetView(rtv_handle, clear_color, NULL, nullptr);
-	// InitBaseAssets();
-	CD3DX12_RESOURCE_BARRIER end_transition = CD3DX12_RESOURCE_BARRIER::Transition(
-		RT[BBIndex].Get(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET,
-		D3D12_RESOURCE_STATE_PRESENT
-	);
-	List->ResourceBarrier(1, &end_transition);
-	ThrowIfFailed(List->Close());
-	ID3D12CommandList** cmd_lists = new ID3D12CommandList * [1];
-	cmd_lists[0] = List.Get();
-	Queue->ExecuteCommandLists(1, cmd_lists);
-	// GPU Signal
-	ThrowIfFailed(Queue->Signal(Fence.Get(), FenceValue));
-	ThrowIfFailed(Swap->Present(1, 0));
-	WaitForPrevFrame();
-	// Update our frame index
-	BBIndex = Swap->GetCurrentBackBufferIndex();
-	index = Swap->GetCurrentBackBufferIndex();
+	if (RecordScene && SceneSlices > 0)
+	{
+		RecordParallel(SceneSlices, RecordScene);
+		// The present transition has to be ordered after every slice.
+		list = CommandLists.Acquire(SceneSlices + 1)->List;
+	}
+	Graph.ExecuteFinalBarriers(list);
+	// Last list of the frame, after every timestamp.
+	GpuTimings.Resolve(list);
+	{
+		VR_PROFILE_SCOPE("Submit");
+		// All lists of the frame go to the queue in one ExecuteCommandLists call.
+		CommandLists.Submit();
+	}
+	{
+		VR_PROFILE_SCOPE("Present");
+		ThrowIfFailed(Swap->Present(1, 0));
+	}
+	// SyncQPCTime is on the QPC axis, the pacer's clock. Fails until the first frames were shown.
+	DXGI_FRAME_STATISTICS present_stats;
+	if (SUCCEEDED(Swap->GetFrameStatistics(&present_stats)) && present_stats.SyncQPCTime.QuadPart != 0)
+		Pacer.OnVsync(present_stats.SyncQPCTime.QuadPart, present_stats.SyncRefreshCount);
+	// GPU Signal, stamps this back buffer's allocator and the frame's descriptors with the fence value.
+	const UINT64 fence_value = Frames.EndFrame(BBIndex);
+	Descriptors.EndFrame(fence_value);
+	Bindless.EndFrame(fence_value);
+	GpuTimings.EndFrame(fence_value);
+	FrameHeapAllocations = frame_allocations.GetAllocations();
+	RenderedFrames++;
 }
 
-bool VRD3D12::CreateShader(LPCWSTR ShaderName, std::string Main, ShaderT& Type)
+void VRD3D12::RecordParallel(UINT Slices, const SliceRecorder& Record)
 {
-	COM<ID3DBlob> ShaderB;
-	COM<ID3DBlob> Error;
-	LPCSTR type{ "" };
+	const D3D12_CPU_DESCRIPTOR_HANDLE rtv_handle = BackBufferRTV[BBIndex];
+	ID3D12DescriptorHeap* heaps[] = { Descriptors.GetShaderVisible().GetHeap() };
+	VR_PROFILE_SCOPE("RecordParallel");
+	Jobs.Run(Slices, [&](UINT slice)
+	{
+		VR_PROFILE_SCOPE("RecordSlice");
+		NoHeapAllocationScope slice_allocations(IsSteadyState());
+		// Slice i lands right after the frame prologue (order 0), in slice order.
+		auto* context = CommandLists.Acquire(slice + 1);
+		context->List->SetDescriptorHeaps(1, heaps);
+		// Draws only push indices, the bindless table is set once per list.
+		context->List->SetGraphicsRootSignature(BindlessRSO.Get());
+		context->List->SetGraphicsRootDescriptorTable(BindlessRootSignature::TableParameter, Bindless.GetTableStart());
+		context->List->OMSetRenderTargets(1, &rtv_handle, false, nullptr);
+		const UINT pass = GpuTimings.BeginPass(context->List, "SceneSlice");
+		Record(slice, context->List);
+		GpuTimings.EndPass(context->List, pass);
+		CommandLists.Close(context);
+	});
+}
 
-	if (Type == ShaderT::ST_PS)
+static bool ShaderResultToBlob(const ShaderResult& Result, Microsoft::WRL::ComPtr<ID3DBlob>& Out)
+{
+	if (!Result.Success)
 	{
-		type = "ps_5_0";
-		return type;
+		OutputDebugStringA(Result.Errors.c_str());
+		return false;
 	}
+	ThrowIfFailed(D3DCreateBlob(Result.Bytecode.size(), &Out));
+	memcpy(Out->GetBufferPointer(), Result.Bytecode.data(), Result.Bytecode.size());
+	return true;
+}
+
+bool VRD3D12::CreateShader(LPCWSTR ShaderName, std::string Main, ShaderT& Type, COM<ID3DBlob>& Out)
+{
+	ShaderRequest request;
+	request.File = ShaderName;
+	request.EntryPoint = Main;
+	if (Type == ShaderT::ST_PS)
+		request.Target = "ps_5_0";
 	else if (Type == ShaderT::ST_VS)
+		request.Target = "vs_5_0";
+	else
+		return false;
+#ifdef _DEBUG
+	request.Flags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#else
+	request.Flags = D3DCOMPILE_OPTIMIZATION_LEVEL3;
+#endif
+
+	return ShaderResultToBlob(Shaders.Get(request), Out);
+}
+
+bool VRD3D12::CreateShaders(const std::vector<ShaderRequest>& Requests, std::vector<COM<ID3DBlob>>& Out)
+{
+	std::vector<ShaderResult> results;
+	Shaders.CompileBatch(Requests, results, &Jobs);
+	Out.clear();
+	Out.resize(results.size());
+	bool success = true;
+	for (size_t i = 0; i < results.size(); i++)
 	{
-		type = "vs_5_0";
-		return type;
+		success &= ShaderResultToBlob(results[i], Out[i]);
 	}
-	ThrowIfFailed(D3DCompileFromFile(ShaderName, nullptr, nullptr, (LPCSTR)Main.c_str(), (LPCSTR)type, D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION,
-		0,
-		ShaderB.GetAddressOf(),
-		Error.GetAddressOf()));
-	return true;
+	return success;
 }
 
 void VRD3D12::WaitForPrevFrame()
 {
-	const UINT64 fence = (UINT64)FenceValue;
-	ThrowIfFailed(Queue->Signal(Fence.Get(), fence));
-	FenceValue++;
+	// Drains every frame in flight. Only needed on shutdown/resize, Render() does not stall.
+	Frames.Flush();
+}
+
+void D3D12FrameFence::Initialize(ID3D12Device* Device, ID3D12CommandQueue* Queue)
+{
+	m_Queue = Queue;
+	ThrowIfFailed(Device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&Fence)));
+	// create a handle to a fence event
+	Event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (Event == nullptr) {
+		throw "Failed to create fence event.";
+	}
+}
 
-	// Wait until the previous frame is finished.
-	if (Fence->GetCompletedValue() < fence)
+void D3D12FrameFence::Destroy()
+{
+	Fence.Reset();
+	if (Event)
 	{
-		ThrowIfFailed(Fence->SetEventOnCompletion(fence, FenceEvent));
-		WaitForSingleObject(FenceEvent, INFINITE);
+		CloseHandle(Event);
+		Event = nullptr;
 	}
+	m_Queue = nullptr;
+}
+
+void D3D12FrameFence::Signal(UINT64 Value)
+{
+	ThrowIfFailed(m_Queue->Signal(Fence.Get(), Value));
+}
+
+UINT64 D3D12FrameFence::GetCompletedValue()
+{
+	return Fence->GetCompletedValue();
+}
+
+void D3D12FrameFence::WaitForValue(UINT64 Value)
+{
+	if (Fence->GetCompletedValue() >= Value)
+		return;
+	ThrowIfFailed(Fence->SetEventOnCompletion(Value, Event));
+	WaitForSingleObject(Event, INFINITE);
 }
\ No newline at end of file
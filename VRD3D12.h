@@ -7,12 +7,46 @@
 #include <DirectXMath.h>
 #include "BlackSpaceDirectX.h"
 #include "BSTime.h"
+#include "VRFrameScheduler.h"
+#include "VRUploadRing.h"
+#include "VRUploadStreamer.h"
+#include "VRCommandRecorder.h"
+#include "VRRenderGraph.h"
+#include "VRShaderCache.h"
+#include "VRPipelineCache.h"
+#include "VRDescriptorAllocator.h"
+#include "VRBindlessTable.h"
+#include "VRDeferredRelease.h"
+#include "VRProfiler.h"
+#include "VRGpuProfiler.h"
+#include "VRFrameStats.h"
+#include "VRFramePacer.h"
+#include "VRJobSystem.h"
+#include "VRFrameArena.h"
+#include "VRDefragmenter.h"
 #pragma comment(lib, "dxgi.lib")
 #pragma comment(lib, "d3dcompiler.lib")
 #pragma comment(lib, "winmm.lib")
 #pragma comment(lib, "dxguid.lib")
 #pragma comment(lib,"D3d12.lib")
 
+// IFrameFence on top of a command queue and an ID3D12Fence.
+class D3D12FrameFence : public IFrameFence
+{
+public:
+    void Initialize(ID3D12Device* Device, ID3D12CommandQueue* Queue);
+    void Destroy();
+
+    void Signal(UINT64 Value) override;
+    UINT64 GetCompletedValue() override;
+    void WaitForValue(UINT64 Value) override;
+
+    Microsoft::WRL::ComPtr<ID3D12Fence> Fence;
+    HANDLE Event = nullptr;
+private:
+    ID3D12CommandQueue* m_Queue = nullptr;
+};
+
 class VRD3D12 {
 public:
 	template<typename A>
@@ -22,20 +56,56 @@ public:
     RECT WindowRect{};
 
 	COM<ID3D12Device8> Device;
+    COM<IDXGIAdapter1> Adapter;
+    COM<D3D12MA::Allocator> MemAllocator;
     COM<ID3D12CommandQueue> Queue;
-    COM<ID3D12CommandAllocator> Alloc[Buffers];
     COM<IDXGIFactory5> Factory;
     COM<IDXGISwapChain3> Swap;
     COM<ID3D12Resource> BBuffer[Buffers];
-    COM<ID3D12GraphicsCommandList> List;
-    COM<ID3D12DescriptorHeap> RTVH;
     COM<ID3D12PipelineState> PSO;
     COM<ID3D12Debug> Debug;
     COM<ID3D12Resource> RT[Buffers];
     COM<ID3D12RootSignature> RSO;
     COM<ID3D12Resource> VertexBuffer;
+    // Per-frame constants and dynamic vertex data. Partitioned per back buffer.
+    UploadRing Upload;
+    UINT64 UploadBytesPerFrame = 4 * 1024 * 1024;
+    // Asset uploads on the copy queue, at most StreamingBytesPerFrame copied per frame.
+    D3D12UploadQueue CopyQueue;
+    UploadStreamer Streamer;
+    UINT64 StreamingStagingBytes = 32 * 1024 * 1024;
+    UINT64 StreamingBytesPerFrame = 8 * 1024 * 1024;
+    // Per back buffer pool of command allocators/lists, one pair per recording thread.
+    D3D12CommandListBackend CommandListApi;
+    CommandListPool<D3D12CommandListBackend> CommandLists;
+    // Work-stealing job threads, used for recording slices and staging copies. See VRJobSystem.h.
+    JobSystem Jobs;
+    // Job threads besides the render thread. 0 = one per remaining core.
+    UINT RecordThreads = 0;
+    // Pins the render thread to core 0 and keeps the job threads off it.
+    bool PinRenderThread = false;
+
+    // Rebuilt and compiled every frame, owns all resource transitions.
+    RenderGraph Graph;
+    // Compiled shader bytecode, keyed by preprocessed source. See VRShaderCache.h.
+    D3DShaderCompiler ShaderCompiler;
+    ShaderCache Shaders;
+    // Pipelines keyed on their state stream, blobs persisted next to the shader cache.
+    PipelineCache Pipelines;
+    // Staging heaps per descriptor type and the shader-visible CBV/SRV/UAV ring.
+    DescriptorAllocator Descriptors;
+    D3D12_CPU_DESCRIPTOR_HANDLE BackBufferRTV[Buffers] = {};
+    // Stable per-resource slots in the shader-visible heap, indexed through BindlessRSO.
+    BindlessTable Bindless;
+    UINT BindlessSlots = 262144;
+    BindlessRootSignature BindlessLayout;
+    COM<ID3D12RootSignature> BindlessRSO;
+
+    typedef std::function<void(UINT Slice, ID3D12GraphicsCommandList* List)> SliceRecorder;
+    // Scene draws, recorded in SceneSlices slices on the worker threads every frame.
+    SliceRecorder RecordScene;
+    UINT SceneSlices = 0;
 
-    UINT RTVSize{};
     D3D12_BLEND_DESC blend_desc = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
     D3D12_DEPTH_STENCIL_DESC depth_stencil_state = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
     D3D12_RASTERIZER_DESC rasterize_desc = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
@@ -47,12 +117,43 @@ public:
 
     D3D12_VIEWPORT vp;
     D3D12_RECT sr;
-    ID3D12CommandList* const commandLists[1] = {List.Get()};
     //FenceObjects
-    COM<ID3D12Fence> Fence;
-    UINT FenceValue;
-    UINT64 FrameFenceValues = {};
-    HANDLE FenceEvent;
+    D3D12FrameFence FrameFence;
+    FrameScheduler Frames;
+    // Max number of frames the CPU may record ahead of the GPU. Clamped to Buffers.
+    UINT FrameLatency = 2;
+    // Objects dropped mid-run, released once the frames that may use them completed.
+    DeferredReleaseQueue Deferred;
+    // Incremental defragmentation of the default pools, at most DefragMillisecsPerFrame of CPU and
+    // DefragBytesPerFrame of copies per frame. Only runs with a DefragClient, which knows what may
+    // move and rebinds it, set before CreateContexts. See VRDefragmenter.h.
+    IDefragClient* DefragClient = nullptr;
+    D3D12DefragBackend DefragBackend;
+    IncrementalDefragmenter Defrag;
+    double DefragMillisecsPerFrame = 0.5;
+    UINT64 DefragBytesPerFrame = 16 * 1024 * 1024;
+    // Timestamps around every graph pass and scene slice, read back a few frames later.
+    D3D12TimestampQueries TimestampQueries;
+    GpuProfiler GpuTimings;
+    UINT GpuTimedPasses = 256;
+    // Rolling CPU frame times and hitches against the display refresh.
+    FrameStats FrameTimes;
+    double TargetRefreshHz = 90.0;
+    // Tracks vblanks from the swap chain statistics. With PaceToVsync, Render() starts PaceLeadMs
+    // before the predicted vblank instead of as soon as the previous frame was presented.
+    FramePacer Pacer;
+    bool PaceToVsync = false;
+    double PaceLeadMs = 8.0;
+    // CPU-side per-frame data, rewound when the back buffer's frame retired. See VRFrameArena.h.
+    FrameArena FrameMemory;
+    size_t FrameMemoryChunkBytes = 256 * 1024;
+    // Asserts that Render() and the slice recorders make no heap allocation once
+    // AllocationWarmupFrames frames grew every per-frame container to its steady size.
+    bool AssertNoFrameAllocations = false;
+    UINT AllocationWarmupFrames = 16;
+    // operator new calls of the last Render() on the render thread, 0 without VR_COUNT_HEAP_ALLOCATIONS.
+    UINT64 FrameHeapAllocations = 0;
+    UINT64 RenderedFrames = 0;
     GameTimer g;
     //Window Objects 
     bool Windowed = true;
@@ -68,6 +169,9 @@ public:
     void FindAdaptors();
     void WaitForPrevFrame();
     void Render();
+    // Records Slices command lists in parallel, submitted in slice order with the rest of the frame.
+    void RecordParallel(UINT Slices, const SliceRecorder& Record);
+    bool IsSteadyState() const { return AssertNoFrameAllocations && RenderedFrames >= AllocationWarmupFrames; }
 protected:
     enum class ShaderT
     {
@@ -75,7 +179,8 @@ protected:
         ST_PS = 0x2,
         //Add other shader types if needed.
     };
-    bool CreateShader(LPCWSTR ShaderName, std::string Main,ShaderT& Type);
-private:
-    std::vector<ID3D12Resource*> ResourcePool;
+    bool CreateShader(LPCWSTR ShaderName, std::string Main, ShaderT& Type, COM<ID3DBlob>& Out);
+    // Resolves every request, the cache misses compile in parallel on Jobs. Out[i] stays null
+    // where Requests[i] failed, false if any did.
+    bool CreateShaders(const std::vector<ShaderRequest>& Requests, std::vector<COM<ID3DBlob>>& Out);
 };
\ No newline at end of file
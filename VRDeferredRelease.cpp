@@ -0,0 +1,111 @@
+#include "VRDeferredRelease.h"
+#include "BlackSpaceDirectX.h"
+
+void DeferredReleaseQueue::Initialize(IFrameFence* Fence, D3D12MA::Allocator* Allocator, UINT ReservedEntries)
+{
+	ReleaseAll();
+	m_Fence = Fence;
+	m_Allocator = Allocator;
+	m_PendingValue.store(1, std::memory_order_release);
+	m_Due.reserve(ReservedEntries);
+	m_DueAllocations.reserve(ReservedEntries);
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Entries.reserve(ReservedEntries);
+	m_Stats = DeferredReleaseStats();
+}
+
+void DeferredReleaseQueue::BeginFrame(UINT64 PendingFenceValue)
+{
+	Sweep();
+	m_PendingValue.store(PendingFenceValue, std::memory_order_release);
+}
+
+UINT DeferredReleaseQueue::Sweep()
+{
+	RAID_ASSERT(m_Fence != nullptr);
+	const UINT64 completed = m_Fence->GetCompletedValue();
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		size_t due = 0;
+		while (due < m_Entries.size() && m_Entries[due].FenceValue <= completed)
+		{
+			due++;
+		}
+		m_Due.insert(m_Due.end(), m_Entries.begin(), m_Entries.begin() + due);
+		m_Entries.erase(m_Entries.begin(), m_Entries.begin() + due);
+	}
+	const UINT count = (UINT)m_Due.size();
+	ReleaseDue();
+	return count;
+}
+
+void DeferredReleaseQueue::ReleaseAll()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Due.insert(m_Due.end(), m_Entries.begin(), m_Entries.end());
+		m_Entries.clear();
+	}
+	ReleaseDue();
+}
+
+DeferredReleaseStats DeferredReleaseQueue::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+void DeferredReleaseQueue::Enqueue(UINT64 FenceValue, void* Object, Deleter Delete, Kind Type)
+{
+	if (!Object)
+		return;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Entries.push_back({ FenceValue, Object, Delete, Type });
+	m_Stats.Queued++;
+	m_Stats.Pending++;
+	m_Stats.PeakPending = std::max(m_Stats.PeakPending, m_Stats.Pending);
+}
+
+void DeferredReleaseQueue::ReleaseDue()
+{
+	if (m_Due.empty())
+		return;
+	for (const Entry& e : m_Due)
+	{
+		switch (e.Type)
+		{
+		case Kind::Com:
+			static_cast<IUnknown*>(e.Object)->Release();
+			break;
+		case Kind::Allocation:
+			m_DueAllocations.push_back(static_cast<D3D12MA::Allocation*>(e.Object));
+			break;
+		case Kind::Custom:
+			e.Delete(e.Object);
+			break;
+		}
+	}
+	const UINT64 allocations = m_DueAllocations.size();
+	if (!m_DueAllocations.empty())
+	{
+		if (m_Allocator)
+		{
+			// One block vector lock per heap instead of one per allocation.
+			m_Allocator->FreeBatch((UINT)m_DueAllocations.size(), m_DueAllocations.data());
+		}
+		else
+		{
+			for (D3D12MA::Allocation* a : m_DueAllocations)
+			{
+				a->Release();
+			}
+		}
+		m_DueAllocations.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Stats.Released += m_Due.size();
+	m_Stats.Pending -= m_Due.size();
+	m_Stats.AllocationsFreed += allocations;
+	m_Due.clear();
+}
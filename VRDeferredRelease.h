@@ -0,0 +1,112 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "VRFrameScheduler.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Deferred destruction of GPU objects.
+* Release() takes over one reference and stamps it with the fence value of the frame being
+* recorded (BeginFrame's PendingFenceValue), i.e. the last frame that may still use the object.
+* Sweep() (called from BeginFrame) releases everything whose stamp the fence has passed, so an
+* object can be dropped at any point mid-run without waiting for the GPU.
+*
+* D3D12MA allocations due in one sweep are freed together in one batch instead of one allocator
+* lock per object. Any thread may call Release(), sweeping belongs to the render thread.
+* The pending entries and the sweep's lists are vectors reserved in Initialize and reused, releasing
+* inside the frame only allocates when more objects are pending than ever before.
+* The fence is an IFrameFence, so the retirement logic runs against a fake one without a device.
+*/
+
+namespace D3D12MA
+{
+    class Allocation;
+    class Allocator;
+}
+
+struct DeferredReleaseStats
+{
+    UINT64 Queued = 0;
+    UINT64 Released = 0;
+    UINT64 Pending = 0;
+    UINT64 PeakPending = 0;
+    // Allocations freed through the batched path.
+    UINT64 AllocationsFreed = 0;
+};
+
+class DeferredReleaseQueue
+{
+public:
+    typedef void (*Deleter)(void* Object);
+
+    const static UINT DefaultReservedEntries = 1024;
+
+    ~DeferredReleaseQueue() { ReleaseAll(); }
+
+    // Allocator (optional) frees due allocations with FreeBatch, otherwise each is Release()d.
+    // ReservedEntries = objects that may be pending at once before the lists grow.
+    void Initialize(IFrameFence* Fence, D3D12MA::Allocator* Allocator = nullptr, UINT ReservedEntries = DefaultReservedEntries);
+
+    // Releases what the GPU is done with, then stamps new releases with PendingFenceValue
+    // (the value the frame about to be recorded will signal).
+    void BeginFrame(UINT64 PendingFenceValue);
+    // Releases every entry whose fence value has completed. Returns how many were released.
+    UINT Sweep();
+    // Releases everything right away. Only when the GPU is idle (after FrameScheduler::Flush).
+    void ReleaseAll();
+
+    // Thread-safe. Takes over one reference of Object.
+    void Release(IUnknown* Object) { Enqueue(m_PendingValue.load(std::memory_order_acquire), Object, nullptr, Kind::Com); }
+    void Release(D3D12MA::Allocation* Allocation) { Enqueue(m_PendingValue.load(std::memory_order_acquire), Allocation, nullptr, Kind::Allocation); }
+    void Release(void* Object, Deleter Delete) { Enqueue(m_PendingValue.load(std::memory_order_acquire), Object, Delete, Kind::Custom); }
+    // Same, with an explicit value on the frame fence, at most the pending one (an earlier frame
+    // that last used the object). Sweep only ever compares against the frame fence, so a value
+    // of another queue's fence does not belong here.
+    void ReleaseAfter(UINT64 FenceValue, IUnknown* Object) { EnqueueAfter(FenceValue, Object, nullptr, Kind::Com); }
+    void ReleaseAfter(UINT64 FenceValue, D3D12MA::Allocation* Allocation) { EnqueueAfter(FenceValue, Allocation, nullptr, Kind::Allocation); }
+    void ReleaseAfter(UINT64 FenceValue, void* Object, Deleter Delete) { EnqueueAfter(FenceValue, Object, Delete, Kind::Custom); }
+
+    UINT64 GetPendingFenceValue() const { return m_PendingValue.load(std::memory_order_acquire); }
+    DeferredReleaseStats GetStats();
+
+private:
+    enum class Kind : UINT8
+    {
+        Com,
+        Allocation,
+        Custom
+    };
+
+    struct Entry
+    {
+        UINT64 FenceValue;
+        void* Object;
+        Deleter Delete;
+        Kind Type;
+    };
+
+    void Enqueue(UINT64 FenceValue, void* Object, Deleter Delete, Kind Type);
+    void EnqueueAfter(UINT64 FenceValue, void* Object, Deleter Delete, Kind Type)
+    {
+        RAID_ASSERT(FenceValue <= m_PendingValue.load(std::memory_order_acquire));
+        Enqueue(FenceValue, Object, Delete, Type);
+    }
+    // Releases m_Due, allocations in one batch.
+    void ReleaseDue();
+
+    IFrameFence* m_Fence = nullptr;
+    D3D12MA::Allocator* m_Allocator = nullptr;
+    std::atomic<UINT64> m_PendingValue{ 1 };
+
+    std::mutex m_Mutex;
+    // Ordered by submission. Fence values are non-decreasing for Release(), ReleaseAfter()
+    // entries with a lower value simply wait for the entries in front of them. Sweep erases the
+    // due front, the rest moves down within the capacity.
+    std::vector<Entry> m_Entries;
+    DeferredReleaseStats m_Stats;
+
+    // Render thread only.
+    std::vector<Entry> m_Due;
+    std::vector<D3D12MA::Allocation*> m_DueAllocations;
+};
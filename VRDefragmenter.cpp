@@ -0,0 +1,338 @@
+#include "VRDefragmenter.h"
+#include "BlackSpaceDirectX.h"
+#include "BSTime.h"
+#include <algorithm>
+
+void IncrementalDefragmenter::Initialize(IFrameFence* Fence, IDefragBackend* Backend, const IncrementalDefragDesc& Desc)
+{
+	RAID_ASSERT(Fence != nullptr && Backend != nullptr);
+	RAID_ASSERT(Desc.MaxMovesPerPass > 0);
+	m_Fence = Fence;
+	m_Backend = Backend;
+	m_Desc = Desc;
+	m_State = State::Idle;
+	m_Running = false;
+	m_Cooldown = 0;
+	m_Moves.clear();
+	m_Moves.reserve(Desc.MaxMovesPerPass);
+	m_NextMove = 0;
+	m_PassMillisecs = Desc.InitialPassMillisecs;
+	m_MoveMillisecs = Desc.InitialMoveMillisecs;
+	m_Stats = IncrementalDefragStats();
+}
+
+UINT IncrementalDefragmenter::Update(UINT64 PendingFenceValue, double CpuMillisecs, UINT64 MaxBytes)
+{
+	RAID_ASSERT(m_Backend != nullptr);
+	const int64_t start = SystemTime::GetCurrentTick();
+	const UINT64 completed = m_Fence->GetCompletedValue();
+	UINT recorded = 0;
+
+	// Copies done: users switch now, frames recorded up to here still read the old places.
+	if (m_State == State::Copying && completed >= m_CopyFence)
+	{
+		m_Backend->Rebind(m_Moves);
+		m_RetireFence = PendingFenceValue - 1;
+		m_State = State::Retiring;
+	}
+	if (m_State == State::Retiring && completed >= m_RetireFence)
+		EndPass();
+
+	if (CpuMillisecs > 0.0)
+	{
+		if (m_State == State::Idle && !m_Running)
+		{
+			if (m_Cooldown > 0)
+				m_Cooldown--;
+			else
+			{
+				D3D12MA::Statistics stats = {};
+				m_Backend->GetStatistics(stats);
+				if (ShouldStart(stats))
+				{
+					m_Backend->BeginRun();
+					m_Running = true;
+					m_Stats.Runs++;
+				}
+			}
+		}
+
+		// A new pass only if its computation and at least one move fit in what is left.
+		if (m_State == State::Idle && m_Running &&
+			ElapsedMillisecs(start) + m_PassMillisecs + m_MoveMillisecs <= CpuMillisecs)
+		{
+			const double left = CpuMillisecs - ElapsedMillisecs(start) - m_PassMillisecs;
+			const UINT maxMoves = (UINT)std::clamp(left / (std::max)(m_MoveMillisecs, 0.001), 1.0, (double)m_Desc.MaxMovesPerPass);
+			const int64_t passStart = SystemTime::GetCurrentTick();
+			if (m_Backend->BeginPass(MaxBytes, maxMoves, m_Moves))
+			{
+				m_PassMillisecs = m_PassMillisecs * 0.8 + ElapsedMillisecs(passStart) * 0.2;
+				m_NextMove = 0;
+				m_State = State::Recording;
+				m_Stats.Passes++;
+			}
+			else
+				EndRun();
+		}
+
+		if (m_State == State::Recording)
+			recorded = RecordMoves(start, CpuMillisecs, PendingFenceValue);
+	}
+
+	m_Stats.LastUpdateMillisecs = ElapsedMillisecs(start);
+	if (CpuMillisecs > 0.0 && m_Stats.LastUpdateMillisecs > CpuMillisecs)
+		m_Stats.BudgetOverruns++;
+	return recorded;
+}
+
+UINT IncrementalDefragmenter::RecordMoves(int64_t Start, double CpuMillisecs, UINT64 PendingFenceValue)
+{
+	UINT recorded = 0;
+	while (m_NextMove < (UINT)m_Moves.size())
+	{
+		// The first move of the frame always goes, so a small budget still makes progress.
+		if (recorded > 0 && ElapsedMillisecs(Start) + m_MoveMillisecs > CpuMillisecs)
+			break;
+		DefragMove& move = m_Moves[m_NextMove];
+		const int64_t moveStart = SystemTime::GetCurrentTick();
+		if (m_Backend->RecordCopy(m_NextMove))
+		{
+			m_MoveMillisecs = m_MoveMillisecs * 0.8 + ElapsedMillisecs(moveStart) * 0.2;
+			m_CopyFence = PendingFenceValue;
+			m_Stats.MovesCopied++;
+			m_Stats.BytesMoved += move.Size;
+			recorded++;
+		}
+		else
+		{
+			move.Refused = true;
+			m_Stats.MovesRefused++;
+		}
+		m_NextMove++;
+	}
+	if (recorded > 0)
+		m_Backend->FlushCopies();
+
+	if (m_NextMove == (UINT)m_Moves.size())
+	{
+		// Everything refused: nothing to wait for.
+		if (m_CopyFence == 0)
+			EndPass();
+		else
+			m_State = State::Copying;
+	}
+	return recorded;
+}
+
+void IncrementalDefragmenter::Flush()
+{
+	if (!m_Backend)
+		return;
+	// The GPU is idle, every copy recorded so far completed and nothing reads the old places.
+	if (m_State == State::Recording)
+	{
+		for (UINT i = m_NextMove; i < (UINT)m_Moves.size(); i++)
+			m_Moves[i].Refused = true;
+		m_NextMove = (UINT)m_Moves.size();
+		if (m_CopyFence != 0)
+			m_State = State::Copying;
+	}
+	if (m_State == State::Copying)
+		m_Backend->Rebind(m_Moves);
+	if (m_State != State::Idle)
+		EndPass();
+	if (m_Running)
+		EndRun();
+}
+
+IncrementalDefragStats IncrementalDefragmenter::GetStats() const
+{
+	IncrementalDefragStats stats = m_Stats;
+	stats.PassMillisecs = m_PassMillisecs;
+	stats.MoveMillisecs = m_MoveMillisecs;
+	stats.Running = m_Running;
+	return stats;
+}
+
+double IncrementalDefragmenter::ElapsedMillisecs(int64_t Start)
+{
+	return SystemTime::TicksToSeconds(SystemTime::GetCurrentTick() - Start) * 1000.0;
+}
+
+bool IncrementalDefragmenter::ShouldStart(const D3D12MA::Statistics& Stats) const
+{
+	// Allocations fill their heaps, the only heap could not be given back anyway.
+	if (Stats.BlockCount < 2)
+		return false;
+	const UINT64 free = Stats.BlockBytes - Stats.AllocationBytes;
+	return free >= m_Desc.StartFreeBytes && (double)free >= m_Desc.StartFreeRatio * (double)Stats.BlockBytes;
+}
+
+void IncrementalDefragmenter::EndPass()
+{
+	m_Stats.BlocksFreed += m_Backend->EndPass(m_Moves);
+	m_Moves.clear();
+	m_NextMove = 0;
+	m_CopyFence = 0;
+	m_RetireFence = 0;
+	m_State = State::Idle;
+}
+
+void IncrementalDefragmenter::EndRun()
+{
+	RAID_ASSERT(m_State == State::Idle);
+	m_Backend->EndRun();
+	m_Running = false;
+	m_Cooldown = m_Desc.CooldownFrames;
+}
+
+void D3D12DefragBackend::Initialize(ID3D12Device* Device, D3D12MA::Allocator* Allocator, IDefragClient* Client, D3D12MA::Pool* Pool,
+	UINT Algorithm, UINT MaxMovesPerPass)
+{
+	RAID_ASSERT(Device != nullptr && Allocator != nullptr && Client != nullptr);
+	m_Device = Device;
+	m_Allocator = Allocator;
+	m_Pool = Pool;
+	m_Client = Client;
+	m_Algorithm = Algorithm;
+	m_NewResources.reserve(MaxMovesPerPass);
+	m_Before.reserve(MaxMovesPerPass);
+	m_After.reserve(MaxMovesPerPass * 2);
+	m_Copies.reserve(MaxMovesPerPass);
+}
+
+void D3D12DefragBackend::GetStatistics(D3D12MA::Statistics& Stats)
+{
+	if (m_Pool)
+	{
+		m_Pool->GetStatistics(&Stats);
+		return;
+	}
+	// Budgets are cheap, CalculateStatistics walks every block.
+	D3D12MA::Budget local = {}, nonLocal = {};
+	m_Allocator->GetBudget(&local, &nonLocal);
+	Stats.BlockCount = local.Stats.BlockCount + nonLocal.Stats.BlockCount;
+	Stats.AllocationCount = local.Stats.AllocationCount + nonLocal.Stats.AllocationCount;
+	Stats.BlockBytes = local.Stats.BlockBytes + nonLocal.Stats.BlockBytes;
+	Stats.AllocationBytes = local.Stats.AllocationBytes + nonLocal.Stats.AllocationBytes;
+}
+
+void D3D12DefragBackend::BeginRun()
+{
+	D3D12MA::DEFRAGMENTATION_DESC desc = {};
+	desc.Flags = (D3D12MA::DEFRAGMENTATION_FLAGS)m_Algorithm;
+	m_Context.Reset();
+	if (m_Pool)
+		ThrowIfFailed(m_Pool->BeginDefragmentation(&desc, &m_Context));
+	else
+		m_Allocator->BeginDefragmentation(&desc, &m_Context);
+	m_HeapsFreed = 0;
+}
+
+void D3D12DefragBackend::EndRun()
+{
+	m_Context.Reset();
+}
+
+bool D3D12DefragBackend::BeginPass(UINT64 MaxBytes, UINT32 MaxMoves, std::vector<DefragMove>& Moves)
+{
+	RAID_ASSERT(m_Context != nullptr);
+	m_Context->SetPassLimits(MaxBytes, MaxMoves);
+	Moves.clear();
+	if (m_Context->BeginPass(&m_Pass) == S_OK)
+		return false;
+
+	m_NewResources.clear();
+	m_NewResources.resize(m_Pass.MoveCount);
+	for (UINT32 i = 0; i < m_Pass.MoveCount; i++)
+	{
+		DefragMove move;
+		move.Object = m_Pass.pMoves[i].pSrcAllocation;
+		move.Size = m_Pass.pMoves[i].pSrcAllocation->GetSize();
+		Moves.push_back(move);
+	}
+	return true;
+}
+
+bool D3D12DefragBackend::RecordCopy(UINT Index)
+{
+	RAID_ASSERT(m_List != nullptr && Index < m_Pass.MoveCount);
+	const D3D12MA::DEFRAGMENTATION_MOVE& move = m_Pass.pMoves[Index];
+	ID3D12Resource* src = move.pSrcAllocation->GetResource();
+	if (!src || !m_Client->CanMove(move.pSrcAllocation))
+		return false;
+
+	// Fails for upload / readback heaps, those can't be copied into on the GPU.
+	const D3D12_RESOURCE_DESC desc = src->GetDesc();
+	COM<ID3D12Resource> dst;
+	if (FAILED(m_Device->CreatePlacedResource(move.pDstTmpAllocation->GetHeap(), move.pDstTmpAllocation->GetOffset(),
+		&desc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&dst))))
+		return false;
+	move.pDstTmpAllocation->SetResource(dst.Get());
+	m_NewResources[Index] = dst;
+
+	const D3D12_RESOURCE_STATES state = m_Client->GetState(move.pSrcAllocation);
+	D3D12_RESOURCE_BARRIER b = {};
+	b.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	b.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+	if ((state & D3D12_RESOURCE_STATE_COPY_SOURCE) == 0)
+	{
+		b.Transition.pResource = src;
+		b.Transition.StateBefore = state;
+		b.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_SOURCE;
+		m_Before.push_back(b);
+		b.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE;
+		b.Transition.StateAfter = state;
+		m_After.push_back(b);
+	}
+	if (state != D3D12_RESOURCE_STATE_COPY_DEST)
+	{
+		b.Transition.pResource = dst.Get();
+		b.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
+		b.Transition.StateAfter = state;
+		m_After.push_back(b);
+	}
+	m_Copies.push_back(Index);
+	return true;
+}
+
+void D3D12DefragBackend::FlushCopies()
+{
+	if (m_Copies.empty())
+		return;
+	if (!m_Before.empty())
+		m_List->ResourceBarrier((UINT)m_Before.size(), m_Before.data());
+	for (UINT i : m_Copies)
+		m_List->CopyResource(m_NewResources[i].Get(), m_Pass.pMoves[i].pSrcAllocation->GetResource());
+	if (!m_After.empty())
+		m_List->ResourceBarrier((UINT)m_After.size(), m_After.data());
+	m_Before.clear();
+	m_After.clear();
+	m_Copies.clear();
+}
+
+void D3D12DefragBackend::Rebind(const std::vector<DefragMove>& Moves)
+{
+	for (UINT i = 0; i < (UINT)Moves.size(); i++)
+	{
+		if (!Moves[i].Refused)
+			m_Client->OnMoved(m_Pass.pMoves[i].pSrcAllocation, m_NewResources[i].Get());
+	}
+}
+
+UINT D3D12DefragBackend::EndPass(const std::vector<DefragMove>& Moves)
+{
+	RAID_ASSERT(Moves.size() == m_Pass.MoveCount);
+	// COPY hands the new resource to the source allocation and frees the old place, IGNORE frees
+	// the destination (with its resource, if one was created).
+	for (UINT i = 0; i < (UINT)Moves.size(); i++)
+		m_Pass.pMoves[i].Operation = Moves[i].Refused ? D3D12MA::DEFRAGMENTATION_MOVE_OPERATION_IGNORE : D3D12MA::DEFRAGMENTATION_MOVE_OPERATION_COPY;
+	m_Context->EndPass(&m_Pass);
+	m_NewResources.clear();
+
+	D3D12MA::DEFRAGMENTATION_STATS stats = {};
+	m_Context->GetStats(&stats);
+	const UINT freed = stats.HeapsFreed - m_HeapsFreed;
+	m_HeapsFreed = stats.HeapsFreed;
+	return freed;
+}
@@ -0,0 +1,205 @@
+#pragma once
+#include "VRCore.h"
+#include <vector>
+#include <d3d12.h>
+#include <wrl.h>
+#include "D3D12MemAlloc.h"
+#include "VRFrameScheduler.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Incremental defragmentation of D3D12MA memory within a per-frame budget.
+* Long sessions leave heaps half empty, new heaps get created (a CreateHeap hitch) while the
+* free space is spread over the old ones. Once per frame the render thread calls Update() with a
+* CPU millisecond budget and a byte budget:
+*   DefragBackend.SetCommandList(list);
+*   Defrag.Update(Frames.GetLastSignaledValue() + 1, 0.5, 16 * 1024 * 1024);
+*
+* A run starts when the heaps have at least StartFreeBytes free and that is StartFreeRatio of
+* them. Each pass is sized to what one frame's budget can record (per-move cost is measured) and
+* capped at the byte budget, the default FAST algorithm empties the nearly empty heaps first.
+* A move goes through three stages, each waiting for the frame fence:
+*   Recording - new resource created at the destination, copy recorded into the frame's list.
+*               Moves that no longer fit in the budget wait for the next frame.
+*   Copying   - once the copy's frame completed, the client switches to the new resource.
+*   Retiring  - frames recorded before the switch may still read the old resource, once they
+*               completed the pass ends, the old places and the heaps left empty are freed.
+* Nothing ever blocks on the GPU.
+*
+* Memory work goes through IDefragBackend and the fence is an IFrameFence, so the run / pass /
+* budget policy can be run against a simulated heap (a VirtualBlock) without a device.
+* D3D12DefragBackend defragments an allocator's default pools or one custom pool; what may move,
+* and where the users of a resource learn of its new place, is up to an IDefragClient.
+* Allocations being moved must not be released before the pass moving them ended.
+*/
+
+struct IncrementalDefragDesc
+{
+    // A run starts when at least StartFreeBytes of the heaps are free and that is at least
+    // StartFreeRatio of all heap bytes.
+    UINT64 StartFreeBytes = 64ull * 1024 * 1024;
+    double StartFreeRatio = 0.25;
+    // Updates to wait after a run before checking again.
+    UINT CooldownFrames = 300;
+    // Upper bound of moves in one pass, however much the budget allows.
+    UINT MaxMovesPerPass = 64;
+    // Cost estimates until measured.
+    double InitialPassMillisecs = 0.05;
+    double InitialMoveMillisecs = 0.02;
+};
+
+struct DefragMove
+{
+    // Backend's object, e.g. the D3D12MA::Allocation.
+    void* Object = nullptr;
+    UINT64 Size = 0;
+    // The backend refused it (can't move right now), it stays where it is.
+    bool Refused = false;
+};
+
+class IDefragBackend
+{
+public:
+    virtual ~IDefragBackend() = default;
+
+    // Usage of the memory being defragmented, called every frame while no run is going.
+    virtual void GetStatistics(D3D12MA::Statistics& Stats) = 0;
+    virtual void BeginRun() = 0;
+    virtual void EndRun() = 0;
+    // Computes the next pass within the limits into Moves. False when nothing is left to move.
+    virtual bool BeginPass(UINT64 MaxBytes, UINT32 MaxMoves, std::vector<DefragMove>& Moves) = 0;
+    // Creates the new place of Moves[Index] and queues its copy. False to refuse the move.
+    virtual bool RecordCopy(UINT Index) = 0;
+    // Records the copies queued this frame, once per Update().
+    virtual void FlushCopies() = 0;
+    // The copies completed: users switch to the new places of the moves not refused.
+    virtual void Rebind(const std::vector<DefragMove>& Moves) = 0;
+    // Nothing reads the old places any more: commits the moves not refused, frees what emptied.
+    // Returns the number of blocks (heaps) freed.
+    virtual UINT EndPass(const std::vector<DefragMove>& Moves) = 0;
+};
+
+struct IncrementalDefragStats
+{
+    UINT64 Runs = 0;
+    UINT64 Passes = 0;
+    UINT64 MovesCopied = 0;
+    UINT64 MovesRefused = 0;
+    UINT64 BytesMoved = 0;
+    UINT64 BlocksFreed = 0;
+    // Updates that went over the CPU budget (a pass always gets one move per frame).
+    UINT64 BudgetOverruns = 0;
+    double LastUpdateMillisecs = 0.0;
+    // Current per-pass and per-move CPU cost estimates.
+    double PassMillisecs = 0.0;
+    double MoveMillisecs = 0.0;
+    bool Running = false;
+};
+
+class IncrementalDefragmenter
+{
+public:
+    void Initialize(IFrameFence* Fence, IDefragBackend* Backend, const IncrementalDefragDesc& Desc = IncrementalDefragDesc());
+
+    // Render thread, once per frame before the frame's commands are recorded. PendingFenceValue
+    // is the value the frame about to be recorded will signal. CpuMillisecs 0 pauses.
+    // Returns the number of copies recorded.
+    UINT Update(UINT64 PendingFenceValue, double CpuMillisecs, UINT64 MaxBytes);
+    // Finishes or cancels the pass in flight and ends the run. Only when the GPU is idle
+    // (after FrameScheduler::Flush).
+    void Flush();
+
+    bool IsRunning() const { return m_Running; }
+    IncrementalDefragStats GetStats() const;
+
+private:
+    enum class State : UINT8
+    {
+        Idle,
+        Recording,
+        Copying,
+        Retiring
+    };
+
+    static double ElapsedMillisecs(int64_t Start);
+    bool ShouldStart(const D3D12MA::Statistics& Stats) const;
+    // Records moves from m_NextMove while the budget lasts. Returns how many.
+    UINT RecordMoves(int64_t Start, double CpuMillisecs, UINT64 PendingFenceValue);
+    void EndPass();
+    void EndRun();
+
+    IFrameFence* m_Fence = nullptr;
+    IDefragBackend* m_Backend = nullptr;
+    IncrementalDefragDesc m_Desc;
+
+    State m_State = State::Idle;
+    bool m_Running = false;
+    UINT m_Cooldown = 0;
+    std::vector<DefragMove> m_Moves;
+    UINT m_NextMove = 0;
+    // Frame that recorded the last copy of the pass, and the last frame recorded before the switch.
+    UINT64 m_CopyFence = 0;
+    UINT64 m_RetireFence = 0;
+
+    double m_PassMillisecs = 0.0;
+    double m_MoveMillisecs = 0.0;
+    IncrementalDefragStats m_Stats;
+};
+
+class IDefragClient
+{
+public:
+    virtual ~IDefragClient() = default;
+
+    // Whether the resource of Allocation may move: its contents no longer change (static meshes,
+    // loaded textures). Asked right before its copy is recorded.
+    virtual bool CanMove(D3D12MA::Allocation* Allocation) = 0;
+    // State the resource is in between frames, restored after the copy.
+    virtual D3D12_RESOURCE_STATES GetState(D3D12MA::Allocation* Allocation) = 0;
+    // The copy into NewResource completed: views and descriptors switch to it. The old resource
+    // stays valid until the frames in flight completed, then Allocation owns NewResource.
+    virtual void OnMoved(D3D12MA::Allocation* Allocation, ID3D12Resource* NewResource) = 0;
+};
+
+// IDefragBackend on D3D12MA: placed resources at the destinations, CopyResource into the list
+// given by SetCommandList.
+class D3D12DefragBackend : public IDefragBackend
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    // Pool (optional) defragments one custom pool, otherwise the allocator's default pools.
+    // MaxMovesPerPass as in IncrementalDefragDesc, reserved up front so a frame doesn't allocate.
+    void Initialize(ID3D12Device* Device, D3D12MA::Allocator* Allocator, IDefragClient* Client, D3D12MA::Pool* Pool = nullptr,
+        UINT Algorithm = D3D12MA::DEFRAGMENTATION_FLAG_ALGORITHM_FAST, UINT MaxMovesPerPass = 64);
+    // List the copies of the next Update() go to, a direct or compute list of the frame.
+    void SetCommandList(ID3D12GraphicsCommandList* List) { m_List = List; }
+
+    void GetStatistics(D3D12MA::Statistics& Stats) override;
+    void BeginRun() override;
+    void EndRun() override;
+    bool BeginPass(UINT64 MaxBytes, UINT32 MaxMoves, std::vector<DefragMove>& Moves) override;
+    bool RecordCopy(UINT Index) override;
+    void FlushCopies() override;
+    void Rebind(const std::vector<DefragMove>& Moves) override;
+    UINT EndPass(const std::vector<DefragMove>& Moves) override;
+
+private:
+    ID3D12Device* m_Device = nullptr;
+    D3D12MA::Allocator* m_Allocator = nullptr;
+    D3D12MA::Pool* m_Pool = nullptr;
+    IDefragClient* m_Client = nullptr;
+    UINT m_Algorithm = 0;
+    ID3D12GraphicsCommandList* m_List = nullptr;
+
+    COM<D3D12MA::DefragmentationContext> m_Context;
+    D3D12MA::DEFRAGMENTATION_PASS_MOVE_INFO m_Pass = {};
+    UINT m_HeapsFreed = 0;
+    // Per move of the pass, null for refused ones.
+    std::vector<COM<ID3D12Resource>> m_NewResources;
+
+    // Copies queued since the last FlushCopies().
+    std::vector<D3D12_RESOURCE_BARRIER> m_Before;
+    std::vector<D3D12_RESOURCE_BARRIER> m_After;
+    std::vector<UINT> m_Copies;
+};
@@ -0,0 +1,280 @@
+#include "VRDescriptorAllocator.h"
+#include "BlackSpaceDirectX.h"
+
+static inline void UpdatePeak(std::atomic<UINT>& Peak, UINT Value)
+{
+	UINT peak = Peak.load(std::memory_order_relaxed);
+	while (Value > peak && !Peak.compare_exchange_weak(peak, Value, std::memory_order_relaxed))
+	{
+	}
+}
+
+void DescriptorFreeList::Initialize(UINT Capacity)
+{
+	RAID_ASSERT(Capacity < Invalid);
+	m_Capacity = Capacity;
+	m_Next = std::make_unique<std::atomic<UINT>[]>(Capacity);
+	for (UINT i = 0; i < Capacity; i++)
+	{
+		m_Next[i].store(i + 1 < Capacity ? i + 1 : Invalid, std::memory_order_relaxed);
+	}
+	m_Allocated.store(0, std::memory_order_relaxed);
+	m_Head.store(Pack(Capacity ? 0 : Invalid, 0), std::memory_order_release);
+}
+
+void DescriptorFreeList::Destroy()
+{
+	m_Next.reset();
+	m_Capacity = 0;
+	m_Allocated.store(0, std::memory_order_relaxed);
+	m_Head.store(Pack(Invalid, 0), std::memory_order_release);
+}
+
+UINT DescriptorFreeList::Allocate()
+{
+	UINT64 head = m_Head.load(std::memory_order_acquire);
+	UINT index;
+	for (;;)
+	{
+		index = (UINT)head;
+		if (index == Invalid)
+			return Invalid;
+		// May read a link another thread is rewriting, the tag makes the CAS fail in that case.
+		const UINT next = m_Next[index].load(std::memory_order_relaxed);
+		if (m_Head.compare_exchange_weak(head, Pack(next, (UINT)(head >> 32) + 1),
+			std::memory_order_acq_rel, std::memory_order_acquire))
+			break;
+	}
+	m_Allocated.fetch_add(1, std::memory_order_relaxed);
+	return index;
+}
+
+void DescriptorFreeList::Free(UINT Index)
+{
+	RAID_ASSERT(Index < m_Capacity);
+	UINT64 head = m_Head.load(std::memory_order_relaxed);
+	do
+	{
+		m_Next[Index].store((UINT)head, std::memory_order_relaxed);
+	} while (!m_Head.compare_exchange_weak(head, Pack(Index, (UINT)(head >> 32) + 1),
+		std::memory_order_release, std::memory_order_relaxed));
+	m_Allocated.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void DescriptorRing::Initialize(UINT Capacity)
+{
+	m_Capacity = Capacity;
+	m_Head.store(0, std::memory_order_relaxed);
+	m_Tail.store(0, std::memory_order_relaxed);
+	m_FrameFirst = 0;
+	m_FrameCount = 0;
+}
+
+bool DescriptorRing::Allocate(UINT Count, UINT* First)
+{
+	RAID_ASSERT(Count > 0);
+	if (Count > m_Capacity)
+		return false;
+	UINT64 head = m_Head.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		// A range that would straddle the end starts over at index 0, the skipped tail is
+		// reclaimed with the frame.
+		UINT64 start = head;
+		const UINT64 offset = head % m_Capacity;
+		if (offset + Count > m_Capacity)
+			start += m_Capacity - offset;
+		const UINT64 end = start + Count;
+		if (end - m_Tail.load(std::memory_order_acquire) > m_Capacity)
+			return false;
+		if (m_Head.compare_exchange_weak(head, end, std::memory_order_relaxed, std::memory_order_relaxed))
+		{
+			*First = (UINT)(start % m_Capacity);
+			return true;
+		}
+	}
+}
+
+void DescriptorRing::EndFrame(UINT64 FenceValue)
+{
+	RAID_ASSERT(m_FrameCount < MaxFrames);
+	Frame& f = m_Frames[(m_FrameFirst + m_FrameCount) % MaxFrames];
+	f.FenceValue = FenceValue;
+	f.Head = m_Head.load(std::memory_order_relaxed);
+	m_FrameCount++;
+}
+
+void DescriptorRing::Reclaim(UINT64 CompletedFenceValue)
+{
+	while (m_FrameCount > 0 && m_Frames[m_FrameFirst].FenceValue <= CompletedFenceValue)
+	{
+		m_Tail.store(m_Frames[m_FrameFirst].Head, std::memory_order_release);
+		m_FrameFirst = (m_FrameFirst + 1) % MaxFrames;
+		m_FrameCount--;
+	}
+}
+
+UINT DescriptorRing::GetUsedCount() const
+{
+	return (UINT)(m_Head.load(std::memory_order_relaxed) - m_Tail.load(std::memory_order_relaxed));
+}
+
+void StagingDescriptorHeap::Initialize(ID3D12Device* Device, D3D12_DESCRIPTOR_HEAP_TYPE Type, UINT Count)
+{
+	D3D12_DESCRIPTOR_HEAP_DESC d = {};
+	d.Type = Type;
+	d.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	d.NumDescriptors = Count;
+	ThrowIfFailed(Device->CreateDescriptorHeap(&d, IID_PPV_ARGS(&m_Heap)));
+	InitializeHeadless(Type, Count, m_Heap->GetCPUDescriptorHandleForHeapStart(),
+		Device->GetDescriptorHandleIncrementSize(Type));
+}
+
+void StagingDescriptorHeap::InitializeHeadless(D3D12_DESCRIPTOR_HEAP_TYPE Type, UINT Count, D3D12_CPU_DESCRIPTOR_HANDLE Base, UINT Increment)
+{
+	m_Type = Type;
+	m_Base = Base;
+	m_Increment = Increment;
+	m_Free.Initialize(Count);
+	m_PeakUsed.store(0, std::memory_order_relaxed);
+	m_Failed.store(0, std::memory_order_relaxed);
+}
+
+void StagingDescriptorHeap::Destroy()
+{
+	m_Free.Destroy();
+	m_Heap.Reset();
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE StagingDescriptorHeap::Allocate()
+{
+	const UINT index = m_Free.Allocate();
+	if (index == DescriptorFreeList::Invalid)
+	{
+		m_Failed.fetch_add(1, std::memory_order_relaxed);
+		return { 0 };
+	}
+	UpdatePeak(m_PeakUsed, m_Free.GetAllocatedCount());
+	return GetHandle(index);
+}
+
+void StagingDescriptorHeap::Free(D3D12_CPU_DESCRIPTOR_HANDLE Handle)
+{
+	if (Handle.ptr == 0)
+		return;
+	RAID_ASSERT(Handle.ptr >= m_Base.ptr && (Handle.ptr - m_Base.ptr) % m_Increment == 0);
+	m_Free.Free(GetIndex(Handle));
+}
+
+DescriptorHeapStats StagingDescriptorHeap::GetStats() const
+{
+	DescriptorHeapStats s;
+	s.Capacity = m_Free.GetCapacity();
+	s.Used = m_Free.GetAllocatedCount();
+	s.PeakUsed = m_PeakUsed.load(std::memory_order_relaxed);
+	s.FailedAllocations = m_Failed.load(std::memory_order_relaxed);
+	return s;
+}
+
+void ShaderVisibleDescriptorHeap::Initialize(ID3D12Device* Device, D3D12_DESCRIPTOR_HEAP_TYPE Type, UINT Count, UINT PersistentCount)
+{
+	RAID_ASSERT(Type == D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV || Type == D3D12_DESCRIPTOR_HEAP_TYPE_SAMPLER);
+	D3D12_DESCRIPTOR_HEAP_DESC d = {};
+	d.Type = Type;
+	d.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+	d.NumDescriptors = Count;
+	ThrowIfFailed(Device->CreateDescriptorHeap(&d, IID_PPV_ARGS(&m_Heap)));
+	m_Heap->SetName(L"ShaderVisibleDescriptors");
+	InitializeHeadless(Type, Count, m_Heap->GetCPUDescriptorHandleForHeapStart(),
+		m_Heap->GetGPUDescriptorHandleForHeapStart(), Device->GetDescriptorHandleIncrementSize(Type), PersistentCount);
+	m_Device = Device;
+}
+
+void ShaderVisibleDescriptorHeap::InitializeHeadless(D3D12_DESCRIPTOR_HEAP_TYPE Type, UINT Count, D3D12_CPU_DESCRIPTOR_HANDLE CPUBase,
+	D3D12_GPU_DESCRIPTOR_HANDLE GPUBase, UINT Increment, UINT PersistentCount)
+{
+	RAID_ASSERT(PersistentCount < Count);
+	m_Type = Type;
+	m_CPUBase = CPUBase;
+	m_GPUBase = GPUBase;
+	m_Increment = Increment;
+	m_PersistentCount = PersistentCount;
+	m_Ring.Initialize(Count - PersistentCount);
+	m_PeakUsed.store(0, std::memory_order_relaxed);
+	m_Failed.store(0, std::memory_order_relaxed);
+}
+
+void ShaderVisibleDescriptorHeap::Destroy()
+{
+	m_Heap.Reset();
+	m_Device.Reset();
+}
+
+void ShaderVisibleDescriptorHeap::BeginFrame(UINT64 CompletedFenceValue)
+{
+	m_Ring.Reclaim(CompletedFenceValue);
+}
+
+void ShaderVisibleDescriptorHeap::EndFrame(UINT64 FenceValue)
+{
+	UpdatePeak(m_PeakUsed, m_Ring.GetUsedCount());
+	m_Ring.EndFrame(FenceValue);
+}
+
+DescriptorRange ShaderVisibleDescriptorHeap::Allocate(UINT Count)
+{
+	DescriptorRange r;
+	UINT first = 0;
+	if (!m_Ring.Allocate(Count, &first))
+	{
+		m_Failed.fetch_add(1, std::memory_order_relaxed);
+		return r;
+	}
+	r.Index = m_PersistentCount + first;
+	r.Count = Count;
+	r.Increment = m_Increment;
+	r.CPU = GetCPUHandle(r.Index);
+	r.GPU = GetGPUHandle(r.Index);
+	return r;
+}
+
+DescriptorRange ShaderVisibleDescriptorHeap::AllocateTable(const D3D12_CPU_DESCRIPTOR_HANDLE* Sources, UINT Count)
+{
+	RAID_ASSERT(m_Device != nullptr);
+	DescriptorRange r = Allocate(Count);
+	if (r.IsValid())
+	{
+		// One destination range, Count source ranges of one descriptor each.
+		m_Device->CopyDescriptors(1, &r.CPU, &Count, Count, Sources, nullptr, m_Type);
+	}
+	return r;
+}
+
+DescriptorHeapStats ShaderVisibleDescriptorHeap::GetStats() const
+{
+	DescriptorHeapStats s;
+	s.Capacity = m_Ring.GetCapacity();
+	s.Used = m_Ring.GetUsedCount();
+	s.PeakUsed = m_PeakUsed.load(std::memory_order_relaxed);
+	s.FailedAllocations = m_Failed.load(std::memory_order_relaxed);
+	return s;
+}
+
+void DescriptorAllocator::Initialize(ID3D12Device* Device, const Desc& Config)
+{
+	for (UINT t = 0; t < D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES; t++)
+	{
+		m_Staging[t].Initialize(Device, (D3D12_DESCRIPTOR_HEAP_TYPE)t, Config.StagingCount[t]);
+	}
+	m_ShaderVisible.Initialize(Device, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV,
+		Config.BindlessCount + Config.ShaderVisibleCount, Config.BindlessCount);
+}
+
+void DescriptorAllocator::Destroy()
+{
+	for (auto& s : m_Staging)
+	{
+		s.Destroy();
+	}
+	m_ShaderVisible.Destroy();
+}
@@ -0,0 +1,214 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include <d3d12.h>
+#include <wrl.h>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Descriptor management.
+*
+* StagingDescriptorHeap: CPU-only heap of one type. Views are created here once and copied into
+* the shader-visible heap when needed. Single descriptors come from a lock-free free list, so any
+* thread can create/destroy views without taking a lock.
+*
+* ShaderVisibleDescriptorHeap: the CBV/SRV/UAV heap bound for drawing, used as a ring. Allocate()
+* hands out contiguous ranges (descriptor tables) with one CAS on the head. EndFrame() stamps the
+* head with the frame's fence value, BeginFrame() releases everything up to the newest frame whose
+* fence has completed. A range never wraps around the end of the heap. The first PersistentCount
+* descriptors are kept out of the ring for long-lived tables (see VRBindlessTable.h).
+*
+* The index bookkeeping (DescriptorFreeList, DescriptorRing) knows nothing about D3D12, and both
+* heaps have InitializeHeadless() taking a fake base handle and increment, so they run without a
+* device.
+*/
+
+// Lock-free LIFO of indices [0, Capacity). Head is index + ABA tag.
+class DescriptorFreeList
+{
+public:
+    const static UINT Invalid = UINT_MAX;
+
+    void Initialize(UINT Capacity);
+    void Destroy();
+
+    // Thread-safe. Returns Invalid when empty.
+    UINT Allocate();
+    // Thread-safe.
+    void Free(UINT Index);
+
+    UINT GetCapacity() const { return m_Capacity; }
+    UINT GetAllocatedCount() const { return m_Allocated.load(std::memory_order_relaxed); }
+
+private:
+    static UINT64 Pack(UINT Index, UINT Tag) { return ((UINT64)Tag << 32) | Index; }
+
+    std::unique_ptr<std::atomic<UINT>[]> m_Next;
+    std::atomic<UINT64> m_Head{ Pack(Invalid, 0) };
+    std::atomic<UINT> m_Allocated{ 0 };
+    UINT m_Capacity = 0;
+};
+
+// Ring of indices [0, Capacity) reclaimed in frame order by fence value.
+class DescriptorRing
+{
+public:
+    const static UINT MaxFrames = 8;
+
+    void Initialize(UINT Capacity);
+
+    // Thread-safe. Count contiguous indices, never wrapping. Returns false when the ring is full.
+    bool Allocate(UINT Count, UINT* First);
+
+    // Render thread. Everything allocated so far is released once FenceValue completes.
+    void EndFrame(UINT64 FenceValue);
+    // Render thread. Releases the frames whose fence value is <= CompletedFenceValue.
+    void Reclaim(UINT64 CompletedFenceValue);
+
+    UINT GetCapacity() const { return m_Capacity; }
+    // Indices in use (allocated and not yet reclaimed, padding at the end of a wrap included).
+    UINT GetUsedCount() const;
+
+private:
+    struct Frame
+    {
+        UINT64 FenceValue;
+        UINT64 Head;
+    };
+
+    UINT m_Capacity = 0;
+    // Monotonic positions, index = position % capacity.
+    std::atomic<UINT64> m_Head{ 0 };
+    std::atomic<UINT64> m_Tail{ 0 };
+    Frame m_Frames[MaxFrames] = {};
+    UINT m_FrameFirst = 0;
+    UINT m_FrameCount = 0;
+};
+
+struct DescriptorRange
+{
+    D3D12_CPU_DESCRIPTOR_HANDLE CPU = {};
+    D3D12_GPU_DESCRIPTOR_HANDLE GPU = {};
+    UINT Index = 0;
+    UINT Count = 0;
+    UINT Increment = 0;
+
+    bool IsValid() const { return Count != 0; }
+    D3D12_CPU_DESCRIPTOR_HANDLE CPUAt(UINT i) const { return { CPU.ptr + (SIZE_T)i * Increment }; }
+    D3D12_GPU_DESCRIPTOR_HANDLE GPUAt(UINT i) const { return { GPU.ptr + (UINT64)i * Increment }; }
+};
+
+struct DescriptorHeapStats
+{
+    UINT Capacity = 0;
+    UINT Used = 0;
+    UINT PeakUsed = 0;
+    UINT64 FailedAllocations = 0;
+};
+
+class StagingDescriptorHeap
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    void Initialize(ID3D12Device* Device, D3D12_DESCRIPTOR_HEAP_TYPE Type, UINT Count);
+    void InitializeHeadless(D3D12_DESCRIPTOR_HEAP_TYPE Type, UINT Count, D3D12_CPU_DESCRIPTOR_HANDLE Base, UINT Increment);
+    void Destroy();
+
+    // Thread-safe. Returns a null handle (ptr == 0) when the heap is full.
+    D3D12_CPU_DESCRIPTOR_HANDLE Allocate();
+    // Thread-safe.
+    void Free(D3D12_CPU_DESCRIPTOR_HANDLE Handle);
+
+    UINT GetIndex(D3D12_CPU_DESCRIPTOR_HANDLE Handle) const { return (UINT)((Handle.ptr - m_Base.ptr) / m_Increment); }
+    D3D12_CPU_DESCRIPTOR_HANDLE GetHandle(UINT Index) const { return { m_Base.ptr + (SIZE_T)Index * m_Increment }; }
+    UINT GetIncrement() const { return m_Increment; }
+    D3D12_DESCRIPTOR_HEAP_TYPE GetType() const { return m_Type; }
+    ID3D12DescriptorHeap* GetHeap() const { return m_Heap.Get(); }
+    DescriptorHeapStats GetStats() const;
+
+private:
+    COM<ID3D12DescriptorHeap> m_Heap;
+    D3D12_DESCRIPTOR_HEAP_TYPE m_Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+    D3D12_CPU_DESCRIPTOR_HANDLE m_Base = {};
+    UINT m_Increment = 0;
+    DescriptorFreeList m_Free;
+    std::atomic<UINT> m_PeakUsed{ 0 };
+    std::atomic<UINT64> m_Failed{ 0 };
+};
+
+class ShaderVisibleDescriptorHeap
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    // CBV_SRV_UAV or SAMPLER. Count includes the PersistentCount descriptors at the start of the heap.
+    void Initialize(ID3D12Device* Device, D3D12_DESCRIPTOR_HEAP_TYPE Type, UINT Count, UINT PersistentCount = 0);
+    void InitializeHeadless(D3D12_DESCRIPTOR_HEAP_TYPE Type, UINT Count, D3D12_CPU_DESCRIPTOR_HANDLE CPUBase,
+        D3D12_GPU_DESCRIPTOR_HANDLE GPUBase, UINT Increment, UINT PersistentCount = 0);
+    void Destroy();
+
+    // Call with the queue's completed fence value before allocating for a new frame.
+    void BeginFrame(UINT64 CompletedFenceValue);
+    // Call with the fence value signaled after the frame's command lists.
+    void EndFrame(UINT64 FenceValue);
+
+    // Thread-safe. Returns an invalid range (Count == 0) when the ring is full.
+    DescriptorRange Allocate(UINT Count);
+
+    // Allocates a table and fills it from staging descriptors with one CopyDescriptors call.
+    // Sources may live in different staging heaps of the same type. Needs a device.
+    DescriptorRange AllocateTable(const D3D12_CPU_DESCRIPTOR_HANDLE* Sources, UINT Count);
+
+    ID3D12DescriptorHeap* GetHeap() const { return m_Heap.Get(); }
+    ID3D12Device* GetDevice() const { return m_Device.Get(); }
+    UINT GetIncrement() const { return m_Increment; }
+    UINT GetPersistentCount() const { return m_PersistentCount; }
+    D3D12_CPU_DESCRIPTOR_HANDLE GetCPUHandle(UINT Index) const { return { m_CPUBase.ptr + (SIZE_T)Index * m_Increment }; }
+    D3D12_GPU_DESCRIPTOR_HANDLE GetGPUHandle(UINT Index) const { return { m_GPUBase.ptr + (UINT64)Index * m_Increment }; }
+    // Stats of the ring part.
+    DescriptorHeapStats GetStats() const;
+
+private:
+    COM<ID3D12Device> m_Device;
+    COM<ID3D12DescriptorHeap> m_Heap;
+    D3D12_DESCRIPTOR_HEAP_TYPE m_Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+    D3D12_CPU_DESCRIPTOR_HANDLE m_CPUBase = {};
+    D3D12_GPU_DESCRIPTOR_HANDLE m_GPUBase = {};
+    UINT m_Increment = 0;
+    UINT m_PersistentCount = 0;
+    DescriptorRing m_Ring;
+    std::atomic<UINT> m_PeakUsed{ 0 };
+    std::atomic<UINT64> m_Failed{ 0 };
+};
+
+// One staging heap per descriptor type plus the shader-visible CBV/SRV/UAV ring.
+class DescriptorAllocator
+{
+public:
+    struct Desc
+    {
+        UINT StagingCount[D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES] = { 16384, 1024, 256, 64 };
+        // Ring part of the shader-visible heap.
+        UINT ShaderVisibleCount = 65536;
+        // Persistent descriptors in front of the ring, for BindlessTable.
+        UINT BindlessCount = 0;
+    };
+
+    void Initialize(ID3D12Device* Device, const Desc& Config);
+    void Destroy();
+
+    void BeginFrame(UINT64 CompletedFenceValue) { m_ShaderVisible.BeginFrame(CompletedFenceValue); }
+    void EndFrame(UINT64 FenceValue) { m_ShaderVisible.EndFrame(FenceValue); }
+
+    D3D12_CPU_DESCRIPTOR_HANDLE AllocateStaging(D3D12_DESCRIPTOR_HEAP_TYPE Type) { return m_Staging[Type].Allocate(); }
+    void FreeStaging(D3D12_DESCRIPTOR_HEAP_TYPE Type, D3D12_CPU_DESCRIPTOR_HANDLE Handle) { m_Staging[Type].Free(Handle); }
+
+    StagingDescriptorHeap& GetStaging(D3D12_DESCRIPTOR_HEAP_TYPE Type) { return m_Staging[Type]; }
+    ShaderVisibleDescriptorHeap& GetShaderVisible() { return m_ShaderVisible; }
+
+private:
+    StagingDescriptorHeap m_Staging[D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES];
+    ShaderVisibleDescriptorHeap m_ShaderVisible;
+};
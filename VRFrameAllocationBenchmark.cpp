@@ -0,0 +1,196 @@
+#include "VRFrameAllocationBenchmark.h"
+#include "VRGpuProfiler.h"
+#include "VRUploadStreamer.h"
+#include "VRBindlessTable.h"
+#include "VRDeferredRelease.h"
+#include "VRFrameArena.h"
+#include "BSTime.h"
+
+// Frames the stand-in GPU runs behind the CPU.
+static const UINT64 BenchmarkLatency = 2;
+static const UINT BenchmarkSlots = 3;
+static const UINT BenchmarkPasses = 8;
+static const UINT BenchmarkUploads = 16;
+static const UINT BenchmarkBindlessSlots = 4096;
+static const UINT BenchmarkBindlessPerFrame = 64;
+static const UINT BenchmarkReleasesPerFrame = 64;
+static const UINT BenchmarkArenaAllocations = 256;
+
+// Completes each value BenchmarkLatency frames after it was signaled.
+class LaggingFrameFence : public IFrameFence
+{
+public:
+	void Signal(UINT64 Value) override { m_Signaled = Value; }
+	UINT64 GetCompletedValue() override { return m_Signaled > BenchmarkLatency ? m_Signaled - BenchmarkLatency : 0; }
+	void WaitForValue(UINT64) override {}
+
+private:
+	UINT64 m_Signaled = 0;
+};
+
+// Records nothing, every batch completes BenchmarkLatency submits later.
+class NullUploadQueue : public IUploadQueue
+{
+public:
+	UINT64 GetStagingSize(const UploadRequest& Request) override { return Request.Size; }
+	void Begin() override {}
+	void Record(const UploadRequest&, UINT64) override {}
+	UINT64 Submit() override { return ++m_Submitted; }
+	UINT64 GetCompletedValue() override { return m_Submitted > BenchmarkLatency ? m_Submitted - BenchmarkLatency : 0; }
+	void WaitForValue(UINT64) override {}
+
+private:
+	UINT64 m_Submitted = 0;
+};
+
+// A microsecond per timestamp, calibrated at tick 0.
+class SyntheticTimestamps : public IGpuTimestampQueries
+{
+public:
+	void WriteTimestamp(ID3D12GraphicsCommandList*, UINT, UINT) override {}
+	void Resolve(ID3D12GraphicsCommandList*, UINT, UINT) override {}
+	void Read(UINT, UINT Count, UINT64* Out) override
+	{
+		for (UINT i = 0; i < Count; i++)
+		{
+			Out[i] = m_Time + i;
+		}
+		m_Time += Count;
+	}
+	UINT64 GetFrequency() override { return 1000000; }
+	void GetCalibration(UINT64& GpuTimestamp, int64_t& CpuTick) override
+	{
+		GpuTimestamp = m_Time;
+		CpuTick = 0;
+	}
+
+private:
+	UINT64 m_Time = 0;
+};
+
+static void ReleaseNothing(void*) {}
+
+FrameAllocationBenchmarkResult BenchmarkFrameAllocations(UINT Frames, UINT WarmupFrames)
+{
+	FrameAllocationBenchmarkResult r;
+	r.Frames = Frames;
+
+	LaggingFrameFence fence;
+	NullUploadQueue upload_queue;
+	SyntheticTimestamps timestamps;
+
+	GpuProfiler profiler;
+	profiler.Initialize(&timestamps, BenchmarkSlots + 1, BenchmarkPasses);
+	UploadStreamer streamer;
+	streamer.Initialize(&upload_queue, 4 * 1024 * 1024, 1024 * 1024);
+	BindlessTable bindless;
+	bindless.InitializeHeadless(BenchmarkBindlessSlots);
+	DeferredReleaseQueue deferred;
+	deferred.Initialize(&fence);
+	FrameArena arena;
+	arena.Initialize(BenchmarkSlots);
+
+	// Stand-ins for the buffer being uploaded to and the objects being released.
+	static UINT8 upload_data[4096];
+	static UINT8 objects[BenchmarkReleasesPerFrame];
+	ID3D12Resource* const destination = reinterpret_cast<ID3D12Resource*>(upload_data);
+	BindlessHandle handles[BenchmarkBindlessPerFrame];
+
+	int64_t start = 0;
+	for (UINT f = 0; f < WarmupFrames + Frames; f++)
+	{
+		const bool measured = f >= WarmupFrames;
+		if (f == WarmupFrames)
+			start = SystemTime::GetCurrentTick();
+		const UINT slot = f % BenchmarkSlots;
+		const UINT64 fence_value = (UINT64)f + 1;
+		const UINT64 completed = fence.GetCompletedValue();
+		{
+			NoHeapAllocationScope scope(false);
+			arena.BeginFrame(slot);
+			UINT* keys = arena.AllocateArray<UINT>(BenchmarkArenaAllocations);
+			for (UINT i = 0; i < BenchmarkArenaAllocations; i++)
+			{
+				keys[i] = i;
+			}
+			std::pmr::vector<UINT> sorted(arena.GetResource());
+			sorted.assign(keys, keys + BenchmarkArenaAllocations);
+			if (measured)
+				r.ArenaAllocations += scope.GetAllocations();
+		}
+		{
+			NoHeapAllocationScope scope(false);
+			deferred.BeginFrame(fence_value);
+			for (UINT i = 0; i < BenchmarkReleasesPerFrame; i++)
+			{
+				deferred.Release(&objects[i], ReleaseNothing);
+			}
+			if (measured)
+				r.DeferredReleaseAllocations += scope.GetAllocations();
+		}
+		{
+			NoHeapAllocationScope scope(false);
+			for (UINT i = 0; i < BenchmarkUploads; i++)
+			{
+				UploadRequest request;
+				request.Destination = destination;
+				request.Data = upload_data;
+				request.Size = sizeof(upload_data);
+				streamer.Enqueue(request);
+			}
+			streamer.Update();
+			if (measured)
+				r.StreamerAllocations += scope.GetAllocations();
+		}
+		{
+			NoHeapAllocationScope scope(false);
+			bindless.BeginFrame(completed);
+			for (UINT i = 0; i < BenchmarkBindlessPerFrame; i++)
+			{
+				handles[i] = bindless.Allocate();
+			}
+			for (UINT i = 0; i < BenchmarkBindlessPerFrame; i++)
+			{
+				bindless.Free(handles[i]);
+			}
+			if (measured)
+				r.BindlessAllocations += scope.GetAllocations();
+		}
+		{
+			NoHeapAllocationScope scope(false);
+			profiler.BeginFrame(completed);
+			for (UINT i = 0; i < BenchmarkPasses; i++)
+			{
+				profiler.EndPass(nullptr, profiler.BeginPass(nullptr, "Pass"));
+			}
+			profiler.Resolve(nullptr);
+			if (measured)
+				r.ProfilerAllocations += scope.GetAllocations();
+		}
+		fence.Signal(fence_value);
+		{
+			NoHeapAllocationScope scope(false);
+			bindless.EndFrame(fence_value);
+			if (measured)
+				r.BindlessAllocations += scope.GetAllocations();
+		}
+		{
+			NoHeapAllocationScope scope(false);
+			profiler.EndFrame(fence_value);
+			if (measured)
+				r.ProfilerAllocations += scope.GetAllocations();
+		}
+	}
+	const int64_t end = SystemTime::GetCurrentTick();
+	if (Frames > 0)
+		r.FrameMicrosecs = SystemTime::TimeBetweenTicks(start, end) * 1e6 / Frames;
+	r.TotalAllocations = r.ProfilerAllocations + r.StreamerAllocations + r.BindlessAllocations +
+		r.DeferredReleaseAllocations + r.ArenaAllocations;
+
+	streamer.Destroy();
+	deferred.ReleaseAll();
+	bindless.Destroy();
+	profiler.Destroy();
+	arena.Destroy();
+	return r;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "VRCore.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Heap allocations of the per-frame subsystems in the steady state, without a device. Every
+* subsystem runs its BeginFrame/EndFrame loop against a stand-in (IFrameFence, IUploadQueue,
+* IGpuTimestampQueries) the way VRD3D12::Render drives it, with a frame's worth of work between:
+*   GpuProfiler           - a few passes begun, ended and resolved, frames collected two late.
+*   UploadStreamer        - buffer requests enqueued and submitted every frame.
+*   BindlessTable         - slots allocated and freed, recycled once their fence passed.
+*   DeferredReleaseQueue  - objects released and swept.
+*   FrameArena            - raw allocations and a std::pmr::vector per frame.
+*   FrameAllocationBenchmarkResult r = BenchmarkFrameAllocations();
+*   RAID_ASSERT(r.TotalAllocations == 0);
+*
+* After WarmupFrames (which let every container grow to its steady size), each subsystem's calls
+* run under a NoHeapAllocationScope that does not assert, its count goes into the result. The
+* counts need VR_COUNT_HEAP_ALLOCATIONS (see VRFrameArena.h), without it they stay 0.
+*/
+
+struct FrameAllocationBenchmarkResult
+{
+    // Measured frames, the warm-up excluded.
+    UINT Frames = 0;
+    // Heap allocations over the measured frames, per subsystem.
+    UINT64 ProfilerAllocations = 0;
+    UINT64 StreamerAllocations = 0;
+    UINT64 BindlessAllocations = 0;
+    UINT64 DeferredReleaseAllocations = 0;
+    UINT64 ArenaAllocations = 0;
+    UINT64 TotalAllocations = 0;
+    // CPU time of one headless frame, all subsystems.
+    double FrameMicrosecs = 0.0;
+};
+
+FrameAllocationBenchmarkResult BenchmarkFrameAllocations(UINT Frames = 1000, UINT WarmupFrames = 16);
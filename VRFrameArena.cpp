@@ -0,0 +1,374 @@
+#include "VRFrameArena.h"
+#include "BSTime.h"
+#include <cstring>
+#include <cstdlib>
+
+#if VR_COUNT_HEAP_ALLOCATIONS
+static thread_local UINT64 t_HeapAllocations = 0;
+
+// Replaces the global operator new/delete of the executable to count allocations. The array,
+// sized and nothrow forms of the runtime forward to these.
+void* operator new(size_t Bytes)
+{
+	t_HeapAllocations++;
+	if (void* p = malloc(Bytes ? Bytes : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* Pointer) noexcept
+{
+	free(Pointer);
+}
+
+void* operator new(size_t Bytes, std::align_val_t Alignment)
+{
+	t_HeapAllocations++;
+	const size_t alignment = (size_t)Alignment;
+	Bytes = (std::max)((Bytes + alignment - 1) & ~(alignment - 1), alignment);
+#ifdef _WIN32
+	void* p = _aligned_malloc(Bytes, alignment);
+#else
+	void* p = aligned_alloc(alignment, Bytes);
+#endif
+	if (p)
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* Pointer, std::align_val_t) noexcept
+{
+#ifdef _WIN32
+	_aligned_free(Pointer);
+#else
+	free(Pointer);
+#endif
+}
+
+UINT64 HeapAllocationCounter::GetThreadAllocations()
+{
+	return t_HeapAllocations;
+}
+#else
+UINT64 HeapAllocationCounter::GetThreadAllocations()
+{
+	return 0;
+}
+#endif
+
+const static unsigned char AllocatedPoison = 0xCD;
+const static unsigned char RewoundPoison = 0xDD;
+const static size_t ChunkAlignment = 64;
+
+struct FrameArena::Chunk
+{
+	Chunk* Next;
+	size_t Size;
+
+	unsigned char* GetData() { return reinterpret_cast<unsigned char*>(this) + HeaderBytes(); }
+	static size_t HeaderBytes() { return (sizeof(Chunk) + ChunkAlignment - 1) & ~(ChunkAlignment - 1); }
+};
+
+// One slot's chunks of one thread. Chunks up to Current are in use this frame, the rest are
+// left over from bigger frames and reused before anything new is allocated.
+struct FrameArena::ThreadChain
+{
+	Chunk* First = nullptr;
+	Chunk* Current = nullptr;
+	size_t Offset = 0;
+	// Bytes used in the chunks before Current.
+	size_t Retired = 0;
+};
+
+struct FrameArena::ThreadState
+{
+	ThreadChain Chains[MaxSlots];
+	std::thread::id Thread;
+};
+
+// Last few arenas the thread used, so alternating between two does not go through the mutex.
+struct FrameArenaThreadCache
+{
+	const static UINT Entries = 4;
+	UINT64 Arena[Entries] = {};
+	void* State[Entries] = {};
+	UINT Next = 0;
+};
+static thread_local FrameArenaThreadCache t_ArenaCache;
+static std::atomic<UINT64> s_NextArenaId{ 1 };
+
+FrameArena::FrameArena()
+{
+}
+
+FrameArena::~FrameArena()
+{
+	Destroy();
+}
+
+void FrameArena::Initialize(UINT Slots, size_t ChunkBytes)
+{
+	RAID_ASSERT(Slots > 0 && Slots <= MaxSlots && ChunkBytes > 0);
+	Destroy();
+	m_Slots = Slots;
+	m_ChunkBytes = ChunkBytes;
+	m_Slot.store(0);
+	m_Id = s_NextArenaId.fetch_add(1);
+}
+
+void FrameArena::Destroy()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const UINT threads = m_ThreadCount.load();
+	for (UINT t = 0; t < threads; t++)
+	{
+		for (ThreadChain& chain : m_Threads[t]->Chains)
+		{
+			Chunk* chunk = chain.First;
+			while (chunk)
+			{
+				Chunk* next = chunk->Next;
+				::operator delete(chunk, std::align_val_t(ChunkAlignment));
+				chunk = next;
+			}
+		}
+		m_Threads[t].reset();
+	}
+	m_ThreadCount.store(0);
+	m_Chunks.store(0);
+	m_AllocatedBytes.store(0);
+	m_LastFrameBytes = 0;
+	m_PeakFrameBytes = 0;
+	// Thread caches still point at the freed states, a new id makes them miss.
+	m_Id = s_NextArenaId.fetch_add(1);
+}
+
+void FrameArena::BeginFrame(UINT Slot)
+{
+	RAID_ASSERT(Slot < m_Slots);
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	UINT64 bytes = 0;
+	const UINT threads = m_ThreadCount.load(std::memory_order_relaxed);
+	for (UINT t = 0; t < threads; t++)
+	{
+		ThreadChain& chain = m_Threads[t]->Chains[Slot];
+		if (!chain.Current)
+			continue;
+		bytes += chain.Retired + chain.Offset;
+#if VR_FRAME_ARENA_POISON
+		for (Chunk* chunk = chain.First; chunk; chunk = chunk->Next)
+		{
+			memset(chunk->GetData(), RewoundPoison, chunk == chain.Current ? chain.Offset : chunk->Size);
+			if (chunk == chain.Current)
+				break;
+		}
+#endif
+		chain.Current = nullptr;
+		chain.Offset = 0;
+		chain.Retired = 0;
+	}
+	m_LastFrameBytes = bytes;
+	m_PeakFrameBytes = (std::max)(m_PeakFrameBytes, bytes);
+	m_Slot.store(Slot, std::memory_order_relaxed);
+}
+
+FrameArena::ThreadState& FrameArena::GetThreadState()
+{
+	FrameArenaThreadCache& cache = t_ArenaCache;
+	for (UINT i = 0; i < FrameArenaThreadCache::Entries; i++)
+	{
+		if (cache.Arena[i] == m_Id)
+			return *static_cast<ThreadState*>(cache.State[i]);
+	}
+	return RegisterThread();
+}
+
+FrameArena::ThreadState& FrameArena::RegisterThread()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const std::thread::id id = std::this_thread::get_id();
+	ThreadState* state = nullptr;
+	const UINT count = m_ThreadCount.load(std::memory_order_relaxed);
+	for (UINT i = 0; i < count && !state; i++)
+	{
+		if (m_Threads[i]->Thread == id)
+			state = m_Threads[i].get();
+	}
+	if (!state)
+	{
+		RAID_ASSERT(count < MaxThreads && "Too many threads using the frame arena");
+		m_Threads[count] = std::make_unique<ThreadState>();
+		state = m_Threads[count].get();
+		state->Thread = id;
+		m_ThreadCount.store(count + 1, std::memory_order_release);
+	}
+	FrameArenaThreadCache& cache = t_ArenaCache;
+	const UINT entry = cache.Next++ % FrameArenaThreadCache::Entries;
+	cache.Arena[entry] = m_Id;
+	cache.State[entry] = state;
+	return *state;
+}
+
+static inline size_t AlignedOffset(unsigned char* Data, size_t Offset, size_t Alignment)
+{
+	const uintptr_t address = (uintptr_t)Data + Offset;
+	return Offset + (((address + Alignment - 1) & ~(uintptr_t)(Alignment - 1)) - address);
+}
+
+void* FrameArena::Allocate(size_t Bytes, size_t Alignment)
+{
+	RAID_ASSERT(Alignment > 0 && (Alignment & (Alignment - 1)) == 0);
+	ThreadChain& chain = GetThreadState().Chains[m_Slot.load(std::memory_order_relaxed)];
+	void* p;
+	if (chain.Current)
+	{
+		const size_t offset = AlignedOffset(chain.Current->GetData(), chain.Offset, Alignment);
+		if (offset + Bytes <= chain.Current->Size)
+		{
+			chain.Offset = offset + Bytes;
+			p = chain.Current->GetData() + offset;
+		}
+		else
+		{
+			p = AllocateSlow(chain, Bytes, Alignment);
+		}
+	}
+	else
+	{
+		p = AllocateSlow(chain, Bytes, Alignment);
+	}
+#if VR_FRAME_ARENA_POISON
+	memset(p, AllocatedPoison, Bytes);
+#endif
+	return p;
+}
+
+void* FrameArena::AllocateSlow(ThreadChain& Chain, size_t Bytes, size_t Alignment)
+{
+	// Move on to the next chunk of the chain that fits, skipping (and wasting for this frame)
+	// chunks too small for an oversized allocation.
+	Chunk* previous = Chain.Current;
+	if (Chain.Current)
+		Chain.Retired += Chain.Offset;
+	Chunk* next = Chain.Current ? Chain.Current->Next : Chain.First;
+	while (next && AlignedOffset(next->GetData(), 0, Alignment) + Bytes > next->Size)
+	{
+		previous = next;
+		next = next->Next;
+	}
+	if (!next)
+	{
+		// Past the peak of any earlier frame, the chain grows. Alignment above a cache line
+		// is met by over-allocating.
+		const size_t size = (std::max)(m_ChunkBytes, Bytes + (Alignment > ChunkAlignment ? Alignment : 0));
+		next = static_cast<Chunk*>(::operator new(Chunk::HeaderBytes() + size, std::align_val_t(ChunkAlignment)));
+		next->Size = size;
+		next->Next = nullptr;
+		if (previous)
+			previous->Next = next;
+		else
+			Chain.First = next;
+		m_Chunks.fetch_add(1, std::memory_order_relaxed);
+		m_AllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	const size_t offset = AlignedOffset(next->GetData(), 0, Alignment);
+	Chain.Current = next;
+	Chain.Offset = offset + Bytes;
+	return next->GetData() + offset;
+}
+
+FrameArenaStats FrameArena::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	FrameArenaStats s;
+	s.Chunks = m_Chunks.load(std::memory_order_relaxed);
+	s.ChunkBytes = m_AllocatedBytes.load(std::memory_order_relaxed);
+	s.LastFrameBytes = m_LastFrameBytes;
+	s.PeakFrameBytes = m_PeakFrameBytes;
+	s.Threads = m_ThreadCount.load(std::memory_order_relaxed);
+	return s;
+}
+
+// Same sizes for arena and malloc, xorshift so the sequence costs next to nothing.
+static size_t BenchmarkSize(uint32_t& State)
+{
+	State ^= State << 13;
+	State ^= State >> 17;
+	State ^= State << 5;
+	return 16 + (State & 240);
+}
+
+FrameArenaBenchmarkResult BenchmarkFrameArena(UINT Threads, UINT Allocations, UINT Frames)
+{
+	FrameArenaBenchmarkResult r;
+	Threads = (std::max)(Threads, 1u);
+	FrameArena arena;
+	arena.Initialize(2);
+	std::vector<std::vector<void*>> pointers(Threads, std::vector<void*>(Allocations));
+	std::vector<std::thread> threads;
+	const double per_allocation = 1e9 / ((double)Allocations * Frames);
+
+	auto measure = [&](const std::function<void(UINT)>& Frame, const std::function<void(UINT)>& EndFrame)
+	{
+		// Warm up once so the arena chunks exist and malloc has its pages.
+		for (UINT t = 0; t < Threads; t++)
+			threads.emplace_back(Frame, t);
+		for (std::thread& t : threads)
+			t.join();
+		threads.clear();
+		EndFrame(0);
+		double seconds = 0.0;
+		for (UINT f = 0; f < Frames; f++)
+		{
+			const int64_t start = SystemTime::GetCurrentTick();
+			if (Threads == 1)
+			{
+				Frame(0);
+			}
+			else
+			{
+				for (UINT t = 0; t < Threads; t++)
+					threads.emplace_back(Frame, t);
+				for (std::thread& t : threads)
+					t.join();
+				threads.clear();
+			}
+			EndFrame(f);
+			seconds += SystemTime::TicksToSeconds(SystemTime::GetCurrentTick() - start);
+		}
+		return seconds;
+	};
+
+	// Thread creation is in both timings, it cancels out only roughly, prefer Threads = 1 for
+	// absolute numbers.
+	r.ArenaNanosecs = measure([&](UINT Thread)
+	{
+		uint32_t state = 0x9E3779B9u * (Thread + 1);
+		for (UINT i = 0; i < Allocations; i++)
+			pointers[Thread][i] = arena.Allocate(BenchmarkSize(state), 16);
+	}, [&](UINT Frame) { arena.BeginFrame(Frame & 1); }) * per_allocation;
+
+	r.MallocNanosecs = measure([&](UINT Thread)
+	{
+		uint32_t state = 0x9E3779B9u * (Thread + 1);
+		for (UINT i = 0; i < Allocations; i++)
+			pointers[Thread][i] = malloc(BenchmarkSize(state));
+		for (UINT i = 0; i < Allocations; i++)
+			free(pointers[Thread][i]);
+	}, [](UINT) {}) * per_allocation;
+
+	r.PmrVectorArenaNanosecs = measure([&](UINT)
+	{
+		std::pmr::vector<UINT> values(arena.GetResource());
+		for (UINT i = 0; i < Allocations; i++)
+			values.push_back(i);
+	}, [&](UINT Frame) { arena.BeginFrame(Frame & 1); }) * per_allocation;
+
+	r.VectorHeapNanosecs = measure([&](UINT)
+	{
+		std::vector<UINT> values;
+		for (UINT i = 0; i < Allocations; i++)
+			values.push_back(i);
+	}, [](UINT) {}) * per_allocation;
+	return r;
+}
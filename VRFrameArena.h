@@ -0,0 +1,174 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include <mutex>
+#include <memory_resource>
+#include <new>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Linear allocator for CPU-side data that lives for one frame (draw lists, sort keys, scratch).
+*   arena.BeginFrame(slot);                            // after FrameScheduler::BeginFrame(slot)
+*   DrawItem* items = arena.AllocateArray<DrawItem>(count);
+*   std::pmr::vector<UINT> keys(arena.GetResource());  // STL containers through the pmr adapter
+*
+* Every thread allocating from the arena gets its own chain of chunks per back buffer slot, so
+* Allocate() is a bump of a thread-local offset without locks or atomics. BeginFrame(Slot) rewinds
+* every thread's chain of that slot at once, nothing is freed individually and no destructor runs.
+* Chunks stay with their chain, once the arena grew to the frame's peak usage it never touches
+* the heap again. BeginFrame must not race with Allocate on other threads (call it before any
+* job of the frame is spawned).
+*
+* VR_FRAME_ARENA_POISON (default in _DEBUG) fills new allocations with 0xCD and rewound memory
+* with 0xDD, so reading uninitialized or last-frame data shows up.
+*
+* VR_COUNT_HEAP_ALLOCATIONS (default in _DEBUG) counts global operator new per thread by replacing
+* the global operator new/delete (see VRFrameArena.cpp). Define it to 1 to count in a release build.
+* NoHeapAllocationScope asserts that the code it encloses did not allocate on the calling thread,
+* VRD3D12::Render puts one around the steady-state frame. BenchmarkFrameArena() compares the
+* arena with malloc/free, BenchmarkFrameAllocations() (VRFrameAllocationBenchmark.h) counts what
+* the per-frame subsystems allocate headless.
+*/
+
+#ifndef VR_FRAME_ARENA_POISON
+#ifdef _DEBUG
+#define VR_FRAME_ARENA_POISON 1
+#else
+#define VR_FRAME_ARENA_POISON 0
+#endif
+#endif
+
+#ifndef VR_COUNT_HEAP_ALLOCATIONS
+#ifdef _DEBUG
+#define VR_COUNT_HEAP_ALLOCATIONS 1
+#else
+#define VR_COUNT_HEAP_ALLOCATIONS 0
+#endif
+#endif
+
+struct FrameArenaStats
+{
+    UINT64 Chunks = 0;
+    UINT64 ChunkBytes = 0;
+    // Bytes handed out (alignment included) in the frame last rewound by BeginFrame, all threads.
+    UINT64 LastFrameBytes = 0;
+    UINT64 PeakFrameBytes = 0;
+    UINT Threads = 0;
+};
+
+class FrameArena
+{
+public:
+    const static UINT MaxSlots = 8;
+    const static UINT MaxThreads = 64;
+
+    FrameArena();
+    ~FrameArena();
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Allocations bigger than ChunkBytes get a chunk of their own, which is reused like any other.
+    void Initialize(UINT Slots, size_t ChunkBytes = 256 * 1024);
+    void Destroy();
+
+    // Rewinds everything allocated in Slot on any thread. Render thread, no Allocate in flight.
+    void BeginFrame(UINT Slot);
+
+    // Thread-safe. Valid until the next BeginFrame of the current slot.
+    void* Allocate(size_t Bytes, size_t Alignment = alignof(std::max_align_t));
+
+    // Uninitialized storage for Count T.
+    template<typename T>
+    T* AllocateArray(size_t Count)
+    {
+        return static_cast<T*>(Allocate(sizeof(T) * Count, alignof(T)));
+    }
+
+    // The destructor is never called, T should not own anything outside the arena.
+    template<typename T, typename... Args>
+    T* New(Args&&... Arguments)
+    {
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(Arguments)...);
+    }
+
+    // For std::pmr containers. deallocate is a no-op, the memory goes back with BeginFrame.
+    std::pmr::memory_resource* GetResource() { return &m_Resource; }
+
+    UINT GetCurrentSlot() const { return m_Slot.load(std::memory_order_relaxed); }
+    FrameArenaStats GetStats();
+
+private:
+    struct Chunk;
+    struct ThreadChain;
+    struct ThreadState;
+
+    class Resource : public std::pmr::memory_resource
+    {
+    public:
+        explicit Resource(FrameArena* Arena) : m_Arena(Arena) {}
+
+    private:
+        void* do_allocate(size_t Bytes, size_t Alignment) override { return m_Arena->Allocate(Bytes, Alignment); }
+        void do_deallocate(void*, size_t, size_t) override {}
+        bool do_is_equal(const std::pmr::memory_resource& Other) const noexcept override { return this == &Other; }
+
+        FrameArena* m_Arena;
+    };
+
+    ThreadState& GetThreadState();
+    ThreadState& RegisterThread();
+    void* AllocateSlow(ThreadChain& Chain, size_t Bytes, size_t Alignment);
+
+    size_t m_ChunkBytes = 256 * 1024;
+    UINT m_Slots = 0;
+    std::atomic<UINT> m_Slot{ 0 };
+    std::unique_ptr<ThreadState> m_Threads[MaxThreads];
+    std::atomic<UINT> m_ThreadCount{ 0 };
+    std::mutex m_Mutex;
+    std::atomic<UINT64> m_Chunks{ 0 };
+    std::atomic<UINT64> m_AllocatedBytes{ 0 };
+    UINT64 m_LastFrameBytes = 0;
+    UINT64 m_PeakFrameBytes = 0;
+    UINT64 m_Id = 0;
+    Resource m_Resource{ this };
+};
+
+// Counts global operator new calls per thread. Always 0 without VR_COUNT_HEAP_ALLOCATIONS.
+class HeapAllocationCounter
+{
+public:
+    static bool IsEnabled() { return VR_COUNT_HEAP_ALLOCATIONS != 0; }
+    static UINT64 GetThreadAllocations();
+};
+
+// Asserts on destruction if the calling thread allocated from the heap since construction.
+class NoHeapAllocationScope
+{
+public:
+    explicit NoHeapAllocationScope(bool Assert = true)
+        : m_Start(HeapAllocationCounter::GetThreadAllocations()), m_Assert(Assert) {}
+    ~NoHeapAllocationScope()
+    {
+        RAID_ASSERT((!m_Assert || GetAllocations() == 0) && "Heap allocation in an allocation-free scope");
+    }
+    NoHeapAllocationScope(const NoHeapAllocationScope&) = delete;
+    NoHeapAllocationScope& operator=(const NoHeapAllocationScope&) = delete;
+
+    UINT64 GetAllocations() const { return HeapAllocationCounter::GetThreadAllocations() - m_Start; }
+
+private:
+    UINT64 m_Start;
+    bool m_Assert;
+};
+
+struct FrameArenaBenchmarkResult
+{
+    // Per allocation, the frame reset / the frees included.
+    double ArenaNanosecs = 0.0;
+    double MallocNanosecs = 0.0;
+    // std::pmr::vector push_back without reserve, per element.
+    double PmrVectorArenaNanosecs = 0.0;
+    double VectorHeapNanosecs = 0.0;
+};
+
+// Threads allocate concurrently, Allocations per thread per frame of 16 to 256 bytes.
+FrameArenaBenchmarkResult BenchmarkFrameArena(UINT Threads = 1, UINT Allocations = 10000, UINT Frames = 100);
@@ -0,0 +1,232 @@
+#include "VRFramePacer.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <timeapi.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+static inline void SpinPause()
+{
+#if BS_TIME_TSC
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+FramePacer::FramePacer() : m_Clock(&GetPlatformClock())
+{
+}
+
+FramePacer::~FramePacer()
+{
+#ifdef _WIN32
+	if (m_Timer)
+		CloseHandle(m_Timer);
+	if (m_TimerPeriodSet)
+		timeEndPeriod(1);
+#endif
+}
+
+void FramePacer::Initialize(const Options& Config, const IClock& Clock)
+{
+	m_Options = Config;
+	m_Clock = &Clock;
+	m_SpinTicks = m_Clock->SecondsToTicks(m_Options.InitialSpinMs / 1000.0);
+	m_OvershootMean = 0.0;
+	m_OvershootVariance = 0.0;
+	m_Calibrated = false;
+	m_Period = Config.RefreshHz > 0.0 ? m_Clock->GetTicksPerSecond() / Config.RefreshHz : 0.0;
+	m_LastVsync = 0;
+	m_LastRefreshCount = 0;
+	m_Stats = FramePacerStats();
+	m_Stats.SpinWindowMs = m_Options.InitialSpinMs;
+#ifdef _WIN32
+	if (!m_Timer)
+	{
+		// Windows 10 1803+, far finer than the default 15.6 ms timer.
+		m_Timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if (!m_Timer)
+		{
+			m_Timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+			if (!m_TimerPeriodSet)
+				m_TimerPeriodSet = timeBeginPeriod(1) == TIMERR_NOERROR;
+		}
+	}
+#endif
+}
+
+void FramePacer::Sleep(int64_t Ticks)
+{
+	const double seconds = m_Clock->TicksToSeconds(Ticks);
+#ifdef _WIN32
+	if (m_Timer)
+	{
+		// Relative due time, in 100 ns units.
+		LARGE_INTEGER due;
+		due.QuadPart = -(LONGLONG)(seconds * 1e7);
+		if (SetWaitableTimer(m_Timer, &due, 0, nullptr, nullptr, FALSE))
+		{
+			WaitForSingleObject(m_Timer, INFINITE);
+			return;
+		}
+	}
+	::Sleep((DWORD)(seconds * 1000.0));
+#else
+	timespec t;
+	t.tv_sec = (time_t)seconds;
+	t.tv_nsec = (long)((seconds - (double)t.tv_sec) * 1e9);
+	nanosleep(&t, nullptr);
+#endif
+}
+
+void FramePacer::AddOvershoot(double Ms)
+{
+	if (!m_Calibrated)
+	{
+		m_OvershootMean = Ms;
+		m_OvershootVariance = 0.0;
+		m_Calibrated = true;
+	}
+	else
+	{
+		// Exponentially weighted mean and variance.
+		const double a = m_Options.Smoothing;
+		const double diff = Ms - m_OvershootMean;
+		m_OvershootMean += a * diff;
+		m_OvershootVariance = (1.0 - a) * (m_OvershootVariance + a * diff * diff);
+	}
+	const double deviation = std::sqrt(m_OvershootVariance);
+	const double spin = (std::min)((std::max)(m_OvershootMean + m_Options.SpinDeviations * deviation, m_Options.MinSpinMs), m_Options.MaxSpinMs);
+	m_SpinTicks = m_Clock->SecondsToTicks(spin / 1000.0);
+	m_Stats.OvershootMeanMs = m_OvershootMean;
+	m_Stats.OvershootDeviationMs = deviation;
+	m_Stats.SpinWindowMs = spin;
+}
+
+FramePacerWait FramePacer::WaitUntil(int64_t Deadline)
+{
+	FramePacerWait w;
+	w.Deadline = Deadline;
+	int64_t now = m_Clock->GetTicks();
+	// Sleep what is safely ahead, a chunk at a time so every sleep refines the spin window.
+	while (Deadline - now > m_SpinTicks)
+	{
+		const int64_t request = Deadline - now - m_SpinTicks;
+		Sleep(request);
+		const int64_t after = m_Clock->GetTicks();
+		AddOvershoot(m_Clock->TicksToMillisecs((after - now) - request));
+		m_Stats.Sleeps++;
+		now = after;
+	}
+	while (now < Deadline)
+	{
+		SpinPause();
+		now = m_Clock->GetTicks();
+	}
+	w.Woke = now;
+	w.LateTicks = now - Deadline;
+	m_Stats.Waits++;
+	if (m_Clock->TicksToSeconds(w.LateTicks) > 50e-6)
+		m_Stats.LateWakeups++;
+	return w;
+}
+
+void FramePacer::OnVsync(int64_t Tick, uint64_t RefreshCount)
+{
+	if (m_LastVsync != 0 && Tick > m_LastVsync)
+	{
+		double periods = 1.0;
+		if (RefreshCount > m_LastRefreshCount && m_LastRefreshCount != 0)
+			periods = (double)(RefreshCount - m_LastRefreshCount);
+		else if (m_Period > 0.0)
+			periods = (std::max)(std::round((Tick - m_LastVsync) / m_Period), 1.0);
+		const double measured = (Tick - m_LastVsync) / periods;
+		// Ignore samples far off, a missed report or a mode change settles in over a few frames.
+		if (m_Period <= 0.0 || std::fabs(measured - m_Period) < m_Period * 0.25)
+			m_Period = m_Period <= 0.0 ? measured : m_Period + (measured - m_Period) * 0.1;
+		else
+			m_Period += (measured - m_Period) * 0.01;
+	}
+	m_LastVsync = Tick;
+	m_LastRefreshCount = RefreshCount;
+}
+
+int64_t FramePacer::PredictNextVsync(int64_t Now) const
+{
+	if (m_Period <= 0.0)
+		return Now;
+	if (m_LastVsync == 0)
+		return Now + (int64_t)m_Period;
+	const double periods = std::floor((Now - m_LastVsync) / m_Period) + 1.0;
+	return m_LastVsync + (int64_t)(periods * m_Period);
+}
+
+FramePacerWait FramePacer::WaitForVsync(double LeadMs)
+{
+	const int64_t lead = m_Clock->SecondsToTicks(LeadMs / 1000.0);
+	const int64_t vsync = PredictNextVsync(m_Clock->GetTicks() + lead);
+	return WaitUntil(vsync - lead);
+}
+
+static double GetThreadCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+	const uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	const uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (k + u) * 1e-7;
+#else
+	timespec t;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+FramePacerBenchmarkResult BenchmarkFramePacer(FramePacer* Pacer, double IntervalMs, unsigned Waits)
+{
+	const IClock& clock = Pacer ? Pacer->GetClock() : GetPlatformClock();
+	Waits = (std::max)(Waits, 1u);
+	std::vector<double> late(Waits);
+	double wall = 0.0;
+	const double cpu_start = GetThreadCpuSeconds();
+	for (unsigned i = 0; i < Waits; i++)
+	{
+		const int64_t start = clock.GetTicks();
+		const int64_t deadline = start + clock.SecondsToTicks(IntervalMs / 1000.0);
+		int64_t woke;
+		if (Pacer)
+		{
+			woke = Pacer->WaitUntil(deadline).Woke;
+		}
+		else
+		{
+			SystemTime::BusyLoopSleep((float)(IntervalMs / 1000.0));
+			woke = clock.GetTicks();
+		}
+		late[i] = (std::max)(clock.TicksToSeconds(woke - deadline), 0.0) * 1e6;
+		wall += clock.TicksToSeconds(woke - start);
+	}
+	const double cpu = GetThreadCpuSeconds() - cpu_start;
+
+	FramePacerBenchmarkResult r;
+	for (double l : late)
+	{
+		r.MeanLateMicrosecs += l;
+		r.MaxLateMicrosecs = (std::max)(r.MaxLateMicrosecs, l);
+	}
+	r.MeanLateMicrosecs /= Waits;
+	std::sort(late.begin(), late.end());
+	r.P99LateMicrosecs = late[(std::min)((size_t)(Waits * 0.99), late.size() - 1)];
+	r.CpuMicrosecsPerWait = cpu * 1e6 / Waits;
+	r.CpuFraction = wall > 0.0 ? cpu / wall : 0.0;
+	return r;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include "BSTime.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Precise waits without burning a core, the replacement for SystemTime::BusyLoopSleep.
+* WaitUntil(Deadline) sleeps on the OS timer while more than the spin window is left, then spins
+* the rest with pause instructions. The spin window follows the OS sleep overshoot, measured on
+* every sleep (running mean + SpinDeviations deviations, clamped to [MinSpinMs, MaxSpinMs]), so it
+* shrinks to a fraction of a millisecond where the timer is good and grows where it is not.
+*
+* Vsync: OnVsync() feeds observed vblank times (IDXGISwapChain::GetFrameStatistics SyncQPCTime,
+* with its refresh count) into a period/phase estimate, PredictNextVsync() extrapolates it and
+* WaitForVsync(LeadMs) wakes LeadMs before the next predicted vblank, e.g. to sample the headset
+* pose as late as possible.
+*
+* One pacer per waiting thread. BenchmarkFramePacer() reports wake-up jitter and the CPU time
+* spent per wait, next to BusyLoopSleep.
+*/
+
+struct FramePacerStats
+{
+    uint64_t Waits = 0;
+    uint64_t Sleeps = 0;
+    // Waits that woke more than 50 us past their deadline.
+    uint64_t LateWakeups = 0;
+    // Current OS sleep overshoot estimate and spin window.
+    double OvershootMeanMs = 0.0;
+    double OvershootDeviationMs = 0.0;
+    double SpinWindowMs = 0.0;
+};
+
+struct FramePacerWait
+{
+    int64_t Deadline = 0;
+    int64_t Woke = 0;
+    // Woke - Deadline, in clock ticks. Never negative.
+    int64_t LateTicks = 0;
+};
+
+class FramePacer
+{
+public:
+    struct Options
+    {
+        // Spin window before the first overshoot was measured.
+        double InitialSpinMs = 1.0;
+        double MinSpinMs = 0.1;
+        double MaxSpinMs = 4.0;
+        double SpinDeviations = 3.0;
+        // Weight of a new overshoot sample in the running estimate.
+        double Smoothing = 0.05;
+        // Display refresh until vblanks were observed.
+        double RefreshHz = 90.0;
+    };
+
+    FramePacer();
+    ~FramePacer();
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    void Initialize(const Options& Config, const IClock& Clock = GetPlatformClock());
+
+    FramePacerWait WaitUntil(int64_t Deadline);
+    FramePacerWait WaitFor(double Seconds) { return WaitUntil(m_Clock->GetTicks() + m_Clock->SecondsToTicks(Seconds)); }
+
+    // A vblank at Tick, the RefreshCount'th since some origin (0 if unknown, then consecutive calls
+    // are assumed to be whole periods apart).
+    void OnVsync(int64_t Tick, uint64_t RefreshCount = 0);
+    // First predicted vblank after Now.
+    int64_t PredictNextVsync(int64_t Now) const;
+    double GetVsyncPeriodMs() const { return m_Clock->TicksToMillisecs((int64_t)m_Period); }
+    // Wakes LeadMs before the first predicted vblank that is at least LeadMs away.
+    FramePacerWait WaitForVsync(double LeadMs);
+
+    const FramePacerStats& GetStats() const { return m_Stats; }
+    const IClock& GetClock() const { return *m_Clock; }
+
+private:
+    // Sleeps on the OS timer for about Ticks.
+    void Sleep(int64_t Ticks);
+    void AddOvershoot(double Ms);
+
+    Options m_Options;
+    const IClock* m_Clock;
+    int64_t m_SpinTicks = 0;
+    double m_OvershootMean = 0.0;
+    double m_OvershootVariance = 0.0;
+    bool m_Calibrated = false;
+
+    double m_Period = 0.0;
+    int64_t m_LastVsync = 0;
+    uint64_t m_LastRefreshCount = 0;
+
+    // High resolution waitable timer on Windows.
+    void* m_Timer = nullptr;
+    bool m_TimerPeriodSet = false;
+    FramePacerStats m_Stats;
+};
+
+struct FramePacerBenchmarkResult
+{
+    // Wake-up minus deadline, microseconds.
+    double MeanLateMicrosecs = 0.0;
+    double P99LateMicrosecs = 0.0;
+    double MaxLateMicrosecs = 0.0;
+    // Thread CPU time per wait over the wall time of the wait, 1.0 = spun the whole time.
+    double CpuFraction = 0.0;
+    double CpuMicrosecsPerWait = 0.0;
+};
+
+// Waits Waits times for IntervalMs with Pacer, or with SystemTime::BusyLoopSleep when Pacer is null.
+FramePacerBenchmarkResult BenchmarkFramePacer(FramePacer* Pacer, double IntervalMs, unsigned Waits);
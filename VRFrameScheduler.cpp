@@ -0,0 +1,66 @@
+#include "VRFrameScheduler.h"
+
+void FrameScheduler::Initialize(IFrameFence* Fence, UINT Slots, UINT LatencyDepth)
+{
+	RAID_ASSERT(Fence != nullptr);
+	RAID_ASSERT(Slots > 0 && Slots <= MaxSlots);
+	m_Fence = Fence;
+	m_Slots = Slots;
+	m_NextValue = 1;
+	for (UINT i = 0; i < MaxSlots; i++)
+	{
+		m_SlotValues[i] = 0;
+	}
+	SetLatencyDepth(LatencyDepth);
+	ResetStats();
+}
+
+void FrameScheduler::SetLatencyDepth(UINT LatencyDepth)
+{
+	m_LatencyDepth = (std::max)(1u, (std::min)(LatencyDepth, m_Slots));
+}
+
+void FrameScheduler::BeginFrame(UINT Slot)
+{
+	RAID_ASSERT(Slot < m_Slots);
+	// The allocator of this slot is still referenced by the GPU until its last frame retires.
+	UINT64 target = m_SlotValues[Slot];
+	// Never run more than LatencyDepth frames ahead of the GPU, even if the slot itself is free.
+	if (m_NextValue > m_LatencyDepth)
+	{
+		target = (std::max)(target, m_NextValue - m_LatencyDepth);
+	}
+
+	UINT64 completed = m_Fence->GetCompletedValue();
+	const UINT64 in_flight = (m_NextValue - 1) - (std::min)(completed, m_NextValue - 1);
+	m_Stats.FramesBegun++;
+	m_Stats.InFlightAccum += in_flight;
+	if (in_flight > 0)
+		m_Stats.OverlappedFrames++;
+
+	if (completed < target)
+	{
+		const int64_t start = SystemTime::GetCurrentTick();
+		m_Fence->WaitForValue(target);
+		m_Stats.StallTicks += SystemTime::GetCurrentTick() - start;
+		m_Stats.Stalls++;
+	}
+}
+
+UINT64 FrameScheduler::EndFrame(UINT Slot)
+{
+	RAID_ASSERT(Slot < m_Slots);
+	const UINT64 value = m_NextValue++;
+	m_Fence->Signal(value);
+	m_SlotValues[Slot] = value;
+	return value;
+}
+
+void FrameScheduler::Flush()
+{
+	if (m_Fence == nullptr || m_NextValue == 1)
+		return;
+	const UINT64 last = m_NextValue - 1;
+	if (m_Fence->GetCompletedValue() < last)
+		m_Fence->WaitForValue(last);
+}
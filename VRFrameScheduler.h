@@ -0,0 +1,91 @@
+#pragma once
+#include "VRCore.h"
+#include "BSTime.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Keeps up to LatencyDepth frames in flight on the GPU.
+* Each back buffer slot remembers the fence value of the last frame recorded into it,
+* and the CPU only blocks when it is about to reuse that slot's command allocator
+* (or when it would run further ahead of the GPU than the latency depth allows).
+*/
+
+// GPU timeline the scheduler synchronises against.
+// VRD3D12 backs this with a queue + ID3D12Fence; a recording stand-in can be used headlessly.
+class IFrameFence
+{
+public:
+    virtual ~IFrameFence() = default;
+
+    // Queue a GPU-side signal of Value after all previously submitted work.
+    virtual void Signal(UINT64 Value) = 0;
+
+    // Last value the GPU has reached.
+    virtual UINT64 GetCompletedValue() = 0;
+
+    // Block the calling thread until the GPU has reached Value.
+    virtual void WaitForValue(UINT64 Value) = 0;
+};
+
+struct FrameSchedulerStats
+{
+    UINT64 FramesBegun = 0;
+    // Frames whose recording started while earlier frames were still executing on the GPU.
+    UINT64 OverlappedFrames = 0;
+    // Sum of the in-flight frame counts observed at BeginFrame.
+    UINT64 InFlightAccum = 0;
+    // Number of BeginFrame calls that had to block on the fence.
+    UINT64 Stalls = 0;
+    int64_t StallTicks = 0;
+
+    // Fraction of frames recorded while the GPU was busy with a previous frame.
+    double OverlapRatio() const
+    {
+        return FramesBegun ? (double)OverlappedFrames / (double)FramesBegun : 0.0;
+    }
+
+    double AverageFramesInFlight() const
+    {
+        return FramesBegun ? (double)InFlightAccum / (double)FramesBegun : 0.0;
+    }
+
+    double StallMillisecs() const
+    {
+        return SystemTime::TicksToMillisecs(StallTicks);
+    }
+};
+
+class FrameScheduler
+{
+public:
+    const static UINT MaxSlots = 8;
+
+    // Slots is the number of per-frame resources (back buffers/allocators).
+    // LatencyDepth is clamped to [1, Slots].
+    void Initialize(IFrameFence* Fence, UINT Slots, UINT LatencyDepth);
+
+    // Called before the slot's allocator is reset. Waits only if the GPU still uses it.
+    void BeginFrame(UINT Slot);
+
+    // Called after the frame has been submitted. Signals and stamps the slot. Returns the fence value.
+    UINT64 EndFrame(UINT Slot);
+
+    // Waits for every submitted frame. Used on shutdown/resize.
+    void Flush();
+
+    void SetLatencyDepth(UINT LatencyDepth);
+    UINT GetLatencyDepth() const { return m_LatencyDepth; }
+
+    UINT64 GetLastSignaledValue() const { return m_NextValue - 1; }
+    UINT64 GetSlotFenceValue(UINT Slot) const { return m_SlotValues[Slot]; }
+    const FrameSchedulerStats& GetStats() const { return m_Stats; }
+    void ResetStats() { m_Stats = FrameSchedulerStats(); }
+
+private:
+    IFrameFence* m_Fence = nullptr;
+    UINT m_Slots = 0;
+    UINT m_LatencyDepth = 1;
+    // Fence values start at 1 so a zero slot value means "never submitted".
+    UINT64 m_NextValue = 1;
+    UINT64 m_SlotValues[MaxSlots] = {};
+    FrameSchedulerStats m_Stats;
+};
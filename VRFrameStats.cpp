@@ -0,0 +1,212 @@
+#include "VRFrameStats.h"
+#include <cmath>
+
+static inline UINT BucketOf(uint32_t Microsecs)
+{
+	return (std::min)(Microsecs / FrameStats::BucketMicrosecs, FrameStats::HistogramBuckets - 1);
+}
+
+template<typename T>
+static inline void Increment(std::atomic<T>& Value, T Amount)
+{
+	Value.store(Value.load(std::memory_order_relaxed) + Amount, std::memory_order_relaxed);
+}
+
+static inline void Decrement(std::atomic<uint32_t>& Value)
+{
+	Value.store(Value.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+void FrameStats::Initialize(double TargetRefreshHz, UINT WindowFrames, double HitchFactor)
+{
+	m_Window = (std::max)(WindowFrames, 1u);
+	m_HitchFactor = HitchFactor;
+	SetTargetRefresh(TargetRefreshHz);
+	m_Ring = std::make_unique<uint32_t[]>(m_Window);
+	m_RingHitch = std::make_unique<bool[]>(m_Window);
+	m_Head = 0;
+	m_Sum = 0;
+	m_SumSquares = 0;
+	m_InWindowHitches = 0;
+	m_LastTick = 0;
+	for (std::atomic<uint32_t>& bucket : m_Histogram)
+	{
+		bucket.store(0, std::memory_order_relaxed);
+	}
+	m_PublishedFrames.store(0, std::memory_order_relaxed);
+	m_PublishedSum.store(0, std::memory_order_relaxed);
+	m_PublishedSumSquares.store(0, std::memory_order_relaxed);
+	m_PublishedLast.store(0, std::memory_order_relaxed);
+	m_PublishedWindowHitches.store(0, std::memory_order_relaxed);
+	m_Hitches.store(0, std::memory_order_relaxed);
+	m_MissedFrames.store(0, std::memory_order_relaxed);
+	m_LastHitchFrame.store(0, std::memory_order_relaxed);
+	m_FrameStart.store(0, std::memory_order_relaxed);
+}
+
+void FrameStats::SetTargetRefresh(double Hz)
+{
+	const double micros = Hz > 0.0 ? 1e6 / Hz : 0.0;
+	m_TargetMicrosecs.store((uint32_t)(micros + 0.5), std::memory_order_relaxed);
+}
+
+void FrameStats::BeginFrame(int64_t Tick)
+{
+	const int64_t last = m_LastTick;
+	m_LastTick = Tick;
+	m_FrameStart.store(Tick, std::memory_order_relaxed);
+	// The first boundary only starts the clock.
+	if (last != 0 && Tick > last)
+		Push((uint32_t)(std::min)(SystemTime::TicksToSeconds(Tick - last) * 1e6 + 0.5, 4294967295.0));
+}
+
+void FrameStats::AddFrame(double DeltaMs)
+{
+	Push((uint32_t)(std::min)((std::max)(DeltaMs, 0.0) * 1000.0 + 0.5, 4294967295.0));
+}
+
+void FrameStats::Push(uint32_t Microsecs)
+{
+	RAID_ASSERT(m_Ring && "FrameStats::Initialize was not called");
+	const UINT slot = (UINT)(m_Head % m_Window);
+	const uint32_t target = m_TargetMicrosecs.load(std::memory_order_relaxed);
+	const bool hitch = target > 0 && Microsecs > target * m_HitchFactor;
+
+	// Single writer, plain load + store instead of locked read-modify-writes.
+	const uint32_t sequence = m_Sequence.load(std::memory_order_relaxed);
+	m_Sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	if (m_Head >= m_Window)
+	{
+		const uint32_t old = m_Ring[slot];
+		m_Sum -= old;
+		m_SumSquares -= (UINT64)old * old;
+		m_InWindowHitches -= m_RingHitch[slot] ? 1 : 0;
+		Decrement(m_Histogram[BucketOf(old)]);
+	}
+	m_Ring[slot] = Microsecs;
+	m_RingHitch[slot] = hitch;
+	m_Sum += Microsecs;
+	m_SumSquares += (UINT64)Microsecs * Microsecs;
+	m_InWindowHitches += hitch ? 1 : 0;
+	Increment(m_Histogram[BucketOf(Microsecs)], (uint32_t)1);
+	m_Head++;
+
+	m_PublishedFrames.store(m_Head, std::memory_order_relaxed);
+	m_PublishedSum.store(m_Sum, std::memory_order_relaxed);
+	m_PublishedSumSquares.store(m_SumSquares, std::memory_order_relaxed);
+	m_PublishedLast.store(Microsecs, std::memory_order_relaxed);
+	m_PublishedWindowHitches.store(m_InWindowHitches, std::memory_order_relaxed);
+	m_Sequence.store(sequence + 2, std::memory_order_release);
+
+	if (hitch)
+	{
+		// A 2.4 interval frame cost 1 vsync, at least one is counted.
+		const UINT64 missed = (std::max)((UINT64)std::llround((double)Microsecs / target) - 1, (UINT64)1);
+		Increment(m_MissedFrames, missed);
+		Increment(m_Hitches, (UINT64)1);
+		m_LastHitchFrame.store(m_Head, std::memory_order_relaxed);
+	}
+}
+
+double FrameStats::PercentileFromCounts(const uint32_t* Counts, UINT Frames, double P) const
+{
+	if (Frames == 0)
+		return 0.0;
+	const UINT64 rank = (std::max)((UINT64)std::ceil((std::min)((std::max)(P, 0.0), 1.0) * Frames), (UINT64)1);
+	UINT64 seen = 0;
+	for (UINT b = 0; b < HistogramBuckets; b++)
+	{
+		seen += Counts[b];
+		if (seen >= rank)
+			return (b + 1) * BucketMicrosecs / 1000.0;
+	}
+	return HistogramBuckets * BucketMicrosecs / 1000.0;
+}
+
+double FrameStats::GetPercentileMs(double P) const
+{
+	uint32_t counts[HistogramBuckets];
+	UINT frames = 0;
+	for (UINT b = 0; b < HistogramBuckets; b++)
+	{
+		counts[b] = m_Histogram[b].load(std::memory_order_relaxed);
+		frames += counts[b];
+	}
+	return PercentileFromCounts(counts, frames, P);
+}
+
+FrameTimeSummary FrameStats::GetSummary() const
+{
+	FrameTimeSummary s;
+	UINT64 frames, sum, sum_squares;
+	uint32_t last, window_hitches, sequence;
+	do
+	{
+		sequence = m_Sequence.load(std::memory_order_acquire);
+		frames = m_PublishedFrames.load(std::memory_order_relaxed);
+		sum = m_PublishedSum.load(std::memory_order_relaxed);
+		sum_squares = m_PublishedSumSquares.load(std::memory_order_relaxed);
+		last = m_PublishedLast.load(std::memory_order_relaxed);
+		window_hitches = m_PublishedWindowHitches.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((sequence & 1) || sequence != m_Sequence.load(std::memory_order_relaxed));
+
+	s.TotalFrames = frames;
+	s.Frames = (UINT)(std::min)(frames, (UINT64)m_Window);
+	s.TargetMs = GetTargetMs();
+	s.Hitches = m_Hitches.load(std::memory_order_relaxed);
+	s.MissedFrames = m_MissedFrames.load(std::memory_order_relaxed);
+	s.WindowHitches = window_hitches;
+	if (s.Frames == 0)
+		return s;
+
+	const double n = s.Frames;
+	const double mean = sum / n;
+	s.LastMs = last / 1000.0;
+	s.MeanMs = mean / 1000.0;
+	s.VarianceMs2 = (std::max)(sum_squares / n - mean * mean, 0.0) / 1e6;
+	s.StdDevMs = std::sqrt(s.VarianceMs2);
+
+	uint32_t counts[HistogramBuckets];
+	UINT counted = 0;
+	for (UINT b = 0; b < HistogramBuckets; b++)
+	{
+		counts[b] = m_Histogram[b].load(std::memory_order_relaxed);
+		counted += counts[b];
+	}
+	s.P50Ms = PercentileFromCounts(counts, counted, 0.50);
+	s.P95Ms = PercentileFromCounts(counts, counted, 0.95);
+	s.P99Ms = PercentileFromCounts(counts, counted, 0.99);
+	return s;
+}
+
+double FrameStats::GetBudgetRemainingMs(int64_t Now) const
+{
+	const int64_t start = m_FrameStart.load(std::memory_order_relaxed);
+	const double elapsed = start != 0 ? SystemTime::TicksToMillisecs(Now - start) : 0.0;
+	return GetTargetMs() - elapsed;
+}
+
+double FrameStats::MeasureUpdateCost(UINT Iterations)
+{
+	if (Iterations == 0)
+		return 0.0;
+	FrameStats stats;
+	stats.Initialize();
+	// 11.1 ms +- a few, with the odd hitch, so the histogram and hitch paths both run.
+	uint32_t seed = 12345;
+	std::vector<double> deltas(1024);
+	for (double& d : deltas)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		d = 11.1 + (seed >> 24) / 64.0 + ((seed & 0xff) == 0 ? 20.0 : 0.0);
+	}
+	const int64_t start = SystemTime::GetCurrentTick();
+	for (UINT i = 0; i < Iterations; i++)
+	{
+		stats.AddFrame(deltas[i & 1023]);
+	}
+	const int64_t end = SystemTime::GetCurrentTick();
+	return SystemTime::TicksToSeconds(end - start) * 1e9 / Iterations;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include "BSTime.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Rolling frame-time statistics and hitch detection.
+* The render thread calls BeginFrame() once per frame (or AddFrame() with a delta it measured
+* itself). The last WindowFrames deltas are kept in a ring together with their running sum, sum
+* of squares and a fixed-bucket histogram, so adding a frame is O(1): the new delta goes in, the
+* one falling out of the window comes out. Deltas are stored in whole microseconds, so the sums
+* are exact integers and do not drift however long the app runs.
+*
+* Any thread may read: GetSummary() (mean, deviation, p50/p95/p99 over the window), the hitch
+* counters and GetBudgetRemainingMs(), the time left before the next refresh. Mean and variance
+* come from a consistent snapshot, percentiles are a histogram walk and may be a frame stale.
+*
+* A frame is a hitch when it took more than HitchFactor target intervals, the frames it cost are
+* counted in MissedFrames. MeasureUpdateCost() times AddFrame on the calling thread.
+*/
+
+struct FrameTimeSummary
+{
+    UINT Frames = 0;
+    double LastMs = 0.0;
+    double MeanMs = 0.0;
+    double VarianceMs2 = 0.0;
+    double StdDevMs = 0.0;
+    // Upper edge of the histogram bucket the percentile falls in.
+    double P50Ms = 0.0;
+    double P95Ms = 0.0;
+    double P99Ms = 0.0;
+    double TargetMs = 0.0;
+    // Over the whole run, not just the window.
+    UINT64 TotalFrames = 0;
+    UINT64 Hitches = 0;
+    UINT64 MissedFrames = 0;
+    // Hitches still inside the window.
+    UINT WindowHitches = 0;
+};
+
+class FrameStats
+{
+public:
+    const static UINT DefaultWindowFrames = 512;
+    const static UINT HistogramBuckets = 512;
+    // 0.1 ms buckets up to 51.2 ms, longer frames land in the last one.
+    const static UINT BucketMicrosecs = 100;
+
+    FrameStats() = default;
+    FrameStats(const FrameStats&) = delete;
+    FrameStats& operator=(const FrameStats&) = delete;
+
+    void Initialize(double TargetRefreshHz = 90.0, UINT WindowFrames = DefaultWindowFrames, double HitchFactor = 1.5);
+
+    // Target frame interval, e.g. the HMD's refresh rate. Safe from any thread.
+    void SetTargetRefresh(double Hz);
+    double GetTargetMs() const { return m_TargetMicrosecs.load(std::memory_order_relaxed) / 1000.0; }
+
+    // Frame boundary at SystemTime tick Tick, adds the delta to the previous boundary.
+    void BeginFrame(int64_t Tick);
+    void BeginFrame() { BeginFrame(SystemTime::GetCurrentTick()); }
+    // Adds a frame of DeltaMs without touching the frame start, for deltas measured elsewhere.
+    void AddFrame(double DeltaMs);
+
+    FrameTimeSummary GetSummary() const;
+    // Frame time below which P (0..1) of the window falls.
+    double GetPercentileMs(double P) const;
+    // Target interval minus the time since the last BeginFrame, negative once over budget.
+    double GetBudgetRemainingMs(int64_t Now) const;
+    double GetBudgetRemainingMs() const { return GetBudgetRemainingMs(SystemTime::GetCurrentTick()); }
+
+    UINT64 GetHitchCount() const { return m_Hitches.load(std::memory_order_relaxed); }
+    // 0 before the first hitch.
+    UINT64 GetLastHitchFrame() const { return m_LastHitchFrame.load(std::memory_order_relaxed); }
+    UINT GetWindowFrames() const { return m_Window; }
+
+    // Nanoseconds per AddFrame, Iterations frames of made-up deltas into a scratch instance.
+    static double MeasureUpdateCost(UINT Iterations = 1000000);
+
+private:
+    void Push(uint32_t Microsecs);
+    double PercentileFromCounts(const uint32_t* Counts, UINT Frames, double P) const;
+
+    UINT m_Window = 0;
+    double m_HitchFactor = 1.5;
+    std::atomic<uint32_t> m_TargetMicrosecs{ 11111 };
+
+    // Written by the frame thread only.
+    std::unique_ptr<uint32_t[]> m_Ring;
+    std::unique_ptr<bool[]> m_RingHitch;
+    UINT64 m_Head = 0;
+    UINT64 m_Sum = 0;
+    UINT64 m_SumSquares = 0;
+    UINT m_InWindowHitches = 0;
+    int64_t m_LastTick = 0;
+
+    // Published for readers, the seqlock covers the values below it.
+    std::atomic<uint32_t> m_Sequence{ 0 };
+    std::atomic<UINT64> m_PublishedFrames{ 0 };
+    std::atomic<UINT64> m_PublishedSum{ 0 };
+    std::atomic<UINT64> m_PublishedSumSquares{ 0 };
+    std::atomic<uint32_t> m_PublishedLast{ 0 };
+    std::atomic<uint32_t> m_PublishedWindowHitches{ 0 };
+
+    std::atomic<uint32_t> m_Histogram[HistogramBuckets] = {};
+    std::atomic<int64_t> m_FrameStart{ 0 };
+    std::atomic<UINT64> m_Hitches{ 0 };
+    std::atomic<UINT64> m_MissedFrames{ 0 };
+    std::atomic<UINT64> m_LastHitchFrame{ 0 };
+};
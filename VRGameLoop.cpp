@@ -0,0 +1,186 @@
+#include "VRGameLoop.h"
+#include "VRProfiler.h"
+
+enum : UINT
+{
+	SimulationThread = 0,
+	RenderThread = 1,
+};
+
+GameLoopBase::~GameLoopBase()
+{
+	Stop();
+}
+
+void GameLoopBase::InitializeBase(const Options& Config)
+{
+	RAID_ASSERT(!m_Running.load() && Config.SimulationHz > 0.0);
+	m_Options = Config;
+	m_StepSeconds = 1.0 / Config.SimulationHz;
+	FramePacer::Options pacing;
+	pacing.RefreshHz = Config.SimulationHz;
+	m_SimulationPacer.Initialize(pacing);
+	pacing.RefreshHz = Config.RenderHz;
+	m_RenderPacer.Initialize(pacing);
+}
+
+void GameLoopBase::Start()
+{
+	if (m_Running.exchange(true))
+		return;
+	m_StopRequested.store(false, std::memory_order_relaxed);
+	m_PendingInput.store(0, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_StartTick = SystemTime::GetCurrentTick();
+		m_Busy[0] = m_Busy[1] = false;
+		m_BusyTicks[0] = m_BusyTicks[1] = 0;
+		m_OverlapTicks = 0;
+		m_LastInputRendered = 0;
+		m_InputLatencySum = 0.0;
+		m_Stats = GameLoopStats();
+	}
+	m_SimulationThread = std::thread(&GameLoopBase::SimulationMain, this);
+	m_RenderThread = std::thread(&GameLoopBase::RenderMain, this);
+}
+
+void GameLoopBase::Stop()
+{
+	if (!m_Running.load())
+		return;
+	RequestStop();
+	if (m_SimulationThread.joinable())
+		m_SimulationThread.join();
+	if (m_RenderThread.joinable())
+		m_RenderThread.join();
+	m_Running.store(false);
+}
+
+void GameLoopBase::Run(PumpFunction Pump)
+{
+	Start();
+	while (!IsStopRequested())
+	{
+		if (Pump)
+		{
+			if (!Pump())
+				break;
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	Stop();
+}
+
+void GameLoopBase::NotifyInput(int64_t Tick)
+{
+	// Keeps the earliest input not yet consumed, the latency is measured from it.
+	int64_t expected = 0;
+	m_PendingInput.compare_exchange_strong(expected, Tick, std::memory_order_relaxed);
+}
+
+void GameLoopBase::SetBusy(UINT Thread, bool Busy)
+{
+	const int64_t now = SystemTime::GetCurrentTick();
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	const bool both_before = m_Busy[0] && m_Busy[1];
+	if (Busy)
+		m_BusySince[Thread] = now;
+	else
+		m_BusyTicks[Thread] += now - m_BusySince[Thread];
+	m_Busy[Thread] = Busy;
+	const bool both_after = m_Busy[0] && m_Busy[1];
+	if (!both_before && both_after)
+		m_OverlapSince = now;
+	else if (both_before && !both_after)
+		m_OverlapTicks += now - m_OverlapSince;
+}
+
+void GameLoopBase::SimulationMain()
+{
+	VR_PROFILE_THREAD("Simulation");
+	const int64_t step_ticks = (std::max)((int64_t)(m_StepSeconds / SystemTime::TicksToSeconds(1)), (int64_t)1);
+	UINT64 step = 0;
+	int64_t next = SystemTime::GetCurrentTick() + step_ticks;
+	while (!IsStopRequested())
+	{
+		m_SimulationPacer.WaitUntil(next);
+		const int64_t now = SystemTime::GetCurrentTick();
+		const int64_t behind = (now - next) / step_ticks + 1;
+		UINT steps = (UINT)(std::min)(behind, (int64_t)m_Options.MaxCatchUpSteps);
+		if (behind > (int64_t)steps)
+		{
+			// Too far behind to catch up, the simulation slows down instead of spiralling.
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stats.DroppedSteps += behind - steps;
+			next += (behind - steps) * step_ticks;
+		}
+		SetBusy(SimulationThread, true);
+		for (UINT i = 0; i < steps; i++)
+		{
+			VR_PROFILE_SCOPE("SimulationStep");
+			const int64_t input = m_PendingInput.exchange(0, std::memory_order_relaxed);
+			Step(m_StepSeconds, ++step, next, input);
+			next += step_ticks;
+		}
+		SetBusy(SimulationThread, false);
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.SimulationSteps = step;
+	}
+}
+
+void GameLoopBase::RenderMain()
+{
+	VR_PROFILE_THREAD("Render");
+	const int64_t frame_ticks = m_Options.RenderHz > 0.0 ? (int64_t)(1.0 / m_Options.RenderHz / SystemTime::TicksToSeconds(1)) : 0;
+	int64_t next = SystemTime::GetCurrentTick();
+	while (!IsStopRequested())
+	{
+		if (frame_ticks > 0)
+		{
+			next += frame_ticks;
+			m_RenderPacer.WaitUntil(next);
+		}
+		SetBusy(RenderThread, true);
+		const int64_t input = RenderFrame(SystemTime::GetCurrentTick());
+		const int64_t done = SystemTime::GetCurrentTick();
+		SetBusy(RenderThread, false);
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.RenderFrames++;
+		// A state stays on screen for several frames, its input is counted the first time only.
+		if (input != 0 && input != m_LastInputRendered)
+		{
+			m_LastInputRendered = input;
+			const double latency = SystemTime::TicksToMillisecs(done - input);
+			m_Stats.InputSamples++;
+			m_Stats.LastInputLatencyMs = latency;
+			m_Stats.MaxInputLatencyMs = (std::max)(m_Stats.MaxInputLatencyMs, latency);
+			m_InputLatencySum += latency;
+			m_Stats.MeanInputLatencyMs = m_InputLatencySum / m_Stats.InputSamples;
+		}
+	}
+}
+
+GameLoopStats GameLoopBase::GetStats() const
+{
+	const int64_t now = SystemTime::GetCurrentTick();
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	GameLoopStats s = m_Stats;
+	const double wall = SystemTime::TicksToSeconds(now - m_StartTick);
+	if (wall <= 0.0)
+		return s;
+	// Intervals still open count up to now.
+	int64_t busy[2];
+	for (UINT t = 0; t < 2; t++)
+	{
+		busy[t] = m_BusyTicks[t] + (m_Busy[t] ? now - m_BusySince[t] : 0);
+	}
+	const int64_t overlap = m_OverlapTicks + (m_Busy[0] && m_Busy[1] ? now - m_OverlapSince : 0);
+	s.SimulationBusy = SystemTime::TicksToSeconds(busy[SimulationThread]) / wall;
+	s.RenderBusy = SystemTime::TicksToSeconds(busy[RenderThread]) / wall;
+	s.Overlap = SystemTime::TicksToSeconds(overlap) / wall;
+	return s;
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include <mutex>
+#include "BSTime.h"
+#include "VRFramePacer.h"
+#include "VRTripleBuffer.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Decoupled main loop, three threads:
+*  - Simulation: advances the game state in fixed steps of 1 / SimulationHz, paced by a FramePacer.
+*    When it falls behind it catches up with at most MaxCatchUpSteps steps and drops the rest.
+*  - Render: renders as fast as Present allows (or at RenderHz), interpolating between the last two
+*    simulation states. States go from simulation to render through a lock-free TripleBuffer, so
+*    neither thread ever waits on the other.
+*  - The thread calling Run(): pumps messages with the given PumpFunction, which should drain
+*    every pending message per call (and may block briefly when there are none). Input messages
+*    are reported with NotifyInput() for the latency measurement.
+*
+*   GameLoop<State> loop;
+*   loop.Initialize(options, initial_state, simulate, render);
+*   loop.Run(pump);   // until pump returns false or RequestStop()
+*
+* Headless: Run(nullptr) runs the simulation and render threads until RequestStop().
+* GetStats() measures how much simulation and rendering overlap and how long an input takes to
+* reach a rendered frame (render call end minus input time, present latency not included).
+*/
+
+struct GameLoopStats
+{
+    UINT64 SimulationSteps = 0;
+    // Steps skipped because the simulation fell more than MaxCatchUpSteps behind.
+    UINT64 DroppedSteps = 0;
+    UINT64 RenderFrames = 0;
+    // Fractions of the wall time since Start().
+    double SimulationBusy = 0.0;
+    double RenderBusy = 0.0;
+    // Both threads working at the same time.
+    double Overlap = 0.0;
+    UINT64 InputSamples = 0;
+    double LastInputLatencyMs = 0.0;
+    double MeanInputLatencyMs = 0.0;
+    double MaxInputLatencyMs = 0.0;
+};
+
+class GameLoopBase
+{
+public:
+    struct Options
+    {
+        double SimulationHz = 90.0;
+        UINT MaxCatchUpSteps = 5;
+        // 0 renders back to back, the swap chain's Present paces the thread.
+        double RenderHz = 0.0;
+    };
+
+    // Returns false to quit.
+    typedef std::function<bool()> PumpFunction;
+
+    GameLoopBase() = default;
+    virtual ~GameLoopBase();
+    GameLoopBase(const GameLoopBase&) = delete;
+    GameLoopBase& operator=(const GameLoopBase&) = delete;
+
+    void Start();
+    // Stops and joins the simulation and render threads.
+    void Stop();
+    // Start(), Pump until it returns false or RequestStop(), Stop().
+    void Run(PumpFunction Pump);
+    // Any thread.
+    void RequestStop() { m_StopRequested.store(true, std::memory_order_relaxed); }
+    bool IsStopRequested() const { return m_StopRequested.load(std::memory_order_relaxed); }
+
+    // An input event at Tick (SystemTime), any thread. The next step consumes it.
+    void NotifyInput(int64_t Tick);
+    void NotifyInput() { NotifyInput(SystemTime::GetCurrentTick()); }
+
+    GameLoopStats GetStats() const;
+    double GetStepSeconds() const { return m_StepSeconds; }
+
+protected:
+    void InitializeBase(const Options& Config);
+
+    // Simulation thread. StepTick is the SystemTime tick the new state belongs to, InputTick the
+    // earliest input it consumed (0 = none).
+    virtual void Step(double Dt, UINT64 StepIndex, int64_t StepTick, int64_t InputTick) = 0;
+    // Render thread. Returns the input tick of the state that was rendered.
+    virtual int64_t RenderFrame(int64_t Now) = 0;
+
+private:
+    void SimulationMain();
+    void RenderMain();
+    void SetBusy(UINT Thread, bool Busy);
+
+    Options m_Options;
+    double m_StepSeconds = 1.0 / 90.0;
+    std::thread m_SimulationThread;
+    std::thread m_RenderThread;
+    std::atomic<bool> m_StopRequested{ false };
+    std::atomic<bool> m_Running{ false };
+    std::atomic<int64_t> m_PendingInput{ 0 };
+    FramePacer m_SimulationPacer;
+    FramePacer m_RenderPacer;
+
+    // Busy intervals of simulation (0) and render (1), under m_Mutex.
+    mutable std::mutex m_Mutex;
+    bool m_Busy[2] = {};
+    int64_t m_BusySince[2] = {};
+    int64_t m_BusyTicks[2] = {};
+    int64_t m_OverlapSince = 0;
+    int64_t m_OverlapTicks = 0;
+    int64_t m_StartTick = 0;
+    int64_t m_LastInputRendered = 0;
+    double m_InputLatencySum = 0.0;
+    GameLoopStats m_Stats;
+};
+
+template<typename State>
+class GameLoop : public GameLoopBase
+{
+public:
+    // Next = Current advanced by Dt.
+    typedef std::function<void(const State& Current, State& Next, double Dt)> SimulateFunction;
+    // Alpha in [0, 1] from Previous to Current.
+    typedef std::function<void(const State& Previous, const State& Current, double Alpha)> RenderFunction;
+
+    // The threads call into this object, they have to be gone before its members are.
+    ~GameLoop() override { Stop(); }
+
+    void Initialize(const Options& Config, const State& Initial, SimulateFunction Simulate, RenderFunction Render)
+    {
+        InitializeBase(Config);
+        m_State = Initial;
+        m_Simulate = Simulate;
+        m_Render = Render;
+        Frame& frame = m_Frames.GetWriteBuffer();
+        frame.Previous = Initial;
+        frame.Current = Initial;
+        frame.Tick = 0;
+        frame.InputTick = 0;
+        m_Frames.Publish();
+    }
+
+protected:
+    void Step(double Dt, UINT64 StepIndex, int64_t StepTick, int64_t InputTick) override
+    {
+        Frame& frame = m_Frames.GetWriteBuffer();
+        frame.Previous = m_State;
+        m_Simulate(frame.Previous, frame.Current, Dt);
+        frame.Tick = StepTick;
+        frame.Step = StepIndex;
+        frame.InputTick = InputTick;
+        m_State = frame.Current;
+        m_Frames.Publish();
+    }
+
+    int64_t RenderFrame(int64_t Now) override
+    {
+        m_Frames.Update();
+        const Frame& frame = m_Frames.GetReadBuffer();
+        // The state of Tick is shown one step late, so there is always a newer one to blend to.
+        double alpha = 1.0;
+        if (frame.Tick != 0)
+            alpha = (std::min)((std::max)(SystemTime::TicksToSeconds(Now - frame.Tick) / GetStepSeconds(), 0.0), 1.0);
+        m_Render(frame.Previous, frame.Current, alpha);
+        return frame.InputTick;
+    }
+
+private:
+    struct Frame
+    {
+        State Previous;
+        State Current;
+        int64_t Tick = 0;
+        UINT64 Step = 0;
+        int64_t InputTick = 0;
+    };
+
+    // Simulation thread only.
+    State m_State;
+    TripleBuffer<Frame> m_Frames;
+    SimulateFunction m_Simulate;
+    RenderFunction m_Render;
+};
@@ -0,0 +1,289 @@
+#include "VRGpuProfiler.h"
+#include "BlackSpaceDirectX.h"
+#include <cstring>
+
+void GpuProfiler::Initialize(IGpuTimestampQueries* Queries, UINT Slots, UINT MaxPasses, UINT HistoryFrames)
+{
+	RAID_ASSERT(Queries && Slots > 0 && MaxPasses > 0);
+	m_Queries = Queries;
+	m_MaxPasses = MaxPasses;
+	m_Slots.clear();
+	m_Slots.resize(Slots);
+	for (Slot& s : m_Slots)
+	{
+		s.Passes.resize(MaxPasses);
+	}
+	m_Readback.resize((size_t)MaxPasses * 2);
+	m_History.clear();
+	m_History.resize((std::max)(HistoryFrames, 1u));
+	for (GpuFrameTimings& frame : m_History)
+	{
+		frame.Passes.reserve(MaxPasses);
+	}
+	m_HistoryStart = 0;
+	m_HistoryCount = 0;
+	m_NextSlot = 0;
+	m_Current = InvalidPass;
+	m_PassCount.store(0, std::memory_order_relaxed);
+	m_Frame = 0;
+	m_Stats = GpuProfilerStats();
+	m_Frequency = (std::max)(m_Queries->GetFrequency(), (UINT64)1);
+	Recalibrate();
+}
+
+void GpuProfiler::Destroy()
+{
+	m_Queries = nullptr;
+	m_Slots.clear();
+	m_History.clear();
+	m_HistoryStart = 0;
+	m_HistoryCount = 0;
+	m_Current = InvalidPass;
+}
+
+void GpuProfiler::Recalibrate()
+{
+	m_Queries->GetCalibration(m_CalibrationGpu, m_CalibrationCpu);
+	m_CalibratedFrame = m_Frame;
+}
+
+int64_t GpuProfiler::GpuToCpuTick(UINT64 Timestamp) const
+{
+	// Signed, timestamps taken before the calibration land before its CPU tick.
+	const double seconds = (double)(int64_t)(Timestamp - m_CalibrationGpu) / (double)m_Frequency;
+	return m_CalibrationCpu + (int64_t)(seconds / SystemTime::TicksToSeconds(1));
+}
+
+void GpuProfiler::BeginFrame(UINT64 CompletedFenceValue)
+{
+	if (!m_Queries)
+		return;
+	if (RecalibrateFrames > 0 && m_Frame - m_CalibratedFrame >= RecalibrateFrames)
+		Recalibrate();
+
+	// Slots are handed out round robin, so from m_NextSlot on they go oldest to newest.
+	const UINT count = (UINT)m_Slots.size();
+	for (UINT i = 0; i < count; i++)
+	{
+		Slot& s = m_Slots[(m_NextSlot + i) % count];
+		if (s.Pending && s.FenceValue <= CompletedFenceValue)
+			Collect(s);
+	}
+
+	Slot& next = m_Slots[m_NextSlot];
+	if (next.Pending)
+	{
+		// Still in flight, reusing its heap would mean waiting on the GPU.
+		m_Current = InvalidPass;
+		m_Stats.SkippedFrames++;
+	}
+	else
+	{
+		m_Current = m_NextSlot;
+		m_NextSlot = (m_NextSlot + 1) % count;
+		next.PassCount = 0;
+		next.Frame = m_Frame;
+	}
+	m_PassCount.store(0, std::memory_order_relaxed);
+}
+
+UINT GpuProfiler::BeginPass(ID3D12GraphicsCommandList* List, const char* Name)
+{
+	if (m_Current == InvalidPass)
+		return InvalidPass;
+	const UINT pass = m_PassCount.fetch_add(1, std::memory_order_relaxed);
+	if (pass >= m_MaxPasses)
+		return InvalidPass;
+	PassRecord& record = m_Slots[m_Current].Passes[pass];
+	record.Name = Name;
+	record.Ended = false;
+	m_Queries->WriteTimestamp(List, m_Current, pass * 2);
+	return pass;
+}
+
+void GpuProfiler::EndPass(ID3D12GraphicsCommandList* List, UINT Pass)
+{
+	if (Pass == InvalidPass || m_Current == InvalidPass)
+		return;
+	m_Queries->WriteTimestamp(List, m_Current, Pass * 2 + 1);
+	m_Slots[m_Current].Passes[Pass].Ended = true;
+}
+
+void GpuProfiler::Resolve(ID3D12GraphicsCommandList* List)
+{
+	if (m_Current == InvalidPass)
+		return;
+	// Recording threads have been joined by now, the count is final.
+	const UINT begun = m_PassCount.load(std::memory_order_relaxed);
+	if (begun > m_MaxPasses)
+		m_Stats.DroppedPasses += begun - m_MaxPasses;
+	Slot& s = m_Slots[m_Current];
+	s.PassCount = (std::min)(begun, m_MaxPasses);
+	if (s.PassCount > 0)
+		m_Queries->Resolve(List, m_Current, s.PassCount * 2);
+}
+
+void GpuProfiler::EndFrame(UINT64 FenceValue)
+{
+	if (m_Current != InvalidPass)
+	{
+		Slot& s = m_Slots[m_Current];
+		if (s.PassCount > 0)
+		{
+			s.FenceValue = FenceValue;
+			s.Pending = true;
+			m_Stats.TimedFrames++;
+		}
+		m_Current = InvalidPass;
+	}
+	m_Frame++;
+}
+
+void GpuProfiler::Collect(Slot& S)
+{
+	S.Pending = false;
+	m_Queries->Read((UINT)(&S - m_Slots.data()), S.PassCount * 2, m_Readback.data());
+
+	UINT64 first = UINT64_MAX;
+	UINT64 last = 0;
+	for (UINT i = 0; i < S.PassCount; i++)
+	{
+		if (!S.Passes[i].Ended)
+			continue;
+		first = (std::min)(first, m_Readback[i * 2]);
+		last = (std::max)(last, m_Readback[i * 2 + 1]);
+	}
+	if (first == UINT64_MAX)
+		return;
+
+	// The oldest entry is overwritten once the history is full.
+	const UINT size = (UINT)m_History.size();
+	GpuFrameTimings& frame = m_History[(m_HistoryStart + m_HistoryCount) % size];
+	if (m_HistoryCount < size)
+		m_HistoryCount++;
+	else
+		m_HistoryStart = (m_HistoryStart + 1) % size;
+	frame.Frame = S.Frame;
+	frame.FenceValue = S.FenceValue;
+	frame.Passes.clear();
+
+	const double to_ms = 1000.0 / (double)m_Frequency;
+	frame.TotalMs = (double)(last - first) * to_ms;
+	frame.BeginTick = GpuToCpuTick(first);
+	frame.EndTick = GpuToCpuTick(last);
+	for (UINT i = 0; i < S.PassCount; i++)
+	{
+		if (!S.Passes[i].Ended)
+			continue;
+		const UINT64 begin = m_Readback[i * 2];
+		// Clamped, a pass split over lists of different threads can report an end before its begin.
+		const UINT64 end = (std::max)(begin, m_Readback[i * 2 + 1]);
+		GpuPassTiming pass;
+		pass.Name = S.Passes[i].Name;
+		pass.BeginMs = (double)(begin - first) * to_ms;
+		pass.EndMs = (double)(end - first) * to_ms;
+		pass.BeginTick = GpuToCpuTick(begin);
+		pass.EndTick = GpuToCpuTick(end);
+		frame.Passes.push_back(pass);
+	}
+
+	m_Stats.CollectedFrames++;
+	m_Stats.LastLatency = m_Frame - S.Frame;
+}
+
+bool GpuProfiler::GetLatestFrame(GpuFrameTimings& Out) const
+{
+	if (m_HistoryCount == 0)
+		return false;
+	Out = GetHistoryFrame(m_HistoryCount - 1);
+	return true;
+}
+
+double GpuProfiler::GetAveragePassMs(const char* Name) const
+{
+	double total = 0.0;
+	UINT count = 0;
+	for (UINT i = 0; i < m_HistoryCount; i++)
+	{
+		for (const GpuPassTiming& pass : GetHistoryFrame(i).Passes)
+		{
+			if (pass.Name == Name || (pass.Name && Name && strcmp(pass.Name, Name) == 0))
+			{
+				total += pass.GetDurationMs();
+				count++;
+			}
+		}
+	}
+	return count ? total / count : 0.0;
+}
+
+void D3D12TimestampQueries::Initialize(ID3D12Device* Device, ID3D12CommandQueue* Queue, UINT Slots, UINT QueriesPerSlot)
+{
+	m_Queue = Queue;
+	m_QueriesPerSlot = QueriesPerSlot;
+	m_Heaps.resize(Slots);
+	D3D12_QUERY_HEAP_DESC heap_desc = {};
+	heap_desc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	heap_desc.Count = QueriesPerSlot;
+	heap_desc.NodeMask = 0;
+	for (UINT i = 0; i < Slots; i++)
+	{
+		ThrowIfFailed(Device->CreateQueryHeap(&heap_desc, IID_PPV_ARGS(&m_Heaps[i])));
+		m_Heaps[i]->SetName(L"TimestampHeap");
+	}
+
+	CD3DX12_HEAP_PROPERTIES heap_props(D3D12_HEAP_TYPE_READBACK);
+	CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer((UINT64)Slots * QueriesPerSlot * sizeof(UINT64));
+	ThrowIfFailed(Device->CreateCommittedResource(&heap_props, D3D12_HEAP_FLAG_NONE, &desc,
+		D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&m_Readback)));
+	m_Readback->SetName(L"TimestampReadback");
+}
+
+void D3D12TimestampQueries::Destroy()
+{
+	m_Heaps.clear();
+	m_Readback.Reset();
+	m_Queue.Reset();
+}
+
+void D3D12TimestampQueries::WriteTimestamp(ID3D12GraphicsCommandList* List, UINT Slot, UINT Index)
+{
+	List->EndQuery(m_Heaps[Slot].Get(), D3D12_QUERY_TYPE_TIMESTAMP, Index);
+}
+
+void D3D12TimestampQueries::Resolve(ID3D12GraphicsCommandList* List, UINT Slot, UINT Count)
+{
+	List->ResolveQueryData(m_Heaps[Slot].Get(), D3D12_QUERY_TYPE_TIMESTAMP, 0, Count, m_Readback.Get(),
+		(UINT64)Slot * m_QueriesPerSlot * sizeof(UINT64));
+}
+
+void D3D12TimestampQueries::Read(UINT Slot, UINT Count, UINT64* Out)
+{
+	const SIZE_T offset = (SIZE_T)Slot * m_QueriesPerSlot * sizeof(UINT64);
+	// Only the slot's range is invalidated, the other slots may still be written by the GPU.
+	CD3DX12_RANGE read_range(offset, offset + Count * sizeof(UINT64));
+	void* cpu = nullptr;
+	ThrowIfFailed(m_Readback->Map(0, &read_range, &cpu));
+	memcpy(Out, static_cast<const UINT8*>(cpu) + offset, Count * sizeof(UINT64));
+	CD3DX12_RANGE written_range(0, 0);
+	m_Readback->Unmap(0, &written_range);
+}
+
+UINT64 D3D12TimestampQueries::GetFrequency()
+{
+	UINT64 frequency = 1;
+	ThrowIfFailed(m_Queue->GetTimestampFrequency(&frequency));
+	return frequency;
+}
+
+void D3D12TimestampQueries::GetCalibration(UINT64& GpuTimestamp, int64_t& CpuTick)
+{
+	UINT64 gpu = 0;
+	UINT64 cpu = 0;
+	// The CPU side is a QueryPerformanceCounter value, the same clock as SystemTime.
+	if (SUCCEEDED(m_Queue->GetClockCalibration(&gpu, &cpu)))
+	{
+		GpuTimestamp = gpu;
+		CpuTick = (int64_t)cpu;
+	}
+}
@@ -0,0 +1,181 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include <d3d12.h>
+#include <wrl.h>
+#include "BSTime.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* GPU pass timings from timestamp queries.
+*   BeginFrame(Completed)        Once per frame before recording, Completed = last finished fence value.
+*   BeginPass(List, "Name")      Timestamp before the pass, returns a handle for EndPass.
+*   EndPass(List, Handle)        Timestamp after the pass. Any thread, any list of the frame.
+*   Resolve(List)                Once per frame, in the list submitted last.
+*   EndFrame(FenceValue)         Once per frame after the submit, FenceValue = the frame's fence.
+*
+* Each frame in flight owns a query heap and a range of a readback buffer. Resolve() copies the
+* frame's timestamps into its range with ResolveQueryData, BeginFrame() reads back only the
+* frames whose fence has completed, so nothing ever waits on the GPU. The results come a frame or
+* two late. If the slot the next frame needs is still in flight, that frame is not timed
+* (GpuProfilerStats::SkippedFrames) rather than stalling.
+*
+* Timestamps are converted to milliseconds with the queue's timestamp frequency and placed on the
+* SystemTime tick axis through the queue's clock calibration, so a GPU pass lines up with the CPU
+* scopes of VRProfiler.h.
+*
+* All queue work goes through IGpuTimestampQueries, the readback latency and the conversions can
+* be run against a stand-in that returns synthetic timestamps.
+*/
+
+class IGpuTimestampQueries
+{
+public:
+    virtual ~IGpuTimestampQueries() = default;
+
+    // Writes timestamp Index of Slot's heap at this point of List.
+    virtual void WriteTimestamp(ID3D12GraphicsCommandList* List, UINT Slot, UINT Index) = 0;
+    // Copies timestamps [0, Count) of Slot's heap into Slot's readback range.
+    virtual void Resolve(ID3D12GraphicsCommandList* List, UINT Slot, UINT Count) = 0;
+    // Reads Count resolved timestamps of Slot. Only called once the GPU finished the resolve.
+    virtual void Read(UINT Slot, UINT Count, UINT64* Out) = 0;
+    // Timestamp ticks per second.
+    virtual UINT64 GetFrequency() = 0;
+    // A GPU timestamp and the SystemTime tick sampled at the same moment.
+    virtual void GetCalibration(UINT64& GpuTimestamp, int64_t& CpuTick) = 0;
+};
+
+struct GpuPassTiming
+{
+    const char* Name = nullptr;
+    // Milliseconds from the frame's first timestamp.
+    double BeginMs = 0.0;
+    double EndMs = 0.0;
+    // Same on the SystemTime axis.
+    int64_t BeginTick = 0;
+    int64_t EndTick = 0;
+
+    double GetDurationMs() const { return EndMs - BeginMs; }
+};
+
+struct GpuFrameTimings
+{
+    UINT64 Frame = 0;
+    UINT64 FenceValue = 0;
+    // First pass begin to last pass end.
+    double TotalMs = 0.0;
+    int64_t BeginTick = 0;
+    int64_t EndTick = 0;
+    // In BeginPass order.
+    std::vector<GpuPassTiming> Passes;
+};
+
+struct GpuProfilerStats
+{
+    UINT64 TimedFrames = 0;
+    UINT64 CollectedFrames = 0;
+    // Frames not timed because their slot was still in flight.
+    UINT64 SkippedFrames = 0;
+    // BeginPass calls past MaxPasses.
+    UINT64 DroppedPasses = 0;
+    // Frames between recording and collection, of the last collected frame.
+    UINT64 LastLatency = 0;
+};
+
+class GpuProfiler
+{
+public:
+    const static UINT InvalidPass = ~0u;
+    const static UINT DefaultHistory = 120;
+
+    // Slots = frames that may be in flight at once, each with MaxPasses begin/end pairs.
+    void Initialize(IGpuTimestampQueries* Queries, UINT Slots, UINT MaxPasses, UINT HistoryFrames = DefaultHistory);
+    void Destroy();
+
+    void BeginFrame(UINT64 CompletedFenceValue);
+    // Name must outlive the readback, a literal. Thread-safe.
+    UINT BeginPass(ID3D12GraphicsCommandList* List, const char* Name);
+    void EndPass(ID3D12GraphicsCommandList* List, UINT Pass);
+    void Resolve(ID3D12GraphicsCommandList* List);
+    void EndFrame(UINT64 FenceValue);
+
+    // Most recent collected frame, false before the first one.
+    bool GetLatestFrame(GpuFrameTimings& Out) const;
+    // Collected frames, GetHistoryFrame(0) is the oldest.
+    UINT GetHistoryCount() const { return m_HistoryCount; }
+    const GpuFrameTimings& GetHistoryFrame(UINT Index) const { return m_History[(m_HistoryStart + Index) % m_History.size()]; }
+    // Average duration of the passes called Name over the history, 0 if none.
+    double GetAveragePassMs(const char* Name) const;
+
+    const GpuProfilerStats& GetStats() const { return m_Stats; }
+    UINT GetSlotCount() const { return (UINT)m_Slots.size(); }
+    UINT GetMaxPasses() const { return m_MaxPasses; }
+
+    // Re-reads the clock calibration, done by BeginFrame every RecalibrateFrames frames.
+    void Recalibrate();
+    int64_t GpuToCpuTick(UINT64 Timestamp) const;
+
+    UINT RecalibrateFrames = 300;
+
+private:
+    struct PassRecord
+    {
+        const char* Name;
+        bool Ended;
+    };
+
+    struct Slot
+    {
+        std::vector<PassRecord> Passes;
+        UINT PassCount = 0;
+        UINT64 Frame = 0;
+        UINT64 FenceValue = 0;
+        bool Pending = false;
+    };
+
+    void Collect(Slot& S);
+
+    IGpuTimestampQueries* m_Queries = nullptr;
+    std::vector<Slot> m_Slots;
+    UINT m_MaxPasses = 0;
+    UINT m_NextSlot = 0;
+    // Slot of the frame being recorded, InvalidPass when it is not timed.
+    UINT m_Current = InvalidPass;
+    std::atomic<UINT> m_PassCount{ 0 };
+    UINT64 m_Frame = 0;
+
+    UINT64 m_Frequency = 1;
+    UINT64 m_CalibrationGpu = 0;
+    int64_t m_CalibrationCpu = 0;
+    UINT64 m_CalibratedFrame = 0;
+
+    std::vector<UINT64> m_Readback;
+    // Ring of HistoryFrames entries with Passes reserved to MaxPasses, overwritten in place so
+    // collecting a frame does not allocate.
+    std::vector<GpuFrameTimings> m_History;
+    UINT m_HistoryStart = 0;
+    UINT m_HistoryCount = 0;
+    GpuProfilerStats m_Stats;
+};
+
+// IGpuTimestampQueries on a direct queue, one timestamp heap per slot and one readback buffer.
+class D3D12TimestampQueries : public IGpuTimestampQueries
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    void Initialize(ID3D12Device* Device, ID3D12CommandQueue* Queue, UINT Slots, UINT QueriesPerSlot);
+    void Destroy();
+
+    void WriteTimestamp(ID3D12GraphicsCommandList* List, UINT Slot, UINT Index) override;
+    void Resolve(ID3D12GraphicsCommandList* List, UINT Slot, UINT Count) override;
+    void Read(UINT Slot, UINT Count, UINT64* Out) override;
+    UINT64 GetFrequency() override;
+    void GetCalibration(UINT64& GpuTimestamp, int64_t& CpuTick) override;
+
+private:
+    COM<ID3D12CommandQueue> m_Queue;
+    std::vector<COM<ID3D12QueryHeap>> m_Heaps;
+    COM<ID3D12Resource> m_Readback;
+    UINT m_QueriesPerSlot = 0;
+};
@@ -0,0 +1,439 @@
+#include "VRJobSystem.h"
+#include "BSTime.h"
+#include "VRProfiler.h"
+#include <cmath>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static inline void JobPause()
+{
+#if BS_TIME_TSC
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// Chase-Lev deque, fixed capacity (Le, Pop, Cohen, Zappa Nardelli, "Correct and Efficient
+// Work-Stealing for Weak Memory Models"). Push/Pop by the owner, Steal by anyone.
+class WorkStealingDeque
+{
+public:
+	explicit WorkStealingDeque(UINT Capacity)
+	{
+		m_Buffer = std::make_unique<std::atomic<Job*>[]>(Capacity);
+		m_Mask = Capacity - 1;
+	}
+
+	bool Push(Job* J)
+	{
+		const int64_t b = m_Bottom.load(std::memory_order_relaxed);
+		const int64_t t = m_Top.load(std::memory_order_acquire);
+		if (b - t > m_Mask)
+			return false;
+		m_Buffer[b & m_Mask].store(J, std::memory_order_relaxed);
+		// Publishes the slot (and the job behind it) to thieves acquiring m_Bottom.
+		m_Bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	Job* Pop()
+	{
+		const int64_t b = m_Bottom.load(std::memory_order_relaxed) - 1;
+		m_Bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = m_Top.load(std::memory_order_relaxed);
+		Job* job = nullptr;
+		if (t <= b)
+		{
+			job = m_Buffer[b & m_Mask].load(std::memory_order_relaxed);
+			if (t == b)
+			{
+				// Last one, race the thieves for it.
+				if (!m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					job = nullptr;
+				m_Bottom.store(b + 1, std::memory_order_relaxed);
+			}
+		}
+		else
+		{
+			m_Bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return job;
+	}
+
+	Job* Steal()
+	{
+		int64_t t = m_Top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const int64_t b = m_Bottom.load(std::memory_order_acquire);
+		if (t >= b)
+			return nullptr;
+		Job* job = m_Buffer[t & m_Mask].load(std::memory_order_relaxed);
+		if (!m_Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return job;
+	}
+
+	bool IsEmpty() const
+	{
+		return m_Bottom.load(std::memory_order_relaxed) <= m_Top.load(std::memory_order_relaxed);
+	}
+
+private:
+	alignas(64) std::atomic<int64_t> m_Top{ 0 };
+	alignas(64) std::atomic<int64_t> m_Bottom{ 0 };
+	std::unique_ptr<std::atomic<Job*>[]> m_Buffer;
+	int64_t m_Mask = 0;
+};
+
+struct JobSystem::ThreadContext
+{
+	ThreadContext() : Deque(MaxJobsPerThread) {}
+
+	WorkStealingDeque Deque;
+	std::unique_ptr<Job[]> Jobs{ new Job[MaxJobsPerThread] };
+	UINT NextJob = 0;
+	uint32_t Random = 0;
+	std::thread::id Thread;
+};
+
+// The calling thread's context in the system it last used, looked up again when it changes.
+struct JobThreadCache
+{
+	UINT64 System = 0;
+	void* Context = nullptr;
+};
+static thread_local JobThreadCache t_JobCache;
+static thread_local bool t_RenderThreadPinned = false;
+static std::atomic<UINT64> s_NextSystemId{ 1 };
+
+JobSystem::JobSystem()
+{
+}
+
+JobSystem::~JobSystem()
+{
+	Shutdown();
+}
+
+void JobSystem::Initialize(const Options& Config)
+{
+	RAID_ASSERT(m_Threads.empty());
+	m_Options = Config;
+	m_Id = s_NextSystemId.fetch_add(1);
+	m_Quit.store(false);
+	UINT workers = Config.Workers;
+	if (workers == 0)
+	{
+		const UINT cores = std::thread::hardware_concurrency();
+		const UINT reserved = 1 + (Config.ReserveRenderCore ? 1 : 0);
+		workers = cores > reserved ? cores - reserved : 1;
+	}
+	workers = (std::min)(workers, MaxThreads - 8);
+	// The calling thread first, so it is context 0.
+	GetContext();
+	for (UINT i = 0; i < workers; i++)
+	{
+		m_Threads.emplace_back(&JobSystem::WorkerMain, this, i);
+	}
+}
+
+void JobSystem::Shutdown()
+{
+	if (m_Threads.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_Quit.store(true);
+	}
+	m_Wake.notify_all();
+	for (std::thread& t : m_Threads)
+	{
+		t.join();
+	}
+	m_Threads.clear();
+	std::lock_guard<std::mutex> lock(m_RegisterMutex);
+	for (UINT i = 0; i < m_ContextCount.load(); i++)
+	{
+		m_Contexts[i].reset();
+	}
+	m_ContextCount.store(0);
+	// Stale thread caches point at freed contexts, a new id makes them miss.
+	m_Id = s_NextSystemId.fetch_add(1);
+}
+
+JobSystem::ThreadContext& JobSystem::GetContext()
+{
+	JobThreadCache& cache = t_JobCache;
+	if (cache.System == m_Id)
+		return *static_cast<ThreadContext*>(cache.Context);
+	return RegisterThread();
+}
+
+JobSystem::ThreadContext& JobSystem::RegisterThread()
+{
+	std::lock_guard<std::mutex> lock(m_RegisterMutex);
+	const std::thread::id id = std::this_thread::get_id();
+	ThreadContext* context = nullptr;
+	const UINT count = m_ContextCount.load(std::memory_order_relaxed);
+	for (UINT i = 0; i < count && !context; i++)
+	{
+		if (m_Contexts[i]->Thread == id)
+			context = m_Contexts[i].get();
+	}
+	if (!context)
+	{
+		RAID_ASSERT(count < MaxThreads && "Too many threads using the job system");
+		m_Contexts[count] = std::make_unique<ThreadContext>();
+		context = m_Contexts[count].get();
+		context->Thread = id;
+		context->Random = 0x9E3779B9u * (count + 1);
+		m_ContextCount.store(count + 1, std::memory_order_release);
+	}
+	t_JobCache.System = m_Id;
+	t_JobCache.Context = context;
+	return *context;
+}
+
+Job* JobSystem::AllocateJob()
+{
+	ThreadContext& context = GetContext();
+	Job* job = &context.Jobs[context.NextJob++ & (MaxJobsPerThread - 1)];
+	// A ring's worth of jobs later the slot is normally long done, if not help until it is.
+	while (!job->Finished.load(std::memory_order_acquire))
+	{
+		if (Job* other = FindJob(context))
+			Execute(other);
+		else
+			JobPause();
+	}
+	job->Finished.store(false, std::memory_order_relaxed);
+	return job;
+}
+
+void JobSystem::Submit(Job* J, JobCounter* Counter)
+{
+	J->Counter = Counter;
+	if (Counter)
+		Counter->m_Pending.fetch_add(1, std::memory_order_relaxed);
+	ThreadContext& context = GetContext();
+	if (!context.Deque.Push(J))
+	{
+		// Deque full, run it right here.
+		Execute(J);
+		return;
+	}
+	m_Queued.fetch_add(1, std::memory_order_seq_cst);
+	if (m_Sleeping.load(std::memory_order_seq_cst) > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_SleepMutex);
+		m_Wake.notify_one();
+	}
+}
+
+void JobSystem::Execute(Job* J)
+{
+	JobCounter* counter = J->Counter;
+	J->Invoke(J);
+	J->Finished.store(true, std::memory_order_release);
+	if (counter)
+		counter->m_Pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+Job* JobSystem::FindJob(ThreadContext& Context)
+{
+	Job* job = Context.Deque.Pop();
+	if (!job)
+	{
+		const UINT count = m_ContextCount.load(std::memory_order_acquire);
+		// xorshift, a random first victim spreads the thieves.
+		Context.Random ^= Context.Random << 13;
+		Context.Random ^= Context.Random >> 17;
+		Context.Random ^= Context.Random << 5;
+		const UINT first = count ? Context.Random % count : 0;
+		for (UINT i = 0; i < count && !job; i++)
+		{
+			ThreadContext* victim = m_Contexts[(first + i) % count].get();
+			if (victim != &Context)
+				job = victim->Deque.Steal();
+		}
+	}
+	if (job)
+		m_Queued.fetch_sub(1, std::memory_order_relaxed);
+	return job;
+}
+
+bool JobSystem::IsLocalQueueEmpty()
+{
+	return GetContext().Deque.IsEmpty();
+}
+
+void JobSystem::Wait(const JobCounter& Counter)
+{
+	ThreadContext& context = GetContext();
+	while (!Counter.IsDone())
+	{
+		if (Job* job = FindJob(context))
+			Execute(job);
+		else
+			JobPause();
+	}
+}
+
+void JobSystem::WorkerMain(UINT Index)
+{
+	VR_PROFILE_THREAD("JobWorker");
+	if (m_Options.PinWorkers)
+	{
+		const UINT cores = (std::max)(std::thread::hardware_concurrency(), 1u);
+		const UINT first = m_Options.ReserveRenderCore && cores > 1 ? 1 : 0;
+		PinCurrentThread(first + Index % (cores - first));
+	}
+	ThreadContext& context = GetContext();
+	UINT idle = 0;
+	while (!m_Quit.load(std::memory_order_relaxed))
+	{
+		if (Job* job = FindJob(context))
+		{
+			Execute(job);
+			idle = 0;
+			continue;
+		}
+		// Spin a little before sleeping, frames spawn in bursts.
+		if (++idle < 2048)
+		{
+			JobPause();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_SleepMutex);
+		m_Sleeping.fetch_add(1, std::memory_order_seq_cst);
+		m_Wake.wait(lock, [this] { return m_Quit.load(std::memory_order_relaxed) || m_Queued.load(std::memory_order_seq_cst) > 0; });
+		m_Sleeping.fetch_sub(1, std::memory_order_relaxed);
+		idle = 0;
+	}
+}
+
+void JobSystem::PinRenderThread()
+{
+	if (t_RenderThreadPinned)
+		return;
+	t_RenderThreadPinned = true;
+	PinCurrentThread(0);
+}
+
+bool JobSystem::PinCurrentThread(UINT Core)
+{
+#ifdef _WIN32
+	if (Core >= 64)
+		return false;
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << Core) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(Core, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+static double SecondsSince(int64_t Start)
+{
+	return SystemTime::TicksToSeconds(SystemTime::GetCurrentTick() - Start);
+}
+
+JobSystemBenchmarkResult BenchmarkJobSystem(UINT MaxThreads)
+{
+	JobSystemBenchmarkResult r;
+	if (MaxThreads == 0)
+		MaxThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+	MaxThreads = (std::min)(MaxThreads, JobSystem::MaxThreads - 8);
+
+	if (MaxThreads > 1)
+	{
+		JobSystem jobs;
+		JobSystem::Options options;
+		options.Workers = MaxThreads - 1;
+		jobs.Initialize(options);
+
+		// Spawn latency: the caller only spins, a worker has to pick the job up.
+		const UINT latency_runs = 2000;
+		double latency = 0.0;
+		for (UINT i = 0; i < latency_runs; i++)
+		{
+			JobCounter counter;
+			std::atomic<int64_t> started{ 0 };
+			const int64_t spawned = SystemTime::GetCurrentTick();
+			jobs.Spawn(&counter, [&started] { started.store(SystemTime::GetCurrentTick(), std::memory_order_relaxed); });
+			while (!counter.IsDone())
+				JobPause();
+			latency += SystemTime::TicksToSeconds(started.load() - spawned);
+		}
+		r.SpawnLatencyMicrosecs = latency / latency_runs * 1e6;
+
+		// Steal throughput: batches well under the deque size, all executed by the workers.
+		const UINT batches = 200;
+		const UINT batch = 2048;
+		const int64_t start = SystemTime::GetCurrentTick();
+		for (UINT b = 0; b < batches; b++)
+		{
+			JobCounter counter;
+			for (UINT i = 0; i < batch; i++)
+			{
+				jobs.Spawn(&counter, [] {});
+			}
+			while (!counter.IsDone())
+				JobPause();
+		}
+		r.StolenJobsPerSecond = batches * batch / SecondsSince(start);
+	}
+
+	{
+		JobSystem jobs;
+		JobSystem::Options options;
+		options.Workers = 1;
+		jobs.Initialize(options);
+		const UINT runs = 100000;
+		const int64_t start = SystemTime::GetCurrentTick();
+		for (UINT i = 0; i < runs; i++)
+		{
+			JobCounter counter;
+			jobs.Spawn(&counter, [] {});
+			jobs.Wait(counter);
+		}
+		r.RoundTripMicrosecs = SecondsSince(start) / runs * 1e6;
+	}
+
+	// ParallelFor scaling on a compute bound loop.
+	const UINT count = 1 << 22;
+	std::vector<float> data(count);
+	double single = 0.0;
+	for (UINT threads = 1; threads <= MaxThreads; threads++)
+	{
+		JobSystem jobs;
+		JobSystem::Options options;
+		options.Workers = threads - 1;
+		double best = 1e30;
+		if (threads > 1)
+			jobs.Initialize(options);
+		for (UINT run = 0; run < 3; run++)
+		{
+			const int64_t start = SystemTime::GetCurrentTick();
+			auto body = [&data](UINT Begin, UINT End)
+			{
+				for (UINT i = Begin; i < End; i++)
+					data[i] = std::sqrt((float)i) * std::sin((float)i);
+			};
+			if (threads > 1)
+				jobs.ParallelFor(0, count, body);
+			else
+				body(0, count);
+			best = (std::min)(best, SecondsSince(start));
+		}
+		if (threads == 1)
+			single = best;
+		r.ParallelForSpeedup.push_back(single / best);
+	}
+	return r;
+}
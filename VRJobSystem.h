@@ -0,0 +1,187 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <type_traits>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Work-stealing job scheduler.
+*   JobCounter counter;
+*   jobs.Spawn(&counter, [=] { ... });            // captures up to Job::StorageSize bytes
+*   jobs.Wait(counter);                           // runs other jobs until counter reaches zero
+*   jobs.ParallelFor(0, count, [&](UINT Begin, UINT End) { ... });
+*
+* Every thread that spawns or waits gets its own Chase-Lev deque (registered on first use): the
+* owner pushes and pops at the bottom without contention, idle threads steal from the top of a
+* random victim. A counter is incremented by every job spawned against it and decremented when
+* the job finished, dependencies are expressed by waiting on (or spawning after) a counter.
+* Waits never block while there is work, the waiting thread executes jobs itself.
+*
+* ParallelFor splits lazily: a range is halved and the half pushed only while the thread's own
+* deque is empty (nobody has anything to steal from it), otherwise it keeps working through
+* MinGrain sized chunks. The grain therefore adapts to how busy the other threads are.
+*
+* Jobs come from a per-thread ring of MaxJobsPerThread, nothing is allocated per spawn.
+* Options::ReserveRenderCore keeps workers off core 0, PinRenderThread() puts the calling thread
+* there. BenchmarkJobSystem() measures spawn latency, steal throughput and ParallelFor scaling.
+*/
+
+class JobCounter
+{
+public:
+    bool IsDone() const { return m_Pending.load(std::memory_order_acquire) == 0; }
+    UINT GetPending() const { return m_Pending.load(std::memory_order_relaxed); }
+
+private:
+    friend class JobSystem;
+    std::atomic<UINT> m_Pending{ 0 };
+};
+
+struct alignas(64) Job
+{
+    const static size_t StorageSize = 104;
+
+    void (*Invoke)(Job* Self) = nullptr;
+    JobCounter* Counter = nullptr;
+    // Set once the job ran, its ring slot may then be reused.
+    std::atomic<bool> Finished{ true };
+    alignas(16) unsigned char Storage[StorageSize];
+};
+
+class JobSystem
+{
+public:
+    const static UINT MaxThreads = 64;
+    const static UINT MaxJobsPerThread = 4096;
+
+    struct Options
+    {
+        // Worker threads. 0 = one per core, minus the calling thread and the reserved core.
+        UINT Workers = 0;
+        bool PinWorkers = false;
+        // Workers stay off core 0, for the render thread (PinRenderThread).
+        bool ReserveRenderCore = false;
+    };
+
+    JobSystem();
+    ~JobSystem();
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    void Initialize(const Options& Config);
+    void Shutdown();
+
+    template<typename F>
+    void Spawn(JobCounter* Counter, F&& Task)
+    {
+        typedef typename std::decay<F>::type Functor;
+        static_assert(sizeof(Functor) <= Job::StorageSize, "Job capture too large, capture a pointer to the data instead");
+        static_assert(alignof(Functor) <= 16, "Job capture over-aligned");
+        Job* job = AllocateJob();
+        new (job->Storage) Functor(std::forward<F>(Task));
+        job->Invoke = [](Job* Self)
+        {
+            Functor* f = reinterpret_cast<Functor*>(Self->Storage);
+            (*f)();
+            f->~Functor();
+        };
+        Submit(job, Counter);
+    }
+
+    // Executes jobs until Counter reached zero.
+    void Wait(const JobCounter& Counter);
+
+    // Body(Begin, End) over [Begin, End) in chunks of at least MinGrain (0 = automatic).
+    template<typename F>
+    void ParallelFor(UINT Begin, UINT End, const F& Body, UINT MinGrain = 0)
+    {
+        if (End <= Begin)
+            return;
+        if (MinGrain == 0)
+            MinGrain = (std::max)((End - Begin) / (GetThreadCount() * 32), 1u);
+        JobCounter counter;
+        ForRange(Begin, End, Body, counter, MinGrain);
+        Wait(counter);
+    }
+
+    // Task(0..Tasks-1), same contract as SubresourceCopier::ParallelRun.
+    void Run(UINT Tasks, const std::function<void(UINT)>& Task)
+    {
+        ParallelFor(0, Tasks, [&Task](UINT Begin, UINT End)
+        {
+            for (UINT i = Begin; i < End; i++)
+                Task(i);
+        }, 1);
+    }
+
+    // Workers plus the calling thread.
+    UINT GetThreadCount() const { return (UINT)m_Threads.size() + 1; }
+
+    // Pins the calling thread to core 0, once per thread.
+    void PinRenderThread();
+    static bool PinCurrentThread(UINT Core);
+
+private:
+    struct ThreadContext;
+
+    template<typename F>
+    void ForRange(UINT Begin, UINT End, const F& Body, JobCounter& Counter, UINT Grain)
+    {
+        while (End - Begin > Grain)
+        {
+            if (IsLocalQueueEmpty())
+            {
+                const UINT middle = Begin + (End - Begin) / 2;
+                const F* body = &Body;
+                JobCounter* counter = &Counter;
+                Spawn(&Counter, [this, body, counter, middle, End, Grain] { ForRange(middle, End, *body, *counter, Grain); });
+                End = middle;
+            }
+            else
+            {
+                Body(Begin, Begin + Grain);
+                Begin += Grain;
+            }
+        }
+        Body(Begin, End);
+    }
+
+    ThreadContext& GetContext();
+    ThreadContext& RegisterThread();
+    Job* AllocateJob();
+    void Submit(Job* J, JobCounter* Counter);
+    void Execute(Job* J);
+    Job* FindJob(ThreadContext& Context);
+    bool IsLocalQueueEmpty();
+    void WorkerMain(UINT Index);
+
+    Options m_Options;
+    std::vector<std::thread> m_Threads;
+    std::unique_ptr<ThreadContext> m_Contexts[MaxThreads];
+    std::atomic<UINT> m_ContextCount{ 0 };
+    std::mutex m_RegisterMutex;
+    // Pushed and not yet taken, for putting workers to sleep.
+    std::atomic<int64_t> m_Queued{ 0 };
+    std::atomic<UINT> m_Sleeping{ 0 };
+    std::mutex m_SleepMutex;
+    std::condition_variable m_Wake;
+    std::atomic<bool> m_Quit{ false };
+    UINT64 m_Id = 0;
+};
+
+struct JobSystemBenchmarkResult
+{
+    // Spawn until a spinning worker starts the job.
+    double SpawnLatencyMicrosecs = 0.0;
+    // Spawn + Wait of an empty job on the calling thread.
+    double RoundTripMicrosecs = 0.0;
+    // Empty jobs pushed by one thread and run by the others, all stolen.
+    double StolenJobsPerSecond = 0.0;
+    // ParallelForSpeedup[i] = ParallelFor speedup with i + 1 threads over one thread.
+    std::vector<double> ParallelForSpeedup;
+};
+
+// MaxThreads 0 = hardware_concurrency.
+JobSystemBenchmarkResult BenchmarkJobSystem(UINT MaxThreads = 0);
@@ -0,0 +1,767 @@
+#include "VRPipelineCache.h"
+#include "VRShaderCache.h"
+#include "BlackSpaceDirectX.h"
+#include "BSTime.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const UINT32 PipelineCacheMagic = 0x43505256; // 'VRPC'
+
+// Order-dependent combine of 64 bit values (splitmix64 finalizer per value).
+struct PipelineHashMixer
+{
+	UINT64 H = 0x84222325cbf29ce4ull;
+
+	void Add(UINT64 v)
+	{
+		v += 0x9e3779b97f4a7c15ull;
+		v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ull;
+		v = (v ^ (v >> 27)) * 0x94d049bb133111ebull;
+		v ^= v >> 31;
+		H = ((H << 5) | (H >> 59)) ^ v;
+		H *= 0x9e3779b97f4a7c15ull;
+	}
+
+	void AddFloat(FLOAT f)
+	{
+		// -0.0 and 0.0 behave the same.
+		if (f == 0.0f)
+			f = 0.0f;
+		UINT32 bits;
+		memcpy(&bits, &f, sizeof(bits));
+		Add(bits);
+	}
+
+	// HLSL semantics are case insensitive.
+	void AddSemantic(LPCSTR Name)
+	{
+		UINT64 h = 0;
+		for (LPCSTR c = Name; c && *c; c++)
+		{
+			h = (h ^ (UINT8)toupper((UINT8)*c)) * 0x100000001b3ull;
+		}
+		Add(h);
+	}
+};
+
+static const D3D12_RENDER_TARGET_BLEND_DESC DefaultRenderTargetBlend =
+{
+	FALSE, FALSE,
+	D3D12_BLEND_ONE, D3D12_BLEND_ZERO, D3D12_BLEND_OP_ADD,
+	D3D12_BLEND_ONE, D3D12_BLEND_ZERO, D3D12_BLEND_OP_ADD,
+	D3D12_LOGIC_OP_NOOP,
+	D3D12_COLOR_WRITE_ENABLE_ALL,
+};
+
+// Collects a stream into one value per subobject, starting from the CD3DX12 defaults.
+class CanonicalPipelineStream : public ID3DX12PipelineParserCallbacks
+{
+public:
+	enum ShaderStage { VS, GS, HS, DS, PS, CS, AS, MS, StageCount };
+
+	D3D12_PIPELINE_STATE_FLAGS Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
+	UINT NodeMask = 0;
+	ID3D12RootSignature* RootSignature = nullptr;
+	UINT64 InputLayout = 0;
+	D3D12_INDEX_BUFFER_STRIP_CUT_VALUE StripCutValue = D3D12_INDEX_BUFFER_STRIP_CUT_VALUE_DISABLED;
+	D3D12_PRIMITIVE_TOPOLOGY_TYPE Topology = D3D12_PRIMITIVE_TOPOLOGY_TYPE_UNDEFINED;
+	UINT64 Shaders[StageCount] = {};
+	UINT64 StreamOutput = 0;
+	D3D12_BLEND_DESC Blend = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+	D3D12_DEPTH_STENCIL_DESC1 DepthStencil = CD3DX12_DEPTH_STENCIL_DESC1(D3D12_DEFAULT);
+	DXGI_FORMAT DSVFormat = DXGI_FORMAT_UNKNOWN;
+	D3D12_RASTERIZER_DESC Rasterizer = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+	D3D12_RT_FORMAT_ARRAY RTVFormats = {};
+	DXGI_SAMPLE_DESC SampleDesc = { 1, 0 };
+	UINT SampleMask = UINT_MAX;
+	UINT64 ViewInstancing = 0;
+	bool HasCachedPSO = false;
+
+	void FlagsCb(D3D12_PIPELINE_STATE_FLAGS v) override { Flags = v; }
+	void NodeMaskCb(UINT v) override { NodeMask = v; }
+	void RootSignatureCb(ID3D12RootSignature* v) override { RootSignature = v; }
+	void IBStripCutValueCb(D3D12_INDEX_BUFFER_STRIP_CUT_VALUE v) override { StripCutValue = v; }
+	void PrimitiveTopologyTypeCb(D3D12_PRIMITIVE_TOPOLOGY_TYPE v) override { Topology = v; }
+	void VSCb(const D3D12_SHADER_BYTECODE& v) override { Shaders[VS] = PipelineStreamHasher::HashBytecode(v); }
+	void GSCb(const D3D12_SHADER_BYTECODE& v) override { Shaders[GS] = PipelineStreamHasher::HashBytecode(v); }
+	void HSCb(const D3D12_SHADER_BYTECODE& v) override { Shaders[HS] = PipelineStreamHasher::HashBytecode(v); }
+	void DSCb(const D3D12_SHADER_BYTECODE& v) override { Shaders[DS] = PipelineStreamHasher::HashBytecode(v); }
+	void PSCb(const D3D12_SHADER_BYTECODE& v) override { Shaders[PS] = PipelineStreamHasher::HashBytecode(v); }
+	void CSCb(const D3D12_SHADER_BYTECODE& v) override { Shaders[CS] = PipelineStreamHasher::HashBytecode(v); }
+	void ASCb(const D3D12_SHADER_BYTECODE& v) override { Shaders[AS] = PipelineStreamHasher::HashBytecode(v); }
+	void MSCb(const D3D12_SHADER_BYTECODE& v) override { Shaders[MS] = PipelineStreamHasher::HashBytecode(v); }
+	void BlendStateCb(const D3D12_BLEND_DESC& v) override { Blend = v; }
+	void DepthStencilStateCb(const D3D12_DEPTH_STENCIL_DESC& v) override { DepthStencil = CD3DX12_DEPTH_STENCIL_DESC1(v); }
+	void DepthStencilState1Cb(const D3D12_DEPTH_STENCIL_DESC1& v) override { DepthStencil = v; }
+	void DSVFormatCb(DXGI_FORMAT v) override { DSVFormat = v; }
+	void RasterizerStateCb(const D3D12_RASTERIZER_DESC& v) override { Rasterizer = v; }
+	void RTVFormatsCb(const D3D12_RT_FORMAT_ARRAY& v) override { RTVFormats = v; }
+	void SampleDescCb(const DXGI_SAMPLE_DESC& v) override { SampleDesc = v; }
+	void SampleMaskCb(UINT v) override { SampleMask = v; }
+	void CachedPSOCb(const D3D12_CACHED_PIPELINE_STATE&) override { HasCachedPSO = true; }
+
+	void InputLayoutCb(const D3D12_INPUT_LAYOUT_DESC& v) override
+	{
+		PipelineHashMixer m;
+		m.Add(v.NumElements);
+		for (UINT i = 0; i < v.NumElements; i++)
+		{
+			const D3D12_INPUT_ELEMENT_DESC& e = v.pInputElementDescs[i];
+			m.AddSemantic(e.SemanticName);
+			m.Add(e.SemanticIndex);
+			m.Add(e.Format);
+			m.Add(e.InputSlot);
+			m.Add(e.AlignedByteOffset);
+			m.Add(e.InputSlotClass);
+			m.Add(e.InputSlotClass == D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA ? e.InstanceDataStepRate : 0);
+		}
+		InputLayout = v.NumElements ? m.H : 0;
+	}
+
+	void StreamOutputCb(const D3D12_STREAM_OUTPUT_DESC& v) override
+	{
+		if (v.NumEntries == 0)
+		{
+			StreamOutput = 0;
+			return;
+		}
+		PipelineHashMixer m;
+		m.Add(v.NumEntries);
+		for (UINT i = 0; i < v.NumEntries; i++)
+		{
+			const D3D12_SO_DECLARATION_ENTRY& e = v.pSODeclaration[i];
+			m.Add(e.Stream);
+			m.AddSemantic(e.SemanticName);
+			m.Add(e.SemanticIndex);
+			m.Add(e.StartComponent);
+			m.Add(e.ComponentCount);
+			m.Add(e.OutputSlot);
+		}
+		m.Add(v.NumStrides);
+		for (UINT i = 0; i < v.NumStrides; i++)
+		{
+			m.Add(v.pBufferStrides[i]);
+		}
+		m.Add(v.RasterizedStream);
+		StreamOutput = m.H;
+	}
+
+	void ViewInstancingCb(const D3D12_VIEW_INSTANCING_DESC& v) override
+	{
+		if (v.ViewInstanceCount == 0)
+		{
+			ViewInstancing = 0;
+			return;
+		}
+		PipelineHashMixer m;
+		m.Add(v.ViewInstanceCount);
+		for (UINT i = 0; i < v.ViewInstanceCount; i++)
+		{
+			m.Add(v.pViewInstanceLocations[i].ViewportArrayIndex);
+			m.Add(v.pViewInstanceLocations[i].RenderTargetArrayIndex);
+		}
+		m.Add(v.Flags);
+		ViewInstancing = m.H;
+	}
+
+	// Resets whatever the runtime ignores given the rest of the state.
+	void Canonicalize()
+	{
+		const UINT render_targets = (std::min)(RTVFormats.NumRenderTargets, (UINT)D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT);
+		RTVFormats.NumRenderTargets = render_targets;
+		for (UINT i = render_targets; i < D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT; i++)
+		{
+			RTVFormats.RTFormats[i] = DXGI_FORMAT_UNKNOWN;
+		}
+
+		Blend.IndependentBlendEnable = Blend.IndependentBlendEnable && render_targets > 1;
+		const UINT blend_targets = Blend.IndependentBlendEnable ? render_targets : (std::min)(render_targets, 1u);
+		for (UINT i = 0; i < D3D12_SIMULTANEOUS_RENDER_TARGET_COUNT; i++)
+		{
+			D3D12_RENDER_TARGET_BLEND_DESC& rt = Blend.RenderTarget[i];
+			if (i >= blend_targets)
+			{
+				rt = DefaultRenderTargetBlend;
+				continue;
+			}
+			if (!rt.BlendEnable)
+			{
+				rt.SrcBlend = DefaultRenderTargetBlend.SrcBlend;
+				rt.DestBlend = DefaultRenderTargetBlend.DestBlend;
+				rt.BlendOp = DefaultRenderTargetBlend.BlendOp;
+				rt.SrcBlendAlpha = DefaultRenderTargetBlend.SrcBlendAlpha;
+				rt.DestBlendAlpha = DefaultRenderTargetBlend.DestBlendAlpha;
+				rt.BlendOpAlpha = DefaultRenderTargetBlend.BlendOpAlpha;
+			}
+			if (!rt.LogicOpEnable)
+				rt.LogicOp = DefaultRenderTargetBlend.LogicOp;
+		}
+
+		// Without a depth format nothing can be bound to test against.
+		const D3D12_DEPTH_STENCIL_DESC1 ds_default = CD3DX12_DEPTH_STENCIL_DESC1(D3D12_DEFAULT);
+		if (DSVFormat == DXGI_FORMAT_UNKNOWN)
+		{
+			DepthStencil.DepthEnable = FALSE;
+			DepthStencil.StencilEnable = FALSE;
+			DepthStencil.DepthBoundsTestEnable = FALSE;
+		}
+		if (!DepthStencil.DepthEnable)
+		{
+			DepthStencil.DepthWriteMask = ds_default.DepthWriteMask;
+			DepthStencil.DepthFunc = ds_default.DepthFunc;
+		}
+		if (!DepthStencil.StencilEnable)
+		{
+			DepthStencil.StencilReadMask = ds_default.StencilReadMask;
+			DepthStencil.StencilWriteMask = ds_default.StencilWriteMask;
+			DepthStencil.FrontFace = ds_default.FrontFace;
+			DepthStencil.BackFace = ds_default.BackFace;
+		}
+
+		if (Rasterizer.DepthBias == 0 && Rasterizer.SlopeScaledDepthBias == 0.0f)
+			Rasterizer.DepthBiasClamp = 0.0f;
+	}
+
+	UINT64 Hash(UINT64 RootSignatureKey)
+	{
+		Canonicalize();
+		PipelineHashMixer m;
+		m.Add(Flags);
+		m.Add(NodeMask);
+		m.Add(RootSignatureKey);
+		// A compute pipeline ignores every graphics subobject.
+		if (Shaders[CS])
+		{
+			m.Add(Shaders[CS]);
+			return m.H;
+		}
+		for (UINT s = 0; s < StageCount; s++)
+		{
+			m.Add(Shaders[s]);
+		}
+		m.Add(InputLayout);
+		m.Add(StripCutValue);
+		m.Add(Topology);
+		m.Add(StreamOutput);
+
+		m.Add(Blend.AlphaToCoverageEnable);
+		m.Add(Blend.IndependentBlendEnable);
+		for (const auto& rt : Blend.RenderTarget)
+		{
+			m.Add(rt.BlendEnable);
+			m.Add(rt.LogicOpEnable);
+			m.Add(rt.SrcBlend);
+			m.Add(rt.DestBlend);
+			m.Add(rt.BlendOp);
+			m.Add(rt.SrcBlendAlpha);
+			m.Add(rt.DestBlendAlpha);
+			m.Add(rt.BlendOpAlpha);
+			m.Add(rt.LogicOp);
+			m.Add(rt.RenderTargetWriteMask);
+		}
+
+		m.Add(DepthStencil.DepthEnable);
+		m.Add(DepthStencil.DepthWriteMask);
+		m.Add(DepthStencil.DepthFunc);
+		m.Add(DepthStencil.StencilEnable);
+		m.Add(DepthStencil.StencilReadMask);
+		m.Add(DepthStencil.StencilWriteMask);
+		for (const D3D12_DEPTH_STENCILOP_DESC* face : { &DepthStencil.FrontFace, &DepthStencil.BackFace })
+		{
+			m.Add(face->StencilFailOp);
+			m.Add(face->StencilDepthFailOp);
+			m.Add(face->StencilPassOp);
+			m.Add(face->StencilFunc);
+		}
+		m.Add(DepthStencil.DepthBoundsTestEnable);
+		m.Add(DSVFormat);
+
+		m.Add(Rasterizer.FillMode);
+		m.Add(Rasterizer.CullMode);
+		m.Add(Rasterizer.FrontCounterClockwise);
+		m.Add((UINT32)Rasterizer.DepthBias);
+		m.AddFloat(Rasterizer.DepthBiasClamp);
+		m.AddFloat(Rasterizer.SlopeScaledDepthBias);
+		m.Add(Rasterizer.DepthClipEnable);
+		m.Add(Rasterizer.MultisampleEnable);
+		m.Add(Rasterizer.AntialiasedLineEnable);
+		m.Add(Rasterizer.ForcedSampleCount);
+		m.Add(Rasterizer.ConservativeRaster);
+
+		m.Add(RTVFormats.NumRenderTargets);
+		for (DXGI_FORMAT f : RTVFormats.RTFormats)
+		{
+			m.Add(f);
+		}
+		m.Add(SampleDesc.Count);
+		m.Add(SampleDesc.Quality);
+		m.Add(SampleMask);
+		m.Add(ViewInstancing);
+		return m.H;
+	}
+};
+
+UINT64 PipelineStreamHasher::HashBytecode(const D3D12_SHADER_BYTECODE& Bytecode)
+{
+	if (Bytecode.pShaderBytecode == nullptr || Bytecode.BytecodeLength == 0)
+		return 0;
+	// DXBC and DXIL containers: 'DXBC' followed by a 16 byte digest of the rest.
+	const UINT8* p = static_cast<const UINT8*>(Bytecode.pShaderBytecode);
+	static const UINT8 zero[16] = {};
+	if (Bytecode.BytecodeLength >= 20 && memcmp(p, "DXBC", 4) == 0 && memcmp(p + 4, zero, 16) != 0)
+	{
+		const UINT64 length = Bytecode.BytecodeLength;
+		return ShaderCache::HashBytes(p + 4, 16, ShaderCache::HashBytes(&length, sizeof(length), 0xcbf29ce484222325ull));
+	}
+	return ShaderCache::HashBytes(p, Bytecode.BytecodeLength, 0xcbf29ce484222325ull);
+}
+
+void PipelineStreamHasher::RegisterRootSignature(ID3D12RootSignature* RootSignature, const void* Blob, SIZE_T Size)
+{
+	const UINT64 h = ShaderCache::HashBytes(Blob, Size, 0xcbf29ce484222325ull);
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_RootSignatures[RootSignature] = h;
+}
+
+void PipelineStreamHasher::UnregisterRootSignature(ID3D12RootSignature* RootSignature)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_RootSignatures.erase(RootSignature);
+}
+
+HRESULT PipelineStreamHasher::Hash(const D3D12_PIPELINE_STATE_STREAM_DESC& Desc, PipelineKey& Key) const
+{
+	CanonicalPipelineStream stream;
+	HRESULT hr = D3DX12ParsePipelineStream(Desc, &stream);
+	if (FAILED(hr))
+		return hr;
+
+	UINT64 root_signature = 0;
+	Key.Persistent = true;
+	Key.HasCachedPSO = stream.HasCachedPSO;
+	if (stream.RootSignature)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = m_RootSignatures.find(stream.RootSignature);
+		if (it != m_RootSignatures.end())
+		{
+			root_signature = it->second;
+		}
+		else
+		{
+			root_signature = (UINT64)(uintptr_t)stream.RootSignature;
+			Key.Persistent = false;
+		}
+	}
+	Key.Hash = stream.Hash(root_signature);
+	return S_OK;
+}
+
+static UINT64 ComputeDeviceKey(IDXGIAdapter1* Adapter)
+{
+	PipelineHashMixer m;
+	m.Add(PipelineCache::FormatVersion);
+	if (!Adapter)
+		return m.H;
+	DXGI_ADAPTER_DESC1 desc = {};
+	if (SUCCEEDED(Adapter->GetDesc1(&desc)))
+	{
+		m.Add(desc.VendorId);
+		m.Add(desc.DeviceId);
+		m.Add(desc.SubSysId);
+		m.Add(desc.Revision);
+	}
+	// Blobs are only valid for the driver that produced them.
+	LARGE_INTEGER umd = {};
+	if (SUCCEEDED(Adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &umd)))
+		m.Add((UINT64)umd.QuadPart);
+	return m.H;
+}
+
+void PipelineCache::Initialize(ID3D12Device2* Device, IDXGIAdapter1* Adapter, const std::wstring& Path)
+{
+	m_Device = Device;
+	m_Path = Path;
+	m_DeviceKey = ComputeDeviceKey(Adapter);
+	m_Dirty = false;
+	Load();
+}
+
+void PipelineCache::Destroy()
+{
+	m_CancelWarmUp.store(true, std::memory_order_relaxed);
+	WaitForWarmUp();
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Entries.clear();
+	m_Blobs.clear();
+	m_Dirty = false;
+	m_Device = nullptr;
+}
+
+template<typename T>
+static inline bool ReadPod(std::istream& s, T& v)
+{
+	return (bool)s.read(reinterpret_cast<char*>(&v), sizeof(T));
+}
+
+template<typename T>
+static inline void WritePod(std::ostream& s, const T& v)
+{
+	s.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+void PipelineCache::Load()
+{
+	std::ifstream f(fs::path(m_Path), std::ios::binary);
+	UINT32 magic = 0, version = 0, count = 0;
+	UINT64 device_key = 0;
+	if (!ReadPod(f, magic) || !ReadPod(f, version) || !ReadPod(f, device_key) || !ReadPod(f, count))
+		return;
+	// Another adapter, driver or format: start over, Save() replaces the file.
+	if (magic != PipelineCacheMagic || version != FormatVersion || device_key != m_DeviceKey)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (UINT32 i = 0; i < count; i++)
+	{
+		UINT64 key = 0, size = 0;
+		if (!ReadPod(f, key) || !ReadPod(f, size))
+			break;
+		std::vector<UINT8> blob((size_t)size);
+		if (size && !f.read(reinterpret_cast<char*>(blob.data()), (std::streamsize)size))
+			break;
+		m_Blobs[key] = std::move(blob);
+	}
+}
+
+void PipelineCache::Save()
+{
+	std::ostringstream s;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Dirty)
+			return;
+		WritePod(s, PipelineCacheMagic);
+		WritePod(s, (UINT32)FormatVersion);
+		WritePod(s, m_DeviceKey);
+		WritePod(s, (UINT32)m_Blobs.size());
+		for (const auto& b : m_Blobs)
+		{
+			WritePod(s, b.first);
+			WritePod(s, (UINT64)b.second.size());
+			s.write(reinterpret_cast<const char*>(b.second.data()), b.second.size());
+		}
+		m_Dirty = false;
+	}
+
+	const std::string data = s.str();
+	fs::path tmp = fs::path(m_Path);
+	tmp += L".tmp";
+	{
+		std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+		if (!f)
+			return;
+		f.write(data.data(), data.size());
+		if (!f)
+			return;
+	}
+	std::error_code ec;
+	fs::rename(tmp, fs::path(m_Path), ec);
+	if (ec)
+		fs::remove(tmp, ec);
+}
+
+HRESULT PipelineCache::GetOrCreate(const D3D12_PIPELINE_STATE_STREAM_DESC& Desc, ID3D12PipelineState** Out)
+{
+	RAID_ASSERT(m_Device != nullptr && Out != nullptr);
+	*Out = nullptr;
+	PipelineKey key;
+	HRESULT hr = m_Hasher.Hash(Desc, key);
+	if (FAILED(hr))
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.Requests++;
+		m_Stats.Failed++;
+		return hr;
+	}
+
+	Entry* entry;
+	bool create = false;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.Requests++;
+		auto& slot = m_Entries[key.Hash];
+		if (!slot)
+		{
+			slot = std::make_unique<Entry>();
+			create = true;
+		}
+		entry = slot.get();
+	}
+
+	if (!create)
+	{
+		// Requests for the same key made while it is being created wait here instead of creating it again.
+		std::unique_lock<std::mutex> lock(entry->Mutex);
+		entry->Done.wait(lock, [entry]() { return entry->State != EntryState::Pending; });
+		if (entry->State == EntryState::Ready)
+		{
+			lock.unlock();
+			std::lock_guard<std::mutex> stats_lock(m_Mutex);
+			m_Stats.MemoryHits++;
+			return entry->Pipeline.CopyTo(Out);
+		}
+		// The last attempt failed, this request makes the next one.
+		entry->State = EntryState::Pending;
+	}
+
+	hr = Create(Desc, key, *entry);
+	{
+		std::lock_guard<std::mutex> lock(entry->Mutex);
+		entry->State = SUCCEEDED(hr) ? EntryState::Ready : EntryState::Failed;
+	}
+	entry->Done.notify_all();
+	if (FAILED(hr))
+		return hr;
+	return entry->Pipeline.CopyTo(Out);
+}
+
+HRESULT PipelineCache::Create(const D3D12_PIPELINE_STATE_STREAM_DESC& Desc, const PipelineKey& Key, Entry& E)
+{
+	std::vector<UINT8> blob;
+	if (Key.Persistent && !Key.HasCachedPSO)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = m_Blobs.find(Key.Hash);
+		if (it != m_Blobs.end())
+			blob = it->second;
+	}
+
+	HRESULT hr = E_FAIL;
+	if (!blob.empty())
+	{
+		// Caller's stream followed by a CACHED_PSO subobject.
+		typedef CD3DX12_PIPELINE_STATE_STREAM_CACHED_PSO CachedPSOSubobject;
+		const SIZE_T stream_size = (Desc.SizeInBytes + alignof(void*) - 1) & ~(SIZE_T)(alignof(void*) - 1);
+		std::vector<void*> stream((stream_size + sizeof(CachedPSOSubobject)) / sizeof(void*));
+		memcpy(stream.data(), Desc.pPipelineStateSubobjectStream, Desc.SizeInBytes);
+		D3D12_CACHED_PIPELINE_STATE cached = { blob.data(), blob.size() };
+		new (reinterpret_cast<UINT8*>(stream.data()) + stream_size) CachedPSOSubobject(cached);
+
+		D3D12_PIPELINE_STATE_STREAM_DESC desc = { stream_size + sizeof(CachedPSOSubobject), stream.data() };
+		hr = m_Device->CreatePipelineState(&desc, IID_PPV_ARGS(&E.Pipeline));
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (SUCCEEDED(hr))
+		{
+			m_Stats.BlobHits++;
+			return S_OK;
+		}
+		// D3D12_ERROR_DRIVER_VERSION_MISMATCH, D3D12_ERROR_ADAPTER_NOT_FOUND or a stale blob.
+		m_Stats.BlobMisses++;
+		m_Blobs.erase(Key.Hash);
+		m_Dirty = true;
+	}
+
+	hr = m_Device->CreatePipelineState(&Desc, IID_PPV_ARGS(&E.Pipeline));
+	if (FAILED(hr))
+	{
+		E.Pipeline.Reset();
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.Failed++;
+		return hr;
+	}
+
+	COM<ID3DBlob> created_blob;
+	if (Key.Persistent && !Key.HasCachedPSO)
+		E.Pipeline->GetCachedBlob(&created_blob);
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Stats.Created++;
+	if (created_blob && created_blob->GetBufferSize() > 0)
+	{
+		const UINT8* p = static_cast<const UINT8*>(created_blob->GetBufferPointer());
+		m_Blobs[Key.Hash].assign(p, p + created_blob->GetBufferSize());
+		m_Dirty = true;
+	}
+	return S_OK;
+}
+
+void PipelineCache::BeginWarmUp(std::vector<D3D12_PIPELINE_STATE_STREAM_DESC> Streams)
+{
+	WaitForWarmUp();
+	m_CancelWarmUp.store(false, std::memory_order_relaxed);
+	m_WarmingUp.store(true, std::memory_order_release);
+	m_WarmUpThread = std::thread([this, streams = std::move(Streams)]()
+	{
+		for (const auto& s : streams)
+		{
+			if (m_CancelWarmUp.load(std::memory_order_relaxed))
+				break;
+			COM<ID3D12PipelineState> pipeline;
+			GetOrCreate(s, &pipeline);
+		}
+		m_WarmingUp.store(false, std::memory_order_release);
+	});
+}
+
+void PipelineCache::WaitForWarmUp()
+{
+	if (m_WarmUpThread.joinable())
+		m_WarmUpThread.join();
+}
+
+PipelineCacheStats PipelineCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+// Stream of a typical opaque pass, the reference the variants below are compared against.
+struct BenchmarkPipelineStream
+{
+	CD3DX12_PIPELINE_STATE_STREAM_ROOT_SIGNATURE RootSignature;
+	CD3DX12_PIPELINE_STATE_STREAM_VS VS;
+	CD3DX12_PIPELINE_STATE_STREAM_PS PS;
+	CD3DX12_PIPELINE_STATE_STREAM_PRIMITIVE_TOPOLOGY Topology;
+	CD3DX12_PIPELINE_STATE_STREAM_RENDER_TARGET_FORMATS RTVFormats;
+	CD3DX12_PIPELINE_STATE_STREAM_DEPTH_STENCIL_FORMAT DSVFormat;
+};
+
+struct BenchmarkPipelineStreamReordered
+{
+	CD3DX12_PIPELINE_STATE_STREAM_DEPTH_STENCIL_FORMAT DSVFormat;
+	CD3DX12_PIPELINE_STATE_STREAM_PS PS;
+	CD3DX12_PIPELINE_STATE_STREAM_RENDER_TARGET_FORMATS RTVFormats;
+	CD3DX12_PIPELINE_STATE_STREAM_PRIMITIVE_TOPOLOGY Topology;
+	CD3DX12_PIPELINE_STATE_STREAM_VS VS;
+	CD3DX12_PIPELINE_STATE_STREAM_ROOT_SIGNATURE RootSignature;
+};
+
+// The reference plus the subobjects it leaves at their defaults.
+struct BenchmarkPipelineStreamFull
+{
+	CD3DX12_PIPELINE_STATE_STREAM_FLAGS Flags;
+	CD3DX12_PIPELINE_STATE_STREAM_NODE_MASK NodeMask;
+	CD3DX12_PIPELINE_STATE_STREAM_ROOT_SIGNATURE RootSignature;
+	CD3DX12_PIPELINE_STATE_STREAM_IB_STRIP_CUT_VALUE StripCutValue;
+	CD3DX12_PIPELINE_STATE_STREAM_VS VS;
+	CD3DX12_PIPELINE_STATE_STREAM_PS PS;
+	CD3DX12_PIPELINE_STATE_STREAM_PRIMITIVE_TOPOLOGY Topology;
+	CD3DX12_PIPELINE_STATE_STREAM_BLEND_DESC Blend;
+	CD3DX12_PIPELINE_STATE_STREAM_DEPTH_STENCIL1 DepthStencil;
+	CD3DX12_PIPELINE_STATE_STREAM_RASTERIZER Rasterizer;
+	CD3DX12_PIPELINE_STATE_STREAM_RENDER_TARGET_FORMATS RTVFormats;
+	CD3DX12_PIPELINE_STATE_STREAM_DEPTH_STENCIL_FORMAT DSVFormat;
+	CD3DX12_PIPELINE_STATE_STREAM_SAMPLE_DESC SampleDesc;
+	CD3DX12_PIPELINE_STATE_STREAM_SAMPLE_MASK SampleMask;
+};
+
+template<typename T>
+static UINT64 HashBenchmarkStream(const PipelineStreamHasher& Hasher, T& Stream)
+{
+	D3D12_PIPELINE_STATE_STREAM_DESC desc = { sizeof(Stream), &Stream };
+	PipelineKey key;
+	if (FAILED(Hasher.Hash(desc, key)))
+		return 0;
+	return key.Hash;
+}
+
+template<typename T>
+static void InitBenchmarkStream(T& Stream, const D3D12_SHADER_BYTECODE& VS, const D3D12_SHADER_BYTECODE& PS)
+{
+	Stream.RootSignature = nullptr;
+	Stream.VS = VS;
+	Stream.PS = PS;
+	Stream.Topology = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+	D3D12_RT_FORMAT_ARRAY formats = {};
+	formats.NumRenderTargets = 1;
+	formats.RTFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+	Stream.RTVFormats = formats;
+	Stream.DSVFormat = DXGI_FORMAT_D32_FLOAT;
+}
+
+PipelineHashBenchmarkResult BenchmarkPipelineHashing(UINT Iterations)
+{
+	PipelineHashBenchmarkResult r;
+	PipelineStreamHasher hasher;
+
+	// Shader sized containers, only their digest is read.
+	std::vector<UINT8> vs_code(4096, 0x11), ps_code(8192, 0x22);
+	memcpy(vs_code.data(), "DXBC", 4);
+	memcpy(ps_code.data(), "DXBC", 4);
+	const D3D12_SHADER_BYTECODE vs = { vs_code.data(), vs_code.size() };
+	const D3D12_SHADER_BYTECODE ps = { ps_code.data(), ps_code.size() };
+
+	BenchmarkPipelineStream reference;
+	InitBenchmarkStream(reference, vs, ps);
+	const UINT64 reference_hash = HashBenchmarkStream(hasher, reference);
+
+	BenchmarkPipelineStreamReordered reordered;
+	InitBenchmarkStream(reordered, vs, ps);
+	if (HashBenchmarkStream(hasher, reordered) != reference_hash)
+		r.CanonicalizationMismatches++;
+
+	BenchmarkPipelineStreamFull defaults;
+	InitBenchmarkStream(defaults, vs, ps);
+	if (HashBenchmarkStream(hasher, defaults) != reference_hash)
+		r.CanonicalizationMismatches++;
+
+	BenchmarkPipelineStreamFull ignored;
+	InitBenchmarkStream(ignored, vs, ps);
+	{
+		// Stencil state with stencil off.
+		CD3DX12_DEPTH_STENCIL_DESC1& ds = ignored.DepthStencil;
+		ds.StencilEnable = FALSE;
+		ds.StencilReadMask = 0x0F;
+		ds.StencilWriteMask = 0xF0;
+		ds.FrontFace.StencilFunc = D3D12_COMPARISON_FUNC_EQUAL;
+		ds.BackFace.StencilPassOp = D3D12_STENCIL_OP_REPLACE;
+		// Blend factors with blending off, targets past the first without independent blend.
+		CD3DX12_BLEND_DESC& blend = ignored.Blend;
+		blend.IndependentBlendEnable = TRUE;
+		blend.RenderTarget[0].SrcBlend = D3D12_BLEND_SRC_ALPHA;
+		blend.RenderTarget[0].DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
+		blend.RenderTarget[0].LogicOp = D3D12_LOGIC_OP_XOR;
+		blend.RenderTarget[3].BlendEnable = TRUE;
+		blend.RenderTarget[3].RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_RED;
+		// Formats past NumRenderTargets.
+		D3D12_RT_FORMAT_ARRAY& formats = ignored.RTVFormats;
+		formats.RTFormats[1] = DXGI_FORMAT_R16G16B16A16_FLOAT;
+		formats.RTFormats[5] = DXGI_FORMAT_R32_FLOAT;
+		// Clamp without any bias.
+		CD3DX12_RASTERIZER_DESC& rasterizer = ignored.Rasterizer;
+		rasterizer.DepthBiasClamp = 1.0f;
+	}
+	if (HashBenchmarkStream(hasher, ignored) != reference_hash)
+		r.CanonicalizationMismatches++;
+
+	BenchmarkPipelineStreamFull culled;
+	InitBenchmarkStream(culled, vs, ps);
+	CD3DX12_RASTERIZER_DESC& rasterizer = culled.Rasterizer;
+	rasterizer.CullMode = D3D12_CULL_MODE_FRONT;
+	BenchmarkPipelineStream other_ps;
+	InitBenchmarkStream(other_ps, vs, vs);
+	const UINT64 culled_hash = HashBenchmarkStream(hasher, culled);
+	const UINT64 other_ps_hash = HashBenchmarkStream(hasher, other_ps);
+	if (culled_hash == reference_hash)
+		r.CanonicalizationMismatches++;
+	if (other_ps_hash == reference_hash)
+		r.CanonicalizationMismatches++;
+	if (culled_hash == other_ps_hash)
+		r.CanonicalizationMismatches++;
+
+	// The full stream is what a renderer built on CD3DX12_PIPELINE_STATE_STREAM2 hands in.
+	Iterations = (std::max)(Iterations, 1u);
+	const int64_t start = SystemTime::GetCurrentTick();
+	for (UINT i = 0; i < Iterations; i++)
+	{
+		HashBenchmarkStream(hasher, defaults);
+	}
+	const double seconds = SystemTime::TicksToSeconds(SystemTime::GetCurrentTick() - start);
+	r.NanosecsPerHash = seconds / Iterations * 1e9;
+	r.HashesPerSecond = seconds > 0.0 ? Iterations / seconds : 0.0;
+	return r;
+}
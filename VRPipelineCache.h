@@ -0,0 +1,161 @@
+#pragma once
+#include "VRCore.h"
+#include <d3d12.h>
+#include <dxgi1_6.h>
+#include <wrl.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Cache of pipeline state objects keyed on their D3D12_PIPELINE_STATE_STREAM_DESC.
+*
+* PipelineStreamHasher walks a stream with D3DX12ParsePipelineStream and hashes a canonical form of it:
+*  - every subobject is hashed in a fixed order, missing ones as their CD3DX12 default, so the order of
+*    subobjects and spelling out a default make no difference.
+*  - fields D3D12 ignores are reset (stencil state with stencil off, blend factors with blending off,
+*    render targets past NumRenderTargets, RenderTarget[1..7] without independent blend, ...).
+*  - shaders hash by content. DXBC/DXIL containers carry their own digest, only that is read.
+*  - root signatures hash by their serialized blob, see RegisterRootSignature(). An unregistered one hashes
+*    by address, which still dedupes in memory but is never written to disk.
+*  - a CACHED_PSO subobject in the stream is ignored.
+* The hasher needs no device.
+*
+* PipelineCache creates each distinct stream once, concurrent requests for the same stream wait for the
+* first one. A failed creation marks the entry failed and returns its HRESULT, the next request for the
+* stream tries again. Blobs from ID3D12PipelineState::GetCachedBlob are stored per key in a single file, tagged with
+* FormatVersion and the adapter/driver, and passed back as CACHED_PSO on the next run. A blob the driver
+* rejects is dropped and the PSO is created from scratch.
+*
+* BeginWarmUp() creates a list of pipelines on a background thread at startup. The streams (and the shaders
+* and root signatures they point to) have to stay alive until WaitForWarmUp() returns.
+*
+* BenchmarkPipelineHashing() times the hasher on a typical graphics stream and checks the canonical form:
+*   PipelineHashBenchmarkResult r = BenchmarkPipelineHashing();
+*   RAID_ASSERT(r.CanonicalizationMismatches == 0);
+*/
+
+struct PipelineKey
+{
+    UINT64 Hash = 0;
+    // False if the key depends on a pointer (unregistered root signature), such keys stay in memory.
+    bool Persistent = true;
+    // The stream brings its own CACHED_PSO, the cache does not add or store one.
+    bool HasCachedPSO = false;
+};
+
+class PipelineStreamHasher
+{
+public:
+    // Blob as returned by D3D12SerializeVersionedRootSignature (or the one the root signature was created from).
+    void RegisterRootSignature(ID3D12RootSignature* RootSignature, const void* Blob, SIZE_T Size);
+    void UnregisterRootSignature(ID3D12RootSignature* RootSignature);
+
+    // Fails (E_INVALIDARG) on malformed streams, same rules as D3DX12ParsePipelineStream.
+    HRESULT Hash(const D3D12_PIPELINE_STATE_STREAM_DESC& Desc, PipelineKey& Key) const;
+
+    static UINT64 HashBytecode(const D3D12_SHADER_BYTECODE& Bytecode);
+
+private:
+    mutable std::mutex m_Mutex;
+    std::unordered_map<ID3D12RootSignature*, UINT64> m_RootSignatures;
+};
+
+struct PipelineCacheStats
+{
+    UINT64 Requests = 0;
+    // Already created this run.
+    UINT64 MemoryHits = 0;
+    // Created with a blob from disk.
+    UINT64 BlobHits = 0;
+    // Blob rejected by the driver, created from scratch.
+    UINT64 BlobMisses = 0;
+    // Created without any blob.
+    UINT64 Created = 0;
+    // Creation failed, counted per attempt.
+    UINT64 Failed = 0;
+};
+
+class PipelineCache
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    const static UINT32 FormatVersion = 1;
+
+    ~PipelineCache() { Destroy(); }
+
+    // Loads Path if it was written for the same adapter and driver. Adapter may be null.
+    void Initialize(ID3D12Device2* Device, IDXGIAdapter1* Adapter, const std::wstring& Path);
+    // Stops the warm-up and releases every pipeline. Does not save.
+    void Destroy();
+
+    // Out receives the pipeline for Desc (with a reference of its own), created on first use. On failure
+    // Out is null and the HRESULT of the creation is returned, the next request for the stream tries again.
+    HRESULT GetOrCreate(const D3D12_PIPELINE_STATE_STREAM_DESC& Desc, ID3D12PipelineState** Out);
+
+    // Writes blobs of every pipeline created since Initialize. No-op if nothing changed.
+    void Save();
+
+    void BeginWarmUp(std::vector<D3D12_PIPELINE_STATE_STREAM_DESC> Streams);
+    void WaitForWarmUp();
+    bool IsWarmingUp() const { return m_WarmingUp.load(std::memory_order_acquire); }
+
+    PipelineStreamHasher& GetHasher() { return m_Hasher; }
+    PipelineCacheStats GetStats();
+
+private:
+    enum class EntryState : UINT8
+    {
+        // Being created by one request, the others wait on Done.
+        Pending,
+        Ready,
+        // The last creation failed, the next request creates it again.
+        Failed
+    };
+
+    struct Entry
+    {
+        std::mutex Mutex;
+        std::condition_variable Done;
+        // Made Pending by the request that inserts it.
+        EntryState State = EntryState::Pending;
+        // Written only while Pending, by the request creating it.
+        COM<ID3D12PipelineState> Pipeline;
+    };
+
+    // Counts the outcome in m_Stats.
+    HRESULT Create(const D3D12_PIPELINE_STATE_STREAM_DESC& Desc, const PipelineKey& Key, Entry& E);
+    void Load();
+
+    ID3D12Device2* m_Device = nullptr;
+    std::wstring m_Path;
+    UINT64 m_DeviceKey = 0;
+    PipelineStreamHasher m_Hasher;
+
+    std::mutex m_Mutex;
+    std::unordered_map<UINT64, std::unique_ptr<Entry>> m_Entries;
+    std::unordered_map<UINT64, std::vector<UINT8>> m_Blobs;
+    bool m_Dirty = false;
+    PipelineCacheStats m_Stats;
+
+    std::thread m_WarmUpThread;
+    std::atomic<bool> m_WarmingUp{ false };
+    std::atomic<bool> m_CancelWarmUp{ false };
+};
+
+struct PipelineHashBenchmarkResult
+{
+    // D3DX12ParsePipelineStream and canonical hash of one graphics stream.
+    double NanosecsPerHash = 0.0;
+    double HashesPerSecond = 0.0;
+    // Variants hashing unlike the reference stream although they should not (the same subobjects in
+    // another order, every default subobject spelled out, the fields D3D12 ignores set to garbage), plus
+    // pairs of streams with different state D3D12 does use that hash alike. 0 when the canonical form holds.
+    UINT CanonicalizationMismatches = 0;
+};
+
+// Needs no device.
+PipelineHashBenchmarkResult BenchmarkPipelineHashing(UINT Iterations = 100000);
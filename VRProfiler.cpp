@@ -0,0 +1,212 @@
+#include "VRProfiler.h"
+
+thread_local ProfileRing* Profiler::t_Ring = nullptr;
+std::atomic<bool> Profiler::sm_Enabled{ true };
+UINT Profiler::sm_EventsPerThread = Profiler::DefaultEventsPerThread;
+std::mutex Profiler::sm_Mutex;
+std::vector<std::unique_ptr<Profiler::ThreadInfo>> Profiler::sm_Threads;
+std::atomic<int64_t> Profiler::sm_Frames[Profiler::MaxFrames];
+std::atomic<UINT64> Profiler::sm_FrameHead{ 0 };
+
+ProfileRing::ProfileRing(UINT Capacity)
+{
+	UINT size = 1;
+	while (size < Capacity)
+		size <<= 1;
+	m_Events = std::make_unique<Event[]>(size);
+	m_Mask = size - 1;
+}
+
+void ProfileRing::Read(std::vector<Snapshot>& Out) const
+{
+	const UINT64 capacity = (UINT64)m_Mask + 1;
+	const UINT64 end = m_Head.load(std::memory_order_acquire);
+	const UINT64 begin = end > capacity ? end - capacity : 0;
+	Out.resize((size_t)(end - begin));
+	for (UINT64 i = begin; i < end; i++)
+	{
+		const Event& e = m_Events[i & m_Mask];
+		Out[(size_t)(i - begin)] = { e.Tick.load(std::memory_order_relaxed), e.Name.load(std::memory_order_relaxed) };
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	// The writer may have lapped us meanwhile, including the slot it is filling right now.
+	const UINT64 now = m_Head.load(std::memory_order_relaxed);
+	const UINT64 valid = now + 1 > capacity ? now + 1 - capacity : 0;
+	if (valid > begin)
+		Out.erase(Out.begin(), Out.begin() + (size_t)(std::min)(valid - begin, (UINT64)Out.size()));
+}
+
+void Profiler::Initialize(UINT EventsPerThread)
+{
+	std::lock_guard<std::mutex> lock(sm_Mutex);
+	sm_EventsPerThread = EventsPerThread;
+}
+
+ProfileRing& Profiler::RegisterThread()
+{
+	std::lock_guard<std::mutex> lock(sm_Mutex);
+	auto info = std::make_unique<ThreadInfo>();
+	info->Ring = std::make_unique<ProfileRing>(sm_EventsPerThread);
+	info->Id = (UINT)sm_Threads.size() + 1;
+	info->Name = "Thread " + std::to_string(info->Id);
+	t_Ring = info->Ring.get();
+	// Rings outlive their threads, a trace still shows workers that already exited.
+	sm_Threads.push_back(std::move(info));
+	return *t_Ring;
+}
+
+void Profiler::SetThreadName(const char* Name)
+{
+	ProfileRing* ring = &GetThreadRing();
+	std::lock_guard<std::mutex> lock(sm_Mutex);
+	for (auto& t : sm_Threads)
+	{
+		if (t->Ring.get() == ring)
+			t->Name = Name;
+	}
+}
+
+void Profiler::MarkFrame()
+{
+	const UINT64 head = sm_FrameHead.load(std::memory_order_relaxed);
+	sm_Frames[head % MaxFrames].store(SystemTime::GetCurrentTick(), std::memory_order_relaxed);
+	sm_FrameHead.store(head + 1, std::memory_order_release);
+}
+
+static void AppendEscaped(std::string& Out, const char* Text)
+{
+	for (const char* c = Text; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			Out += '\\';
+		if ((unsigned char)*c >= 0x20)
+			Out += *c;
+	}
+}
+
+static void AppendEvent(std::string& Out, const char* Phase, const char* Name, double Micros, UINT ThreadId, bool& First)
+{
+	char buffer[96];
+	Out += First ? "\n" : ",\n";
+	First = false;
+	Out += "{\"name\":\"";
+	AppendEscaped(Out, Name);
+	snprintf(buffer, sizeof(buffer), "\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", Phase, Micros, ThreadId);
+	Out += buffer;
+	// Frame boundaries are global instant events, drawn across every thread.
+	Out += Phase[0] == 'i' ? ",\"s\":\"g\"}" : "}";
+}
+
+void Profiler::ExportChromeTrace(std::string& Out, UINT LastFrames)
+{
+	struct ThreadEvents
+	{
+		UINT Id;
+		std::string Name;
+		std::vector<ProfileRing::Snapshot> Events;
+	};
+	std::vector<ThreadEvents> threads;
+	{
+		std::lock_guard<std::mutex> lock(sm_Mutex);
+		threads.resize(sm_Threads.size());
+		for (size_t i = 0; i < sm_Threads.size(); i++)
+		{
+			threads[i].Id = sm_Threads[i]->Id;
+			threads[i].Name = sm_Threads[i]->Name;
+			sm_Threads[i]->Ring->Read(threads[i].Events);
+		}
+	}
+
+	const UINT64 frame_head = sm_FrameHead.load(std::memory_order_acquire);
+	const UINT64 frame_count = (std::min)(frame_head, (UINT64)MaxFrames);
+	int64_t cutoff = INT64_MIN;
+	if (LastFrames > 0 && LastFrames <= frame_count)
+		cutoff = sm_Frames[(frame_head - LastFrames) % MaxFrames].load(std::memory_order_relaxed);
+
+	int64_t base = INT64_MAX;
+	for (const ThreadEvents& t : threads)
+	{
+		for (const ProfileRing::Snapshot& e : t.Events)
+		{
+			if (e.Tick >= cutoff)
+			{
+				base = (std::min)(base, e.Tick);
+				break;
+			}
+		}
+	}
+	for (UINT64 f = frame_head - frame_count; f < frame_head; f++)
+	{
+		const int64_t tick = sm_Frames[f % MaxFrames].load(std::memory_order_relaxed);
+		if (tick >= cutoff)
+			base = (std::min)(base, tick);
+	}
+	if (base == INT64_MAX)
+		base = 0;
+	auto micros = [base](int64_t Tick) { return SystemTime::TicksToSeconds(Tick - base) * 1e6; };
+
+	bool first = true;
+	Out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (const ThreadEvents& t : threads)
+	{
+		Out += first ? "\n" : ",\n";
+		first = false;
+		Out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(t.Id) + ",\"args\":{\"name\":\"";
+		AppendEscaped(Out, t.Name.c_str());
+		Out += "\"}}";
+
+		// Ends whose begin was overwritten or cut off are dropped, so the nesting stays balanced.
+		UINT depth = 0;
+		for (const ProfileRing::Snapshot& e : t.Events)
+		{
+			if (e.Tick < cutoff)
+				continue;
+			if (e.Name)
+			{
+				AppendEvent(Out, "B", e.Name, micros(e.Tick), t.Id, first);
+				depth++;
+			}
+			else if (depth > 0)
+			{
+				AppendEvent(Out, "E", "", micros(e.Tick), t.Id, first);
+				depth--;
+			}
+		}
+	}
+	for (UINT64 f = frame_head - frame_count; f < frame_head; f++)
+	{
+		const int64_t tick = sm_Frames[f % MaxFrames].load(std::memory_order_relaxed);
+		if (tick < cutoff)
+			continue;
+		const std::string name = "Frame " + std::to_string(f);
+		AppendEvent(Out, "i", name.c_str(), micros(tick), 0, first);
+	}
+	Out += "\n]}\n";
+}
+
+bool Profiler::WriteChromeTrace(const char* Path, UINT LastFrames)
+{
+	std::string json;
+	ExportChromeTrace(json, LastFrames);
+	FILE* file = fopen(Path, "wb");
+	if (!file)
+		return false;
+	const bool ok = fwrite(json.data(), 1, json.size(), file) == json.size();
+	fclose(file);
+	return ok;
+}
+
+double Profiler::MeasureScopeCost(UINT Iterations)
+{
+	if (Iterations == 0)
+		return 0.0;
+	// Registers the thread outside the timed loop.
+	GetThreadRing();
+	const int64_t start = SystemTime::GetCurrentTick();
+	for (UINT i = 0; i < Iterations; i++)
+	{
+		ProfileScope scope("MeasureScopeCost");
+	}
+	const int64_t end = SystemTime::GetCurrentTick();
+	return SystemTime::TicksToSeconds(end - start) * 1e9 / Iterations;
+}
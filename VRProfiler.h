@@ -0,0 +1,159 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include <mutex>
+#include "BSTime.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Hierarchical CPU profiler.
+*   VR_PROFILE_SCOPE("Name")   RAII marker, begin/end of the enclosing scope. Name must be a literal.
+*   VR_PROFILE_FUNCTION()      Same with the function name.
+*   VR_PROFILE_FRAME()         Frame boundary, once per frame on the render thread.
+*   VR_PROFILE_THREAD("Name")  Names the calling thread in the trace.
+*
+* Every thread writes its events into its own ring (registered on first use), so a marker is a
+* thread_local load, SystemTime::GetCurrentTick() and two relaxed stores, no lock and no
+* allocation. The ring overwrites its oldest events, the profiler can stay on all the time.
+* ExportChromeTrace() snapshots the rings without stopping the writers and produces Chrome
+* trace / Perfetto JSON, nesting comes from the begin/end pairs.
+*
+* Build with VR_PROFILER=0 to compile every marker out. MeasureScopeCost() reports the cost of
+* one marker pair on the calling thread.
+*/
+
+#ifndef VR_PROFILER
+#define VR_PROFILER 1
+#endif
+
+// Single writer (the owning thread), any number of readers taking snapshots.
+class ProfileRing
+{
+public:
+    struct Event
+    {
+        std::atomic<int64_t> Tick{ 0 };
+        // nullptr marks the end of the innermost open scope.
+        std::atomic<const char*> Name{ nullptr };
+    };
+
+    struct Snapshot
+    {
+        int64_t Tick;
+        const char* Name;
+    };
+
+    // Capacity is rounded up to a power of two.
+    explicit ProfileRing(UINT Capacity);
+
+    void Push(int64_t Tick, const char* Name)
+    {
+        const UINT64 head = m_Head.load(std::memory_order_relaxed);
+        Event& e = m_Events[head & m_Mask];
+        e.Tick.store(Tick, std::memory_order_relaxed);
+        e.Name.store(Name, std::memory_order_relaxed);
+        m_Head.store(head + 1, std::memory_order_release);
+    }
+
+    // Copies the events still in the ring, oldest first. Events overwritten during the copy are dropped.
+    void Read(std::vector<Snapshot>& Out) const;
+
+    UINT64 GetWritten() const { return m_Head.load(std::memory_order_acquire); }
+    UINT GetCapacity() const { return m_Mask + 1; }
+
+private:
+    std::unique_ptr<Event[]> m_Events;
+    UINT m_Mask = 0;
+    std::atomic<UINT64> m_Head{ 0 };
+};
+
+class Profiler
+{
+public:
+    const static UINT DefaultEventsPerThread = 16384;
+    const static UINT MaxFrames = 1024;
+
+    // Ring size of threads registered from now on.
+    static void Initialize(UINT EventsPerThread = DefaultEventsPerThread);
+
+    static bool IsEnabled() { return sm_Enabled.load(std::memory_order_relaxed); }
+    static void SetEnabled(bool Enabled) { sm_Enabled.store(Enabled, std::memory_order_relaxed); }
+
+    // The calling thread's ring, registered on first use.
+    static ProfileRing& GetThreadRing()
+    {
+        ProfileRing* ring = t_Ring;
+        return ring ? *ring : RegisterThread();
+    }
+
+    static void SetThreadName(const char* Name);
+    static void MarkFrame();
+    static UINT64 GetFrameIndex() { return sm_FrameHead.load(std::memory_order_acquire); }
+
+    // Chrome trace JSON of everything still in the rings, or of the last LastFrames frames only.
+    static void ExportChromeTrace(std::string& Out, UINT LastFrames = 0);
+    static bool WriteChromeTrace(const char* Path, UINT LastFrames = 0);
+
+    // Nanoseconds per VR_PROFILE_SCOPE (begin + end) on the calling thread, Iterations scopes
+    // long. The events land in the calling thread's ring.
+    static double MeasureScopeCost(UINT Iterations = 1000000);
+
+private:
+    struct ThreadInfo
+    {
+        std::unique_ptr<ProfileRing> Ring;
+        std::string Name;
+        UINT Id;
+    };
+
+    static ProfileRing& RegisterThread();
+
+    static thread_local ProfileRing* t_Ring;
+    static std::atomic<bool> sm_Enabled;
+    static UINT sm_EventsPerThread;
+    static std::mutex sm_Mutex;
+    static std::vector<std::unique_ptr<ThreadInfo>> sm_Threads;
+    // Frame start ticks, written by the render thread only.
+    static std::atomic<int64_t> sm_Frames[MaxFrames];
+    static std::atomic<UINT64> sm_FrameHead;
+};
+
+class ProfileScope
+{
+public:
+    template<size_t N>
+    explicit ProfileScope(const char (&Name)[N])
+    {
+        if (Profiler::IsEnabled())
+        {
+            m_Ring = &Profiler::GetThreadRing();
+            m_Ring->Push(SystemTime::GetCurrentTick(), Name);
+        }
+    }
+
+    ~ProfileScope()
+    {
+        // Ends what was begun even if the profiler got disabled in between.
+        if (m_Ring)
+            m_Ring->Push(SystemTime::GetCurrentTick(), nullptr);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    ProfileRing* m_Ring = nullptr;
+};
+
+#if VR_PROFILER
+#define VR_PROFILE_CONCAT_IMPL(a, b) a##b
+#define VR_PROFILE_CONCAT(a, b) VR_PROFILE_CONCAT_IMPL(a, b)
+#define VR_PROFILE_SCOPE(Name) ProfileScope VR_PROFILE_CONCAT(profile_scope_, __LINE__)(Name)
+#define VR_PROFILE_FUNCTION() VR_PROFILE_SCOPE(__FUNCTION__)
+#define VR_PROFILE_FRAME() Profiler::MarkFrame()
+#define VR_PROFILE_THREAD(Name) Profiler::SetThreadName(Name)
+#else
+#define VR_PROFILE_SCOPE(Name) ((void)0)
+#define VR_PROFILE_FUNCTION() ((void)0)
+#define VR_PROFILE_FRAME() ((void)0)
+#define VR_PROFILE_THREAD(Name) ((void)0)
+#endif
@@ -0,0 +1,432 @@
+#include "VRRenderGraph.h"
+#include "VRFrameArena.h"
+#include "BSTime.h"
+
+static const UINT RG_NO_PASS = UINT_MAX;
+// Marks a resource as already handled for the pass being compiled.
+static const UINT RG_STAMP_DONE = 0x80000000u;
+
+static const D3D12_RESOURCE_STATES RG_WRITE_STATES = D3D12_RESOURCE_STATES(
+	D3D12_RESOURCE_STATE_RENDER_TARGET |
+	D3D12_RESOURCE_STATE_UNORDERED_ACCESS |
+	D3D12_RESOURCE_STATE_DEPTH_WRITE |
+	D3D12_RESOURCE_STATE_STREAM_OUT |
+	D3D12_RESOURCE_STATE_COPY_DEST |
+	D3D12_RESOURCE_STATE_RESOLVE_DEST);
+
+static inline bool IsReadOnlyState(D3D12_RESOURCE_STATES State)
+{
+	return State != D3D12_RESOURCE_STATE_COMMON && (State & RG_WRITE_STATES) == 0;
+}
+
+void RenderGraph::Reset()
+{
+	m_Resources.clear();
+	m_Passes.clear();
+	m_Accesses.clear();
+	m_Order.clear();
+	m_Barriers.clear();
+	m_BatchStart.clear();
+	m_Stats = RenderGraphStats();
+	m_Compiled = false;
+}
+
+RGResource RenderGraph::AddResource(const char* Name, ID3D12Resource* Native, D3D12_RESOURCE_STATES Initial, D3D12_RESOURCE_STATES Final, bool Imported)
+{
+	Resource r = {};
+	r.Name = Name;
+	r.Native = Native;
+	r.Initial = Initial;
+	r.Final = Final;
+	r.Imported = Imported;
+	m_Resources.push_back(r);
+	return (RGResource)m_Resources.size() - 1;
+}
+
+RGResource RenderGraph::ImportResource(const char* Name, ID3D12Resource* Resource, D3D12_RESOURCE_STATES InitialState, D3D12_RESOURCE_STATES FinalState)
+{
+	return AddResource(Name, Resource, InitialState, FinalState, true);
+}
+
+RGResource RenderGraph::CreateResource(const char* Name, ID3D12Resource* Resource, D3D12_RESOURCE_STATES InitialState)
+{
+	return AddResource(Name, Resource, InitialState, InitialState, false);
+}
+
+UINT RenderGraph::AddPass(const char* Name, PassExecute Execute)
+{
+	Pass p;
+	p.Name = Name;
+	p.Execute = std::move(Execute);
+	p.FirstAccess = (UINT)m_Accesses.size();
+	p.AccessCount = 0;
+	p.SideEffects = false;
+	p.Alive = true;
+	m_Passes.push_back(std::move(p));
+	m_Compiled = false;
+	return (UINT)m_Passes.size() - 1;
+}
+
+void RenderGraph::AddAccess(RGResource Resource, D3D12_RESOURCE_STATES State, bool Write)
+{
+	RAID_ASSERT(!m_Passes.empty());
+	RAID_ASSERT(Resource < m_Resources.size());
+	m_Accesses.push_back({ Resource, State, Write });
+	m_Passes.back().AccessCount++;
+}
+
+void RenderGraph::Read(RGResource Resource, D3D12_RESOURCE_STATES State)
+{
+	AddAccess(Resource, State, false);
+}
+
+void RenderGraph::Write(RGResource Resource, D3D12_RESOURCE_STATES State)
+{
+	AddAccess(Resource, State, true);
+}
+
+void RenderGraph::SetSideEffects()
+{
+	RAID_ASSERT(!m_Passes.empty());
+	m_Passes.back().SideEffects = true;
+}
+
+void RenderGraph::Cull()
+{
+	// Imported resources outlive the frame, everything else only matters if a live pass reads it.
+	for (auto& r : m_Resources)
+	{
+		r.Needed = r.Imported;
+	}
+	for (size_t p = m_Passes.size(); p-- > 0;)
+	{
+		Pass& pass = m_Passes[p];
+		const Access* a = m_Accesses.data() + pass.FirstAccess;
+		bool alive = pass.SideEffects;
+		for (UINT i = 0; i < pass.AccessCount && !alive; i++)
+		{
+			alive = a[i].Write && m_Resources[a[i].Resource].Needed;
+		}
+		pass.Alive = alive;
+		if (!alive)
+		{
+			m_Stats.CulledPasses++;
+			continue;
+		}
+		for (UINT i = 0; i < pass.AccessCount; i++)
+		{
+			if (!a[i].Write)
+				m_Resources[a[i].Resource].Needed = true;
+		}
+	}
+}
+
+void RenderGraph::Transition(RGResource Id, D3D12_RESOURCE_STATES After, UINT Batch, bool AllowSplit)
+{
+	Resource& r = m_Resources[Id];
+	PendingBarrier pb;
+	pb.B.Resource = Id;
+	pb.B.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+	pb.B.Before = r.State;
+	pb.B.After = After;
+
+	// Nothing touches the resource between its last use and this pass, so the GPU can start
+	// the transition as soon as the last user is done.
+	const UINT begin = r.LastUse == RG_NO_PASS ? 0 : r.LastUse + 1;
+	if (AllowSplit && begin < Batch)
+	{
+		pb.Batch = begin;
+		pb.B.Flags = D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY;
+		m_Pending.push_back(pb);
+		pb.Batch = Batch;
+		pb.B.Flags = D3D12_RESOURCE_BARRIER_FLAG_END_ONLY;
+		m_Pending.push_back(pb);
+		m_Stats.SplitBarriers++;
+	}
+	else
+	{
+		pb.Batch = Batch;
+		pb.B.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+		m_Pending.push_back(pb);
+	}
+	r.State = After;
+}
+
+void RenderGraph::Compile()
+{
+	m_Stats = RenderGraphStats();
+	m_Stats.Passes = (UINT)m_Passes.size();
+	Cull();
+
+	m_Order.clear();
+	for (UINT p = 0; p < m_Passes.size(); p++)
+	{
+		if (m_Passes[p].Alive)
+			m_Order.push_back(p);
+	}
+	const UINT pass_count = (UINT)m_Order.size();
+
+	for (auto& r : m_Resources)
+	{
+		r.State = r.Initial;
+		r.FirstUse = RG_NO_PASS;
+		r.LastUse = RG_NO_PASS;
+		r.Stamp = RG_NO_PASS;
+		r.LastWasWrite = false;
+	}
+
+	m_Pending.clear();
+	for (UINT i = 0; i < pass_count; i++)
+	{
+		const Pass& pass = m_Passes[m_Order[i]];
+		const Access* a = m_Accesses.data() + pass.FirstAccess;
+
+		// Merge every access of the pass into one required state per resource.
+		// Reads combine, a write wins over reads of the same resource.
+		for (UINT k = 0; k < pass.AccessCount; k++)
+		{
+			Resource& r = m_Resources[a[k].Resource];
+			if (r.Stamp != i)
+			{
+				r.Stamp = i;
+				r.Required = a[k].State;
+				r.RequiredWrite = a[k].Write;
+			}
+			else if (a[k].Write)
+			{
+				RAID_ASSERT(!r.RequiredWrite || r.Required == a[k].State);
+				r.Required = a[k].State;
+				r.RequiredWrite = true;
+			}
+			else if (!r.RequiredWrite)
+			{
+				r.Required = D3D12_RESOURCE_STATES(r.Required | a[k].State);
+			}
+		}
+
+		for (UINT k = 0; k < pass.AccessCount; k++)
+		{
+			const RGResource id = a[k].Resource;
+			Resource& r = m_Resources[id];
+			if (r.Stamp != i)
+				continue;
+			r.Stamp = i | RG_STAMP_DONE;
+
+			// A combined read state already covers any subset of itself.
+			const bool covered = r.State == r.Required ||
+				(!r.RequiredWrite && IsReadOnlyState(r.State) && (r.State & r.Required) == r.Required);
+			if (!covered)
+			{
+				Transition(id, r.Required, i, true);
+			}
+			else if (r.Required == D3D12_RESOURCE_STATE_UNORDERED_ACCESS && r.LastUse != RG_NO_PASS &&
+				(r.LastWasWrite || r.RequiredWrite))
+			{
+				PendingBarrier pb = {};
+				pb.Batch = i;
+				pb.B.Resource = id;
+				pb.B.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+				pb.B.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+				m_Pending.push_back(pb);
+				m_Stats.UAVBarriers++;
+			}
+			if (r.FirstUse == RG_NO_PASS)
+				r.FirstUse = i;
+			r.LastUse = i;
+			r.LastWasWrite = r.RequiredWrite;
+		}
+	}
+
+	// The final batch may be recorded on another command list (ExecuteFinalBarriers) and
+	// split barriers cannot span lists, so these are always full transitions.
+	for (RGResource id = 0; id < m_Resources.size(); id++)
+	{
+		Resource& r = m_Resources[id];
+		if (r.Imported && r.State != r.Final)
+			Transition(id, r.Final, pass_count, false);
+	}
+
+	// Bucket the barriers by batch, keeping the order they were generated in.
+	m_BatchStart.assign(pass_count + 2, 0);
+	for (const auto& pb : m_Pending)
+	{
+		m_BatchStart[pb.Batch + 1]++;
+	}
+	for (UINT b = 0; b <= pass_count; b++)
+	{
+		if (m_BatchStart[b + 1] > 0)
+			m_Stats.BarrierBatches++;
+		m_BatchStart[b + 1] += m_BatchStart[b];
+	}
+	m_Barriers.resize(m_Pending.size());
+	m_Fill.assign(m_BatchStart.begin(), m_BatchStart.end() - 1);
+	for (const auto& pb : m_Pending)
+	{
+		m_Barriers[m_Fill[pb.Batch]++] = pb.B;
+	}
+	m_Stats.Barriers = (UINT)m_Barriers.size();
+	m_Compiled = true;
+}
+
+bool RenderGraph::GetResourceLifetime(RGResource Resource, UINT* FirstPass, UINT* LastPass) const
+{
+	RAID_ASSERT(m_Compiled);
+	const auto& r = m_Resources[Resource];
+	if (r.FirstUse == RG_NO_PASS)
+		return false;
+	*FirstPass = r.FirstUse;
+	*LastPass = r.LastUse;
+	return true;
+}
+
+void RenderGraph::ExecuteBatch(UINT Batch, ID3D12GraphicsCommandList* List)
+{
+	const UINT count = GetBatchBarrierCount(Batch);
+	if (count == 0)
+		return;
+	const Barrier* b = GetBatchBarriers(Batch);
+	m_Scratch.resize(count);
+	for (UINT i = 0; i < count; i++)
+	{
+		D3D12_RESOURCE_BARRIER& d = m_Scratch[i];
+		d = {};
+		d.Type = b[i].Type;
+		d.Flags = b[i].Flags;
+		if (b[i].Type == D3D12_RESOURCE_BARRIER_TYPE_UAV)
+		{
+			d.UAV.pResource = m_Resources[b[i].Resource].Native;
+		}
+		else
+		{
+			d.Transition.pResource = m_Resources[b[i].Resource].Native;
+			d.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+			d.Transition.StateBefore = b[i].Before;
+			d.Transition.StateAfter = b[i].After;
+		}
+	}
+	List->ResourceBarrier(count, m_Scratch.data());
+}
+
+void RenderGraph::ExecutePasses(ID3D12GraphicsCommandList* List)
+{
+	RAID_ASSERT(m_Compiled);
+	for (UINT i = 0; i < m_Order.size(); i++)
+	{
+		ExecuteBatch(i, List);
+		const Pass& pass = m_Passes[m_Order[i]];
+		const UINT token = m_PassBegin ? m_PassBegin(List, pass.Name) : 0;
+		if (pass.Execute)
+			pass.Execute(List);
+		if (m_PassEnd)
+			m_PassEnd(List, token);
+	}
+}
+
+void RenderGraph::SetPassHooks(PassBeginHook Begin, PassEndHook End)
+{
+	m_PassBegin = Begin;
+	m_PassEnd = End;
+}
+
+void RenderGraph::ExecuteFinalBarriers(ID3D12GraphicsCommandList* List)
+{
+	RAID_ASSERT(m_Compiled);
+	ExecuteBatch((UINT)m_Order.size(), List);
+}
+
+void RenderGraph::Execute(ID3D12GraphicsCommandList* List)
+{
+	ExecutePasses(List);
+	ExecuteFinalBarriers(List);
+}
+
+// Declares the same synthetic frame on every call: each pass reads two resources and writes one
+// or two, in the states a deferred renderer uses. Passes whose output nobody reads get culled.
+static void BuildBenchmarkGraph(RenderGraph& Graph, UINT Passes, UINT Resources)
+{
+	static const D3D12_RESOURCE_STATES write_states[] =
+	{
+		D3D12_RESOURCE_STATE_RENDER_TARGET,
+		D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+		D3D12_RESOURCE_STATE_DEPTH_WRITE,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+	};
+	static const D3D12_RESOURCE_STATES read_states[] =
+	{
+		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+		D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+		D3D12_RESOURCE_STATE_COPY_SOURCE,
+		D3D12_RESOURCE_STATE_DEPTH_READ,
+	};
+
+	Graph.Reset();
+	for (UINT r = 0; r < Resources; r++)
+	{
+		if (r % 16 == 0)
+			Graph.ImportResource("Imported", nullptr, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+		else
+			Graph.CreateResource("Transient", nullptr, D3D12_RESOURCE_STATE_COMMON);
+	}
+
+	uint32_t state = 0x9E3779B9u;
+	auto next = [&state]()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	};
+	for (UINT p = 0; p < Passes; p++)
+	{
+		Graph.AddPass("Pass", nullptr);
+		// Mostly the resources written shortly before, like a chain of post effects.
+		const UINT window = (std::min)(Resources, 32u);
+		const RGResource base = (RGResource)((p * 7) % Resources);
+		const RGResource written = (base + next() % window) % Resources;
+		for (UINT i = 0; i < 2; i++)
+		{
+			const RGResource read = (RGResource)((base + Resources - 1 - next() % window) % Resources);
+			if (read != written)
+				Graph.Read(read, read_states[next() % 4]);
+		}
+		Graph.Write(written, write_states[next() % 4]);
+		if (p % 8 == 7)
+		{
+			const RGResource imported = (RGResource)((next() % Resources) & ~15u);
+			if (imported != written)
+				Graph.Write(imported, D3D12_RESOURCE_STATE_RENDER_TARGET);
+		}
+	}
+}
+
+RenderGraphBenchmarkResult BenchmarkRenderGraphCompile(UINT Passes, UINT Resources, UINT Frames)
+{
+	RenderGraphBenchmarkResult r;
+	Passes = (std::max)(Passes, 1u);
+	Resources = (std::max)(Resources, 1u);
+	Frames = (std::max)(Frames, 2u);
+	r.HeapAllocationsCounted = HeapAllocationCounter::IsEnabled();
+
+	RenderGraph graph;
+	double build = 0.0;
+	double compile = 0.0;
+	// Frame 0 grows the graph's storage, every later frame has to reuse it.
+	for (UINT f = 0; f < Frames; f++)
+	{
+		NoHeapAllocationScope frame_allocations(false);
+		const int64_t start = SystemTime::GetCurrentTick();
+		BuildBenchmarkGraph(graph, Passes, Resources);
+		const int64_t built = SystemTime::GetCurrentTick();
+		graph.Compile();
+		const int64_t compiled = SystemTime::GetCurrentTick();
+		if (f == 0)
+			continue;
+		build += SystemTime::TicksToSeconds(built - start);
+		compile += SystemTime::TicksToSeconds(compiled - built);
+		r.HeapAllocationsAfterFirstFrame += frame_allocations.GetAllocations();
+	}
+	r.Stats = graph.GetStats();
+	r.BuildMicrosecs = build / (Frames - 1) * 1e6;
+	r.CompileMicrosecs = compile / (Frames - 1) * 1e6;
+	return r;
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include "VRCore.h"
+#include <d3d12.h>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Frame render graph. Passes declare which resources they read and write and in which state,
+* Compile() then:
+*  - culls passes whose results are never consumed (walking back from imported resources),
+*  - tracks every resource's state through the frame and derives the transitions,
+*  - merges all barriers needed in front of a pass into one ResourceBarrier call,
+*  - uses split (BEGIN_ONLY/END_ONLY) barriers when passes in between leave slack.
+* Compile() is pure CPU work, Execute() is the only part that touches a command list.
+*
+* Usage:
+*   graph.Reset();
+*   RGResource bb = graph.ImportResource("BackBuffer", rt, PRESENT, PRESENT);
+*   graph.AddPass("Clear", [&](ID3D12GraphicsCommandList* l) { ... });
+*   graph.Write(bb, D3D12_RESOURCE_STATE_RENDER_TARGET);
+*   graph.Compile();
+*   graph.Execute(list);
+*
+* BenchmarkRenderGraphCompile() rebuilds and compiles a synthetic frame of a few thousand passes,
+* no device needed. It reports build and compile time, the barrier and cull counts, and the heap
+* allocations made after the first frame (0 expected, needs VR_COUNT_HEAP_ALLOCATIONS).
+*/
+
+typedef UINT RGResource;
+const RGResource RG_INVALID_RESOURCE = UINT_MAX;
+
+struct RenderGraphStats
+{
+    UINT Passes = 0;
+    UINT CulledPasses = 0;
+    UINT Barriers = 0;
+    UINT SplitBarriers = 0;
+    UINT UAVBarriers = 0;
+    // Number of ResourceBarrier calls Execute() will make.
+    UINT BarrierBatches = 0;
+};
+
+class RenderGraph
+{
+public:
+    typedef std::function<void(ID3D12GraphicsCommandList* List)> PassExecute;
+    // Called around every executed pass, after its barriers. Begin's return value goes to End.
+    typedef std::function<UINT(ID3D12GraphicsCommandList* List, const char* Name)> PassBeginHook;
+    typedef std::function<void(ID3D12GraphicsCommandList* List, UINT Token)> PassEndHook;
+
+    struct Barrier
+    {
+        RGResource Resource;
+        D3D12_RESOURCE_BARRIER_TYPE Type;
+        D3D12_RESOURCE_BARRIER_FLAGS Flags;
+        D3D12_RESOURCE_STATES Before;
+        D3D12_RESOURCE_STATES After;
+    };
+
+    // Clears passes and resources but keeps the storage, so rebuilding every frame does not allocate.
+    void Reset();
+
+    // External resource. It is live past the end of the frame and is put in FinalState at the end.
+    RGResource ImportResource(const char* Name, ID3D12Resource* Resource, D3D12_RESOURCE_STATES InitialState, D3D12_RESOURCE_STATES FinalState);
+    // Frame-local resource. Passes only writing it are culled if nothing reads it.
+    RGResource CreateResource(const char* Name, ID3D12Resource* Resource, D3D12_RESOURCE_STATES InitialState);
+
+    // Adds a pass. Following Read()/Write() calls belong to it.
+    UINT AddPass(const char* Name, PassExecute Execute);
+    void Read(RGResource Resource, D3D12_RESOURCE_STATES State);
+    void Write(RGResource Resource, D3D12_RESOURCE_STATES State);
+    // Pass has effects the graph cannot see (readbacks, queries), never cull it.
+    void SetSideEffects();
+
+    void Compile();
+
+    // Records barriers and passes. ExecutePasses + ExecuteFinalBarriers allows putting the
+    // end-of-frame transitions on another command list.
+    void Execute(ID3D12GraphicsCommandList* List);
+    void ExecutePasses(ID3D12GraphicsCommandList* List);
+    void ExecuteFinalBarriers(ID3D12GraphicsCommandList* List);
+    // Kept across Reset(), e.g. GpuProfiler::BeginPass/EndPass.
+    void SetPassHooks(PassBeginHook Begin, PassEndHook End);
+
+    // Compiled result. Batch i runs before GetCompiledPass(i), batch GetCompiledPassCount() at the end.
+    UINT GetCompiledPassCount() const { return (UINT)m_Order.size(); }
+    UINT GetCompiledPass(UINT Index) const { return m_Order[Index]; }
+    UINT GetBatchBarrierCount(UINT Batch) const { return m_BatchStart[Batch + 1] - m_BatchStart[Batch]; }
+    const Barrier* GetBatchBarriers(UINT Batch) const { return m_Barriers.data() + m_BatchStart[Batch]; }
+    bool IsPassCulled(UINT Pass) const { return !m_Passes[Pass].Alive; }
+    const char* GetPassName(UINT Pass) const { return m_Passes[Pass].Name; }
+    const char* GetResourceName(RGResource Resource) const { return m_Resources[Resource].Name; }
+    // Range of compiled pass indices using Resource, as AliasingPlanner wants it. False if unused.
+    bool GetResourceLifetime(RGResource Resource, UINT* FirstPass, UINT* LastPass) const;
+    const RenderGraphStats& GetStats() const { return m_Stats; }
+
+private:
+    struct Resource
+    {
+        const char* Name;
+        ID3D12Resource* Native;
+        D3D12_RESOURCE_STATES Initial;
+        D3D12_RESOURCE_STATES Final;
+        bool Imported;
+        // Compile state.
+        D3D12_RESOURCE_STATES State;
+        UINT FirstUse;
+        UINT LastUse;
+        UINT Stamp;
+        bool LastWasWrite;
+        bool Needed;
+        D3D12_RESOURCE_STATES Required;
+        bool RequiredWrite;
+    };
+
+    struct Access
+    {
+        RGResource Resource;
+        D3D12_RESOURCE_STATES State;
+        bool Write;
+    };
+
+    struct Pass
+    {
+        const char* Name;
+        PassExecute Execute;
+        UINT FirstAccess;
+        UINT AccessCount;
+        bool SideEffects;
+        bool Alive;
+    };
+
+    struct PendingBarrier
+    {
+        UINT Batch;
+        Barrier B;
+    };
+
+    RGResource AddResource(const char* Name, ID3D12Resource* Native, D3D12_RESOURCE_STATES Initial, D3D12_RESOURCE_STATES Final, bool Imported);
+    void AddAccess(RGResource Resource, D3D12_RESOURCE_STATES State, bool Write);
+    void Cull();
+    void Transition(RGResource Id, D3D12_RESOURCE_STATES After, UINT Batch, bool AllowSplit);
+    void ExecuteBatch(UINT Batch, ID3D12GraphicsCommandList* List);
+
+    std::vector<Resource> m_Resources;
+    std::vector<Pass> m_Passes;
+    std::vector<Access> m_Accesses;
+
+    std::vector<UINT> m_Order;
+    std::vector<PendingBarrier> m_Pending;
+    std::vector<Barrier> m_Barriers;
+    std::vector<UINT> m_BatchStart;
+    std::vector<UINT> m_Fill;
+    std::vector<D3D12_RESOURCE_BARRIER> m_Scratch;
+    RenderGraphStats m_Stats;
+    PassBeginHook m_PassBegin;
+    PassEndHook m_PassEnd;
+    bool m_Compiled = false;
+};
+
+struct RenderGraphBenchmarkResult
+{
+    // Of the last frame, the same every frame.
+    RenderGraphStats Stats;
+    // Per frame: Reset() and declaring the passes, and Compile().
+    double BuildMicrosecs = 0.0;
+    double CompileMicrosecs = 0.0;
+    // Heap allocations of the calling thread in every frame after the first, building included.
+    UINT64 HeapAllocationsAfterFirstFrame = 0;
+    // False if VR_COUNT_HEAP_ALLOCATIONS is off, the count above is meaningless then.
+    bool HeapAllocationsCounted = false;
+};
+
+// Resources: every 16th is imported, the rest frame-local.
+RenderGraphBenchmarkResult BenchmarkRenderGraphCompile(UINT Passes = 4096, UINT Resources = 512, UINT Frames = 100);
@@ -0,0 +1,428 @@
+#include "VRShaderCache.h"
+#include "VRJobSystem.h"
+#include <d3dcompiler.h>
+#include <wrl.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const UINT32 ShaderBlobMagic = 0x42535256; // 'VRSB'
+static const UINT32 ShaderDepsMagic = 0x44535256; // 'VRSD'
+static const UINT64 ShaderHashSeed = 0xcbf29ce484222325ull;
+
+// FNV-1a, 64 bit.
+UINT64 ShaderCache::HashBytes(const void* Data, size_t Size, UINT64 Seed)
+{
+	const UINT8* p = static_cast<const UINT8*>(Data);
+	UINT64 h = Seed;
+	for (size_t i = 0; i < Size; i++)
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+static inline UINT64 HashString(const std::string& s, UINT64 Seed)
+{
+	// Length first so "ab"+"c" and "a"+"bc" differ.
+	const UINT64 len = s.size();
+	return ShaderCache::HashBytes(s.data(), s.size(), ShaderCache::HashBytes(&len, sizeof(len), Seed));
+}
+
+static inline UINT64 HashValue(UINT64 v, UINT64 Seed)
+{
+	return ShaderCache::HashBytes(&v, sizeof(v), Seed);
+}
+
+UINT64 ShaderCache::HashFile(const std::wstring& Path)
+{
+	std::ifstream f(fs::path(Path), std::ios::binary);
+	if (!f)
+		return 0;
+	std::ostringstream ss;
+	ss << f.rdbuf();
+	const std::string data = ss.str();
+	return HashString(data, ShaderHashSeed);
+}
+
+void ShaderCache::Initialize(IShaderCompiler* Compiler, const std::wstring& Directory)
+{
+	m_Compiler = Compiler;
+	m_Directory = Directory;
+	m_CompilerHash = Compiler->GetVersionHash();
+	std::error_code ec;
+	fs::create_directories(fs::path(Directory), ec);
+}
+
+UINT64 ShaderCache::ComputeRequestKey(const ShaderRequest& Request) const
+{
+	UINT64 h = HashValue(m_CompilerHash, ShaderHashSeed);
+	const std::string file = fs::path(Request.File).lexically_normal().u8string();
+	h = HashString(file, h);
+	h = HashString(Request.EntryPoint, h);
+	h = HashString(Request.Target, h);
+	h = HashValue(Request.Flags, h);
+	for (const auto& d : Request.Defines)
+	{
+		h = HashString(d.Name, h);
+		h = HashString(d.Value, h);
+	}
+	return h;
+}
+
+UINT64 ShaderCache::ComputeContentKey(const ShaderRequest& Request, const std::string& PreprocessedSource) const
+{
+	// Defines and includes are already baked into the preprocessed text.
+	UINT64 h = HashValue(m_CompilerHash, ShaderHashSeed);
+	h = HashString(PreprocessedSource, h);
+	h = HashString(Request.EntryPoint, h);
+	h = HashString(Request.Target, h);
+	return HashValue(Request.Flags, h);
+}
+
+std::wstring ShaderCache::BlobPath(UINT64 Key) const
+{
+	wchar_t name[32];
+	swprintf(name, 32, L"%016llx.cso", (unsigned long long)Key);
+	return (fs::path(m_Directory) / name).wstring();
+}
+
+std::wstring ShaderCache::DepsPath(UINT64 Key) const
+{
+	wchar_t name[32];
+	swprintf(name, 32, L"%016llx.dep", (unsigned long long)Key);
+	return (fs::path(m_Directory) / name).wstring();
+}
+
+template<typename T>
+static inline bool ReadPod(std::istream& s, T& v)
+{
+	return (bool)s.read(reinterpret_cast<char*>(&v), sizeof(T));
+}
+
+template<typename T>
+static inline void WritePod(std::ostream& s, const T& v)
+{
+	s.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+// Writes through a temporary file so a crash or a second process never sees half a file.
+static void WriteAtomically(const std::wstring& Path, const std::string& Data)
+{
+	std::ostringstream tmp_name;
+	tmp_name << std::this_thread::get_id();
+	fs::path tmp = fs::path(Path);
+	tmp += L".";
+	tmp += tmp_name.str();
+	{
+		std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+		if (!f)
+			return;
+		f.write(Data.data(), Data.size());
+		if (!f)
+			return;
+	}
+	std::error_code ec;
+	fs::rename(tmp, fs::path(Path), ec);
+	if (ec)
+		fs::remove(tmp, ec);
+}
+
+bool ShaderCache::ReadBlob(UINT64 Key, std::vector<UINT8>& Bytecode) const
+{
+	std::ifstream f(fs::path(BlobPath(Key)), std::ios::binary);
+	UINT32 magic = 0, version = 0;
+	UINT64 key = 0, size = 0;
+	if (!ReadPod(f, magic) || !ReadPod(f, version) || !ReadPod(f, key) || !ReadPod(f, size))
+		return false;
+	if (magic != ShaderBlobMagic || version != FormatVersion || key != Key)
+		return false;
+	Bytecode.resize((size_t)size);
+	return size == 0 || (bool)f.read(reinterpret_cast<char*>(Bytecode.data()), (std::streamsize)size);
+}
+
+void ShaderCache::WriteBlob(UINT64 Key, const std::vector<UINT8>& Bytecode) const
+{
+	std::ostringstream s;
+	WritePod(s, ShaderBlobMagic);
+	WritePod(s, (UINT32)FormatVersion);
+	WritePod(s, Key);
+	WritePod(s, (UINT64)Bytecode.size());
+	s.write(reinterpret_cast<const char*>(Bytecode.data()), Bytecode.size());
+	WriteAtomically(BlobPath(Key), s.str());
+}
+
+bool ShaderCache::ReadDeps(UINT64 RequestKey, UINT64& ContentKey, std::vector<Dependency>& Deps) const
+{
+	std::ifstream f(fs::path(DepsPath(RequestKey)), std::ios::binary);
+	UINT32 magic = 0, version = 0, count = 0;
+	if (!ReadPod(f, magic) || !ReadPod(f, version) || !ReadPod(f, ContentKey) || !ReadPod(f, count))
+		return false;
+	if (magic != ShaderDepsMagic || version != FormatVersion)
+		return false;
+	Deps.resize(count);
+	for (auto& d : Deps)
+	{
+		UINT32 length = 0;
+		if (!ReadPod(f, length))
+			return false;
+		std::string path(length, '\0');
+		if (!f.read(&path[0], length) || !ReadPod(f, d.Hash))
+			return false;
+		d.Path = fs::u8path(path).wstring();
+	}
+	return true;
+}
+
+void ShaderCache::WriteDeps(UINT64 RequestKey, UINT64 ContentKey, const std::vector<Dependency>& Deps) const
+{
+	std::ostringstream s;
+	WritePod(s, ShaderDepsMagic);
+	WritePod(s, (UINT32)FormatVersion);
+	WritePod(s, ContentKey);
+	WritePod(s, (UINT32)Deps.size());
+	for (const auto& d : Deps)
+	{
+		const std::string path = fs::path(d.Path).u8string();
+		WritePod(s, (UINT32)path.size());
+		s.write(path.data(), path.size());
+		WritePod(s, d.Hash);
+	}
+	WriteAtomically(DepsPath(RequestKey), s.str());
+}
+
+bool ShaderCache::FindBytecode(UINT64 ContentKey, ShaderResult& Result)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto it = m_Memory.find(ContentKey);
+		if (it != m_Memory.end())
+		{
+			Result.Bytecode = it->second;
+			m_Stats.MemoryHits++;
+			return true;
+		}
+	}
+	if (!ReadBlob(ContentKey, Result.Bytecode))
+		return false;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Memory[ContentKey] = Result.Bytecode;
+	m_Stats.DiskHits++;
+	return true;
+}
+
+ShaderResult ShaderCache::Get(const ShaderRequest& Request)
+{
+	RAID_ASSERT(m_Compiler != nullptr);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.Requests++;
+	}
+	ShaderResult result;
+	const UINT64 request_key = ComputeRequestKey(Request);
+
+	// Fast path: nothing the last compile read has changed.
+	UINT64 content_key = 0;
+	std::vector<Dependency> deps;
+	if (ReadDeps(request_key, content_key, deps))
+	{
+		bool fresh = true;
+		for (const auto& d : deps)
+		{
+			if (HashFile(d.Path) != d.Hash)
+			{
+				fresh = false;
+				break;
+			}
+		}
+		if (fresh && FindBytecode(content_key, result))
+		{
+			result.Success = true;
+			result.FromCache = true;
+			result.Key = content_key;
+			return result;
+		}
+	}
+
+	std::string source;
+	std::vector<std::wstring> includes;
+	const bool preprocessed = m_Compiler->Preprocess(Request, source, includes, result.Errors);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.Preprocessed++;
+		if (!preprocessed)
+			m_Stats.Failed++;
+	}
+	if (!preprocessed)
+		return result;
+
+	content_key = ComputeContentKey(Request, source);
+	result.Key = content_key;
+	deps.clear();
+	deps.push_back({ Request.File, HashFile(Request.File) });
+	for (const auto& inc : includes)
+	{
+		deps.push_back({ inc, HashFile(inc) });
+	}
+
+	// Same expanded source as some earlier request (or an edit that did not change the output).
+	if (FindBytecode(content_key, result))
+	{
+		WriteDeps(request_key, content_key, deps);
+		result.Success = true;
+		result.FromCache = true;
+		return result;
+	}
+
+	result.Success = m_Compiler->Compile(Request, source, result.Bytecode, result.Errors);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!result.Success)
+		{
+			m_Stats.Failed++;
+			return result;
+		}
+		m_Stats.Compiled++;
+		m_Memory[content_key] = result.Bytecode;
+	}
+	WriteBlob(content_key, result.Bytecode);
+	WriteDeps(request_key, content_key, deps);
+	return result;
+}
+
+void ShaderCache::CompileBatch(const std::vector<ShaderRequest>& Requests, std::vector<ShaderResult>& Results, JobSystem* Jobs)
+{
+	Results.clear();
+	Results.resize(Requests.size());
+	auto resolve = [&](UINT i) { Results[i] = Get(Requests[i]); };
+	if (Jobs)
+	{
+		Jobs->Run((UINT)Requests.size(), resolve);
+	}
+	else
+	{
+		for (UINT i = 0; i < Requests.size(); i++)
+			resolve(i);
+	}
+}
+
+void ShaderCache::ClearMemory()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Memory.clear();
+}
+
+ShaderCacheStats ShaderCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+// Resolves #include relative to the including file and records every file it opens.
+class RecordingInclude : public ID3DInclude
+{
+public:
+	RecordingInclude(const fs::path& RootDir, std::vector<std::wstring>& Includes)
+		: m_RootDir(RootDir), m_Includes(Includes)
+	{
+	}
+
+	HRESULT __stdcall Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID* ppData, UINT* pBytes) override
+	{
+		fs::path dir = m_RootDir;
+		auto parent = m_Open.find(pParentData);
+		if (IncludeType == D3D_INCLUDE_LOCAL && parent != m_Open.end())
+			dir = parent->second.Dir;
+		const fs::path path = (dir / fs::u8path(pFileName)).lexically_normal();
+
+		std::ifstream f(path, std::ios::binary);
+		if (!f)
+			return E_FAIL;
+		std::ostringstream ss;
+		ss << f.rdbuf();
+		auto data = std::make_unique<std::string>(ss.str());
+		*ppData = data->data();
+		*pBytes = (UINT)data->size();
+		m_Includes.push_back(path.wstring());
+		m_Open[data->data()] = { path.parent_path(), std::move(data) };
+		return S_OK;
+	}
+
+	HRESULT __stdcall Close(LPCVOID pData) override
+	{
+		m_Open.erase(pData);
+		return S_OK;
+	}
+
+private:
+	struct OpenFile
+	{
+		fs::path Dir;
+		std::unique_ptr<std::string> Data;
+	};
+
+	fs::path m_RootDir;
+	std::vector<std::wstring>& m_Includes;
+	std::map<LPCVOID, OpenFile> m_Open;
+};
+
+UINT64 D3DShaderCompiler::GetVersionHash()
+{
+	return HashValue(D3D_COMPILER_VERSION, ShaderHashSeed);
+}
+
+bool D3DShaderCompiler::Preprocess(const ShaderRequest& Request, std::string& Source, std::vector<std::wstring>& Includes, std::string& Errors)
+{
+	const fs::path file = fs::path(Request.File);
+	std::ifstream f(file, std::ios::binary);
+	if (!f)
+	{
+		Errors = "Unable to open " + file.u8string();
+		return false;
+	}
+	std::ostringstream ss;
+	ss << f.rdbuf();
+	const std::string text = ss.str();
+
+	std::vector<D3D_SHADER_MACRO> macros;
+	for (const auto& d : Request.Defines)
+	{
+		macros.push_back({ d.Name.c_str(), d.Value.c_str() });
+	}
+	macros.push_back({ nullptr, nullptr });
+
+	RecordingInclude include(file.parent_path(), Includes);
+	Microsoft::WRL::ComPtr<ID3DBlob> code;
+	Microsoft::WRL::ComPtr<ID3DBlob> errors;
+	const std::string name = file.u8string();
+	HRESULT hr = D3DPreprocess(text.data(), text.size(), name.c_str(), macros.data(), &include, &code, &errors);
+	if (errors)
+		Errors.assign((const char*)errors->GetBufferPointer(), errors->GetBufferSize());
+	if (FAILED(hr))
+		return false;
+
+	Source.assign((const char*)code->GetBufferPointer(), code->GetBufferSize());
+	while (!Source.empty() && Source.back() == '\0')
+		Source.pop_back();
+	return true;
+}
+
+bool D3DShaderCompiler::Compile(const ShaderRequest& Request, const std::string& Source, std::vector<UINT8>& Bytecode, std::string& Errors)
+{
+	Microsoft::WRL::ComPtr<ID3DBlob> code;
+	Microsoft::WRL::ComPtr<ID3DBlob> errors;
+	const std::string name = fs::path(Request.File).u8string();
+	HRESULT hr = D3DCompile(Source.data(), Source.size(), name.c_str(), nullptr, nullptr,
+		Request.EntryPoint.c_str(), Request.Target.c_str(), Request.Flags, 0, &code, &errors);
+	if (errors)
+		Errors.assign((const char*)errors->GetBufferPointer(), errors->GetBufferSize());
+	if (FAILED(hr))
+		return false;
+
+	const UINT8* p = (const UINT8*)code->GetBufferPointer();
+	Bytecode.assign(p, p + code->GetBufferSize());
+	return true;
+}
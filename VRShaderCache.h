@@ -0,0 +1,131 @@
+#pragma once
+#include "VRCore.h"
+#include <mutex>
+#include <unordered_map>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Content-addressed cache of compiled shader bytecode.
+*
+* A request (file, entry point, target, defines, flags) is resolved in two steps:
+*  1. The request key (hash of the request itself) names a small dependency record on disk with
+*     the content key of the last compile and the hash of every file it included. If all of those
+*     files are unchanged the content key is reused without preprocessing anything.
+*  2. Otherwise the source is preprocessed. The content key is the hash of the preprocessed text
+*     plus entry point, target, flags and the compiler version, and names the bytecode file.
+*     Editing a header therefore only recompiles the shaders whose expanded source changed.
+*
+* Misses are compiled in parallel with CompileBatch(). The compiler sits behind IShaderCompiler
+* so keys, invalidation and the disk format can be exercised without a GPU or d3dcompiler.
+*
+* Disk layout under the cache directory:
+*   <content key>.cso   'VRSB' | version | content key | size | bytecode
+*   <request key>.dep   'VRSD' | version | content key | count | { path length | path | file hash }
+*/
+
+struct ShaderDefine
+{
+    std::string Name;
+    std::string Value;
+};
+
+struct ShaderRequest
+{
+    std::wstring File;
+    std::string EntryPoint;
+    std::string Target;
+    std::vector<ShaderDefine> Defines;
+    UINT Flags = 0;
+};
+
+struct ShaderResult
+{
+    bool Success = false;
+    // Served from memory or disk without invoking the compiler.
+    bool FromCache = false;
+    UINT64 Key = 0;
+    std::vector<UINT8> Bytecode;
+    std::string Errors;
+};
+
+struct ShaderCacheStats
+{
+    UINT64 Requests = 0;
+    UINT64 MemoryHits = 0;
+    UINT64 DiskHits = 0;
+    // Dependency record was stale or missing and the source had to be preprocessed.
+    UINT64 Preprocessed = 0;
+    UINT64 Compiled = 0;
+    UINT64 Failed = 0;
+};
+
+class IShaderCompiler
+{
+public:
+    virtual ~IShaderCompiler() = default;
+
+    // Identifies the compiler build, part of every content key.
+    virtual UINT64 GetVersionHash() = 0;
+
+    // Expands includes and macros. Includes receives the full path of every file opened, nested ones too.
+    virtual bool Preprocess(const ShaderRequest& Request, std::string& Source, std::vector<std::wstring>& Includes, std::string& Errors) = 0;
+
+    // Compiles already preprocessed source.
+    virtual bool Compile(const ShaderRequest& Request, const std::string& Source, std::vector<UINT8>& Bytecode, std::string& Errors) = 0;
+};
+
+class JobSystem;
+
+class ShaderCache
+{
+public:
+    const static UINT32 FormatVersion = 1;
+
+    void Initialize(IShaderCompiler* Compiler, const std::wstring& Directory);
+
+    ShaderResult Get(const ShaderRequest& Request);
+
+    // Resolves every request, compiling the misses in parallel on Jobs. Jobs may be null.
+    void CompileBatch(const std::vector<ShaderRequest>& Requests, std::vector<ShaderResult>& Results, JobSystem* Jobs);
+
+    // Drops the in-memory copies, disk files stay.
+    void ClearMemory();
+
+    ShaderCacheStats GetStats();
+
+    static UINT64 HashBytes(const void* Data, size_t Size, UINT64 Seed);
+    static UINT64 HashFile(const std::wstring& Path);
+    UINT64 ComputeRequestKey(const ShaderRequest& Request) const;
+    UINT64 ComputeContentKey(const ShaderRequest& Request, const std::string& PreprocessedSource) const;
+
+private:
+    struct Dependency
+    {
+        std::wstring Path;
+        UINT64 Hash;
+    };
+
+    std::wstring BlobPath(UINT64 Key) const;
+    std::wstring DepsPath(UINT64 Key) const;
+    bool ReadBlob(UINT64 Key, std::vector<UINT8>& Bytecode) const;
+    void WriteBlob(UINT64 Key, const std::vector<UINT8>& Bytecode) const;
+    bool ReadDeps(UINT64 RequestKey, UINT64& ContentKey, std::vector<Dependency>& Deps) const;
+    void WriteDeps(UINT64 RequestKey, UINT64 ContentKey, const std::vector<Dependency>& Deps) const;
+    bool FindBytecode(UINT64 ContentKey, ShaderResult& Result);
+
+    IShaderCompiler* m_Compiler = nullptr;
+    std::wstring m_Directory;
+    UINT64 m_CompilerHash = 0;
+
+    std::mutex m_Mutex;
+    std::unordered_map<UINT64, std::vector<UINT8>> m_Memory;
+    ShaderCacheStats m_Stats;
+};
+
+// IShaderCompiler on top of d3dcompiler (D3DPreprocess + D3DCompile).
+class D3DShaderCompiler : public IShaderCompiler
+{
+public:
+    UINT64 GetVersionHash() override;
+    bool Preprocess(const ShaderRequest& Request, std::string& Source, std::vector<std::wstring>& Includes, std::string& Errors) override;
+    bool Compile(const ShaderRequest& Request, const std::string& Source, std::vector<UINT8>& Bytecode, std::string& Errors) override;
+};
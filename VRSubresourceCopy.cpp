@@ -0,0 +1,291 @@
+#include "VRSubresourceCopy.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#if VR_SUBRESOURCE_COPY_SSE2
+#include <emmintrin.h>
+#endif
+
+// Below this, aligning the destination and fencing costs more than streaming saves.
+static const size_t StreamMinBytes = 256;
+
+static void CopyStreaming(uint8_t* Dest, const uint8_t* Src, size_t Size)
+{
+#if VR_SUBRESOURCE_COPY_SSE2
+	if (Size >= StreamMinBytes)
+	{
+		// Streaming stores need a 16 byte aligned destination, the source is read unaligned.
+		const size_t head = (16 - ((uintptr_t)Dest & 15)) & 15;
+		memcpy(Dest, Src, head);
+		Dest += head;
+		Src += head;
+		Size -= head;
+		// 64 bytes per iteration fills one write-combining buffer.
+		for (; Size >= 64; Size -= 64, Dest += 64, Src += 64)
+		{
+			const __m128i a = _mm_loadu_si128((const __m128i*)(Src + 0));
+			const __m128i b = _mm_loadu_si128((const __m128i*)(Src + 16));
+			const __m128i c = _mm_loadu_si128((const __m128i*)(Src + 32));
+			const __m128i d = _mm_loadu_si128((const __m128i*)(Src + 48));
+			_mm_stream_si128((__m128i*)(Dest + 0), a);
+			_mm_stream_si128((__m128i*)(Dest + 16), b);
+			_mm_stream_si128((__m128i*)(Dest + 32), c);
+			_mm_stream_si128((__m128i*)(Dest + 48), d);
+		}
+		for (; Size >= 16; Size -= 16, Dest += 16, Src += 16)
+		{
+			_mm_stream_si128((__m128i*)Dest, _mm_loadu_si128((const __m128i*)Src));
+		}
+	}
+#endif
+	memcpy(Dest, Src, Size);
+}
+
+static inline void CopyBlock(uint8_t* Dest, const uint8_t* Src, size_t Size, bool NonTemporal)
+{
+	if (NonTemporal)
+		CopyStreaming(Dest, Src, Size);
+	else
+		memcpy(Dest, Src, Size);
+}
+
+// Streaming stores are weakly ordered, make them visible before the copy is handed to the GPU.
+static inline void StoreFence(bool NonTemporal)
+{
+#if VR_SUBRESOURCE_COPY_SSE2
+	if (NonTemporal)
+		_mm_sfence();
+#else
+	(void)NonTemporal;
+#endif
+}
+
+// Folds the slices into one when both sides are packed, so the pitch-match path sees one block.
+static SubresourceCopyDesc Flatten(const SubresourceCopyDesc& Desc)
+{
+	SubresourceCopyDesc d = Desc;
+	if (d.NumSlices > 1 && (ptrdiff_t)d.DestRowPitch == d.SrcRowPitch &&
+		d.DestSlicePitch == d.DestRowPitch * d.NumRows && d.SrcSlicePitch == d.SrcRowPitch * (ptrdiff_t)d.NumRows)
+	{
+		d.NumRows *= d.NumSlices;
+		d.NumSlices = 1;
+	}
+	return d;
+}
+
+void SubresourceCopier::Initialize(const Options& Config, ParallelRun Run)
+{
+	m_Options = Config;
+	m_Options.ChunkBytes = (std::max)(m_Options.ChunkBytes, (size_t)4096);
+	m_Run = Run;
+	// A full mip chain cut into ChunkBytes pieces, grown further by the first bigger copy.
+	m_Flat.reserve(16);
+	m_Tasks.reserve(256);
+}
+
+void SubresourceCopier::CopyRows(const SubresourceCopyDesc& Desc, unsigned Slice, unsigned FirstRow, unsigned Rows, bool NonTemporal)
+{
+	if (Rows == 0 || Desc.RowSize == 0)
+		return;
+	uint8_t* dest = static_cast<uint8_t*>(Desc.Dest) + Desc.DestSlicePitch * Slice + Desc.DestRowPitch * FirstRow;
+	const uint8_t* src = static_cast<const uint8_t*>(Desc.Src) + Desc.SrcSlicePitch * (ptrdiff_t)Slice + Desc.SrcRowPitch * (ptrdiff_t)FirstRow;
+	if ((ptrdiff_t)Desc.DestRowPitch == Desc.SrcRowPitch)
+	{
+		// Same layout on both sides, the padding between rows is copied along.
+		CopyBlock(dest, src, Desc.DestRowPitch * (Rows - 1) + Desc.RowSize, NonTemporal);
+		return;
+	}
+	for (unsigned y = 0; y < Rows; y++)
+	{
+		CopyBlock(dest + Desc.DestRowPitch * y, src + Desc.SrcRowPitch * (ptrdiff_t)y, Desc.RowSize, NonTemporal);
+	}
+}
+
+void SubresourceCopier::CopyReference(const SubresourceCopyDesc& Desc)
+{
+	for (unsigned z = 0; z < Desc.NumSlices; ++z)
+	{
+		uint8_t* dest_slice = static_cast<uint8_t*>(Desc.Dest) + Desc.DestSlicePitch * z;
+		const uint8_t* src_slice = static_cast<const uint8_t*>(Desc.Src) + Desc.SrcSlicePitch * (ptrdiff_t)z;
+		for (unsigned y = 0; y < Desc.NumRows; ++y)
+		{
+			memcpy(dest_slice + Desc.DestRowPitch * y, src_slice + Desc.SrcRowPitch * (ptrdiff_t)y, Desc.RowSize);
+		}
+	}
+}
+
+void SubresourceCopier::Copy(const SubresourceCopyDesc* Copies, unsigned Count)
+{
+	size_t total = 0;
+	for (unsigned i = 0; i < Count; i++)
+	{
+		total += Copies[i].RowSize * Copies[i].NumRows * Copies[i].NumSlices;
+	}
+	const bool non_temporal = m_Options.NonTemporal && total >= m_Options.NonTemporalThreshold;
+
+	if (!m_Run || total < m_Options.ParallelThreshold)
+	{
+		for (unsigned i = 0; i < Count; i++)
+		{
+			const SubresourceCopyDesc d = Flatten(Copies[i]);
+			for (unsigned z = 0; z < d.NumSlices; z++)
+			{
+				CopyRows(d, z, 0, d.NumRows, non_temporal);
+			}
+		}
+		StoreFence(non_temporal);
+		return;
+	}
+
+	// Cut every slice into runs of about ChunkBytes, small mips end up as one task each.
+	std::lock_guard<std::mutex> lock(m_ScratchMutex);
+	m_Flat.resize(Count);
+	m_Tasks.clear();
+	m_NonTemporal = non_temporal;
+	for (unsigned i = 0; i < Count; i++)
+	{
+		m_Flat[i] = Flatten(Copies[i]);
+		const SubresourceCopyDesc& d = m_Flat[i];
+		if (d.RowSize == 0)
+			continue;
+		const unsigned rows_per_task = (unsigned)(std::max)((size_t)1, m_Options.ChunkBytes / d.RowSize);
+		for (unsigned z = 0; z < d.NumSlices; z++)
+		{
+			for (unsigned y = 0; y < d.NumRows; y += rows_per_task)
+			{
+				m_Tasks.push_back({ i, z, y, (std::min)(rows_per_task, d.NumRows - y) });
+			}
+		}
+	}
+	// Captures only this, small enough for std::function to store without allocating.
+	m_Run((unsigned)m_Tasks.size(), [this](unsigned t)
+	{
+		const Task& task = m_Tasks[t];
+		CopyRows(m_Flat[task.Copy], task.Slice, task.FirstRow, task.Rows, m_NonTemporal);
+		// Each thread fences its own stores.
+		StoreFence(m_NonTemporal);
+	});
+}
+
+void SubresourceCopier::CopyBytes(void* Dest, const void* Src, size_t Size)
+{
+	SubresourceCopyDesc d;
+	d.Dest = Dest;
+	d.Src = Src;
+	d.RowSize = Size;
+	d.NumRows = 1;
+	const bool non_temporal = m_Options.NonTemporal && Size >= m_Options.NonTemporalThreshold;
+	if (!m_Run || Size < m_Options.ParallelThreshold)
+	{
+		CopyRows(d, 0, 0, 1, non_temporal);
+		StoreFence(non_temporal);
+		return;
+	}
+	// As rows of ChunkBytes, so it splits like a texture.
+	d.RowSize = m_Options.ChunkBytes;
+	d.DestRowPitch = m_Options.ChunkBytes;
+	d.SrcRowPitch = (ptrdiff_t)m_Options.ChunkBytes;
+	d.NumRows = (unsigned)(Size / m_Options.ChunkBytes);
+	const size_t tail = Size - (size_t)d.NumRows * m_Options.ChunkBytes;
+	Copy(&d, 1);
+	if (tail)
+	{
+		const size_t done = Size - tail;
+		CopyBlock(static_cast<uint8_t*>(Dest) + done, static_cast<const uint8_t*>(Src) + done, tail, non_temporal);
+		StoreFence(non_temporal);
+	}
+}
+
+static inline size_t AlignUp(size_t Value, size_t Alignment)
+{
+	return (Value + Alignment - 1) / Alignment * Alignment;
+}
+
+SubresourceCopyBenchmarkResult BenchmarkSubresourceCopy(SubresourceCopier& Copier, const SubresourceCopyBenchmarkCase& Case, unsigned Iterations)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	SubresourceCopyDesc d;
+	d.RowSize = (size_t)Case.Width * Case.BytesPerPixel;
+	d.NumRows = Case.Height;
+	d.NumSlices = Case.Slices;
+	d.SrcRowPitch = (ptrdiff_t)(d.RowSize + Case.SrcRowPadding);
+	d.SrcSlicePitch = d.SrcRowPitch * (ptrdiff_t)d.NumRows;
+	d.DestRowPitch = AlignUp(d.RowSize, (std::max)(Case.DestPitchAlignment, (size_t)1));
+	d.DestSlicePitch = d.DestRowPitch * d.NumRows;
+
+	std::vector<uint8_t> src((size_t)d.SrcSlicePitch * d.NumSlices);
+	for (size_t i = 0; i < src.size(); i++)
+	{
+		src[i] = (uint8_t)(i * 2654435761u >> 24);
+	}
+	std::vector<uint8_t> reference(d.DestSlicePitch * d.NumSlices, 0);
+	std::vector<uint8_t> dest(reference.size(), 0);
+	d.Src = src.data();
+
+	SubresourceCopyBenchmarkResult r;
+	r.Bytes = d.RowSize * d.NumRows * d.NumSlices;
+	r.ReferenceMillisecs = 1e30;
+	r.CopierMillisecs = 1e30;
+	for (unsigned i = 0; i < (std::max)(Iterations, 1u); i++)
+	{
+		d.Dest = reference.data();
+		Clock::time_point start = Clock::now();
+		SubresourceCopier::CopyReference(d);
+		r.ReferenceMillisecs = (std::min)(r.ReferenceMillisecs, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+		d.Dest = dest.data();
+		start = Clock::now();
+		Copier.Copy(d);
+		r.CopierMillisecs = (std::min)(r.CopierMillisecs, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+	}
+
+	// Padding bytes are allowed to differ, the pitch-match path copies the source's padding.
+	r.Matches = true;
+	for (unsigned z = 0; z < d.NumSlices && r.Matches; z++)
+	{
+		for (unsigned y = 0; y < d.NumRows; y++)
+		{
+			const size_t offset = d.DestSlicePitch * z + d.DestRowPitch * y;
+			if (memcmp(&reference[offset], &dest[offset], d.RowSize) != 0)
+			{
+				r.Matches = false;
+				break;
+			}
+		}
+	}
+	r.ReferenceGBs = r.Bytes / (r.ReferenceMillisecs * 1e6);
+	r.CopierGBs = r.Bytes / (r.CopierMillisecs * 1e6);
+	return r;
+}
+
+std::vector<SubresourceCopyBenchmarkCase> GetSubresourceCopyBenchmarkCases()
+{
+	std::vector<SubresourceCopyBenchmarkCase> cases;
+	const unsigned sizes[] = { 64, 256, 1024, 2048, 4096 };
+	for (unsigned size : sizes)
+	{
+		SubresourceCopyBenchmarkCase c;
+		c.Width = size;
+		c.Height = size;
+		// Pitch match: rows already a multiple of 256 bytes from 64 px up.
+		c.SrcRowPadding = 0;
+		c.DestPitchAlignment = 256;
+		cases.push_back(c);
+		// Tightly packed source, aligned destination: row by row.
+		c.Width = size - 3;
+		cases.push_back(c);
+		// Padded source rows.
+		c.Width = size;
+		c.SrcRowPadding = 64;
+		cases.push_back(c);
+	}
+	SubresourceCopyBenchmarkCase array_case;
+	array_case.Width = 4096;
+	array_case.Height = 4096;
+	array_case.Slices = 4;
+	array_case.BytesPerPixel = 1;
+	array_case.SrcRowPadding = 32;
+	cases.push_back(array_case);
+	return cases;
+}
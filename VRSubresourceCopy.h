@@ -0,0 +1,124 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* CPU side of texture uploads, a replacement for the row-by-row MemcpySubresource of
+* BlackSpaceDirectX.h.
+*  - Rows of big copies are written with SSE2 streaming stores (NonTemporal), which skip the cache
+*    and fill whole write-combining buffers. That is what an UPLOAD heap (write-combined) wants,
+*    and the cache is not flushed by data the CPU never reads again. Copies that fit in cache
+*    (NonTemporalThreshold) are faster with plain stores.
+*  - When source and destination row pitch match, a run of rows is one block copy instead of one
+*    copy per row. When the slice pitch matches as well, the whole subresource is one block.
+*  - Copies above ParallelThreshold bytes (a big slice, a full mip chain) are cut into
+*    ChunkBytes pieces and spread over the ParallelRun given to Initialize (JobSystem::Run).
+*    The pieces are listed in scratch kept by the copier, a copy inside the frame does not allocate
+*    once the scratch grew to the largest mip chain.
+*
+* Only standard headers, so it builds and benchmarks (BenchmarkSubresourceCopy) anywhere,
+* Linux included. Without SSE2 the streaming path falls back to memcpy.
+*/
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define VR_SUBRESOURCE_COPY_SSE2 1
+#else
+#define VR_SUBRESOURCE_COPY_SSE2 0
+#endif
+
+// Same fields as D3D12_MEMCPY_DEST + D3D12_SUBRESOURCE_DATA + the footprint's row size/count/depth.
+struct SubresourceCopyDesc
+{
+    void* Dest = nullptr;
+    size_t DestRowPitch = 0;
+    size_t DestSlicePitch = 0;
+    const void* Src = nullptr;
+    ptrdiff_t SrcRowPitch = 0;
+    ptrdiff_t SrcSlicePitch = 0;
+    size_t RowSize = 0;
+    unsigned NumRows = 0;
+    unsigned NumSlices = 1;
+};
+
+class SubresourceCopier
+{
+public:
+    // Calls Task(0..Tasks-1), possibly in parallel, and returns when all are done.
+    typedef std::function<void(unsigned Tasks, const std::function<void(unsigned)>& Task)> ParallelRun;
+
+    struct Options
+    {
+        // Streaming stores, for write-combined destinations (UPLOAD heaps).
+        bool NonTemporal = true;
+        // Copies smaller than this fit in cache and use plain stores even with NonTemporal.
+        size_t NonTemporalThreshold = 256 * 1024;
+        // Smaller copies stay on the calling thread.
+        size_t ParallelThreshold = 1024 * 1024;
+        size_t ChunkBytes = 256 * 1024;
+    };
+
+    void Initialize(const Options& Config, ParallelRun Run = nullptr);
+
+    // Thread-safe as long as the ParallelRun is, parallel copies of several threads take turns.
+    // A mip chain or array goes in as one call, so its subresources are split across threads together.
+    void Copy(const SubresourceCopyDesc* Copies, unsigned Count);
+    void Copy(const SubresourceCopyDesc& Desc) { Copy(&Desc, 1); }
+    void CopyBytes(void* Dest, const void* Src, size_t Size);
+
+    // Rows [FirstRow, FirstRow + Rows) of one slice, on the calling thread.
+    static void CopyRows(const SubresourceCopyDesc& Desc, unsigned Slice, unsigned FirstRow, unsigned Rows, bool NonTemporal);
+    // What MemcpySubresource does, for comparison.
+    static void CopyReference(const SubresourceCopyDesc& Desc);
+
+    const Options& GetOptions() const { return m_Options; }
+
+private:
+    struct Task
+    {
+        unsigned Copy;
+        unsigned Slice;
+        unsigned FirstRow;
+        unsigned Rows;
+    };
+
+    Options m_Options;
+    ParallelRun m_Run;
+
+    // Scratch of the parallel path, reused by every call.
+    std::mutex m_ScratchMutex;
+    std::vector<SubresourceCopyDesc> m_Flat;
+    std::vector<Task> m_Tasks;
+    bool m_NonTemporal = false;
+};
+
+struct SubresourceCopyBenchmarkCase
+{
+    unsigned Width = 1024;
+    unsigned Height = 1024;
+    unsigned BytesPerPixel = 4;
+    unsigned Slices = 1;
+    // Extra bytes at the end of each source row. Pitches match when this is 0 and the row size is
+    // already a multiple of DestPitchAlignment.
+    size_t SrcRowPadding = 0;
+    // D3D12_TEXTURE_DATA_PITCH_ALIGNMENT for a real footprint.
+    size_t DestPitchAlignment = 256;
+};
+
+struct SubresourceCopyBenchmarkResult
+{
+    size_t Bytes = 0;
+    double ReferenceMillisecs = 0.0;
+    double CopierMillisecs = 0.0;
+    double ReferenceGBs = 0.0;
+    double CopierGBs = 0.0;
+    // Destination identical to the reference copy.
+    bool Matches = false;
+};
+
+// Times CopyReference against Copier on Case, best of Iterations runs each.
+SubresourceCopyBenchmarkResult BenchmarkSubresourceCopy(SubresourceCopier& Copier, const SubresourceCopyBenchmarkCase& Case, unsigned Iterations);
+// A spread of texture sizes and pitch layouts, from a 64x64 icon to a 4k array with mismatched pitches.
+std::vector<SubresourceCopyBenchmarkCase> GetSubresourceCopyBenchmarkCases();
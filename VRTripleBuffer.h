@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Lock-free triple buffer, one writer thread and one reader thread.
+*   Writer: fill GetWriteBuffer(), then Publish().
+*   Reader: Update() (true if something new was published), then GetReadBuffer().
+* Neither side ever waits: the writer always has a buffer of its own, the reader keeps the last
+* published one until a newer exists. Publishing faster than the reader reads drops the
+* intermediate values, only the latest is ever seen.
+*/
+
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    T& GetWriteBuffer() { return m_Buffers[m_Write].Value; }
+
+    void Publish()
+    {
+        m_Write = m_Middle.exchange((uint8_t)(m_Write | Fresh), std::memory_order_acq_rel) & IndexMask;
+    }
+
+    bool Update()
+    {
+        if (!(m_Middle.load(std::memory_order_relaxed) & Fresh))
+            return false;
+        m_Read = m_Middle.exchange(m_Read, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    const T& GetReadBuffer() const { return m_Buffers[m_Read].Value; }
+
+private:
+    const static uint8_t IndexMask = 3;
+    const static uint8_t Fresh = 4;
+
+    // Writer and reader touch different buffers, keep them off each other's cache lines.
+    struct alignas(64) Slot
+    {
+        T Value{};
+    };
+
+    Slot m_Buffers[3];
+    uint8_t m_Write = 0;
+    alignas(64) std::atomic<uint8_t> m_Middle{ 1 };
+    alignas(64) uint8_t m_Read = 2;
+};
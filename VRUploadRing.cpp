@@ -0,0 +1,236 @@
+#include "VRUploadRing.h"
+#include "BlackSpaceDirectX.h"
+#include "BSTime.h"
+#include <memory>
+#include <thread>
+
+static inline UINT64 AlignUp(UINT64 Value, UINT64 Alignment)
+{
+	return (Value + Alignment - 1) & ~(Alignment - 1);
+}
+
+void UploadRing::Initialize(ID3D12Device* Device, UINT Slots, UINT64 BytesPerFrame)
+{
+	BytesPerFrame = AlignUp(BytesPerFrame, D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+	CD3DX12_HEAP_PROPERTIES heap_props(D3D12_HEAP_TYPE_UPLOAD);
+	CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(BytesPerFrame * Slots);
+	ThrowIfFailed(Device->CreateCommittedResource(&heap_props, D3D12_HEAP_FLAG_NONE, &desc,
+		D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&m_Buffer)));
+	m_Buffer->SetName(L"UploadRing");
+
+	// Upload heaps may stay mapped for their whole lifetime. We never read it back.
+	CD3DX12_RANGE read_range(0, 0);
+	void* cpu = nullptr;
+	ThrowIfFailed(m_Buffer->Map(0, &read_range, &cpu));
+	m_CpuBase = static_cast<UINT8*>(cpu);
+	m_GpuBase = m_Buffer->GetGPUVirtualAddress();
+	CreatePartitions(Slots, BytesPerFrame);
+}
+
+void UploadRing::InitializeHeadless(UINT Slots, UINT64 BytesPerFrame, void* CpuBase, D3D12_GPU_VIRTUAL_ADDRESS GpuBase)
+{
+	// Same partitions as Initialize, so every slot starts on a placement boundary.
+	BytesPerFrame = AlignUp(BytesPerFrame, D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+	m_CpuBase = static_cast<UINT8*>(CpuBase);
+	m_GpuBase = GpuBase;
+	CreatePartitions(Slots, BytesPerFrame);
+}
+
+void UploadRing::CreatePartitions(UINT Slots, UINT64 BytesPerFrame)
+{
+	RAID_ASSERT(Slots > 0 && Slots <= MaxSlots);
+	m_Slots = Slots;
+	m_BytesPerFrame = BytesPerFrame;
+	D3D12MA::VIRTUAL_BLOCK_DESC block_desc = {};
+	block_desc.Flags = D3D12MA::VIRTUAL_BLOCK_FLAG_ALGORITHM_LINEAR;
+	block_desc.Size = BytesPerFrame;
+	for (UINT i = 0; i < Slots; i++)
+	{
+		ThrowIfFailed(D3D12MA::CreateVirtualBlock(&block_desc, &m_Partitions[i]));
+	}
+	m_Slot = 0;
+	m_Stats = UploadRingStats();
+}
+
+void UploadRing::Destroy()
+{
+	for (auto& p : m_Partitions)
+	{
+		if (p)
+		{
+			p->Clear();
+			p.Reset();
+		}
+	}
+	if (m_Buffer)
+	{
+		m_Buffer->Unmap(0, nullptr);
+		m_Buffer.Reset();
+	}
+	m_CpuBase = nullptr;
+	m_GpuBase = 0;
+	m_Slots = 0;
+}
+
+void UploadRing::BeginFrame(UINT Slot)
+{
+	RAID_ASSERT(Slot < m_Slots);
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	// The scheduler has already waited for the frame that last used this partition.
+	m_Partitions[Slot]->Clear();
+	m_Slot = Slot;
+	m_Stats.BytesUsed = 0;
+	m_FrameIndex.fetch_add(1, std::memory_order_release);
+}
+
+bool UploadRing::Allocate(UINT64 Size, UINT64 Alignment, UploadAllocation* Out)
+{
+	RAID_ASSERT(Size > 0);
+	D3D12MA::VIRTUAL_ALLOCATION_DESC desc = {};
+	desc.Size = Size;
+	desc.Alignment = Alignment;
+
+	D3D12MA::VirtualAllocation allocation;
+	UINT64 offset = 0;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	// Allocations are never freed individually, the handle is dropped and Clear() reclaims it.
+	if (FAILED(m_Partitions[m_Slot]->Allocate(&desc, &allocation, &offset)))
+	{
+		m_Stats.FailedAllocations++;
+		return false;
+	}
+	m_Stats.Allocations++;
+	m_Stats.BytesUsed = offset + Size;
+	m_Stats.PeakBytesUsed = (std::max)(m_Stats.PeakBytesUsed, m_Stats.BytesUsed);
+
+	const UINT64 ring_offset = (UINT64)m_Slot * m_BytesPerFrame + offset;
+	Out->CPU = m_CpuBase + ring_offset;
+	Out->GPU = m_GpuBase + ring_offset;
+	Out->Offset = ring_offset;
+	Out->Size = Size;
+	return true;
+}
+
+bool UploadRing::AllocateConstants(UINT Size, UploadAllocation* Out)
+{
+	return Allocate(CalculateConstantBufferByteSize(Size), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, Out);
+}
+
+UploadRingStats UploadRing::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+UploadRingContext::UploadRingContext(UploadRing* Ring, UINT64 PageSize)
+	: m_Ring(Ring), m_PageSize(PageSize)
+{
+}
+
+bool UploadRingContext::Allocate(UINT64 Size, UINT64 Alignment, UploadAllocation* Out)
+{
+	if (Alignment == 0)
+		Alignment = 1;
+	// Big or over-aligned requests would waste most of a page, send them straight to the ring.
+	if (Size > m_PageSize / 2 || Alignment > D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT)
+		return m_Ring->Allocate(Size, Alignment, Out);
+
+	// A page from an earlier frame belongs to a partition that may already be reused.
+	const UINT64 frame = m_Ring->GetFrameIndex();
+	UINT64 offset = AlignUp(m_Page.Offset + m_PageUsed, Alignment) - m_Page.Offset;
+	if (m_PageFrame != frame || offset + Size > m_Page.Size)
+	{
+		if (!m_Ring->Allocate(m_PageSize, D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, &m_Page))
+		{
+			m_PageFrame = UINT64_MAX;
+			return false;
+		}
+		m_PageFrame = frame;
+		m_PageUsed = 0;
+		offset = AlignUp(m_Page.Offset, Alignment) - m_Page.Offset;
+	}
+
+	Out->CPU = static_cast<UINT8*>(m_Page.CPU) + offset;
+	Out->GPU = m_Page.GPU + offset;
+	Out->Offset = m_Page.Offset + offset;
+	Out->Size = Size;
+	m_PageUsed = offset + Size;
+	return true;
+}
+
+bool UploadRingContext::AllocateConstants(UINT Size, UploadAllocation* Out)
+{
+	return Allocate(CalculateConstantBufferByteSize(Size), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, Out);
+}
+
+static const UINT UploadRingBenchmarkSlots = 3;
+
+// Allocations per second of Threads threads filling one frame each, Frames times. Timed from
+// the moment all threads are up until the last one finished, thread creation is not included.
+static double MeasureUploadRing(UINT8* Memory, UINT64 BytesPerFrame, UINT Threads, UINT Allocations, UINT Frames, bool Contexts)
+{
+	UploadRing ring;
+	ring.InitializeHeadless(UploadRingBenchmarkSlots, BytesPerFrame, Memory, 0x10000);
+	std::vector<UploadRingContext> contexts(Threads, UploadRingContext(&ring));
+	std::vector<std::thread> threads;
+	double seconds = 0.0;
+	// Frame 0 warms up.
+	for (UINT f = 0; f <= Frames; f++)
+	{
+		ring.BeginFrame(f % UploadRingBenchmarkSlots);
+		std::atomic<UINT> ready{ 0 };
+		std::atomic<bool> go{ false };
+		for (UINT t = 0; t < Threads; t++)
+		{
+			threads.emplace_back([&, t]()
+			{
+				ready.fetch_add(1, std::memory_order_release);
+				while (!go.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				UploadAllocation allocation;
+				for (UINT i = 0; i < Allocations; i++)
+				{
+					const UINT size = 16 + (i * 16) % 240;
+					if (Contexts)
+						contexts[t].AllocateConstants(size, &allocation);
+					else
+						ring.AllocateConstants(size, &allocation);
+				}
+			});
+		}
+		while (ready.load(std::memory_order_acquire) < Threads)
+			std::this_thread::yield();
+		const int64_t start = SystemTime::GetCurrentTick();
+		go.store(true, std::memory_order_release);
+		for (std::thread& t : threads)
+			t.join();
+		if (f > 0)
+			seconds += SystemTime::TicksToSeconds(SystemTime::GetCurrentTick() - start);
+		threads.clear();
+	}
+	RAID_ASSERT(ring.GetStats().FailedAllocations == 0);
+	return seconds > 0.0 ? (double)Threads * Allocations * Frames / seconds : 0.0;
+}
+
+UploadRingBenchmarkResult BenchmarkUploadRing(UINT MaxThreads, UINT Allocations, UINT Frames)
+{
+	UploadRingBenchmarkResult r;
+	if (MaxThreads == 0)
+		MaxThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+	Allocations = (std::max)(Allocations, 1u);
+	Frames = (std::max)(Frames, 1u);
+
+	// Every allocation takes a full CBV slot, each context may leave most of a page unused.
+	const UINT64 per_thread = (UINT64)Allocations * D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT + 2 * UploadRingContext::DefaultPageSize;
+	// Never written, the pages are not touched.
+	std::unique_ptr<UINT8[]> memory(new UINT8[UploadRingBenchmarkSlots * per_thread * MaxThreads]);
+	for (UINT threads = 1; threads <= MaxThreads; threads++)
+	{
+		UploadRingBenchmarkPoint p;
+		p.Threads = threads;
+		p.ContextAllocationsPerSecond = MeasureUploadRing(memory.get(), per_thread * threads, threads, Allocations, Frames, true);
+		p.RingAllocationsPerSecond = MeasureUploadRing(memory.get(), per_thread * threads, threads, Allocations, Frames, false);
+		r.Points.push_back(p);
+	}
+	return r;
+}
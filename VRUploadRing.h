@@ -0,0 +1,143 @@
+#pragma once
+#include "VRCore.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <d3d12.h>
+#include <wrl.h>
+#include "D3D12MemAlloc.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Persistently mapped UPLOAD buffer for per-frame transient data (constants, dynamic vertices).
+* The buffer is split into one partition per back buffer. Each partition is a linear
+* D3D12MA::VirtualBlock, so allocation is a bump of the partition's end pointer and the
+* whole partition is reclaimed at once when FrameScheduler says that frame retired.
+*
+* BenchmarkUploadRing() runs headless: for 1 to MaxThreads recording threads it measures the
+* allocations per second of one UploadRingContext per thread against all threads on the ring's lock.
+*   for (const UploadRingBenchmarkPoint& p : BenchmarkUploadRing().Points) ...
+*/
+
+struct UploadAllocation
+{
+    void* CPU = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS GPU = 0;
+    // Offset from the start of the ring buffer, for CopyBufferRegion etc.
+    UINT64 Offset = 0;
+    UINT64 Size = 0;
+};
+
+struct UploadRingStats
+{
+    UINT64 Allocations = 0;
+    UINT64 FailedAllocations = 0;
+    // Bytes handed out from the current frame's partition.
+    UINT64 BytesUsed = 0;
+    // Largest BytesUsed seen in any frame, use it to size BytesPerFrame.
+    UINT64 PeakBytesUsed = 0;
+};
+
+class UploadRing
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    const static UINT MaxSlots = 8;
+
+    ~UploadRing() { Destroy(); }
+
+    // Creates and maps the UPLOAD buffer (Slots * BytesPerFrame bytes).
+    void Initialize(ID3D12Device* Device, UINT Slots, UINT64 BytesPerFrame);
+    // Bookkeeping only, on top of caller provided memory. Lets the ring run without a device.
+    // BytesPerFrame is rounded up to 256 as in Initialize, CpuBase must hold Slots times that.
+    void InitializeHeadless(UINT Slots, UINT64 BytesPerFrame, void* CpuBase, D3D12_GPU_VIRTUAL_ADDRESS GpuBase);
+    void Destroy();
+
+    // Call after FrameScheduler::BeginFrame(Slot): everything previously allocated in Slot is released.
+    void BeginFrame(UINT Slot);
+
+    // Thread-safe. Returns false if the current partition is full.
+    bool Allocate(UINT64 Size, UINT64 Alignment, UploadAllocation* Out);
+
+    // Size rounded with CalculateConstantBufferByteSize, placed on a CBV boundary.
+    bool AllocateConstants(UINT Size, UploadAllocation* Out);
+
+    template<typename T>
+    bool PushConstants(const T& Data, UploadAllocation* Out)
+    {
+        if (!AllocateConstants(sizeof(T), Out))
+            return false;
+        memcpy(Out->CPU, &Data, sizeof(T));
+        return true;
+    }
+
+    ID3D12Resource* GetResource() const { return m_Buffer.Get(); }
+    UINT64 GetBytesPerFrame() const { return m_BytesPerFrame; }
+    UINT GetCurrentSlot() const { return m_Slot; }
+    // Incremented by every BeginFrame, used by UploadRingContext to drop stale pages.
+    UINT64 GetFrameIndex() const { return m_FrameIndex.load(std::memory_order_acquire); }
+    UploadRingStats GetStats();
+
+private:
+    void CreatePartitions(UINT Slots, UINT64 BytesPerFrame);
+
+    COM<ID3D12Resource> m_Buffer;
+    COM<D3D12MA::VirtualBlock> m_Partitions[MaxSlots];
+    UINT8* m_CpuBase = nullptr;
+    D3D12_GPU_VIRTUAL_ADDRESS m_GpuBase = 0;
+    UINT64 m_BytesPerFrame = 0;
+    UINT m_Slots = 0;
+    UINT m_Slot = 0;
+    std::atomic<UINT64> m_FrameIndex{ 0 };
+
+    // VirtualBlock is not thread-safe.
+    std::mutex m_Mutex;
+    UploadRingStats m_Stats;
+};
+
+// Per recording thread front end of an UploadRing.
+// Grabs pages from the ring under its lock and bump-allocates inside them without locking,
+// so worker threads only meet on the ring once per page instead of once per allocation.
+class UploadRingContext
+{
+public:
+    const static UINT64 DefaultPageSize = 64 * 1024;
+
+    explicit UploadRingContext(UploadRing* Ring, UINT64 PageSize = DefaultPageSize);
+
+    bool Allocate(UINT64 Size, UINT64 Alignment, UploadAllocation* Out);
+    bool AllocateConstants(UINT Size, UploadAllocation* Out);
+
+    template<typename T>
+    bool PushConstants(const T& Data, UploadAllocation* Out)
+    {
+        if (!AllocateConstants(sizeof(T), Out))
+            return false;
+        memcpy(Out->CPU, &Data, sizeof(T));
+        return true;
+    }
+
+private:
+    UploadRing* m_Ring;
+    UINT64 m_PageSize;
+    UploadAllocation m_Page;
+    UINT64 m_PageUsed = 0;
+    UINT64 m_PageFrame = UINT64_MAX;
+};
+
+struct UploadRingBenchmarkPoint
+{
+    UINT Threads = 0;
+    // All threads together, 16 to 256 byte constant buffers.
+    double ContextAllocationsPerSecond = 0.0;
+    double RingAllocationsPerSecond = 0.0;
+};
+
+struct UploadRingBenchmarkResult
+{
+    std::vector<UploadRingBenchmarkPoint> Points;
+};
+
+// MaxThreads 0 = hardware_concurrency. Allocations per thread per frame.
+UploadRingBenchmarkResult BenchmarkUploadRing(UINT MaxThreads = 0, UINT Allocations = 2048, UINT Frames = 64);
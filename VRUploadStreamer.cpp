@@ -0,0 +1,386 @@
+#include "VRUploadStreamer.h"
+#include "BlackSpaceDirectX.h"
+
+static inline UINT64 AlignUp(UINT64 Value, UINT64 Alignment)
+{
+	return (Value + Alignment - 1) & ~(Alignment - 1);
+}
+
+void UploadStreamer::Initialize(IUploadQueue* Queue, UINT64 StagingSize, UINT64 BytesPerFrame, UINT MaxBatches, UINT ReservedRequests)
+{
+	RAID_ASSERT(Queue != nullptr && MaxBatches > 0);
+	// Keeps every ring position that is a multiple of TextureAlignment aligned after the modulo.
+	RAID_ASSERT(StagingSize >= TextureAlignment && StagingSize % TextureAlignment == 0);
+	m_Queue = Queue;
+	m_StagingSize = StagingSize;
+	m_BytesPerFrame = BytesPerFrame;
+	m_Head = 0;
+	m_Tail = 0;
+	m_LastSubmitted = 0;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Requests.clear();
+	m_Requests.reserve(ReservedRequests);
+	m_Batches.assign(MaxBatches, Batch());
+	m_FirstBatch = 0;
+	m_BatchCount = 0;
+	m_NextTicket = 1;
+	m_RecordedTicket = 0;
+	m_CompletedValue = 0;
+	m_Stats = UploadStreamerStats();
+}
+
+void UploadStreamer::Destroy()
+{
+	if (m_Queue == nullptr)
+		return;
+	if (m_LastSubmitted)
+		m_Queue->WaitForValue(m_LastSubmitted);
+	Reclaim();
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Requests.clear();
+	m_Queue = nullptr;
+}
+
+UploadTicket UploadStreamer::Enqueue(const UploadRequest& Request)
+{
+	RAID_ASSERT(Request.Destination != nullptr);
+	Pending p;
+	p.Request = Request;
+	p.Size = m_Queue->GetStagingSize(Request);
+	p.Alignment = Request.IsTexture() ? TextureAlignment : BufferAlignment;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (p.Size == 0 || p.Size > m_StagingSize)
+	{
+		m_Stats.RejectedRequests++;
+		return 0;
+	}
+	p.Ticket = m_NextTicket++;
+	m_Requests.push_back(p);
+	m_Stats.Requests++;
+	return p.Ticket;
+}
+
+UINT UploadStreamer::Update()
+{
+	Reclaim();
+	return Process(false);
+}
+
+void UploadStreamer::Flush()
+{
+	for (;;)
+	{
+		Reclaim();
+		Process(true);
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Requests.empty())
+				break;
+		}
+		// Staging is full, wait for the batches in flight to give it back.
+		m_Queue->WaitForValue(m_LastSubmitted);
+	}
+	if (m_LastSubmitted)
+		m_Queue->WaitForValue(m_LastSubmitted);
+	Reclaim();
+}
+
+UINT64 UploadStreamer::GetFenceValue(UploadTicket Ticket)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (Ticket == 0 || Ticket > m_RecordedTicket)
+		return 0;
+	for (UINT i = 0; i < m_BatchCount; i++)
+	{
+		const Batch& b = m_Batches[(m_FirstBatch + i) % m_Batches.size()];
+		if (Ticket <= b.LastTicket)
+			return b.FenceValue;
+	}
+	// Its batch already retired.
+	return m_CompletedValue;
+}
+
+bool UploadStreamer::IsComplete(UploadTicket Ticket)
+{
+	const UINT64 value = GetFenceValue(Ticket);
+	return value != 0 && m_Queue->GetCompletedValue() >= value;
+}
+
+UploadStreamerStats UploadStreamer::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	UploadStreamerStats s = m_Stats;
+	s.Pending = (UINT)m_Requests.size();
+	return s;
+}
+
+void UploadStreamer::Reclaim()
+{
+	const UINT64 completed = m_Queue->GetCompletedValue();
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	while (m_BatchCount > 0 && m_Batches[m_FirstBatch].FenceValue <= completed)
+	{
+		const Batch& b = m_Batches[m_FirstBatch];
+		m_Tail = b.StagingEnd;
+		m_CompletedValue = b.FenceValue;
+		m_FirstBatch = (m_FirstBatch + 1) % (UINT)m_Batches.size();
+		m_BatchCount--;
+	}
+	// Nothing in flight, start over at offset 0 so a request as big as the ring still fits.
+	if (m_BatchCount == 0)
+	{
+		m_Head = 0;
+		m_Tail = 0;
+	}
+}
+
+bool UploadStreamer::AllocateStaging(UINT64 Size, UINT64 Alignment, UINT64* Offset)
+{
+	UINT64 start = AlignUp(m_Head, Alignment);
+	// A request never straddles the end of the ring, the skipped tail is reclaimed with the batch.
+	// The ring size need not be a power of two, so no AlignUp to the next lap.
+	if (start % m_StagingSize + Size > m_StagingSize)
+		start = (start / m_StagingSize + 1) * m_StagingSize;
+	const UINT64 end = start + Size;
+	if (end - m_Tail > m_StagingSize)
+		return false;
+	m_Head = end;
+	*Offset = start % m_StagingSize;
+	return true;
+}
+
+UINT UploadStreamer::Process(bool IgnoreBudget)
+{
+	UINT count = 0;
+	UINT64 bytes = 0;
+	UploadTicket last = 0;
+	size_t taken = 0;
+	{
+		// No record left for another batch, Flush() waits for the oldest one.
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_BatchCount == m_Batches.size())
+		{
+			if (!m_Requests.empty())
+				m_Stats.BatchLimited++;
+			m_Stats.BytesLastFrame = 0;
+			return 0;
+		}
+	}
+	for (;;)
+	{
+		Pending p;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (taken == m_Requests.size())
+				break;
+			p = m_Requests[taken];
+		}
+		// The first request of a frame always goes, otherwise one bigger than the budget would never leave.
+		if (!IgnoreBudget && count > 0 && bytes + p.Size > m_BytesPerFrame)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stats.BudgetLimited++;
+			break;
+		}
+		UINT64 offset = 0;
+		if (!AllocateStaging(p.Size, p.Alignment, &offset))
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stats.StagingLimited++;
+			break;
+		}
+		if (count == 0)
+			m_Queue->Begin();
+		m_Queue->Record(p.Request, offset);
+		count++;
+		bytes += p.Size;
+		last = p.Ticket;
+		taken++;
+	}
+
+	if (count == 0)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.BytesLastFrame = 0;
+		return 0;
+	}
+
+	m_LastSubmitted = m_Queue->Submit();
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	// Enqueue only appends, the first taken requests are still the ones recorded.
+	m_Requests.erase(m_Requests.begin(), m_Requests.begin() + taken);
+	m_Stats.BytesLastFrame = bytes;
+	m_Batches[(m_FirstBatch + m_BatchCount) % m_Batches.size()] = { m_LastSubmitted, last, m_Head };
+	m_BatchCount++;
+	m_RecordedTicket = last;
+	m_Stats.Batches++;
+	m_Stats.BytesUploaded += bytes;
+	m_Stats.PeakStagingUsed = (std::max)(m_Stats.PeakStagingUsed, m_Head - m_Tail);
+	return count;
+}
+
+void D3D12UploadQueue::Initialize(ID3D12Device* Device, UINT64 StagingSize, SubresourceCopier::ParallelRun Run)
+{
+	m_Device = Device;
+	m_Copier.Initialize(SubresourceCopier::Options(), Run);
+	// A full mip chain, bigger requests grow them once.
+	m_Layouts.reserve(D3D12_REQ_MIP_LEVELS);
+	m_NumRows.reserve(D3D12_REQ_MIP_LEVELS);
+	m_RowSizes.reserve(D3D12_REQ_MIP_LEVELS);
+	m_Copies.reserve(D3D12_REQ_MIP_LEVELS);
+	D3D12_COMMAND_QUEUE_DESC queue_desc = {};
+	queue_desc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+	queue_desc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+	ThrowIfFailed(Device->CreateCommandQueue(&queue_desc, IID_PPV_ARGS(&m_Queue)));
+	m_Queue->SetName(L"UploadQueue");
+	ThrowIfFailed(Device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_Fence)));
+	m_Event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (m_Event == nullptr) {
+		throw "Failed to create upload fence event.";
+	}
+	m_NextValue = 1;
+
+	for (UINT i = 0; i < MaxBatches; i++)
+	{
+		ThrowIfFailed(Device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&m_Allocators[i])));
+		m_AllocatorValues[i] = 0;
+	}
+	m_Allocator = 0;
+	ThrowIfFailed(Device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, m_Allocators[0].Get(), nullptr, IID_PPV_ARGS(&m_List)));
+	ThrowIfFailed(m_List->Close());
+
+	CD3DX12_HEAP_PROPERTIES heap_props(D3D12_HEAP_TYPE_UPLOAD);
+	CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(StagingSize);
+	ThrowIfFailed(Device->CreateCommittedResource(&heap_props, D3D12_HEAP_FLAG_NONE, &desc,
+		D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&m_Staging)));
+	m_Staging->SetName(L"UploadStaging");
+	// Mapped for the lifetime of the buffer.
+	CD3DX12_RANGE read_range(0, 0);
+	void* cpu = nullptr;
+	ThrowIfFailed(m_Staging->Map(0, &read_range, &cpu));
+	m_StagingCPU = static_cast<UINT8*>(cpu);
+}
+
+void D3D12UploadQueue::Destroy()
+{
+	if (m_Fence && m_NextValue > 1)
+		WaitForValue(m_NextValue - 1);
+	if (m_Staging)
+	{
+		m_Staging->Unmap(0, nullptr);
+		m_Staging.Reset();
+	}
+	m_StagingCPU = nullptr;
+	m_List.Reset();
+	for (auto& a : m_Allocators)
+	{
+		a.Reset();
+	}
+	m_Fence.Reset();
+	m_Queue.Reset();
+	m_Device.Reset();
+	if (m_Event)
+	{
+		CloseHandle(m_Event);
+		m_Event = nullptr;
+	}
+}
+
+UINT64 D3D12UploadQueue::GetStagingSize(const UploadRequest& Request)
+{
+	if (!Request.IsTexture())
+		return Request.Size;
+	const D3D12_RESOURCE_DESC desc = Request.Destination->GetDesc();
+	UINT64 size = 0;
+	m_Device->GetCopyableFootprints(&desc, Request.FirstSubresource, Request.NumSubresources, 0, nullptr, nullptr, nullptr, &size);
+	return size;
+}
+
+void D3D12UploadQueue::Begin()
+{
+	m_Allocator = (m_Allocator + 1) % MaxBatches;
+	// Only blocks when more than MaxBatches batches are in flight.
+	WaitForValue(m_AllocatorValues[m_Allocator]);
+	ThrowIfFailed(m_Allocators[m_Allocator]->Reset());
+	ThrowIfFailed(m_List->Reset(m_Allocators[m_Allocator].Get(), nullptr));
+}
+
+void D3D12UploadQueue::Record(const UploadRequest& Request, UINT64 StagingOffset)
+{
+	if (!Request.IsTexture())
+	{
+		m_Copier.CopyBytes(m_StagingCPU + StagingOffset, Request.Data, (size_t)Request.Size);
+		m_List->CopyBufferRegion(Request.Destination, Request.DestinationOffset, m_Staging.Get(), StagingOffset, Request.Size);
+		return;
+	}
+
+	// What UpdateSubresources does, with the whole mip chain going through m_Copier in one call.
+	const UINT count = Request.NumSubresources;
+	const D3D12_RESOURCE_DESC desc = Request.Destination->GetDesc();
+	m_Layouts.resize(count);
+	m_NumRows.resize(count);
+	m_RowSizes.resize(count);
+	m_Copies.resize(count);
+	UINT64 required = 0;
+	m_Device->GetCopyableFootprints(&desc, Request.FirstSubresource, count, StagingOffset,
+		m_Layouts.data(), m_NumRows.data(), m_RowSizes.data(), &required);
+	for (UINT i = 0; i < count; i++)
+	{
+		const D3D12_PLACED_SUBRESOURCE_FOOTPRINT& layout = m_Layouts[i];
+		const D3D12_SUBRESOURCE_DATA& src = Request.Subresources[i];
+		SubresourceCopyDesc& c = m_Copies[i];
+		c.Dest = m_StagingCPU + layout.Offset;
+		c.DestRowPitch = layout.Footprint.RowPitch;
+		c.DestSlicePitch = (size_t)layout.Footprint.RowPitch * m_NumRows[i];
+		c.Src = src.pData;
+		c.SrcRowPitch = src.RowPitch;
+		c.SrcSlicePitch = src.SlicePitch;
+		c.RowSize = (size_t)m_RowSizes[i];
+		c.NumRows = m_NumRows[i];
+		c.NumSlices = layout.Footprint.Depth;
+	}
+	m_Copier.Copy(m_Copies.data(), count);
+
+	// Destination must be in COMMON, it is promoted to COPY_DEST and decays back after the batch.
+	if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+	{
+		m_List->CopyBufferRegion(Request.Destination, 0, m_Staging.Get(), m_Layouts[0].Offset, m_Layouts[0].Footprint.Width);
+		return;
+	}
+	for (UINT i = 0; i < count; i++)
+	{
+		CD3DX12_TEXTURE_COPY_LOCATION dst(Request.Destination, Request.FirstSubresource + i);
+		CD3DX12_TEXTURE_COPY_LOCATION src(m_Staging.Get(), m_Layouts[i]);
+		m_List->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+	}
+}
+
+UINT64 D3D12UploadQueue::Submit()
+{
+	ThrowIfFailed(m_List->Close());
+	ID3D12CommandList* lists[] = { m_List.Get() };
+	m_Queue->ExecuteCommandLists(1, lists);
+	const UINT64 value = m_NextValue++;
+	ThrowIfFailed(m_Queue->Signal(m_Fence.Get(), value));
+	m_AllocatorValues[m_Allocator] = value;
+	return value;
+}
+
+UINT64 D3D12UploadQueue::GetCompletedValue()
+{
+	return m_Fence->GetCompletedValue();
+}
+
+void D3D12UploadQueue::WaitForValue(UINT64 Value)
+{
+	if (m_Fence->GetCompletedValue() >= Value)
+		return;
+	ThrowIfFailed(m_Fence->SetEventOnCompletion(Value, m_Event));
+	WaitForSingleObject(m_Event, INFINITE);
+}
+
+void D3D12UploadQueue::GPUWait(ID3D12CommandQueue* Queue, UINT64 Value)
+{
+	if (Value)
+		ThrowIfFailed(Queue->Wait(m_Fence.Get(), Value));
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include "VRCore.h"
+#include <mutex>
+#include <vector>
+#include <d3d12.h>
+#include <wrl.h>
+#include "VRSubresourceCopy.h"
+/*Copyright(C) Raid Studios, All Rights Reserved.
+* CLASS USAGE:
+* Asynchronous uploads on a copy queue.
+* Any thread may Enqueue() a buffer or texture upload and gets a ticket back. Once per frame the
+* render thread calls Update(), which takes requests off the queue in order, places each one in a
+* staging ring, records all of them into one copy command list and submits it with one fence
+* signal. Update() stops when the frame's byte budget is used up or the staging ring is full, the
+* rest waits for the next frame, so streaming a level never costs more than BytesPerFrame of
+* copying per frame.
+*
+* Graphics work that reads an upload makes its queue wait on GetFenceValue(Ticket) (see
+* D3D12UploadQueue::GPUWait), the CPU can poll IsComplete(Ticket). Source data must stay valid
+* until the request was recorded (GetFenceValue(Ticket) != 0).
+*
+* All queue work goes through IUploadQueue, so the batching and budget policy can be run against
+* a stand-in that only logs what it was asked to record.
+*/
+
+typedef UINT64 UploadTicket;
+
+struct UploadRequest
+{
+    ID3D12Resource* Destination = nullptr;
+
+    // Buffer upload, used when NumSubresources == 0.
+    UINT64 DestinationOffset = 0;
+    const void* Data = nullptr;
+    UINT64 Size = 0;
+
+    // Texture upload, one D3D12_SUBRESOURCE_DATA per subresource as for UpdateSubresources.
+    UINT FirstSubresource = 0;
+    UINT NumSubresources = 0;
+    const D3D12_SUBRESOURCE_DATA* Subresources = nullptr;
+
+    bool IsTexture() const { return NumSubresources > 0; }
+};
+
+class IUploadQueue
+{
+public:
+    virtual ~IUploadQueue() = default;
+
+    // Staging bytes the request needs (GetRequiredIntermediateSize for textures).
+    virtual UINT64 GetStagingSize(const UploadRequest& Request) = 0;
+    // Opens a copy list for a new batch.
+    virtual void Begin() = 0;
+    // Fills staging at StagingOffset and records the copy.
+    virtual void Record(const UploadRequest& Request, UINT64 StagingOffset) = 0;
+    // Closes and executes the batch, signals and returns its fence value.
+    virtual UINT64 Submit() = 0;
+    virtual UINT64 GetCompletedValue() = 0;
+    virtual void WaitForValue(UINT64 Value) = 0;
+};
+
+struct UploadStreamerStats
+{
+    UINT64 Requests = 0;
+    UINT64 RejectedRequests = 0;
+    UINT64 Batches = 0;
+    UINT64 BytesUploaded = 0;
+    // Staging bytes used by the last Update().
+    UINT64 BytesLastFrame = 0;
+    // Updates that left requests behind because of the byte budget or a full staging ring.
+    UINT64 BudgetLimited = 0;
+    UINT64 StagingLimited = 0;
+    // Updates that submitted nothing because MaxBatches batches were still in flight.
+    UINT64 BatchLimited = 0;
+    UINT64 PeakStagingUsed = 0;
+    UINT Pending = 0;
+};
+
+class UploadStreamer
+{
+public:
+    const static UINT64 TextureAlignment = D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+    const static UINT64 BufferAlignment = 16;
+    const static UINT DefaultMaxBatches = 8;
+    const static UINT DefaultReservedRequests = 1024;
+
+    ~UploadStreamer() { Destroy(); }
+
+    // StagingSize must match the staging buffer behind Queue. MaxBatches = batches in flight at
+    // once, one is submitted per Update(), their records are allocated here. ReservedRequests =
+    // requests that may wait at once before the queue grows.
+    void Initialize(IUploadQueue* Queue, UINT64 StagingSize, UINT64 BytesPerFrame, UINT MaxBatches = DefaultMaxBatches,
+        UINT ReservedRequests = DefaultReservedRequests);
+    // Waits for everything submitted, drops what was never recorded.
+    void Destroy();
+
+    // Thread-safe. Returns 0 if the request can never fit in the staging ring.
+    UploadTicket Enqueue(const UploadRequest& Request);
+
+    // Render thread, once per frame. Reclaims staging of finished batches, then records and submits
+    // what fits in the budget. Returns the number of requests submitted.
+    UINT Update();
+    // Submits and waits until every request enqueued so far has completed, ignoring the budget.
+    void Flush();
+
+    void SetBytesPerFrame(UINT64 BytesPerFrame) { m_BytesPerFrame = BytesPerFrame; }
+    UINT64 GetBytesPerFrame() const { return m_BytesPerFrame; }
+
+    // Fence value of the batch that carries Ticket, 0 while it is still queued.
+    UINT64 GetFenceValue(UploadTicket Ticket);
+    bool IsComplete(UploadTicket Ticket);
+    // Fence value of the newest batch, what graphics waits on to see every upload so far.
+    UINT64 GetLastSubmittedValue() const { return m_LastSubmitted; }
+
+    UploadStreamerStats GetStats();
+
+private:
+    struct Pending
+    {
+        UploadTicket Ticket;
+        UploadRequest Request;
+        UINT64 Size;
+        UINT64 Alignment;
+    };
+
+    struct Batch
+    {
+        UINT64 FenceValue;
+        UploadTicket LastTicket;
+        // Ring position after the batch, becomes the tail once it completed.
+        UINT64 StagingEnd;
+    };
+
+    void Reclaim();
+    // Places Size bytes in the ring without wrapping. Returns false when the ring is full.
+    bool AllocateStaging(UINT64 Size, UINT64 Alignment, UINT64* Offset);
+    UINT Process(bool IgnoreBudget);
+
+    IUploadQueue* m_Queue = nullptr;
+    UINT64 m_StagingSize = 0;
+    UINT64 m_BytesPerFrame = 0;
+
+    std::mutex m_Mutex;
+    // In order, Update() erases the front it recorded, the rest moves down within the capacity.
+    std::vector<Pending> m_Requests;
+    UploadTicket m_NextTicket = 1;
+    // Ring of batches in flight, oldest at m_FirstBatch.
+    std::vector<Batch> m_Batches;
+    UINT m_FirstBatch = 0;
+    UINT m_BatchCount = 0;
+    UploadTicket m_RecordedTicket = 0;
+    UINT64 m_CompletedValue = 0;
+    UploadStreamerStats m_Stats;
+
+    // Render thread only. Monotonic ring positions, offset = position % m_StagingSize.
+    UINT64 m_Head = 0;
+    UINT64 m_Tail = 0;
+    UINT64 m_LastSubmitted = 0;
+};
+
+// IUploadQueue on a D3D12 copy queue with a persistently mapped staging buffer.
+class D3D12UploadQueue : public IUploadQueue
+{
+public:
+    template<typename A>
+    using COM = Microsoft::WRL::ComPtr<A>;
+
+    const static UINT MaxBatches = 8;
+
+    // Run (optional, e.g. JobSystem::Run) spreads big staging copies over threads.
+    void Initialize(ID3D12Device* Device, UINT64 StagingSize, SubresourceCopier::ParallelRun Run = nullptr);
+    void Destroy();
+
+    UINT64 GetStagingSize(const UploadRequest& Request) override;
+    void Begin() override;
+    void Record(const UploadRequest& Request, UINT64 StagingOffset) override;
+    UINT64 Submit() override;
+    UINT64 GetCompletedValue() override;
+    void WaitForValue(UINT64 Value) override;
+
+    // Makes Queue wait on the GPU until the copy fence reached Value.
+    void GPUWait(ID3D12CommandQueue* Queue, UINT64 Value);
+
+    ID3D12CommandQueue* GetQueue() const { return m_Queue.Get(); }
+
+private:
+    COM<ID3D12Device> m_Device;
+    COM<ID3D12CommandQueue> m_Queue;
+    COM<ID3D12Fence> m_Fence;
+    HANDLE m_Event = nullptr;
+    UINT64 m_NextValue = 1;
+    // One allocator per batch in flight, reused once its fence value completed.
+    COM<ID3D12CommandAllocator> m_Allocators[MaxBatches];
+    UINT64 m_AllocatorValues[MaxBatches] = {};
+    UINT m_Allocator = 0;
+    COM<ID3D12GraphicsCommandList> m_List;
+    COM<ID3D12Resource> m_Staging;
+    UINT8* m_StagingCPU = nullptr;
+
+    // Staging is write-combined, filled with streaming stores.
+    SubresourceCopier m_Copier;
+    std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> m_Layouts;
+    std::vector<UINT> m_NumRows;
+    std::vector<UINT64> m_RowSizes;
+    std::vector<SubresourceCopyDesc> m_Copies;
+};